@@ -1,12 +1,41 @@
+#ifndef ARTILLERY_HEADLESS
 #include <gtk/gtk.h>
+#endif
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <time.h>
 #include <stdbool.h>
-
-#define WINDOW_WIDTH 1920
+#include <stdint.h>
+#include <stdatomic.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#endif
+#include "artillery_env.h"
+
+#define WORLD_WIDTH 1920  // Logical units; the camera fits the world to the window
+#define WORLD_HEIGHT 1080
+#define WINDOW_WIDTH 1920 // Default window size
 #define WINDOW_HEIGHT 1080
+#define MIN_RENDER_SCALE 0.5
+#define MAX_RENDER_SCALE 1.0
 #define TERRAIN_SEGMENTS 800
 #define GRAVITY 0.1
 #define MAX_POWER 100
@@ -14,8 +43,117 @@
 #define TANK_WIDTH 20
 #define TANK_HEIGHT 10
 #define MAX_PARTICLES 200
-#define MAX_PROJECTILES 20
-#define MAX_EXPLOSIONS 10
+#define MAX_PROJECTILES 16384
+#define MAX_EXPLOSIONS 64
+#define MAX_PLAYERS 64
+#define DEFAULT_PLAYERS 2
+#define TANK_BUCKET_WIDTH 64
+#define TANK_BUCKETS ((WORLD_WIDTH + TANK_BUCKET_WIDTH - 1) / TANK_BUCKET_WIDTH)
+#define GRID_CELL_SIZE 16
+#define GRID_COLS ((WORLD_WIDTH + GRID_CELL_SIZE - 1) / GRID_CELL_SIZE)
+#define GRID_ROWS ((WORLD_HEIGHT + GRID_CELL_SIZE - 1) / GRID_CELL_SIZE)
+#define AIRBURST_DISTANCE 40.0
+#define FUSE_ARM_DISTANCE 20.0
+#define FRAME_BUDGET_MS 16.0
+#define MAX_CRATER_OPS 4096
+#define SLIDE_SLOPE 1.0        // Ground steeper than 45 degrees under a tank makes it slide
+#define SLIDE_SPEED 1.0
+#define FALL_DAMAGE_SPEED 4.0  // Landing faster than this hurts (a drop of about 80 px)
+#define FALL_DAMAGE_FACTOR 10.0
+#define SLUMP_CHUNK_SEGMENTS 40    // Terrain slumps in chunks of this many segments that sleep once stable
+#define SLUMP_CHUNKS (TERRAIN_SEGMENTS / SLUMP_CHUNK_SEGMENTS) // At most 32: one bit each
+#define SLUMP_MAX_DROP 4.8         // Steepest stable drop between neighbouring segments (about 63 degrees)
+#define SLUMP_SETTLE_PASSES 200    // Most passes spent settling a new terrain
+#define SLUMP_MAX_FLOW 48          // Most dirt one pair passes on per step, in terrain height steps
+#define LANDSLIDE_DAMAGE 4.0       // Damage per px of dirt a landslide piles on a tank
+#define DEBRIS_CLOD_STEPS 640      // Debris mode: dirt per clod (terrain height steps), before the cap below
+#define DEBRIS_MAX_CLODS 40        // Most clods one crater throws
+#define DEBRIS_GRAVITY 0.25        // A power of two, so clod flights stay exact
+#define DEBRIS_SPREAD 2            // A landed clod covers this many segments either side
+#define QUALITY_WINDOW 30          // Frames averaged by the quality governor
+#define QUALITY_DOWN_FACTOR 1.25   // Drop a level when the average exceeds the budget by this much
+#define QUALITY_UP_FACTOR 1.1      // Frames up to this much over budget still count as on time
+#define QUALITY_UP_FRAMES 180      // On-time frames needed before raising a level
+#define QUALITY_MAX_UP_FRAMES 1800 // Cap on the backed-off wait after a failed raise
+#define QUALITY_COOLDOWN 60        // Frames to ignore after any level change
+#define MAX_SOIL_SPECKS 3          // Most soil specks any quality level draws per column
+#define SPRITE_ANGLES 64           // Rotations prebuilt in the sprite atlas for barrels and drills
+#define SPRITE_CELL 48             // Sprite atlas cell size, in world units (fits a tank and its barrel)
+#define EXPORT_WIDTH 1280          // Exported video frame size; one frame per simulation step
+#define EXPORT_HEIGHT 720
+#define EXPORT_FPS 60
+#define EXPORT_FRAME_BYTES (EXPORT_WIDTH * EXPORT_HEIGHT * 3 / 2) // I420: luma, then quarter-size Cb and Cr
+#define EXPORT_RING_FRAMES 16      // Frames queued or waiting to be written, whatever the thread count (about 2.5 MB each)
+#define EXPORT_BENCH_STEPS 60      // Scripted steps the export benchmark renders (one second of match)
+#define SNAPSHOT_VERSION 8
+#define TERRAIN_HEIGHT_STEPS 32.0   // Quantized terrain heights are in 1/32 px
+#define TERRAIN_OP_SUBPIXELS 16.0   // Terrain op coordinates are in 1/16 px
+#define TERRAIN_LOG_CAPACITY (2 * MAX_CRATER_OPS)
+#define TERRAIN_COMPACT_OPS 1024    // Compact the terrain log at a turn start once it holds this many ops
+#define AUTOSAVE_PATH "artillery_autosave.bin"
+#define QUICKSAVE_PATH "artillery_quicksave.bin"
+#define REPLAY_VERSION 2
+#define REPLAY_KEYFRAME_TURNS 2     // Turns between replay keyframes
+#define REPLAY_SEEK_STEPS 300       // Replay viewer seek step (5 s at 60 FPS)
+#define REPLAY_PATH "artillery_replay.bin"
+#define MATCH_SEATS 2               // Network clients per match; seat k plays tanks k, k + 2, ...
+#define MAX_STEP_ACTIONS 64         // Inputs a server match accepts per step
+#define SERVER_MAX_CLIENTS 4096
+#define MATCH_STEP_SAMPLES 256      // Recent step times kept per match for its percentiles
+#define POOL_MAX_WORKERS 64
+#define NET_STEP_MS (1000.0 / 60)
+#define NET_MAX_MESSAGE (SNAPSHOT_MAX_SIZE + 64)
+#define NET_MAX_BACKLOG (4 * NET_MAX_MESSAGE) // Unsent bytes before a client is dropped as stuck
+#define NET_MAX_INPUT (2 * (4 + NET_MAX_MESSAGE)) // Received bytes buffered before reading waits
+#define NET_LATENCY_SLOTS 256       // Send times remembered per client for latency
+#define HASH_CHECKPOINT_STEPS 1000  // --hash prints the state hash this often
+#define TELEMETRY_RING_SIZE 16384   // Events buffered per simulating thread (a power of two)
+#define TELEMETRY_MAX_RINGS 64      // Simulating threads that can log telemetry at once
+#define TELEMETRY_DRAIN_MS 10       // How often the telemetry thread empties the rings
+#define METRICS_MAX_THREADS 64      // Simulating threads at once with their own metrics block
+#define METRIC_TIME_BUCKETS 9       // Histogram buckets for step and frame times, plus +Inf
+#define METRICS_MAX_TEXT 8192       // Room for the metrics endpoint's response body
+#define WORLD_MAGIC "ARTWORLD"
+#define WORLD_CHUNK_SEGMENTS (TERRAIN_SEGMENTS / 2) // A wide-world chunk is half a screen
+#define WORLD_CHUNK_WIDTH (WORLD_WIDTH / 2)
+#define WORLD_MAX_CHUNKS 65536
+#define WORLD_OVERVIEW_SAMPLES 8    // Minimap heights per chunk
+#define MAP_PACK_MAGIC "ARTPACK1"
+#define MAP_PACK_MAX_MAPS 1000000
+#define HEIGHTMAP_U16_LE 0          // Heightmap sample formats
+#define HEIGHTMAP_U16_BE 1
+#define HEIGHTMAP_U8 2
+#define HEIGHTMAP_LOWEST (WORLD_HEIGHT * 85 / 100) // Terrain y of a heightmap's 0, as low as generated terrain goes
+#define HEIGHTMAP_HIGHEST (WORLD_HEIGHT * 3 / 10)  // and of its highest sample
+#define WIND_FIELD_SPACING 120      // Wind field nodes are this far apart
+#define WIND_FIELD_COLS (WORLD_WIDTH / WIND_FIELD_SPACING + 1)
+#define WIND_FIELD_ROWS (WORLD_HEIGHT / WIND_FIELD_SPACING + 1)
+#define WIND_ALOFT_PCT 140          // Wind at the top of the world, in percent of the turn's wind
+#define WIND_GROUND_PCT 60          // and at the bottom
+#define WIND_GUST_WIDTH 360         // A gust fades out this far from its middle
+#define WIND_GUST_SPEED 4           // Units a gust travels per step
+#define WIND_GUST_MIN_PCT 20        // Extra wind at a gust's middle
+#define WIND_GUST_MAX_PCT 80
+#define WIND_SHIELD_REACH 240       // Ground this far upwind shelters what is below its top
+#define WIND_SHIELD_STRIDE 8
+#define WIND_SHIELD_PCT 25          // Wind left below sheltering ground
+#define WIND_LEE_HEIGHT 60          // and just above it
+#define WIND_LEE_PCT 60
+#define PARTICLE_WIND_PUSH 0.00025  // Push on a particle per thousandth of wind
+#ifdef ARTILLERY_FIXED_POINT
+#define FX_ONE 65536                // Fixed-point physics: Q16.16
+#define FX_GRAVITY 6554             // GRAVITY in Q16.16
+#define SINE_TABLE_SIZE 4096        // Sine table entries per full turn
+#define PHYS_TO_DOUBLE(v) ((double)(v) / FX_ONE)
+#define PHYS_FROM_DOUBLE(v) ((phys_t)((v) * FX_ONE)) // Only for values already on the Q16.16 grid
+#define PHYS_TO_INT(v) ((int)((v) / FX_ONE))
+#define PHYS_GRAVITY FX_GRAVITY
+#else
+#define PHYS_TO_DOUBLE(v) (v)
+#define PHYS_FROM_DOUBLE(v) (v)
+#define PHYS_TO_INT(v) ((int)(v))
+#define PHYS_GRAVITY GRAVITY
+#endif
 
 // Game states
 typedef enum
@@ -27,6 +165,27 @@ typedef enum
     STATE_GAME_OVER
 } GameState;
 
+// Player actions: every input that changes the simulation is one of these,
+// so a match can be replayed from its actions
+typedef enum
+{
+    ACTION_ANGLE_DOWN,
+    ACTION_ANGLE_UP,
+    ACTION_POWER_UP,
+    ACTION_POWER_DOWN,
+    ACTION_NEXT_WEAPON,
+    ACTION_PREV_WEAPON,
+    ACTION_MOVE_LEFT,
+    ACTION_MOVE_RIGHT,
+    ACTION_FIRE,
+    ACTION_PAUSE,
+    ACTION_RESET,
+    ACTION_CYCLE_PLAYERS,
+    ACTION_TOGGLE_TEAMS,
+    ACTION_TOGGLE_DEBRIS,
+    ACTION_COUNT
+} GameAction;
+
 // Weapon types
 typedef enum
 {
@@ -35,18 +194,32 @@ typedef enum
     WEAPON_DRILL,
     WEAPON_CLUSTER,
     WEAPON_NUKE,
+    WEAPON_SALVO,
+    WEAPON_BARRAGE,
     WEAPON_COUNT
 } WeaponType;
 
+// Scalar types of projectile state and of the broadphase grid's copies of
+// it. Deterministic builds (ARTILLERY_FIXED_POINT) use Q16.16 integers,
+// which come out the same whatever the compiler and its flags.
+#ifdef ARTILLERY_FIXED_POINT
+typedef int32_t phys_t;
+typedef int32_t grid_coord_t;
+#else
+typedef double phys_t;
+typedef float grid_coord_t;
+#endif
+
 // Structure for projectiles
 typedef struct
 {
-    double x, y;
-    double dx, dy;
+    phys_t x, y;
+    phys_t dx, dy;
     WeaponType weapon_type;
     bool active;
-    double travel_distance;
+    phys_t travel_distance;
     int sub_projectiles;
+    int stage; // Remaining split generations
 } Projectile;
 
 // Structure for explosions
@@ -70,8 +243,34 @@ typedef struct
     double max_lifetime;
     double size;
     bool active;
+    int debris; // Terrain height steps of dirt this clod puts back where it lands (0 for dust)
 } Particle;
 
+// Structure for the wind over the world: a coarse grid of nodes, rebuilt
+// every step and blended bilinearly in between
+typedef struct
+{
+    int32_t milli[WIND_FIELD_ROWS * WIND_FIELD_COLS]; // Wind at each node, in thousandths
+    phys_t push[WIND_FIELD_ROWS * WIND_FIELD_COLS];   // Its push on a projectile per step
+    double particle_push[WIND_FIELD_ROWS * WIND_FIELD_COLS];
+
+    // Per cell, the push on a projectile as a + b * fx + c * fy + d * fx * fy
+    // over the cell (fx, fy from 0 to 1), so a sample reads one cell
+    phys_t cell[(WIND_FIELD_ROWS - 1) * (WIND_FIELD_COLS - 1)][4];
+} WindField;
+
+// Structure for the positions of every projectile or particle in flight,
+// gathered so the wind field is sampled for all of them in one batch
+typedef struct
+{
+    int index[MAX_PROJECTILES];
+    phys_t x[MAX_PROJECTILES], y[MAX_PROJECTILES];
+    phys_t push[MAX_PROJECTILES];
+    double particle_x[MAX_PARTICLES], particle_y[MAX_PARTICLES];
+    double particle_push[MAX_PARTICLES];
+    int particle_index[MAX_PARTICLES];
+} WindBatch;
+
 // Structure for tanks
 typedef struct
 {
@@ -83,6 +282,11 @@ typedef struct
     WeaponType current_weapon;
     char name[20];
     int moves_left;
+    int team;
+    double vy;      // Falling speed
+    int slide_dir;  // Direction of the current slide (0 when not sliding)
+    bool unsettled; // Needs settling after a crater or a move
+    int last_turn;  // Turn it last played (-1 before its first this round)
 } Tank;
 
 // Structure for weapon properties
@@ -94,46 +298,697 @@ typedef struct
     int terrain_deformation;
     int sub_projectiles;
     double drill_capability;
+    int cluster_stages;          // How many times the projectile splits
+    WeaponType sub_weapon;       // Weapon used by the sub-projectiles
+    bool airburst;               // Split in mid-air instead of on impact
+    bool sympathetic_detonation; // Set off by nearby explosions once armed
+    int salvo_size;              // Projectiles launched per shot
 } WeaponProperty;
 
+// Broadphase scratch for projectile interactions: a uniform grid holding the
+// indices of active projectiles, counting-sorted by cell every step
+typedef struct
+{
+    int cell_start[GRID_COLS * GRID_ROWS + 1];
+    int cell_end[GRID_COLS * GRID_ROWS]; // Shrinks as detonated entries are dropped
+    int cell_of[MAX_PROJECTILES];
+    int items[MAX_PROJECTILES];
+    grid_coord_t item_x[MAX_PROJECTILES]; // Positions copied next to the indices so
+    grid_coord_t item_y[MAX_PROJECTILES]; // cell scans stay in cache
+    int item_count;
+
+    // Detonations this step that may set off neighbouring projectiles
+    phys_t detonation_x[MAX_PROJECTILES];
+    phys_t detonation_y[MAX_PROJECTILES];
+    phys_t detonation_radius[MAX_PROJECTILES];
+    int detonation_count;
+} ProjectileGrid;
+
+// Structure for a queued crater
+typedef struct
+{
+    double x, y;
+    double radius;
+    int deformation;
+    int start_index, end_index; // Affected terrain segments
+} CraterOp;
+
+// Craters queued during a simulation step, applied together at its end
+typedef struct
+{
+    CraterOp ops[MAX_CRATER_OPS];
+    int count;
+} CraterBatch;
+
+// Debris landed during a simulation step, per terrain segment, put onto
+// the terrain together at its end
+typedef struct
+{
+    int32_t steps[TERRAIN_SEGMENTS]; // Terrain height steps to raise each segment by
+    int lo, hi;                      // Segments holding any (lo > hi when empty)
+} DepositBuffer;
+
+// Structure for a replay keyframe: an exact snapshot taken at a turn start
+typedef struct
+{
+    uint32_t step;         // Game step the snapshot was taken at
+    uint32_t action_index; // First action recorded after it
+    uint32_t offset, size; // Snapshot bytes in Replay.data
+} ReplayKeyframe;
+
+// Structure for a match recording: the actions, each packed as
+// step << 5 | action, plus keyframes to seek from. The first keyframe is
+// the state recording started from.
+typedef struct
+{
+    uint32_t seed;     // Random generator state when recording started
+    uint32_t end_step; // Last step covered by the recording
+    uint32_t *actions;
+    int action_count;
+    size_t action_capacity;
+    ReplayKeyframe *keyframes;
+    int keyframe_count;
+    size_t keyframe_capacity;
+    unsigned char *data;
+    size_t data_size, data_capacity;
+    int keyframe_turn; // Game turn of the latest keyframe
+
+    // What save_replay has written to saved_path (nothing while saved_size is 0)
+    char saved_path[256];
+    uint64_t saved_size; // File bytes up to the end of the last chunk
+    int saved_actions, saved_keyframes;
+    size_t saved_data;
+} Replay;
+
+// Structure for the header of a replay file, followed by chunks. It holds
+// the totals over the chunks, and is rewritten after each chunk is appended,
+// so a save cut short leaves the file as it was at the previous save.
+typedef struct
+{
+    char magic[4]; // "ARTR"
+    uint32_t version;
+    uint32_t seed;
+    uint32_t end_step;
+    uint32_t action_count;
+    uint32_t keyframe_count;
+    uint64_t data_size;
+} ReplayHeader;
+
+// Structure for the start of a replay file chunk: what one save added. The
+// actions, keyframes and keyframe data follow it in that order.
+typedef struct
+{
+    uint32_t action_count;
+    uint32_t keyframe_count;
+    uint64_t data_size;
+} ReplayChunk;
+
+// Kinds of logged terrain change
+typedef enum
+{
+    TERRAIN_OP_CRATER,
+    TERRAIN_OP_SLUMP,  // One slumping pass: segments x..radius, reversed if deformation is set
+    TERRAIN_OP_DEPOSIT // Debris raising segment x by y terrain height steps
+} TerrainOpKind;
+
+// Structure for one logged terrain change, in 8 bytes
+typedef struct
+{
+    uint8_t kind;        // TerrainOpKind
+    uint8_t deformation; // Crater depth at the centre, in px
+    uint16_t x;          // Centre, in 1/16 px
+    int16_t y;
+    uint16_t radius;     // In 1/16 px
+} TerrainOp;
+
+// Structure for the terrain change log. The terrain is always exactly the
+// base heightfield followed by the logged ops, so anyone holding the base
+// and the ops (a replay, a spectator, a save file) can rebuild it bit for
+// bit. Compaction folds the ops into a new base.
+typedef struct
+{
+    int32_t base[TERRAIN_SEGMENTS]; // Quantized heightfield, TERRAIN_HEIGHT_STEPS per px, however deep the craters go
+    uint32_t base_seq;               // Sequence number of ops[0]
+    int op_count;
+    TerrainOp ops[TERRAIN_LOG_CAPACITY];
+} TerrainLog;
+
+// Structure for a simplified terrain outline: the segments kept so that the
+// polyline through them never strays more than the tolerance (vertically)
+// from the heightfield. Drawing only these vertices saves path work on the
+// long nearly straight stretches.
+typedef struct
+{
+    uint8_t keep[TERRAIN_SEGMENTS];
+    int vertex_count;  // Segments kept
+    double tolerance;  // In world units; 0 until first built
+} TerrainOutline;
+
+// Network message types. Every message is a 32-bit length (type byte
+// included), the type byte and a payload.
+typedef enum
+{
+    MSG_JOIN = 1, // Client: uint32 match, UINT32_MAX for any
+    MSG_INPUT,    // Client: NetInput
+    MSG_RESYNC,   // Client: empty, asks for MSG_SNAPSHOT
+    MSG_WELCOME,  // Server: NetWelcome, then a snapshot
+    MSG_STEP,     // Server: NetStep, then its NetActions
+    MSG_SNAPSHOT  // Server: a snapshot
+} NetMessageType;
+
+// Structure for a player input sent to the server
+typedef struct
+{
+    uint32_t seq; // Per-client sequence number, acknowledged in NetStep
+    uint8_t action;
+} NetInput;
+
+// Structure for an action the server applied
+typedef struct
+{
+    uint8_t action;
+    uint8_t seat;
+} NetAction;
+
+// Structure for the server's reply to MSG_JOIN
+typedef struct
+{
+    uint32_t match;
+    uint8_t seat;
+    uint8_t seats;
+} NetWelcome;
+
+// Structure for one server step: the actions applied before update_game,
+// and enough of the resulting state for clients to detect a desync
+typedef struct
+{
+    uint32_t step;      // Game step after the update
+    uint32_t rng_state; // Random generator state after the update
+    uint32_t ack_seq;   // Last input received from the recipient
+    uint8_t action_count;
+} NetStep;
+
+// Structure for a buffered, non-blocking message connection
+typedef struct
+{
+    int fd;
+    unsigned char *in;
+    size_t in_len, in_pos, in_cap;
+    unsigned char *out;
+    size_t out_len, out_cap;
+    bool broken; // A malformed frame arrived; the connection is to be dropped
+} NetConnection;
+
+// Structure for a copy of the terrain kept in step with a terrain log
+typedef struct
+{
+    double terrain[TERRAIN_SEGMENTS];
+    uint32_t base_seq; // Base the copy was built on
+    uint32_t seq;      // Next op expected
+    bool synced;
+} TerrainObserver;
+
+// Kinds of telemetry events
+typedef enum
+{
+    TELEMETRY_SHOT,   // player fired weapon: a = angle, b = power, c = wind, value = shells launched
+    TELEMETRY_IMPACT, // Explosion at (a, b) with radius c, value = damage
+    TELEMETRY_DAMAGE, // Tank player lost value health, a = health left
+    TELEMETRY_TURN,   // player's turn starts: value = turn, c = wind
+    TELEMETRY_ROUND,  // Round over: value = winning team (-1 for nobody)
+    TELEMETRY_DROPPED // Written by the telemetry thread: value = events dropped so far
+} TelemetryKind;
+
+// Structure for a telemetry event, written by the simulation and logged by
+// the telemetry thread
+typedef struct
+{
+    uint32_t step;
+    uint8_t kind;
+    int8_t weapon;
+    int16_t player;
+    int32_t value;
+    float a, b, c;
+} TelemetryEvent;
+
+// Structure for a single-producer, single-consumer ring of telemetry events;
+// each simulating thread gets its own, so producers never contend. A ring
+// is handed back when its thread exits, for the next new thread to claim.
+typedef struct
+{
+    _Alignas(64) atomic_uint head; // Next slot to write (producer)
+    _Alignas(64) atomic_uint tail; // Next slot to read (telemetry thread)
+    atomic_ullong dropped;         // Events lost to a full ring
+    atomic_bool claimed;           // A live thread is writing to it
+    TelemetryEvent events[TELEMETRY_RING_SIZE];
+} TelemetryRing;
+
+// Structure for the telemetry log
+typedef struct
+{
+    atomic_bool enabled;
+    atomic_bool stopping;
+    _Atomic(TelemetryRing *) rings[TELEMETRY_MAX_RINGS];
+    atomic_int ring_count;
+    atomic_ullong unringed; // Events from threads that found every ring taken
+    FILE *file;
+    bool ndjson; // NDJSON lines rather than raw TelemetryEvent records
+    unsigned long long written;
+#ifdef __linux__
+    pthread_t thread;
+#endif
+} Telemetry;
+
+// Counters kept for the metrics endpoint
+typedef enum
+{
+    METRIC_STEPS,
+    METRIC_PROJECTILE_SPAWNS,
+    METRIC_PROJECTILE_DROPS, // No free projectile slot
+    METRIC_PARTICLE_SPAWNS,
+    METRIC_PARTICLE_DROPS,
+    METRIC_EXPLOSION_SPAWNS,
+    METRIC_EXPLOSION_DROPS,
+    METRIC_SHOTS_LOST, // fire_weapon could not launch a single shell
+    METRIC_CRATER_OPS,
+    METRIC_SLUMP_PASSES, // Slumping passes that moved dirt
+    METRIC_PEAK_PROJECTILES, // High-water marks of live entities in any one game
+    METRIC_PEAK_PARTICLES,
+    METRIC_PEAK_EXPLOSIONS,
+    METRIC_COUNT
+} MetricId;
+
+// Structure for a histogram of durations, over metric_time_bounds_ms
+typedef struct
+{
+    atomic_ullong buckets[METRIC_TIME_BUCKETS + 1]; // The last one is +Inf
+    atomic_ullong total_ns;
+} MetricHistogram;
+
+// Structure for the metrics of one simulating thread; the endpoint adds up
+// every thread's block when scraped. A block is handed back when its thread
+// exits, and the next new thread carries on adding to it.
+typedef struct
+{
+    atomic_ullong counters[METRIC_COUNT];
+    MetricHistogram step_time;  // update_game
+    MetricHistogram frame_time; // Interval between drawn frames
+    atomic_bool claimed;        // A live thread is counting into it
+} MetricsBlock;
+
+// Structure for the metrics registry and endpoint
+typedef struct
+{
+    _Atomic(MetricsBlock *) blocks[METRICS_MAX_THREADS];
+    atomic_int block_count;
+    MetricsBlock overflow; // Shared by threads beyond METRICS_MAX_THREADS
+    atomic_int quality_level; // The window's quality level, or -1 without a window
+#ifdef __linux__
+    int listen_fd;
+    atomic_bool stopping;
+    pthread_t thread;
+#endif
+} Metrics;
+
+// Structure for a read-only view of a whole file
+typedef struct
+{
+    const unsigned char *data;
+    size_t size;
+} MappedFile;
+
+// Structure for the header of a wide-world map file, followed by
+// chunk_count * WORLD_CHUNK_SEGMENTS heights in 1/TERRAIN_HEIGHT_STEPS px
+typedef struct
+{
+    char magic[8]; // WORLD_MAGIC
+    uint32_t chunk_count;
+    uint32_t chunk_segments; // WORLD_CHUNK_SEGMENTS
+} WorldHeader;
+
+// Structure for a wide world paged in from a memory-mapped map file. The
+// game simulates and draws two chunks of it at a time; chunks away from
+// them are dropped from memory, and craters survive only as per-chunk
+// copies of the chunks that have them.
+typedef struct
+{
+    MappedFile file;
+    const uint16_t *heights; // The map's heights, chunk after chunk
+    int chunk_count;
+    uint16_t **scars;  // Per chunk: its heights after craters, or NULL while untouched
+    float *overview;   // WORLD_OVERVIEW_SAMPLES peaks per chunk, for the minimap
+} ChunkedWorld;
+
+// Structure for the header of a map pack, followed by map_count
+// MapPackEntry records and then the maps' heights
+typedef struct
+{
+    char magic[8]; // MAP_PACK_MAGIC
+    uint32_t map_count;
+    uint32_t reserved;
+} MapPackHeader;
+
+// Structure for a heightmap inside a mapped file: width samples from offset,
+// each 0..max
+typedef struct
+{
+    uint64_t offset;
+    uint32_t width;
+    uint16_t format; // HEIGHTMAP_U16_LE, HEIGHTMAP_U16_BE or HEIGHTMAP_U8
+    uint16_t max;
+} MapPackEntry;
+
+// Structure for the heightmaps a game picks its terrain from at each round:
+// a map pack, or a single raw or PGM heightmap, memory-mapped
+typedef struct
+{
+    MappedFile file;
+    const MapPackEntry *entries;
+    MapPackEntry single; // Entry of a lone heightmap
+    int map_count;
+} MapSet;
+
+// Structure for a round's generated terrain built ahead of time, off the
+// game thread. Whoever builds it sets the seed, then the terrain, then ready.
+typedef struct
+{
+    uint32_t seed;        // Terrain seed it is built from
+    atomic_bool ready;    // Terrain holds the seed's terrain
+    double terrain[TERRAIN_SEGMENTS];
+} PregeneratedRound;
+
 // Structure for the game
 typedef struct
 {
     double terrain[TERRAIN_SEGMENTS];
-    Tank players[2];
+    Tank players[MAX_PLAYERS];
+    int num_players;
     int current_player;
+    int winning_team;
+    int unsettled_tanks;
     GameState state;
     Projectile projectiles[MAX_PROJECTILES];
+    int projectile_free[MAX_PROJECTILES]; // Stack of inactive projectile slots
+    int projectile_free_count;
     Explosion explosions[MAX_EXPLOSIONS];
     Particle particles[MAX_PARTICLES];
     double wind;
+    WindField wind_field; // Wind at each place this step, built from the wind above
     WeaponProperty weapon_properties[WEAPON_COUNT];
     int frame_count;
     bool game_paused;
+
+    // Terrain segments changed since the renderer last looked (lo > hi when clean)
+    int terrain_dirty_lo, terrain_dirty_hi;
+
+    // Every change made to the terrain since the last compaction
+    TerrainLog terrain_log;
+
+    // Slump chunks still settling after a crater, one bit each
+    uint32_t slump_chunks;
+
+    // Match setup, kept across rounds (0 players means DEFAULT_PLAYERS)
+    int match_players;
+    bool match_teams;
+    bool match_debris; // Craters throw their dirt out as debris that lands back on the terrain
+
+    // Random generator state; every random draw in the simulation uses it
+    uint32_t rng_state;
+
+    // Seed of the next round's generated terrain, drawn a round ahead so it
+    // can be built early (0 until a round has drawn it)
+    uint32_t round_seed;
+
+    // Turns started since launch (a new round starts one too)
+    int turn;
+
+    // Simulation steps run since launch (paused frames do not count); player
+    // actions are recorded against it
+    uint32_t step;
+
+    // Spatial index over tank x positions: tank indices sorted by bucket,
+    // with tank_bucket_start[b]..tank_bucket_start[b + 1] holding bucket b
+    int tank_bucket_start[TANK_BUCKETS + 1];
+    int tank_bucket_items[MAX_PLAYERS];
+
+    // Wide world the match is played on (NULL for a single screen). The
+    // terrain then holds the two chunks from world_chunk on, and every x in
+    // the game is relative to that window.
+    ChunkedWorld *world;
+    int world_chunk;
+
+    // Heightmaps each round picks its terrain from (NULL to generate it)
+    const MapSet *maps;
+
+    // Next round's terrain if something builds it ahead of time (NULL to
+    // always generate it in place); used only when its seed matches
+    PregeneratedRound *pregenerated;
 } Game;
 
+// Structure for a match on a dedicated server
+typedef struct
+{
+    Game *game;
+    int seats[MATCH_SEATS]; // Client index per seat, -1 if free
+    NetAction pending[MAX_STEP_ACTIONS];
+    int pending_count;
+    NetAction applied[MAX_STEP_ACTIONS]; // Actions taken in the last step
+    int applied_count;
+    bool parked; // Idle until the next input arrives
+
+    // Step time statistics
+    uint64_t steps;
+    double step_ms_total;
+    float step_ms[MATCH_STEP_SAMPLES]; // Ring of recent step times
+} ServerMatch;
+
+#ifdef __linux__
+// Structure for one worker's task deque. The owner takes from the tail,
+// thieves from the head; tasks are coarse (a whole match step), so a lock
+// per deque is cheap.
+typedef struct
+{
+    pthread_mutex_t lock;
+    int *tasks;
+    int head, tail;
+} WorkQueue;
+
+// Structure for a work-stealing thread pool that runs batches of tasks
+typedef struct
+{
+    pthread_t threads[POOL_MAX_WORKERS];
+    WorkQueue queues[POOL_MAX_WORKERS];
+    int worker_count;
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready, batch_done;
+    uint64_t batch;       // Generation of the current batch
+    atomic_int remaining; // Tasks of the batch not finished yet
+    bool stopping;
+    void (*run)(void *context, int task);
+    void *context;
+} WorkPool;
+
+// Structure for a worker's start-up arguments
+typedef struct
+{
+    WorkPool *pool;
+    int index;
+} WorkerArgs;
+#endif
+
+// Structure for a connection on a dedicated server
+typedef struct
+{
+    NetConnection conn;
+    bool used;
+    bool closing;
+    int match; // -1 until joined
+    int seat;
+    uint32_t last_seq;
+} ServerClient;
+
+// Structure for a dedicated server
+typedef struct
+{
+    ServerMatch *matches;
+    int match_count;
+    ServerClient clients[SERVER_MAX_CLIENTS];
+    int *due; // Matches to step this tick
+#ifdef __linux__
+    WorkPool pool;
+#endif
+} Server;
+
+// Structure for a client of a dedicated server
+typedef struct
+{
+    bool active;
+    NetConnection conn;
+    uint32_t match;
+    int seat;
+    uint32_t next_seq;
+    uint32_t acked_seq;
+    double sent_ms[NET_LATENCY_SLOTS];
+    double latency_ms; // Input to the server step that applied it
+    int desyncs;
+    bool awaiting_resync;
+} NetClient;
+
 // Function prototypes
-static void generate_terrain(Game *game);
+static void generate_terrain(Game *game, uint32_t seed);
+static void pregenerate_round(PregeneratedRound *round);
+static void generate_terrain_into(double *terrain, uint32_t *rng);
 static void init_game(Game *game);
 static void update_game(Game *game);
-static void render_game(GtkDrawingArea *drawing_area, cairo_t *cr, int width, int height, gpointer user_data);
-static void key_pressed(GtkEventController *controller, guint keyval, guint keycode, GdkModifierType state, gpointer user_data);
 static void fire_weapon(Game *game);
 static void create_explosion(Game *game, double x, double y, double radius, int damage, int terrain_deformation);
 static void apply_explosion_to_terrain(Game *game, double x, double y, double radius, int deformation);
+static void flush_craters(Game *game);
+static void mark_terrain_dirty(Game *game, int lo, int hi);
+static void compact_terrain_log(Game *game);
+static TerrainOp make_crater_op(double x, double y, double radius, int deformation);
+static bool terrain_op_range(const TerrainOp *op, int *start_index, int *end_index);
 static void create_particles(Game *game, double x, double y, int count, double power);
+static bool map_file(const char *path, MappedFile *file);
+static void unmap_file(MappedFile *file);
+static FILE *begin_atomic_write(const char *path, char *tmp_path, size_t tmp_size);
+static bool finish_atomic_write(FILE *f, bool ok, const char *tmp_path, const char *path);
+static uint16_t quantize_terrain_height(double height);
+static int32_t quantize_log_height(double height);
+static void update_terrain_outline(TerrainOutline *outline, const double *terrain, int lo, int hi, double tolerance);
+static bool load_world(ChunkedWorld *world, const char *path);
+static void free_world(ChunkedWorld *world);
+static bool write_world(const char *path, int screens, uint32_t seed);
+static void world_start_match(Game *game);
+static void world_follow_shell(Game *game);
+static void world_show_tank(Game *game, int index);
+static double world_height_at(const ChunkedWorld *world, double world_x);
+static double world_tank_x(const ChunkedWorld *world, int num_players, int i);
+static bool load_maps(MapSet *maps, const char *path);
+static void free_maps(MapSet *maps);
+static bool write_map_pack(const char *path, char **inputs, int count);
+static void load_map_terrain(Game *game, const MapSet *maps, int index);
+static bool tank_is_resident(const Tank *tank);
 static void check_tank_positions(Game *game);
+static void unsettle_tank(Game *game, int index);
+static void update_tanks(Game *game);
+static void rebuild_tank_index(Game *game);
+static int query_tanks_in_range(Game *game, double x_min, double x_max, int *out);
+static int next_alive_player(Game *game);
+static int count_alive_teams(Game *game, int *last_team);
 static double get_terrain_height(Game *game, int x);
+static int terrain_segment_at(int x);
+static double crater_depth_at(int i, double x, double radius, int deformation);
 static void reset_game(Game *game);
-static void spawn_cluster_bombs(Game *game, double x, double y);
+static void spawn_cluster_bombs(Game *game, Projectile *parent);
+static int blast_damage(double dx, double dy, double damage_radius, int damage);
+static int alloc_projectile(Game *game);
+static void launch_projectile(Projectile *proj, double tank_x, double tank_y, int angle_tenths, int power_hundredths);
+static void release_projectile(Game *game, int index);
+static void detonate_projectile(Game *game, int index);
+static void update_projectile_interactions(Game *game);
+static void update_wind_display(Game *game);
+static void update_wind_field(Game *game);
+static int slump_segments(double *terrain, int lo, int hi, bool reverse);
+static void wake_slump_chunks(Game *game, int lo, int hi);
+static void update_slumps(Game *game);
+static void settle_terrain(double *terrain);
+static int crater_volume(double x, double radius, int deformation);
+static void create_debris(Game *game, double x, double y, int steps, double power);
+static void deposit_debris(int segment, int steps);
+static void flush_deposits(Game *game);
+static int game_rand(Game *game);
+static uint32_t xorshift32(uint32_t *state);
+static int next_rand(uint32_t *state);
+static void seed_game_rand(Game *game, uint32_t seed);
+static double now_ms(void);
+static void telemetry_emit(const TelemetryEvent *event);
+static bool telemetry_start(const char *path);
+static void telemetry_stop(void);
+static MetricsBlock *metrics_thread_block(void);
+static void metrics_add(MetricId id, unsigned long long amount);
+static void metrics_time(MetricHistogram *histogram, double ms);
+static void metrics_peak(MetricId id, unsigned long long value);
+static bool metrics_serve(const char *address);
+static void metrics_stop(void);
+static bool save_snapshot(Game *game, const char *path);
+static bool load_snapshot(Game *game, const char *path);
+static void apply_action(Game *game, GameAction action);
+static void replay_start(Replay *replay, Game *game);
+static void replay_record_action(Replay *replay, Game *game, GameAction action);
+static void replay_record_step(Replay *replay, Game *game);
+static bool save_replay(Replay *replay, const char *path);
+static bool load_replay(Replay *replay, const char *path);
+static bool replay_advance(Replay *replay, Game *game, int *next_action);
+static bool replay_seek(Replay *replay, Game *game, uint32_t target_step, int *next_action);
+static int verify_replay(const char *path);
+static int compare_doubles(const void *a, const void *b);
+static uint64_t state_hash(const Game *game);
+static uint32_t start_scripted_match(Game *game);
+static void play_scripted_step(Game *game, uint32_t *script, int s);
+static int run_hash_check(Game *game, int steps, const char *expected);
+#ifdef ARTILLERY_FIXED_POINT
+static void init_sine_table(void);
+#endif
+#ifdef __linux__
+static int run_server(const char *address, int match_count, int threads, uint32_t seed, double seconds);
+static int run_net_benchmark(int match_count, int threads, double seconds);
+static int run_host_benchmark(int match_count, int ticks);
+static bool net_client_connect(NetClient *client, Game *game, const char *address, uint32_t match);
+static void net_client_send_action(NetClient *client, GameAction action);
+static int net_client_poll(NetClient *client, Game *game);
+#endif
+static int run_benchmarks(Game *game);
+static int run_env_benchmark(int count, int steps);
+#ifndef ARTILLERY_HEADLESS
+static void render_game(GtkDrawingArea *drawing_area, cairo_t *cr, int width, int height, gpointer user_data);
+static void key_pressed(GtkEventController *controller, guint keyval, guint keycode, GdkModifierType state, gpointer user_data);
 static gboolean tick(GtkWidget *widget, GdkFrameClock *frame_clock, gpointer user_data);
 static void activate(GtkApplication *app, gpointer user_data);
-static void update_wind_display(Game *game);
+static void set_render_scale(double scale);
+static void adjust_render_scale(double delta);
+static bool window_save_snapshot(Game *game, const char *path);
+static bool window_load_snapshot(Game *game, const char *path);
+static void replay_viewer_seek(Game *game, uint32_t target_step);
+static int run_video_export(Game *game, const char *out_path, const char *replay_path, const char *maps_path,
+                            int steps, int threads);
+#endif
 
 // Global variables
-Game game;
+static Game game;
+#ifndef ARTILLERY_HEADLESS
 GtkWidget *window;
-
+#endif
+static _Thread_local ProjectileGrid projectile_grid;
+static _Thread_local CraterBatch crater_batch;
+static _Thread_local DepositBuffer deposit_buffer = {.lo = TERRAIN_SEGMENTS, .hi = -1};
+static _Thread_local WindBatch wind_batch;
+static Telemetry telemetry;
+static _Thread_local TelemetryRing *telemetry_ring; // The calling thread's ring, once it logs an event
+static Metrics metrics = {.quality_level = -1};
+static _Thread_local MetricsBlock *metrics_block; // The calling thread's metrics, once it counts something
+static const double metric_time_bounds_ms[METRIC_TIME_BUCKETS] = {0.25, 0.5, 1, 2, 4, 8, 16, 33, 100};
+
+#ifndef ARTILLERY_HEADLESS
+// Structure for the replay viewer
+typedef struct
+{
+    bool active;     // Watching a recording instead of playing
+    bool paused;
+    int speed;       // Steps per frame: 1, 8 or 64
+    int next_action; // Next recorded action to apply
+} ReplayViewer;
+
+static ReplayViewer viewer = {.speed = 1};
+static ChunkedWorld wide_world; // Map given with --world
+static MapSet map_rotation; // Heightmaps given with --maps
+static Replay recording; // The match being played, or the one being watched
+static NetClient net_client; // Connection when playing on a server
+static PregeneratedRound next_round; // Built by round_worker while the current round plays
+static GThread *round_worker;
+#endif
+
+#ifndef ARTILLERY_HEADLESS
 // Add this new activate function above main
 static void activate(GtkApplication *app, gpointer user_data)
 {
@@ -144,13 +999,33 @@ static void activate(GtkApplication *app, gpointer user_data)
     gtk_window_set_title(GTK_WINDOW(window), "Artillery Game");
     gtk_window_set_default_size(GTK_WINDOW(window), WINDOW_WIDTH, WINDOW_HEIGHT);
 
-    // Initialize game
-    init_game(game);
+    if (viewer.active)
+    {
+        // Watch a recording from its start
+        replay_viewer_seek(game, 0);
+    }
+    else if (net_client.active)
+    {
+        // The server's welcome snapshot is already loaded
+    }
+    else
+    {
+        // Initialize game, resuming the last autosave if there is one, and
+        // record the match from here. Saves and replays hold one screen, so
+        // wide worlds have neither.
+        init_game(game);
+        if (game->world == NULL)
+        {
+            window_load_snapshot(game, AUTOSAVE_PATH);
+            replay_start(&recording, game);
+        }
+    }
 
     // Create drawing area
     GtkWidget *drawing_area = gtk_drawing_area_new();
     gtk_drawing_area_set_draw_func(GTK_DRAWING_AREA(drawing_area), render_game, game, NULL);
-    gtk_widget_set_size_request(drawing_area, WINDOW_WIDTH, WINDOW_HEIGHT);
+    gtk_widget_set_hexpand(drawing_area, TRUE);
+    gtk_widget_set_vexpand(drawing_area, TRUE);
     gtk_window_set_child(GTK_WINDOW(window), drawing_area);
 
     // Add key event controller
@@ -164,13 +1039,200 @@ static void activate(GtkApplication *app, gpointer user_data)
     // Show window
     gtk_window_present(GTK_WINDOW(window));
 }
+#endif
 
+// main stays out of the environment library's exports (see artillery_env.h)
+#if defined(__GNUC__) && !defined(_WIN32)
+__attribute__((visibility("hidden")))
+#endif
 int main(int argc, char *argv[])
 {
+    seed_game_rand(&game, (uint32_t)time(NULL));
+#ifdef ARTILLERY_FIXED_POINT
+    init_sine_table();
+#endif
+
+    // Telemetry log and metrics endpoint for whatever runs next:
+    // --telemetry FILE, --metrics ADDRESS
+    while (argc > 2 && (strcmp(argv[1], "--telemetry") == 0 || strcmp(argv[1], "--metrics") == 0))
+    {
+        bool serving = strcmp(argv[1], "--metrics") == 0;
+        if (serving ? !metrics_serve(argv[2]) : !telemetry_start(argv[2]))
+        {
+            fprintf(stderr, "Cannot %s %s\n", serving ? "serve metrics on" : "log telemetry to", argv[2]);
+            return 1;
+        }
+        atexit(serving ? metrics_stop : telemetry_stop);
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+
+    // Benchmarks run without opening a window
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+    {
+        return run_benchmarks(&game);
+    }
+
+    // Determinism check: --hash [STEPS] [EXPECTED]
+    if (argc > 1 && strcmp(argv[1], "--hash") == 0)
+    {
+        return run_hash_check(&game, argc > 2 ? atoi(argv[2]) : 20000, argc > 3 ? argv[3] : NULL);
+    }
+
+    // Batched training environment throughput: --env-bench [MATCHES] [STEPS]
+    if (argc > 1 && strcmp(argv[1], "--env-bench") == 0)
+    {
+        return run_env_benchmark(argc > 2 ? atoi(argv[2]) : 4096, argc > 3 ? atoi(argv[3]) : 2000);
+    }
+
+    // Wide-world map generator: --make-world FILE [SCREENS] [SEED]
+    if (argc > 2 && strcmp(argv[1], "--make-world") == 0)
+    {
+        int screens = argc > 3 ? atoi(argv[3]) : 100;
+        if (!write_world(argv[2], screens, argc > 4 ? (uint32_t)atoi(argv[4]) : (uint32_t)time(NULL)))
+        {
+            fprintf(stderr, "Cannot write world map %s\n", argv[2]);
+            return 1;
+        }
+        printf("Wrote %s: %d screens\n", argv[2], screens);
+        return 0;
+    }
+
+    // Map pack builder: --pack-maps OUT HEIGHTMAP...
+    if (argc > 3 && strcmp(argv[1], "--pack-maps") == 0)
+    {
+        if (!write_map_pack(argv[2], argv + 3, argc - 3))
+        {
+            fprintf(stderr, "Cannot write map pack %s\n", argv[2]);
+            return 1;
+        }
+        printf("Wrote %s: %d maps\n", argv[2], argc - 3);
+        return 0;
+    }
+
+    // Replays a recording headlessly, checking it against its keyframes
+    if (argc > 2 && strcmp(argv[1], "--verify-replay") == 0)
+    {
+        return verify_replay(argv[2]);
+    }
+
+#ifdef __linux__
+    // Dedicated server: --server ADDRESS [MATCHES] [THREADS] [SEED]; the
+    // matches are seeded per launch unless a seed is given
+    int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (argc > 2 && strcmp(argv[1], "--server") == 0)
+    {
+        return run_server(argv[2], argc > 3 ? atoi(argv[3]) : 1, argc > 4 ? atoi(argv[4]) : cores,
+                          argc > 5 ? (uint32_t)strtoul(argv[5], NULL, 0) : (uint32_t)time(NULL), 0);
+    }
+
+    // Local server benchmark: --net-bench [MATCHES] [SECONDS] [THREADS]
+    if (argc > 1 && strcmp(argv[1], "--net-bench") == 0)
+    {
+        return run_net_benchmark(argc > 2 ? atoi(argv[2]) : 100, argc > 4 ? atoi(argv[4]) : cores,
+                                 argc > 3 ? atof(argv[3]) : 10);
+    }
+
+    // Multi-match host scaling benchmark: --host-bench [MATCHES] [TICKS]
+    if (argc > 1 && strcmp(argv[1], "--host-bench") == 0)
+    {
+        return run_host_benchmark(argc > 2 ? atoi(argv[2]) : 500, argc > 3 ? atoi(argv[3]) : 600);
+    }
+#endif
+
+#ifdef ARTILLERY_HEADLESS
+    fprintf(stderr, "Usage: %s [--telemetry FILE] [--metrics ADDRESS] --bench | --hash [STEPS] [EXPECTED] | --env-bench [MATCHES] [STEPS] | --make-world FILE [SCREENS] [SEED] | --pack-maps OUT HEIGHTMAP... | --verify-replay FILE | --server ADDRESS [MATCHES] [THREADS] [SEED] | "
+                    "--net-bench [MATCHES] [SECONDS] [THREADS] | --host-bench [MATCHES] [TICKS]\n", argv[0]);
+    return 1;
+#else
     GtkApplication *app;
     int status;
 
-    srand(time(NULL));
+    // Video export, without opening a window:
+    // --export-video OUT REPLAY [THREADS] [--maps FILE], --export-script OUT STEPS [THREADS]
+    if (argc > 3 && strcmp(argv[1], "--export-video") == 0)
+    {
+        int threads = argc > 4 && argv[4][0] != '-' ? atoi(argv[4]) : 0;
+        const char *maps_path = NULL;
+        for (int i = 4; i + 1 < argc; i++)
+        {
+            if (strcmp(argv[i], "--maps") == 0)
+                maps_path = argv[i + 1];
+        }
+        return run_video_export(&game, argv[2], argv[3], maps_path, 0, threads);
+    }
+    if (argc > 3 && strcmp(argv[1], "--export-script") == 0)
+    {
+        return run_video_export(&game, argv[2], NULL, NULL, atoi(argv[3]), argc > 4 ? atoi(argv[4]) : 0);
+    }
+
+    // Game options; everything else is left to GTK
+    int gtk_argc = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--render-scale") == 0 && i + 1 < argc)
+        {
+            set_render_scale(atof(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--world") == 0 && i + 1 < argc)
+        {
+            // Play on a wide-world map
+            const char *path = argv[++i];
+            if (!load_world(&wide_world, path))
+            {
+                fprintf(stderr, "Cannot read world map %s\n", path);
+                return 1;
+            }
+            game.world = &wide_world;
+        }
+        else if (strcmp(argv[i], "--maps") == 0 && i + 1 < argc)
+        {
+            // Pick each round's terrain from a map pack or heightmap
+            const char *path = argv[++i];
+            if (!load_maps(&map_rotation, path))
+            {
+                fprintf(stderr, "Cannot read maps %s\n", path);
+                return 1;
+            }
+            game.maps = &map_rotation;
+        }
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+        {
+            // Watch a recording instead of playing
+            const char *path = argv[++i];
+            if (!load_replay(&recording, path))
+            {
+                fprintf(stderr, "Cannot read replay %s\n", path);
+                return 1;
+            }
+            if (!replay_seek(&recording, &game, 0, &viewer.next_action))
+            {
+                fprintf(stderr, "Replay %s starts from a corrupt keyframe\n", path);
+                return 1;
+            }
+            viewer.active = true;
+        }
+#ifdef __linux__
+        else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc)
+        {
+            // Play on a dedicated server
+            const char *address = argv[++i];
+            if (!net_client_connect(&net_client, &game, address, UINT32_MAX))
+            {
+                fprintf(stderr, "Cannot join a match on %s\n", address);
+                return 1;
+            }
+            printf("Joined match %u as seat %d\n", net_client.match, net_client.seat);
+        }
+#endif
+        else
+        {
+            argv[gtk_argc++] = argv[i];
+        }
+    }
+    argc = gtk_argc;
+    game.pregenerated = &next_round;
 
     // Create GTK application
     app = gtk_application_new("org.example.ArtilleryGame", G_APPLICATION_FLAGS_NONE);
@@ -183,10 +1245,11 @@ int main(int argc, char *argv[])
     g_object_unref(app);
 
     return status;
+#endif
 }
 
 // Function to initialize weapon properties
-void init_weapons(Game *game)
+static void init_weapons(Game *game)
 {
     // Small missile
     strcpy(game->weapon_properties[WEAPON_SMALL_MISSILE].name, "Small Missile");
@@ -195,6 +1258,11 @@ void init_weapons(Game *game)
     game->weapon_properties[WEAPON_SMALL_MISSILE].terrain_deformation = 10;
     game->weapon_properties[WEAPON_SMALL_MISSILE].sub_projectiles = 0;
     game->weapon_properties[WEAPON_SMALL_MISSILE].drill_capability = 0;
+    game->weapon_properties[WEAPON_SMALL_MISSILE].cluster_stages = 0;
+    game->weapon_properties[WEAPON_SMALL_MISSILE].sub_weapon = WEAPON_SMALL_MISSILE;
+    game->weapon_properties[WEAPON_SMALL_MISSILE].airburst = false;
+    game->weapon_properties[WEAPON_SMALL_MISSILE].sympathetic_detonation = false;
+    game->weapon_properties[WEAPON_SMALL_MISSILE].salvo_size = 1;
 
     // Big missile
     strcpy(game->weapon_properties[WEAPON_BIG_MISSILE].name, "Big Missile");
@@ -203,6 +1271,11 @@ void init_weapons(Game *game)
     game->weapon_properties[WEAPON_BIG_MISSILE].terrain_deformation = 25;
     game->weapon_properties[WEAPON_BIG_MISSILE].sub_projectiles = 0;
     game->weapon_properties[WEAPON_BIG_MISSILE].drill_capability = 0;
+    game->weapon_properties[WEAPON_BIG_MISSILE].cluster_stages = 0;
+    game->weapon_properties[WEAPON_BIG_MISSILE].sub_weapon = WEAPON_BIG_MISSILE;
+    game->weapon_properties[WEAPON_BIG_MISSILE].airburst = false;
+    game->weapon_properties[WEAPON_BIG_MISSILE].sympathetic_detonation = false;
+    game->weapon_properties[WEAPON_BIG_MISSILE].salvo_size = 1;
 
     // Drill
     strcpy(game->weapon_properties[WEAPON_DRILL].name, "Drill");
@@ -211,6 +1284,11 @@ void init_weapons(Game *game)
     game->weapon_properties[WEAPON_DRILL].terrain_deformation = 30;
     game->weapon_properties[WEAPON_DRILL].sub_projectiles = 0;
     game->weapon_properties[WEAPON_DRILL].drill_capability = 1.0;
+    game->weapon_properties[WEAPON_DRILL].cluster_stages = 0;
+    game->weapon_properties[WEAPON_DRILL].sub_weapon = WEAPON_DRILL;
+    game->weapon_properties[WEAPON_DRILL].airburst = false;
+    game->weapon_properties[WEAPON_DRILL].sympathetic_detonation = false;
+    game->weapon_properties[WEAPON_DRILL].salvo_size = 1;
 
     // Cluster
     strcpy(game->weapon_properties[WEAPON_CLUSTER].name, "Cluster Bomb");
@@ -219,6 +1297,11 @@ void init_weapons(Game *game)
     game->weapon_properties[WEAPON_CLUSTER].terrain_deformation = 5;
     game->weapon_properties[WEAPON_CLUSTER].sub_projectiles = 5;
     game->weapon_properties[WEAPON_CLUSTER].drill_capability = 0;
+    game->weapon_properties[WEAPON_CLUSTER].cluster_stages = 1;
+    game->weapon_properties[WEAPON_CLUSTER].sub_weapon = WEAPON_SMALL_MISSILE; // Use small missile properties
+    game->weapon_properties[WEAPON_CLUSTER].airburst = false;
+    game->weapon_properties[WEAPON_CLUSTER].sympathetic_detonation = false;
+    game->weapon_properties[WEAPON_CLUSTER].salvo_size = 1;
 
     // Nuke
     strcpy(game->weapon_properties[WEAPON_NUKE].name, "Nuke");
@@ -227,47 +1310,89 @@ void init_weapons(Game *game)
     game->weapon_properties[WEAPON_NUKE].terrain_deformation = 70;
     game->weapon_properties[WEAPON_NUKE].sub_projectiles = 0;
     game->weapon_properties[WEAPON_NUKE].drill_capability = 0;
+    game->weapon_properties[WEAPON_NUKE].cluster_stages = 0;
+    game->weapon_properties[WEAPON_NUKE].sub_weapon = WEAPON_NUKE;
+    game->weapon_properties[WEAPON_NUKE].airburst = false;
+    game->weapon_properties[WEAPON_NUKE].sympathetic_detonation = false;
+    game->weapon_properties[WEAPON_NUKE].salvo_size = 1;
+
+    // Rocket salvo: a fan of rockets launched together
+    strcpy(game->weapon_properties[WEAPON_SALVO].name, "Rocket Salvo");
+    game->weapon_properties[WEAPON_SALVO].damage = 8;
+    game->weapon_properties[WEAPON_SALVO].explosion_radius = 12;
+    game->weapon_properties[WEAPON_SALVO].terrain_deformation = 6;
+    game->weapon_properties[WEAPON_SALVO].sub_projectiles = 0;
+    game->weapon_properties[WEAPON_SALVO].drill_capability = 0;
+    game->weapon_properties[WEAPON_SALVO].cluster_stages = 0;
+    game->weapon_properties[WEAPON_SALVO].sub_weapon = WEAPON_SALVO;
+    game->weapon_properties[WEAPON_SALVO].airburst = false;
+    game->weapon_properties[WEAPON_SALVO].sympathetic_detonation = false;
+    game->weapon_properties[WEAPON_SALVO].salvo_size = 48;
+
+    // Barrage: bursts in the air three times, 24 ways each (up to 13824 bomblets)
+    strcpy(game->weapon_properties[WEAPON_BARRAGE].name, "Barrage");
+    game->weapon_properties[WEAPON_BARRAGE].damage = 2;
+    game->weapon_properties[WEAPON_BARRAGE].explosion_radius = 8;
+    game->weapon_properties[WEAPON_BARRAGE].terrain_deformation = 2;
+    game->weapon_properties[WEAPON_BARRAGE].sub_projectiles = 24;
+    game->weapon_properties[WEAPON_BARRAGE].drill_capability = 0;
+    game->weapon_properties[WEAPON_BARRAGE].cluster_stages = 3;
+    game->weapon_properties[WEAPON_BARRAGE].sub_weapon = WEAPON_BARRAGE;
+    game->weapon_properties[WEAPON_BARRAGE].airburst = true;
+    game->weapon_properties[WEAPON_BARRAGE].sympathetic_detonation = true;
+    game->weapon_properties[WEAPON_BARRAGE].salvo_size = 1;
 }
 
 // Function to initialize the game
 static void init_game(Game *game)
 {
     game->current_player = 0;
+    game->winning_team = -1;
     game->state = STATE_AIMING;
     game->frame_count = 0;
     game->game_paused = false;
-    game->players[0].moves_left = 3;
-    game->players[1].moves_left = 3;
+
+    // Number of tanks for this match
+    game->num_players = game->match_players;
+    if (game->num_players < 2 || game->num_players > MAX_PLAYERS)
+        game->num_players = DEFAULT_PLAYERS;
 
     // Initialize weapons
     init_weapons(game);
 
     // Initialize players
-    strcpy(game->players[0].name, "Player 1");
-    game->players[0].health = 100;
-    game->players[0].score = 0;
-    game->players[0].angle = 45;
-    game->players[0].power = 50;
-    game->players[0].current_weapon = WEAPON_SMALL_MISSILE;
-
-    strcpy(game->players[1].name, "Player 2");
-    game->players[1].health = 100;
-    game->players[1].score = 0;
-    game->players[1].angle = 135;
-    game->players[1].power = 50;
-    game->players[1].current_weapon = WEAPON_SMALL_MISSILE;
+    for (int i = 0; i < game->num_players; i++)
+    {
+        Tank *tank = &game->players[i];
+        sprintf(tank->name, "Player %d", i + 1);
+        tank->health = 100;
+        tank->score = 0;
+        tank->power = 50;
+        tank->current_weapon = WEAPON_SMALL_MISSILE;
+        tank->moves_left = 3;
+        tank->vy = 0;
+        tank->slide_dir = 0;
+        tank->unsettled = false;
+
+        // Free-for-all gives every tank its own team, team matches alternate
+        // between two teams so turns alternate between the sides
+        tank->team = game->match_teams ? i % 2 : i;
+        tank->last_turn = (i == game->current_player) ? game->turn : -1;
+    }
 
     // Generate random wind
     do
     {
-        game->wind = (rand() % 21 - 10) * 0.01;
+        game->wind = (game_rand(game) % 21 - 10) * 0.01;
     } while (fabs(game->wind) < 0.02);
 
-    // Initialize projectiles
+    // Initialize projectiles, with every slot on the free stack (lowest index on top)
     for (int i = 0; i < MAX_PROJECTILES; i++)
     {
         game->projectiles[i].active = false;
+        game->projectile_free[i] = MAX_PROJECTILES - 1 - i;
     }
+    game->projectile_free_count = MAX_PROJECTILES;
 
     // Initialize explosions
     for (int i = 0; i < MAX_EXPLOSIONS; i++)
@@ -281,31 +1406,244 @@ static void init_game(Game *game)
         game->particles[i].active = false;
     }
 
-    // Generate terrain
-    generate_terrain(game);
+    // Generate terrain (or page in a wide world's first window, or resample
+    // the next map); it becomes the base of the terrain log
+    if (game->world != NULL)
+        world_start_match(game);
+    else if (game->maps != NULL)
+        load_map_terrain(game, game->maps, game_rand(game) % game->maps->map_count);
+    else
+    {
+        // The terrain comes from the seed drawn last round, so it may already be built
+        uint32_t seed = game->round_seed ? game->round_seed : (uint32_t)game_rand(game) | 1;
+        game->round_seed = (uint32_t)game_rand(game) | 1;
+        generate_terrain(game, seed);
+    }
+    compact_terrain_log(game);
+    game->terrain_dirty_lo = 1;
+    game->terrain_dirty_hi = 0;
+    mark_terrain_dirty(game, 0, TERRAIN_SEGMENTS - 1);
+    game->slump_chunks = 0;
+    update_wind_field(game);
 
     // Position tanks on the terrain
-    game->players[0].x = WINDOW_WIDTH * 0.25;
-    game->players[1].x = WINDOW_WIDTH * 0.75;
+    for (int i = 0; i < game->num_players; i++)
+    {
+        Tank *tank = &game->players[i];
+
+#ifdef ARTILLERY_FIXED_POINT
+        // Same spots as below, rounded down to whole pixels so tank positions are exact
+        if (game->match_teams)
+        {
+            int team_size = (game->num_players + 1 - tank->team) / 2;
+            tank->x = tank->team * (WORLD_WIDTH / 2) + (WORLD_WIDTH / 2) * (2 * (i / 2) + 1) / (2 * team_size);
+        }
+        else
+        {
+            tank->x = WORLD_WIDTH * (2 * i + 1) / (2 * game->num_players);
+        }
+#else
+        if (game->match_teams)
+        {
+            // Team 0 holds the left half of the map, team 1 the right half
+            int team_size = (game->num_players + 1 - tank->team) / 2;
+            int slot = i / 2;
+            double half = WORLD_WIDTH / 2.0;
+            tank->x = tank->team * half + half * (slot + 0.5) / team_size;
+        }
+        else
+        {
+            // Spread tanks evenly; two players end up at 25% and 75%
+            tank->x = WORLD_WIDTH * (i + 0.5) / game->num_players;
+        }
+#endif
+
+        // Aim towards the middle of the map
+        tank->angle = (tank->x < WORLD_WIDTH / 2) ? 45 : 135;
+
+        // On a wide world the tanks stand in a row, aiming towards its middle
+        if (game->world != NULL)
+        {
+            tank->x = world_tank_x(game->world, game->num_players, i) - (double)game->world_chunk * WORLD_CHUNK_WIDTH;
+            tank->angle = (2 * i + 1 < game->num_players) ? 45 : 135;
+        }
+    }
 
-    // Set Y positions based on terrain
+    // Build the spatial index and set Y positions based on terrain
+    game->unsettled_tanks = 0;
+    rebuild_tank_index(game);
     check_tank_positions(game);
+
+    game->turn++;
 }
 
-// Function to generate terrain using sine waves
-static void generate_terrain(Game *game)
-{
-    // Base height
-    double base_height = WINDOW_HEIGHT * 0.7;
+#ifdef ARTILLERY_FIXED_POINT
+static int32_t sine_table[SINE_TABLE_SIZE + 1]; // Q16.16 over one turn, plus a wrap-around entry
 
-    // Generate terrain using multiple layers
-    for (int i = 0; i < TERRAIN_SEGMENTS; i++)
+// Function to fill the sine table using integer arithmetic only (a Taylor
+// series in Q30), so it comes out the same whatever the compiler and libm
+static void init_sine_table(void)
+{
+    const int64_t half_pi = 1686629713; // pi / 2 in Q30
+    int quarter = SINE_TABLE_SIZE / 4;
+    for (int k = 0; k <= quarter; k++)
     {
-        double x = (double)i / TERRAIN_SEGMENTS * WINDOW_WIDTH;
-        double height = base_height;
+        int64_t x = half_pi * k / quarter;
+        int64_t x2 = x * x / (1 << 30);
+        int64_t term = x, sum = x;
+        for (int n = 1; n <= 8; n++)
+        {
+            term = term * x2 / (1 << 30) / ((2 * n) * (2 * n + 1));
+            sum += (n % 2) ? -term : term;
+        }
 
-        // Large mountains
-        height += sin(x * 0.002) * 120;
+        // Mirror the first quarter into the other three
+        int32_t value = (int32_t)((sum + (1 << 13)) / (1 << 14));
+        sine_table[k] = value;
+        sine_table[2 * quarter - k] = value;
+        sine_table[2 * quarter + k] = -value;
+        sine_table[4 * quarter - k] = -value;
+    }
+}
+
+// Function to get the sine of a binary angle (2^32 per turn) in Q16.16,
+// interpolating between table entries
+static int32_t fx_sin(uint32_t angle)
+{
+    uint32_t index = angle >> 20;
+    int32_t frac = (angle >> 4) & 0xFFFF;
+    int32_t a = sine_table[index], b = sine_table[index + 1];
+    return a + (int32_t)((int64_t)(b - a) * frac / FX_ONE);
+}
+
+// Function to get the cosine of a binary angle in Q16.16
+static int32_t fx_cos(uint32_t angle)
+{
+    return fx_sin(angle + 0x40000000u);
+}
+
+// Function to convert tenths of a degree to a binary angle
+static uint32_t fx_angle_tenths(int tenths)
+{
+    return (uint32_t)((int64_t)tenths * 4294967296LL / 3600);
+}
+
+// Function to multiply two Q16.16 numbers
+static int32_t fx_mul(int32_t a, int32_t b)
+{
+    return (int32_t)((int64_t)a * b / FX_ONE);
+}
+
+// Function to get the integer square root of v, rounded down. The hardware
+// square root only gives the first guess; the integer checks make the
+// result exact whatever its rounding.
+static uint64_t isqrt64(uint64_t v)
+{
+    uint64_t root = (uint64_t)sqrt((double)v);
+    while (root > 0 && root * root > v)
+        root--;
+    while ((root + 1) * (root + 1) <= v)
+        root++;
+    return root;
+}
+
+// Function to get the length of a Q16.16 vector in Q16.16
+static int32_t fx_length(int32_t dx, int32_t dy)
+{
+    return (int32_t)isqrt64((uint64_t)((int64_t)dx * dx + (int64_t)dy * dy));
+}
+
+// Binary angle a terrain wave of the given rate (radians per pixel)
+// advances per terrain segment
+#define TERRAIN_WAVE(rate) ((uint32_t)((rate) * WORLD_WIDTH / TERRAIN_SEGMENTS / (2 * PI) * 4294967296.0 + 0.5))
+
+// Function to generate terrain using sine waves, drawing its noise from the
+// given generator. Fixed-point builds add up the same layers in Q16.16 from
+// the sine table, so every build generates the same heights.
+static void generate_terrain_into(double *terrain, uint32_t *rng)
+{
+    int32_t height[TERRAIN_SEGMENTS];
+    const int32_t min_height = WORLD_HEIGHT * 3 / 10 * FX_ONE, max_height = WORLD_HEIGHT * 85 / 100 * FX_ONE;
+
+    // Generate terrain using multiple layers
+    for (int i = 0; i < TERRAIN_SEGMENTS; i++)
+    {
+        uint32_t u = i;
+        int32_t h = WORLD_HEIGHT * 7 / 10 * FX_ONE;
+
+        // Large mountains
+        h += fx_sin(u * TERRAIN_WAVE(0.002)) * 120;
+
+        // Medium hills
+        h += fx_sin(u * TERRAIN_WAVE(0.01)) * 50;
+        h += fx_cos(u * TERRAIN_WAVE(0.005)) * 40;
+
+        // Small hills
+        h += fx_mul(fx_sin(u * TERRAIN_WAVE(0.03)) * 20, fx_cos(u * TERRAIN_WAVE(0.001)) + FX_ONE);
+
+        // Rough terrain details
+        h += fx_sin(u * TERRAIN_WAVE(0.2)) * 5;
+
+        // Random noise for texture
+        h += (next_rand(rng) % 10 - 5) * (fx_sin(u * TERRAIN_WAVE(0.01)) + FX_ONE);
+
+        // Ensure height stays within bounds
+        height[i] = h < min_height ? min_height : h > max_height ? max_height : h;
+    }
+
+    // Smooth the terrain
+    for (int pass = 0; pass < 2; pass++)
+    {
+        int32_t prev = height[0];
+        for (int i = 1; i < TERRAIN_SEGMENTS - 1; i++)
+        {
+            int32_t current = height[i];
+            height[i] = (prev + current + height[i + 1]) / 3;
+            prev = current;
+        }
+    }
+
+    // Add small terrain features
+    for (int i = 1; i < TERRAIN_SEGMENTS - 1; i++)
+    {
+        if (next_rand(rng) % 50 == 0)
+        { // Random small bumps
+            int bump_width = 5 + (next_rand(rng) % 10);
+            int bump_height = 5 + (next_rand(rng) % 10);
+
+            for (int j = -bump_width; j <= bump_width; j++)
+            {
+                if (i + j >= 0 && i + j < TERRAIN_SEGMENTS)
+                {
+                    // cos(j / bump_width * pi) * 0.5 + 0.5, half a turn being 2^31
+                    int32_t factor = (fx_cos((uint32_t)((int64_t)j * 0x80000000LL / bump_width)) + FX_ONE) / 2;
+                    height[i + j] += bump_height * factor;
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < TERRAIN_SEGMENTS; i++)
+    {
+        terrain[i] = PHYS_TO_DOUBLE(height[i]);
+    }
+}
+#else
+// Function to generate terrain using sine waves, drawing its noise from the
+// given generator
+static void generate_terrain_into(double *terrain, uint32_t *rng)
+{
+    // Base height
+    double base_height = WORLD_HEIGHT * 0.7;
+
+    // Generate terrain using multiple layers
+    for (int i = 0; i < TERRAIN_SEGMENTS; i++)
+    {
+        double x = (double)i / TERRAIN_SEGMENTS * WORLD_WIDTH;
+        double height = base_height;
+
+        // Large mountains
+        height += sin(x * 0.002) * 120;
 
         // Medium hills
         height += sin(x * 0.01) * 50;
@@ -318,24 +1656,24 @@ static void generate_terrain(Game *game)
         height += sin(x * 0.2) * 5;
 
         // Random noise for texture
-        height += (rand() % 10 - 5) * (sin(x * 0.01) + 1);
+        height += (next_rand(rng) % 10 - 5) * (sin(x * 0.01) + 1);
 
         // Ensure height stays within bounds
-        height = fmax(height, WINDOW_HEIGHT * 0.3);
-        height = fmin(height, WINDOW_HEIGHT * 0.85);
+        height = fmax(height, WORLD_HEIGHT * 0.3);
+        height = fmin(height, WORLD_HEIGHT * 0.85);
 
-        game->terrain[i] = height;
+        terrain[i] = height;
     }
 
     // Smooth the terrain
     double smoothing_passes = 2;
     while (smoothing_passes-- > 0)
     {
-        double prev = game->terrain[0];
+        double prev = terrain[0];
         for (int i = 1; i < TERRAIN_SEGMENTS - 1; i++)
         {
-            double current = game->terrain[i];
-            game->terrain[i] = (prev + current + game->terrain[i + 1]) / 3.0;
+            double current = terrain[i];
+            terrain[i] = (prev + current + terrain[i + 1]) / 3.0;
             prev = current;
         }
     }
@@ -343,1168 +1681,8040 @@ static void generate_terrain(Game *game)
     // Add small terrain features
     for (int i = 1; i < TERRAIN_SEGMENTS - 1; i++)
     {
-        if (rand() % 50 == 0)
+        if (next_rand(rng) % 50 == 0)
         { // Random small bumps
-            double bump_width = 5 + (rand() % 10);
-            double bump_height = 5 + (rand() % 10);
+            double bump_width = 5 + (next_rand(rng) % 10);
+            double bump_height = 5 + (next_rand(rng) % 10);
 
             for (int j = -bump_width; j <= bump_width; j++)
             {
                 if (i + j >= 0 && i + j < TERRAIN_SEGMENTS)
                 {
                     double factor = cos((j / bump_width) * PI) * 0.5 + 0.5;
-                    game->terrain[i + j] += bump_height * factor;
+                    terrain[i + j] += bump_height * factor;
                 }
             }
         }
     }
 }
+#endif
+
+// Function to generate the game's terrain from a seed, or swap in the
+// pregenerated round if it was built from the same one
+static void generate_terrain(Game *game, uint32_t seed)
+{
+    PregeneratedRound *next = game->pregenerated;
+    if (next != NULL && atomic_load_explicit(&next->ready, memory_order_acquire) && next->seed == seed)
+    {
+        memcpy(game->terrain, next->terrain, sizeof(game->terrain));
+        return;
+    }
+    generate_terrain_into(game->terrain, &seed);
+    settle_terrain(game->terrain);
+}
+
+// Function to build a round's terrain from its seed; any thread may run it
+// while the game plays on
+static void pregenerate_round(PregeneratedRound *round)
+{
+    uint32_t rng = round->seed;
+    generate_terrain_into(round->terrain, &rng);
+    settle_terrain(round->terrain);
+    atomic_store_explicit(&round->ready, true, memory_order_release);
+}
 
 // Function to get terrain height at a specific x coordinate
 static double get_terrain_height(Game *game, int x)
 {
     if (x < 0)
-        return WINDOW_HEIGHT;
-    if (x >= WINDOW_WIDTH)
-        return WINDOW_HEIGHT;
+        return WORLD_HEIGHT;
+    if (x >= WORLD_WIDTH)
+        return WORLD_HEIGHT;
 
-    int index = (int)((double)x / WINDOW_WIDTH * TERRAIN_SEGMENTS);
+    return game->terrain[terrain_segment_at(x)];
+}
+
+// Function to get the terrain segment under a pixel column. Integer math,
+// so columns on a segment boundary never round down to the previous one.
+static int terrain_segment_at(int x)
+{
+    int index = x * TERRAIN_SEGMENTS / WORLD_WIDTH;
     if (index < 0)
         index = 0;
     if (index >= TERRAIN_SEGMENTS)
         index = TERRAIN_SEGMENTS - 1;
-
-    return game->terrain[index];
+    return index;
 }
 
-// Function to check and adjust tank positions based on terrain
+// Function to place every tank directly on the terrain (used at round start)
 static void check_tank_positions(Game *game)
 {
-    for (int i = 0; i < 2; i++)
+    for (int i = 0; i < game->num_players; i++)
     {
-        int tank_x = (int)game->players[i].x;
-        game->players[i].y = get_terrain_height(game, tank_x) - TANK_HEIGHT / 2;
+        Tank *tank = &game->players[i];
+        if (game->world != NULL && !tank_is_resident(tank))
+            tank->y = world_height_at(game->world, tank->x + (double)game->world_chunk * WORLD_CHUNK_WIDTH) - TANK_HEIGHT / 2;
+        else
+            tank->y = get_terrain_height(game, (int)tank->x) - TANK_HEIGHT / 2;
     }
 }
 
-// Function to handle key press events
-static void key_pressed(GtkEventController *controller, guint keyval, guint keycode, GdkModifierType state, gpointer user_data)
+// Function to flag a tank for settling
+static void unsettle_tank(Game *game, int index)
 {
-    Game *game = (Game *)user_data;
-
-    // Special handling for R key - allow it to work even when game is over
-    if (keyval == GDK_KEY_r || keyval == GDK_KEY_R)
+    if (!game->players[index].unsettled)
     {
-        // Reset scores but keep other player info
-        int p1_score = game->players[0].score;
-        int p2_score = game->players[1].score;
-
-        // Full game reset
-        init_game(game);
-
-        // Reset player health and positions
-        game->players[0].health = 100;
-        game->players[1].health = 100;
-
-        // Restore scores
-        game->players[0].score = p1_score;
-        game->players[1].score = p2_score;
-
-        // Reset game state and player turns
-        game->state = STATE_AIMING;
-        game->current_player = 0;
-        game->players[0].moves_left = 3;
-        game->players[1].moves_left = 3;
-
-        // Clear all active projectiles, explosions, and particles
-        for (int i = 0; i < MAX_PROJECTILES; i++)
-        {
-            game->projectiles[i].active = false;
-        }
-        for (int i = 0; i < MAX_EXPLOSIONS; i++)
-        {
-            game->explosions[i].active = false;
-        }
-        for (int i = 0; i < MAX_PARTICLES; i++)
-        {
-            game->particles[i].active = false;
-        }
-
-        // Generate new wind
-        do
-        {
-            game->wind = (rand() % 21 - 10) * 0.01;
-        } while (fabs(game->wind) < 0.02);
-
-        // Force redraw
-        if (window != NULL)
-        {
-            gtk_widget_queue_draw(window);
-        }
-        return;
+        game->players[index].unsettled = true;
+        game->unsettled_tanks++;
     }
+}
 
-    // Skip if game is over or not in aiming state
-    if (game->state == STATE_GAME_OVER || game->state != STATE_AIMING)
+// Function to settle the tanks that lost their footing: they fall under
+// gravity, take damage on hard landings and slide off steep slopes. Only
+// flagged tanks are simulated, so a quiet map costs nothing.
+static void update_tanks(Game *game)
+{
+    if (game->unsettled_tanks == 0)
         return;
 
-    Tank *current_tank = &game->players[game->current_player];
-
-    switch (keyval)
+    bool moved = false;
+    for (int i = 0; i < game->num_players; i++)
     {
-    case GDK_KEY_Left:
-        // Decrease angle
-        current_tank->angle = (current_tank->angle - 1) % 360;
-        if (current_tank->angle < 0)
-            current_tank->angle += 360;
-        break;
-
-    case GDK_KEY_Right:
-        // Increase angle
-        current_tank->angle = (current_tank->angle + 1) % 360;
-        break;
-
-    case GDK_KEY_Up:
-        // Increase power
-        if (current_tank->power < MAX_POWER)
-            current_tank->power++;
-        break;
-
-    case GDK_KEY_Down:
-        // Decrease power
-        if (current_tank->power > 1)
-            current_tank->power--;
-        break;
-
-    case GDK_KEY_w:
-    case GDK_KEY_W:
-        // Select next weapon
-        current_tank->current_weapon = (current_tank->current_weapon + 1) % WEAPON_COUNT;
-        break;
-
-    case GDK_KEY_s:
-    case GDK_KEY_S:
-        // Select previous weapon
-        current_tank->current_weapon = (current_tank->current_weapon - 1 + WEAPON_COUNT) % WEAPON_COUNT;
-        break;
-
-    case GDK_KEY_space:
-        // Fire weapon
-        fire_weapon(game);
-        break;
+        Tank *tank = &game->players[i];
+        if (!tank->unsettled)
+            continue;
 
-    case GDK_KEY_r:
-    case GDK_KEY_R:
-        // Allow reset at any time, regardless of game state
+        // Outside a wide world's window: put it straight down on the world's ground
+        if (game->world != NULL && !tank_is_resident(tank))
         {
-            // Reset scores but keep other player info
-            int p1_score = game->players[0].score;
-            int p2_score = game->players[1].score;
-
-            // Full game reset
-            init_game(game);
-
-            // Reset player health and positions
-            game->players[0].health = 100;
-            game->players[1].health = 100;
-
-            // Restore scores
-            game->players[0].score = p1_score;
-            game->players[1].score = p2_score;
-
-            // Reset game state and player turns
-            game->state = STATE_AIMING;
-            game->current_player = 0;
-            game->players[0].moves_left = 3;
-            game->players[1].moves_left = 3;
-
-            // Clear all active projectiles, explosions, and particles
-            for (int i = 0; i < MAX_PROJECTILES; i++)
-            {
-                game->projectiles[i].active = false;
-            }
-            for (int i = 0; i < MAX_EXPLOSIONS; i++)
-            {
-                game->explosions[i].active = false;
-            }
-            for (int i = 0; i < MAX_PARTICLES; i++)
-            {
-                game->particles[i].active = false;
-            }
-
-            // Generate new wind
-            do
-            {
-                game->wind = (rand() % 21 - 10) * 0.01;
-            } while (fabs(game->wind) < 0.02);
-
-            // Force redraw
-            if (window != NULL)
-            {
-                gtk_widget_queue_draw(window);
-            }
+            tank->y = world_height_at(game->world, tank->x + (double)game->world_chunk * WORLD_CHUNK_WIDTH) - TANK_HEIGHT / 2;
+            tank->vy = 0;
+            tank->slide_dir = 0;
+            tank->unsettled = false;
+            game->unsettled_tanks--;
+            continue;
         }
-        break;
 
-    case GDK_KEY_p:
-    case GDK_KEY_P:
-        // Toggle pause
-        game->game_paused = !game->game_paused;
-        break;
+        double ground = get_terrain_height(game, (int)tank->x) - TANK_HEIGHT / 2;
 
-    case GDK_KEY_a:
-    case GDK_KEY_A:
-        if (current_tank->moves_left > 0)
+        if (tank->y < ground)
         {
-            // Move left
-            current_tank->x -= 22.0;
-            if (current_tank->x < TANK_WIDTH / 2)
+            // Falling (gravity rounded to Q16.16 in fixed-point builds, so the sums stay exact)
+#ifdef ARTILLERY_FIXED_POINT
+            tank->vy += PHYS_TO_DOUBLE(FX_GRAVITY);
+#else
+            tank->vy += GRAVITY;
+#endif
+            tank->y += tank->vy;
+            if (tank->y < ground)
+                continue;
+
+            // Landing
+            if (tank->vy > FALL_DAMAGE_SPEED && tank->health > 0)
             {
-                current_tank->x = TANK_WIDTH / 2;
+                tank->health -= (int)((tank->vy - FALL_DAMAGE_SPEED) * FALL_DAMAGE_FACTOR);
+                if (tank->health < 0)
+                    tank->health = 0;
             }
-            check_tank_positions(game);
-            current_tank->moves_left--;
         }
-        break;
 
-    case GDK_KEY_d:
-    case GDK_KEY_D:
-        if (current_tank->moves_left > 0)
+        // Resting on (or pushed up onto) the ground
+        tank->y = ground;
+        tank->vy = 0;
+
+        // Slide down slopes that are too steep to hold on to. A slide that
+        // would turn back (a pit narrower than the tank) stops instead.
+        double left = get_terrain_height(game, (int)(tank->x - TANK_WIDTH / 2));
+        double right = get_terrain_height(game, (int)(tank->x + TANK_WIDTH / 2));
+        double rise = right - left;
+        int dir = (rise > 0) ? 1 : -1;
+        if (fabs(rise) > SLIDE_SLOPE * TANK_WIDTH && tank->slide_dir != -dir)
         {
-            // Move right
-            current_tank->x += 22.0;
-            if (current_tank->x > WINDOW_WIDTH - TANK_WIDTH / 2)
+            double x = tank->x + dir * SLIDE_SPEED;
+            if (x >= TANK_WIDTH / 2 && x <= WORLD_WIDTH - TANK_WIDTH / 2)
             {
-                current_tank->x = WINDOW_WIDTH - TANK_WIDTH / 2;
+                tank->x = x;
+                tank->slide_dir = dir;
+                moved = true;
+                continue;
             }
-            check_tank_positions(game);
-            current_tank->moves_left--;
         }
-        break;
+
+        tank->slide_dir = 0;
+        tank->unsettled = false;
+        game->unsettled_tanks--;
+    }
+
+    if (moved)
+    {
+        rebuild_tank_index(game);
     }
 }
 
-// Function to fire the current weapon
-static void fire_weapon(Game *game)
+// Function to get the spatial index bucket for an x coordinate
+static int tank_bucket_for_x(double x)
 {
-    if (game->state != STATE_AIMING)
-        return;
-
-    Tank *current_tank = &game->players[game->current_player];
+    int bucket = (int)(x / TANK_BUCKET_WIDTH);
+    if (bucket < 0)
+        bucket = 0;
+    if (bucket >= TANK_BUCKETS)
+        bucket = TANK_BUCKETS - 1;
+    return bucket;
+}
 
-    // Find an inactive projectile
-    int proj_index = -1;
-    for (int i = 0; i < MAX_PROJECTILES; i++)
+// Function to rebuild the tank spatial index (counting sort by bucket).
+// Tanks only change x when they move, so this runs rarely.
+static void rebuild_tank_index(Game *game)
+{
+    int counts[TANK_BUCKETS] = {0};
+    for (int i = 0; i < game->num_players; i++)
     {
-        if (!game->projectiles[i].active)
-        {
-            proj_index = i;
-            break;
-        }
+        counts[tank_bucket_for_x(game->players[i].x)]++;
     }
 
-    if (proj_index == -1)
-        return; // No available projectiles
-
-    // Activate projectile
-    Projectile *proj = &game->projectiles[proj_index];
-    proj->active = true;
-    proj->weapon_type = current_tank->current_weapon;
-
-    // Set starting position (tank barrel)
-    double angle_rad = current_tank->angle * PI / 180.0;
-    double barrel_length = 20.0;
-
-    // Adjust starting position based on player
-    if (game->current_player == 0)
+    game->tank_bucket_start[0] = 0;
+    for (int b = 0; b < TANK_BUCKETS; b++)
     {
-        proj->x = current_tank->x + cos(angle_rad) * barrel_length;
-        proj->y = current_tank->y - sin(angle_rad) * barrel_length;
+        game->tank_bucket_start[b + 1] = game->tank_bucket_start[b] + counts[b];
     }
-    else
+
+    int fill[TANK_BUCKETS];
+    memcpy(fill, game->tank_bucket_start, sizeof(fill));
+    for (int i = 0; i < game->num_players; i++)
     {
-        // For player 2, adjust the angle calculation
-        proj->x = current_tank->x + cos(angle_rad) * barrel_length;
-        proj->y = current_tank->y - sin(angle_rad) * barrel_length;
+        int bucket = tank_bucket_for_x(game->players[i].x);
+        game->tank_bucket_items[fill[bucket]++] = i;
     }
+}
 
-    // Set velocity based on power and angle
-    double power_factor = (double)current_tank->power / MAX_POWER * 10.0;
-    proj->dx = cos(angle_rad) * power_factor;
-    proj->dy = -sin(angle_rad) * power_factor;
-
-    proj->travel_distance = 0;
-    proj->sub_projectiles = game->weapon_properties[current_tank->current_weapon].sub_projectiles;
+// Function to collect the tanks whose buckets overlap [x_min, x_max].
+// Callers still do the exact distance test on the returned candidates.
+static int query_tanks_in_range(Game *game, double x_min, double x_max, int *out)
+{
+    int first = game->tank_bucket_start[tank_bucket_for_x(x_min)];
+    int last = game->tank_bucket_start[tank_bucket_for_x(x_max) + 1];
 
-    // Change state to firing
-    game->state = STATE_FIRING;
+    // Buckets are stored back to back, so the range is one contiguous slice
+    int count = 0;
+    for (int i = first; i < last; i++)
+    {
+        out[count++] = game->tank_bucket_items[i];
+    }
+    return count;
 }
 
-// Function to create an explosion
-static void create_explosion(Game *game, double x, double y, double radius, int damage, int terrain_deformation)
+// Function to find the tank to play next: the next team in turn order that
+// still has a living tank, and of that team's living tanks the one that has
+// waited longest. Teams keep alternating after deaths leave them uneven.
+static int next_alive_player(Game *game)
 {
-    // Find an inactive explosion
-    int exp_index = -1;
-    for (int i = 0; i < MAX_EXPLOSIONS; i++)
+    int current_team = game->players[game->current_player].team;
+    int next = game->current_player;
+    int next_offset = MAX_PLAYERS;
+    for (int step = 1; step <= game->num_players; step++)
     {
-        if (!game->explosions[i].active)
+        int i = (game->current_player + step) % game->num_players;
+        Tank *tank = &game->players[i];
+        if (tank->health <= 0)
+            continue;
+
+        // Teams after the current one come first, the current team last
+        int offset = (tank->team - current_team - 1 + MAX_PLAYERS) % MAX_PLAYERS;
+        if (offset < next_offset || (offset == next_offset && tank->last_turn < game->players[next].last_turn))
         {
-            exp_index = i;
-            break;
+            next = i;
+            next_offset = offset;
         }
     }
+    return next;
+}
 
-    if (exp_index == -1)
-        return; // No available explosions
-
-    // Activate explosion
-    Explosion *exp = &game->explosions[exp_index];
-    exp->active = true;
-    exp->x = x;
-    exp->y = y;
-    exp->radius = 1.0;
-    exp->max_radius = radius;
-    exp->growth_rate = radius / 10.0; // Grow to full size in 10 frames
-    exp->damage = damage;
-    exp->terrain_deformation = terrain_deformation;
-
-    // Create particles for visual effect
-    create_particles(game, x, y, 30, radius);
+// Function to count the teams that still have a living tank
+static int count_alive_teams(Game *game, int *last_team)
+{
+    bool seen[MAX_PLAYERS] = {false};
+    int alive = 0;
 
-    // Apply damage to tanks if in explosion radius
-    for (int i = 0; i < 2; i++)
+    *last_team = -1;
+    for (int i = 0; i < game->num_players; i++)
     {
-        double dx = game->players[i].x - x;
-        double dy = game->players[i].y - y;
-        double distance = sqrt(dx * dx + dy * dy);
-
-        if (distance < radius * 1.5) // Increase damage radius by 50%
+        Tank *tank = &game->players[i];
+        if (tank->health > 0 && !seen[tank->team])
         {
-            // Apply damage with falloff based on distance, but with a higher minimum damage
-            double damage_factor = 1.0 - (distance / (radius * 1.5));
-            damage_factor = fmax(damage_factor, 0.3); // Minimum 30% damage even at edge of radius
-
-            int applied_damage = (int)(damage * damage_factor * 1.5); // Multiply damage by 1.5
-            game->players[i].health -= applied_damage;
-
-            // Ensure health doesn't go below 0
-            if (game->players[i].health < 0)
-                game->players[i].health = 0;
+            seen[tank->team] = true;
+            *last_team = tank->team;
+            alive++;
         }
     }
-
-    // Apply explosion to terrain
-    apply_explosion_to_terrain(game, x, y, radius, terrain_deformation);
-
-    // Set game state to explosion
-    game->state = STATE_EXPLOSION;
+    return alive;
 }
 
-// Function to spawn cluster bombs
-static void spawn_cluster_bombs(Game *game, double x, double y)
+#ifndef ARTILLERY_HEADLESS
+// Function to map a key to the player action it triggers (-1 if none)
+static int action_for_key(guint keyval)
 {
-    int count = 5; // Number of sub-projectiles
+    switch (keyval)
+    {
+    case GDK_KEY_Left:
+        return ACTION_ANGLE_DOWN;
+    case GDK_KEY_Right:
+        return ACTION_ANGLE_UP;
+    case GDK_KEY_Up:
+        return ACTION_POWER_UP;
+    case GDK_KEY_Down:
+        return ACTION_POWER_DOWN;
+    case GDK_KEY_w:
+    case GDK_KEY_W:
+        return ACTION_NEXT_WEAPON;
+    case GDK_KEY_s:
+    case GDK_KEY_S:
+        return ACTION_PREV_WEAPON;
+    case GDK_KEY_a:
+    case GDK_KEY_A:
+        return ACTION_MOVE_LEFT;
+    case GDK_KEY_d:
+    case GDK_KEY_D:
+        return ACTION_MOVE_RIGHT;
+    case GDK_KEY_space:
+        return ACTION_FIRE;
+    case GDK_KEY_p:
+    case GDK_KEY_P:
+        return ACTION_PAUSE;
+    case GDK_KEY_r:
+    case GDK_KEY_R:
+        return ACTION_RESET;
+    case GDK_KEY_n:
+    case GDK_KEY_N:
+        return ACTION_CYCLE_PLAYERS;
+    case GDK_KEY_t:
+    case GDK_KEY_T:
+        return ACTION_TOGGLE_TEAMS;
+    case GDK_KEY_b:
+    case GDK_KEY_B:
+        return ACTION_TOGGLE_DEBRIS;
+    default:
+        return -1;
+    }
+}
 
-    for (int i = 0; i < count; i++)
+// Function to seek the replay viewer, pausing it where it is if the
+// keyframe to seek from is corrupt
+static void replay_viewer_seek(Game *game, uint32_t target_step)
+{
+    if (!replay_seek(&recording, game, target_step, &viewer.next_action))
+    {
+        fprintf(stderr, "Cannot seek to step %u: corrupt keyframe\n", target_step);
+        viewer.paused = true;
+    }
+}
+
+// Function to handle replay viewer keys
+static void replay_viewer_key(Game *game, guint keyval)
+{
+    switch (keyval)
+    {
+    case GDK_KEY_space:
+        viewer.paused = !viewer.paused;
+        break;
+    case GDK_KEY_1:
+        viewer.speed = 1;
+        break;
+    case GDK_KEY_2:
+        viewer.speed = 8;
+        break;
+    case GDK_KEY_3:
+        viewer.speed = 64;
+        break;
+    case GDK_KEY_Left:
+        replay_viewer_seek(game, game->step > REPLAY_SEEK_STEPS ? game->step - REPLAY_SEEK_STEPS : 0);
+        break;
+    case GDK_KEY_Right:
+        replay_viewer_seek(game, game->step + REPLAY_SEEK_STEPS);
+        break;
+    case GDK_KEY_Home:
+        replay_viewer_seek(game, 0);
+        break;
+    case GDK_KEY_End:
+        replay_viewer_seek(game, recording.end_step);
+        break;
+    }
+}
+
+// Function to handle key press events
+static void key_pressed(GtkEventController *controller, guint keyval, guint keycode, GdkModifierType state, gpointer user_data)
+{
+    Game *game = (Game *)user_data;
+
+    switch (keyval)
+    {
+    case GDK_KEY_bracketleft:
+        // Lower the internal render resolution
+        adjust_render_scale(-0.125);
+        return;
+
+    case GDK_KEY_bracketright:
+        // Raise the internal render resolution
+        adjust_render_scale(0.125);
+        return;
+    }
+
+    if (viewer.active)
+    {
+        replay_viewer_key(game, keyval);
+        return;
+    }
+
+#ifdef __linux__
+    if (net_client.active)
+    {
+        // Online, actions go to the server and come back in its steps
+        int action = action_for_key(keyval);
+        if (action >= 0)
+            net_client_send_action(&net_client, (GameAction)action);
+        return;
+    }
+#endif
+
+    switch (keyval)
+    {
+    case GDK_KEY_F5:
+        // Quick save (a single screen only)
+        if (game->world == NULL)
+            window_save_snapshot(game, QUICKSAVE_PATH);
+        return;
+
+    case GDK_KEY_F9:
+        // Quick load; the recording restarts from the loaded state
+        if (game->world == NULL && window_load_snapshot(game, QUICKSAVE_PATH))
+            replay_start(&recording, game);
+        return;
+    }
+
+    // Everything else is a player action, recorded unless on a wide world
+    int action = action_for_key(keyval);
+    if (action < 0)
+        return;
+    if (game->world == NULL)
+        replay_record_action(&recording, game, (GameAction)action);
+    apply_action(game, (GameAction)action);
+
+    if (window != NULL)
+    {
+        gtk_widget_queue_draw(window);
+    }
+}
+#endif
+
+// Function to fire the current weapon
+static void fire_weapon(Game *game)
+{
+    if (game->state != STATE_AIMING)
+        return;
+
+    Tank *current_tank = &game->players[game->current_player];
+    WeaponProperty *wp = &game->weapon_properties[current_tank->current_weapon];
+
+    int fired = 0;
+    for (int shot = 0; shot < wp->salvo_size; shot++)
     {
         // Find an inactive projectile
-        int proj_index = -1;
-        for (int j = 0; j < MAX_PROJECTILES; j++)
+        int proj_index = alloc_projectile(game);
+        if (proj_index == -1)
+            break; // No available projectiles
+
+        // Activate projectile
+        Projectile *proj = &game->projectiles[proj_index];
+        proj->weapon_type = current_tank->current_weapon;
+
+        // Salvo rockets after the first fan out around the aimed angle and
+        // power (angle in tenths of a degree, power in hundredths)
+        int angle_tenths = current_tank->angle * 10;
+        int power_hundredths = current_tank->power * 100;
+        if (shot > 0)
         {
-            if (!game->projectiles[j].active)
-            {
-                proj_index = j;
-                break;
-            }
+            angle_tenths += game_rand(game) % 81 - 40;
+            power_hundredths = current_tank->power * (95 + game_rand(game) % 11);
+        }
+        launch_projectile(proj, current_tank->x, current_tank->y, angle_tenths, power_hundredths);
+
+        proj->stage = wp->cluster_stages;
+        proj->sub_projectiles = (proj->stage > 0) ? wp->sub_projectiles : 0;
+        fired++;
+    }
+
+    if (fired == 0)
+    {
+        metrics_add(METRIC_SHOTS_LOST, 1);
+        return;
+    }
+
+    telemetry_emit(&(TelemetryEvent){.kind = TELEMETRY_SHOT,
+                                     .step = game->step,
+                                     .player = game->current_player,
+                                     .weapon = current_tank->current_weapon,
+                                     .value = fired,
+                                     .a = current_tank->angle,
+                                     .b = current_tank->power,
+                                     .c = game->wind});
+
+    // Change state to firing
+    game->state = STATE_FIRING;
+}
+
+// Function to set a projectile leaving a tank's barrel at the given angle
+// (tenths of a degree) and power (hundredths)
+static void launch_projectile(Projectile *proj, double tank_x, double tank_y, int angle_tenths, int power_hundredths)
+{
+    const int barrel_length = 20;
+#ifdef ARTILLERY_FIXED_POINT
+    // Position and velocity from the sine table
+    uint32_t angle = fx_angle_tenths(angle_tenths);
+    phys_t power_factor = (phys_t)((int64_t)power_hundredths * 10 * FX_ONE / (100 * MAX_POWER));
+    proj->x = PHYS_FROM_DOUBLE(tank_x) + fx_cos(angle) * barrel_length;
+    proj->y = PHYS_FROM_DOUBLE(tank_y) - fx_sin(angle) * barrel_length;
+    proj->dx = fx_mul(fx_cos(angle), power_factor);
+    proj->dy = -fx_mul(fx_sin(angle), power_factor);
+#else
+    // Set starting position (tank barrel)
+    double angle_rad = angle_tenths / 10.0 * PI / 180.0;
+    proj->x = tank_x + cos(angle_rad) * barrel_length;
+    proj->y = tank_y - sin(angle_rad) * barrel_length;
+
+    // Set velocity based on power and angle
+    double power_factor = power_hundredths / 100.0 / MAX_POWER * 10.0;
+    proj->dx = cos(angle_rad) * power_factor;
+    proj->dy = -sin(angle_rad) * power_factor;
+#endif
+    proj->travel_distance = 0;
+}
+
+// Function to take a projectile slot off the free stack (-1 if the pool is exhausted)
+static int alloc_projectile(Game *game)
+{
+    if (game->projectile_free_count == 0)
+    {
+        metrics_add(METRIC_PROJECTILE_DROPS, 1);
+        return -1;
+    }
+    metrics_add(METRIC_PROJECTILE_SPAWNS, 1);
+
+    int index = game->projectile_free[--game->projectile_free_count];
+    game->projectiles[index].active = true;
+
+    // A reused slot is not in this step's broadphase grid
+    projectile_grid.cell_of[index] = -1;
+    return index;
+}
+
+// Function to return a projectile slot to the free stack
+static void release_projectile(Game *game, int index)
+{
+    game->projectiles[index].active = false;
+    game->projectile_free[game->projectile_free_count++] = index;
+}
+
+// Function to explode a projectile where it is
+static void detonate_projectile(Game *game, int index)
+{
+    // Copy the projectile first: its slot is reused straight away by the sub-projectiles
+    Projectile proj = game->projectiles[index];
+    release_projectile(game, index);
+
+    // Get weapon properties
+    WeaponProperty *wp = &game->weapon_properties[proj.weapon_type];
+
+    // Create explosion
+    create_explosion(game, PHYS_TO_DOUBLE(proj.x), PHYS_TO_DOUBLE(proj.y), wp->explosion_radius, wp->damage,
+                     wp->terrain_deformation);
+
+    // Remember the blast so it can set off projectiles flying through it
+    ProjectileGrid *grid = &projectile_grid;
+    if (grid->detonation_count < MAX_PROJECTILES)
+    {
+        grid->detonation_x[grid->detonation_count] = proj.x;
+        grid->detonation_y[grid->detonation_count] = proj.y;
+        grid->detonation_radius[grid->detonation_count] = PHYS_FROM_DOUBLE(wp->explosion_radius);
+        grid->detonation_count++;
+    }
+
+    // Handle cluster bombs
+    if (proj.sub_projectiles > 0)
+    {
+        spawn_cluster_bombs(game, &proj);
+    }
+}
+
+// Function to create an explosion
+static void create_explosion(Game *game, double x, double y, double radius, int damage, int terrain_deformation)
+{
+    // Find an inactive explosion
+    int exp_index = -1;
+    for (int i = 0; i < MAX_EXPLOSIONS; i++)
+    {
+        if (!game->explosions[i].active)
+        {
+            exp_index = i;
+            break;
         }
+    }
+
+    // The explosion slot is only the visual; damage and craters apply regardless
+    metrics_add(exp_index != -1 ? METRIC_EXPLOSION_SPAWNS : METRIC_EXPLOSION_DROPS, 1);
+    if (exp_index != -1)
+    {
+        // Activate explosion
+        Explosion *exp = &game->explosions[exp_index];
+        exp->active = true;
+        exp->x = x;
+        exp->y = y;
+        exp->radius = 1.0;
+        exp->max_radius = radius;
+        exp->growth_rate = radius / 10.0; // Grow to full size in 10 frames
+        exp->damage = damage;
+        exp->terrain_deformation = terrain_deformation;
+
+        // Create particles for visual effect
+        create_particles(game, x, y, 30, radius);
+    }
+
+    telemetry_emit(&(TelemetryEvent){
+        .kind = TELEMETRY_IMPACT, .step = game->step, .value = damage, .a = x, .b = y, .c = radius});
+
+    // Apply damage to tanks if in explosion radius, only visiting the tanks
+    // that the spatial index places near the blast
+    double damage_radius = radius * 1.5; // Increase damage radius by 50%
+    int candidates[MAX_PLAYERS];
+    int candidate_count = query_tanks_in_range(game, x - damage_radius, x + damage_radius, candidates);
+    for (int c = 0; c < candidate_count; c++)
+    {
+        Tank *tank = &game->players[candidates[c]];
+        int dealt = blast_damage(tank->x - x, tank->y - y, damage_radius, damage);
+        if (dealt > tank->health)
+            dealt = tank->health; // Ensure health doesn't go below 0
+        if (dealt <= 0)
+            continue;
+        tank->health -= dealt;
+
+        telemetry_emit(&(TelemetryEvent){
+            .kind = TELEMETRY_DAMAGE, .step = game->step, .player = candidates[c], .value = dealt, .a = tank->health});
+    }
+
+    // Apply explosion to terrain, unless it went off in the air well above the ground
+    if (y + radius >= get_terrain_height(game, (int)x))
+    {
+        apply_explosion_to_terrain(game, x, y, radius, terrain_deformation);
+        if (game->match_debris)
+            create_debris(game, x, y, crater_volume(x, radius, terrain_deformation), radius);
+    }
 
+    // Set game state to explosion
+    game->state = STATE_EXPLOSION;
+}
+
+// Function to get the damage a blast deals to a tank at an offset from it
+static int blast_damage(double dx, double dy, double damage_radius, int damage)
+{
+#ifdef ARTILLERY_FIXED_POINT
+    // Distance and falloff in Q16.16 (every input is on its grid), with the
+    // same falloff as below
+    int64_t distance = fx_length(PHYS_FROM_DOUBLE(dx), PHYS_FROM_DOUBLE(dy));
+    int64_t reach = PHYS_FROM_DOUBLE(damage_radius);
+    if (distance >= reach)
+        return 0;
+    int64_t falloff = reach - distance > reach * 3 / 10 ? reach - distance : reach * 3 / 10;
+    return (int)(damage * 3 * falloff / (2 * reach));
+#else
+    double distance = sqrt(dx * dx + dy * dy);
+    if (distance >= damage_radius)
+        return 0;
+
+    // Apply damage with falloff based on distance, but with a higher minimum damage
+    double damage_factor = 1.0 - (distance / damage_radius);
+    damage_factor = fmax(damage_factor, 0.3); // Minimum 30% damage even at edge of radius
+    return (int)(damage * damage_factor * 1.5); // Multiply damage by 1.5
+#endif
+}
+
+// Function to spawn cluster bombs
+static void spawn_cluster_bombs(Game *game, Projectile *parent)
+{
+    WeaponProperty *wp = &game->weapon_properties[parent->weapon_type];
+    int count = parent->sub_projectiles; // Number of sub-projectiles
+    int stage = parent->stage - 1;
+
+    for (int i = 0; i < count; i++)
+    {
+        // Find an inactive projectile
+        int proj_index = alloc_projectile(game);
         if (proj_index == -1)
-            continue; // No available projectiles
+            break; // No available projectiles
 
         // Activate projectile
         Projectile *proj = &game->projectiles[proj_index];
-        proj->active = true;
-        proj->weapon_type = WEAPON_SMALL_MISSILE; // Use small missile properties
+        proj->weapon_type = wp->sub_weapon;
+
+#ifdef ARTILLERY_FIXED_POINT
+        if (wp->airburst)
+        {
+            // Mid-air bursts keep the parent's momentum and scatter around it
+            uint32_t angle = fx_angle_tenths(game_rand(game) % 360 * 10);
+            phys_t spread = game_rand(game) % 100 * 4 * FX_ONE / 100;
+
+            proj->x = parent->x;
+            proj->y = parent->y;
+            proj->dx = parent->dx + fx_mul(fx_cos(angle), spread);
+            proj->dy = parent->dy - fx_mul(fx_sin(angle), spread);
+        }
+        else
+        {
+            // Set starting position (slightly randomized)
+            proj->x = parent->x + (game_rand(game) % 11 - 5) * FX_ONE;
+            proj->y = parent->y + (game_rand(game) % 11 - 5) * FX_ONE;
 
-        // Set starting position (slightly randomized)
-        proj->x = x + (rand() % 11 - 5);
-        proj->y = y + (rand() % 11 - 5);
+            // Set random velocity
+            uint32_t angle = fx_angle_tenths(game_rand(game) % 360 * 10);
+            phys_t power = (game_rand(game) % 5 + 3) * FX_ONE;
+
+            proj->dx = fx_mul(fx_cos(angle), power);
+            proj->dy = -fx_mul(fx_sin(angle), power);
+        }
+#else
+        if (wp->airburst)
+        {
+            // Mid-air bursts keep the parent's momentum and scatter around it
+            double angle = (game_rand(game) % 360) * PI / 180.0;
+            double spread = (game_rand(game) % 100) / 100.0 * 4.0;
+
+            proj->x = parent->x;
+            proj->y = parent->y;
+            proj->dx = parent->dx + cos(angle) * spread;
+            proj->dy = parent->dy - sin(angle) * spread;
+        }
+        else
+        {
+            // Set starting position (slightly randomized)
+            proj->x = parent->x + (game_rand(game) % 11 - 5);
+            proj->y = parent->y + (game_rand(game) % 11 - 5);
 
-        // Set random velocity
-        double angle = (rand() % 360) * PI / 180.0;
-        double power = (rand() % 5) + 3.0;
+            // Set random velocity
+            double angle = (game_rand(game) % 360) * PI / 180.0;
+            double power = (game_rand(game) % 5) + 3.0;
 
-        proj->dx = cos(angle) * power;
-        proj->dy = -sin(angle) * power;
+            proj->dx = cos(angle) * power;
+            proj->dy = -sin(angle) * power;
+        }
+#endif
 
         proj->travel_distance = 0;
-        proj->sub_projectiles = 0; // No more sub-projectiles
+        proj->stage = stage;
+        proj->sub_projectiles = (stage > 0) ? count : 0; // No more sub-projectiles after the last stage
     }
 }
 
-// Function to apply explosion to terrain
+// Function to apply explosion to terrain. The crater is queued and applied
+// with the rest of the step's craters in flush_craters.
 static void apply_explosion_to_terrain(Game *game, double x, double y, double radius, int deformation)
 {
-    // Calculate the range of affected terrain segments
-    int start_index = (int)((x - radius) / WINDOW_WIDTH * TERRAIN_SEGMENTS);
-    int end_index = (int)((x + radius) / WINDOW_WIDTH * TERRAIN_SEGMENTS);
+    CraterBatch *batch = &crater_batch;
+    TerrainLog *log = &game->terrain_log;
+    if (batch->count == MAX_CRATER_OPS || log->op_count == TERRAIN_LOG_CAPACITY)
+    {
+        flush_craters(game);
+    }
 
-    // Clamp indices
-    if (start_index < 0)
-        start_index = 0;
-    if (end_index >= TERRAIN_SEGMENTS)
-        end_index = TERRAIN_SEGMENTS - 1;
+    // Slumps and deposits can fill the log between batches; with no craters
+    // queued the terrain matches the log, so it can be folded straight away
+    if (log->op_count == TERRAIN_LOG_CAPACITY)
+        compact_terrain_log(game);
+
+    // The crater is quantized to what the log can hold, then applied as logged
+    TerrainOp logged = make_crater_op(x, y, radius, deformation);
+    int start_index, end_index;
+    if (!terrain_op_range(&logged, &start_index, &end_index))
+        return;
+    log->ops[log->op_count++] = logged;
+    metrics_add(METRIC_CRATER_OPS, 1);
+
+    CraterOp *op = &batch->ops[batch->count++];
+    op->x = logged.x / TERRAIN_OP_SUBPIXELS;
+    op->y = logged.y / TERRAIN_OP_SUBPIXELS;
+    op->radius = logged.radius / TERRAIN_OP_SUBPIXELS;
+    op->deformation = logged.deformation;
+    op->start_index = start_index;
+    op->end_index = end_index;
+}
+
+// Function to build a crater op, clamped to the op's fixed-point ranges
+static TerrainOp make_crater_op(double x, double y, double radius, int deformation)
+{
+    TerrainOp op;
+    op.kind = TERRAIN_OP_CRATER;
+    op.deformation = deformation < 0 ? 0 : deformation > UINT8_MAX ? UINT8_MAX : deformation;
+    long qx = lround(x * TERRAIN_OP_SUBPIXELS);
+    long qy = lround(y * TERRAIN_OP_SUBPIXELS);
+    long qr = lround(radius * TERRAIN_OP_SUBPIXELS);
+    op.x = qx < 0 ? 0 : qx > UINT16_MAX ? UINT16_MAX : qx;
+    op.y = qy < INT16_MIN ? INT16_MIN : qy > INT16_MAX ? INT16_MAX : qy;
+    op.radius = qr < 0 ? 0 : qr > UINT16_MAX ? UINT16_MAX : qr;
+    return op;
+}
 
-    // Apply crater effect
+// Function to get how much dirt a crater digs out, in terrain height steps
+static int crater_volume(double x, double radius, int deformation)
+{
+    TerrainOp op = make_crater_op(x, 0, radius, deformation);
+    int start_index, end_index;
+    if (!terrain_op_range(&op, &start_index, &end_index))
+        return 0;
+
+    // Rounded once for the whole crater (exact in fixed-point builds, whose
+    // depths are whole steps)
+    double depth = 0;
     for (int i = start_index; i <= end_index; i++)
     {
-        double segment_x = (double)i / TERRAIN_SEGMENTS * WINDOW_WIDTH;
-        double dx = segment_x - x;
-        double distance = fabs(dx);
+        depth += crater_depth_at(i, op.x / TERRAIN_OP_SUBPIXELS, op.radius / TERRAIN_OP_SUBPIXELS, op.deformation);
+    }
+    return (int)lround(depth * TERRAIN_HEIGHT_STEPS);
+}
 
-        if (distance < radius)
-        {
-            // Crater shape (semicircle)
-            double crater_depth = sqrt(radius * radius - dx * dx) / radius * deformation;
-            game->terrain[i] += crater_depth;
-        }
+// Function to get the terrain segments a logged op touches; false if none
+static bool terrain_op_range(const TerrainOp *op, int *start_index, int *end_index)
+{
+    const int64_t scale = WORLD_WIDTH * (int64_t)TERRAIN_OP_SUBPIXELS;
+    *start_index = (int)(((int64_t)op->x - op->radius) * TERRAIN_SEGMENTS / scale);
+    *end_index = (int)(((int64_t)op->x + op->radius) * TERRAIN_SEGMENTS / scale);
+
+    // Clamp indices
+    if (*start_index < 0)
+        *start_index = 0;
+    if (*end_index >= TERRAIN_SEGMENTS)
+        *end_index = TERRAIN_SEGMENTS - 1;
+    return *start_index <= *end_index;
+}
+
+// Function to apply one logged op to a heightfield, the way flush_craters,
+// update_slumps and flush_deposits do
+static void apply_terrain_op(double *terrain, const TerrainOp *op)
+{
+    if (op->kind == TERRAIN_OP_SLUMP)
+    {
+        if (op->x <= op->radius && op->radius < TERRAIN_SEGMENTS)
+            slump_segments(terrain, op->x, op->radius, op->deformation);
+        return;
+    }
+    if (op->kind == TERRAIN_OP_DEPOSIT)
+    {
+        if (op->x < TERRAIN_SEGMENTS)
+            terrain[op->x] -= op->y / TERRAIN_HEIGHT_STEPS;
+        return;
     }
 
-    // Check if tanks need to be repositioned
-    check_tank_positions(game);
+    int start_index, end_index;
+    if (!terrain_op_range(op, &start_index, &end_index))
+        return;
+
+    double x = op->x / TERRAIN_OP_SUBPIXELS;
+    double radius = op->radius / TERRAIN_OP_SUBPIXELS;
+    for (int i = start_index; i <= end_index; i++)
+    {
+        terrain[i] += crater_depth_at(i, x, radius, op->deformation);
+    }
 }
 
-// Function to create particles
-static void create_particles(Game *game, double x, double y, int count, double power)
+// Function to get how deep a crater (centre and radius on the 1/16 px op
+// grid) digs at a terrain segment; 0 outside its radius. Fixed-point builds
+// work in whole 1/(16 * TERRAIN_SEGMENTS) px and round the depth to the
+// terrain's 1/32 px steps, so heights only ever take exact values.
+static double crater_depth_at(int i, double x, double radius, int deformation)
 {
-    for (int i = 0; i < count; i++)
+#ifdef ARTILLERY_FIXED_POINT
+    int64_t dx = (int64_t)i * WORLD_WIDTH * (int64_t)TERRAIN_OP_SUBPIXELS -
+                 (int64_t)(x * TERRAIN_OP_SUBPIXELS) * TERRAIN_SEGMENTS;
+    int64_t r = (int64_t)(radius * TERRAIN_OP_SUBPIXELS) * TERRAIN_SEGMENTS;
+    if (dx <= -r || dx >= r)
+        return 0;
+    int64_t steps = ((int64_t)isqrt64(r * r - dx * dx) * deformation * (int64_t)TERRAIN_HEIGHT_STEPS + r / 2) / r;
+    return steps / TERRAIN_HEIGHT_STEPS;
+#else
+    double dx = (double)i / TERRAIN_SEGMENTS * WORLD_WIDTH - x;
+    if (fabs(dx) >= radius)
+        return 0;
+
+    // Crater shape (semicircle)
+    return sqrt(radius * radius - dx * dx) / radius * deformation;
+#endif
+}
+
+// Function to quantize a terrain height for a map file's 16-bit samples
+static uint16_t quantize_terrain_height(double height)
+{
+    double h = height * TERRAIN_HEIGHT_STEPS;
+    return (uint16_t)(h < 0 ? 0 : h > UINT16_MAX ? UINT16_MAX : lround(h));
+}
+
+// Function to quantize a terrain height for the log's base. Craters can dig
+// far below the world, and no depth is clamped away, so dirt is never lost.
+static int32_t quantize_log_height(double height)
+{
+    double h = height * TERRAIN_HEIGHT_STEPS;
+    return (int32_t)(h < INT32_MIN ? INT32_MIN : h > INT32_MAX ? INT32_MAX : lround(h));
+}
+
+// Function to simplify the outline between two kept segments (Douglas-
+// Peucker): keep the segment furthest from the chord, and split there,
+// until every segment lies within the tolerance of its chord
+static void simplify_outline(TerrainOutline *outline, const double *terrain, int a, int b, double tolerance)
+{
+    int stack[TERRAIN_SEGMENTS][2];
+    int depth = 0;
+    stack[depth][0] = a;
+    stack[depth][1] = b;
+    depth++;
+    while (depth > 0)
     {
-        // Find an inactive particle
-        int part_index = -1;
-        for (int j = 0; j < MAX_PARTICLES; j++)
+        depth--;
+        int lo = stack[depth][0], hi = stack[depth][1];
+        double slope = (terrain[hi] - terrain[lo]) / (hi - lo);
+        double worst = tolerance;
+        int split = -1;
+        for (int i = lo + 1; i < hi; i++)
         {
-            if (!game->particles[j].active)
+            double error = fabs(terrain[i] - (terrain[lo] + slope * (i - lo)));
+            if (error > worst)
             {
-                part_index = j;
-                break;
+                worst = error;
+                split = i;
             }
         }
+        if (split < 0)
+            continue;
+        outline->keep[split] = 1;
+        outline->vertex_count++;
+        stack[depth][0] = lo;
+        stack[depth][1] = split;
+        stack[depth + 1][0] = split;
+        stack[depth + 1][1] = hi;
+        depth += 2;
+    }
+}
 
-        if (part_index == -1)
-            continue; // No available particles
+// Function to bring a simplified outline up to date after segments lo..hi
+// changed. Only the stretch between the kept segments either side is
+// simplified again; a new tolerance rebuilds the whole outline.
+static void update_terrain_outline(TerrainOutline *outline, const double *terrain, int lo, int hi, double tolerance)
+{
+    if (outline->tolerance != tolerance)
+    {
+        outline->tolerance = tolerance;
+        memset(outline->keep, 0, sizeof(outline->keep));
+        outline->keep[0] = outline->keep[TERRAIN_SEGMENTS - 1] = 1;
+        outline->vertex_count = 2;
+        lo = 1;
+        hi = TERRAIN_SEGMENTS - 2;
+    }
+    if (lo < 1)
+        lo = 1;
+    if (hi > TERRAIN_SEGMENTS - 2)
+        hi = TERRAIN_SEGMENTS - 2;
+    if (lo > hi)
+        return;
 
-        // Activate particle
-        Particle *part = &game->particles[part_index];
-        part->active = true;
-        part->x = x;
-        part->y = y;
+    int a = lo - 1, b = hi + 1;
+    while (!outline->keep[a])
+        a--;
+    while (!outline->keep[b])
+        b++;
+    for (int i = a + 1; i < b; i++)
+    {
+        outline->vertex_count -= outline->keep[i];
+        outline->keep[i] = 0;
+    }
+    simplify_outline(outline, terrain, a, b, tolerance);
+}
 
-        // Random velocity in all directions
-        double angle = (rand() % 360) * PI / 180.0;
-        double speed = (rand() % (int)(power * 0.5)) + power * 0.2;
+// Function to rebuild a heightfield from a terrain log
+static void rebuild_terrain(const TerrainLog *log, double *terrain)
+{
+    for (int i = 0; i < TERRAIN_SEGMENTS; i++)
+    {
+        terrain[i] = log->base[i] / TERRAIN_HEIGHT_STEPS;
+    }
+    for (int k = 0; k < log->op_count; k++)
+    {
+        apply_terrain_op(terrain, &log->ops[k]);
+    }
+}
+
+// Function to get the ops an observer has not seen yet, given the base it
+// built on and the sequence number of the next op it expects. Returns -1 if
+// the log has been compacted since, in which case the observer has to start
+// again from the new base.
+static int terrain_log_ops_since(const TerrainLog *log, uint32_t base_seq, uint32_t seq, const TerrainOp **ops)
+{
+    if (base_seq != log->base_seq || seq < log->base_seq || seq > log->base_seq + log->op_count)
+        return -1;
+    *ops = &log->ops[seq - log->base_seq];
+    return log->base_seq + log->op_count - seq;
+}
+
+// Function to bring an observer's copy of the terrain up to date with a log;
+// returns the bytes of log data it needed (a base and/or ops)
+static size_t sync_terrain_observer(TerrainObserver *observer, const TerrainLog *log)
+{
+    size_t bytes = 0;
+    const TerrainOp *ops;
+    int count = observer->synced ? terrain_log_ops_since(log, observer->base_seq, observer->seq, &ops) : -1;
+    if (count < 0)
+    {
+        for (int i = 0; i < TERRAIN_SEGMENTS; i++)
+        {
+            observer->terrain[i] = log->base[i] / TERRAIN_HEIGHT_STEPS;
+        }
+        observer->base_seq = observer->seq = log->base_seq;
+        observer->synced = true;
+        bytes += sizeof(log->base);
+        ops = log->ops;
+        count = log->op_count;
+    }
+    for (int k = 0; k < count; k++)
+    {
+        apply_terrain_op(observer->terrain, &ops[k]);
+    }
+    observer->seq += count;
+    return bytes + count * sizeof(TerrainOp);
+}
+
+// Function to fold the logged ops into a new quantized base. The terrain is
+// snapped to the base (moving it by at most 1/64 px) so it stays exactly
+// reproducible from the log; the segments that moved are marked dirty.
+static void compact_terrain_log(Game *game)
+{
+    TerrainLog *log = &game->terrain_log;
+    int lo = TERRAIN_SEGMENTS, hi = -1;
+    for (int i = 0; i < TERRAIN_SEGMENTS; i++)
+    {
+        log->base[i] = quantize_log_height(game->terrain[i]);
+        double snapped = log->base[i] / TERRAIN_HEIGHT_STEPS;
+        if (snapped != game->terrain[i])
+        {
+            if (i < lo)
+                lo = i;
+            hi = i;
+        }
+        game->terrain[i] = snapped;
+    }
+    if (lo <= hi)
+        mark_terrain_dirty(game, lo, hi);
+    log->base_seq += log->op_count;
+    log->op_count = 0;
+}
+
+// Function to apply all queued craters at once. Each crater is dug over
+// its own segments in queue order, so every segment adds the depths in
+// the order one-by-one application would and the terrain comes out the
+// same bit for bit; the dirty range, the slump wake-up and the tank
+// re-settle are then done once for the union of the craters.
+static void flush_craters(Game *game)
+{
+    CraterBatch *batch = &crater_batch;
+    if (batch->count == 0)
+        return;
+
+    // Dig, counting the craters that start and end at each segment
+    static _Thread_local int coverage[TERRAIN_SEGMENTS + 1];
+    memset(coverage, 0, sizeof(coverage));
+    int dirty_lo = TERRAIN_SEGMENTS, dirty_hi = -1;
+    for (int k = 0; k < batch->count; k++)
+    {
+        // Copied out so the stores to the terrain cannot alias them
+        const CraterOp *op = &batch->ops[k];
+        double x = op->x, radius = op->radius;
+        int deformation = op->deformation;
+        for (int i = op->start_index; i <= op->end_index; i++)
+        {
+            game->terrain[i] += crater_depth_at(i, x, radius, deformation);
+        }
+        if (op->start_index < dirty_lo)
+            dirty_lo = op->start_index;
+        if (op->end_index > dirty_hi)
+            dirty_hi = op->end_index;
+        coverage[op->start_index]++;
+        coverage[op->end_index + 1]--;
+    }
+
+    // One notification for the renderer, the crater walls may slump, and
+    // only the tanks standing on a crater need settling
+    mark_terrain_dirty(game, dirty_lo, dirty_hi);
+    wake_slump_chunks(game, dirty_lo - 1, dirty_hi + 1);
+    for (int i = dirty_lo + 1; i <= dirty_hi; i++)
+    {
+        coverage[i] += coverage[i - 1];
+    }
+    int candidates[MAX_PLAYERS];
+    int candidate_count = query_tanks_in_range(game, dirty_lo * (double)WORLD_WIDTH / TERRAIN_SEGMENTS - TANK_WIDTH,
+                                               (dirty_hi + 1) * (double)WORLD_WIDTH / TERRAIN_SEGMENTS + TANK_WIDTH,
+                                               candidates);
+    for (int c = 0; c < candidate_count; c++)
+    {
+        Tank *tank = &game->players[candidates[c]];
+        int foot_lo = terrain_segment_at((int)(tank->x - TANK_WIDTH / 2));
+        int foot_hi = terrain_segment_at((int)(tank->x + TANK_WIDTH / 2));
+        if (foot_lo < dirty_lo)
+            foot_lo = dirty_lo;
+        if (foot_hi > dirty_hi)
+            foot_hi = dirty_hi;
+        for (int i = foot_lo; i <= foot_hi; i++)
+        {
+            if (coverage[i] > 0)
+            {
+                unsettle_tank(game, candidates[c]);
+                break;
+            }
+        }
+    }
+    batch->count = 0;
+
+    // Keep room in the log for a full batch
+    if (game->terrain_log.op_count > TERRAIN_LOG_CAPACITY - MAX_CRATER_OPS)
+        compact_terrain_log(game);
+}
+
+// Function to run one slumping pass over the segment pairs lo..hi (each
+// segment with its right-hand neighbour): where the ground drops more than
+// the angle of repose allows, dirt flows from the top of the slope to its
+// foot. Dirt moves in whole height steps, so the terrain stays exact and
+// conserved in every build. Returns the steps moved.
+static int slump_segments(double *terrain, int lo, int hi, bool reverse)
+{
+    int moved = 0;
+    for (int k = 0; k <= hi - lo; k++)
+    {
+        int i = reverse ? hi - k : lo + k;
+        if (i + 1 >= TERRAIN_SEGMENTS)
+            continue;
+
+        // Positive drop: the right segment is lower (heights grow downwards)
+        double drop = terrain[i + 1] - terrain[i];
+        double excess = fabs(drop) - SLUMP_MAX_DROP;
+        if (excess <= 0)
+            continue;
+
+        // Half the excess brings the pair back to the angle of repose
+        int steps = (int)(excess * TERRAIN_HEIGHT_STEPS) / 2;
+        if (steps > SLUMP_MAX_FLOW)
+            steps = SLUMP_MAX_FLOW;
+        if (steps == 0)
+            continue;
+        double amount = steps / TERRAIN_HEIGHT_STEPS;
+        terrain[drop > 0 ? i : i + 1] += amount;
+        terrain[drop > 0 ? i + 1 : i] -= amount;
+        moved += steps;
+    }
+    return moved;
+}
+
+// Function to wake the slump chunks covering terrain segments lo..hi
+static void wake_slump_chunks(Game *game, int lo, int hi)
+{
+    int first = lo < 0 ? 0 : lo / SLUMP_CHUNK_SEGMENTS;
+    int last = hi >= TERRAIN_SEGMENTS ? SLUMP_CHUNKS - 1 : hi / SLUMP_CHUNK_SEGMENTS;
+    for (int c = first; c <= last; c++)
+        game->slump_chunks |= 1u << c;
+}
+
+// Function to log a run of slumping passes over segments lo..hi (none if
+// lo > hi). A full log is compacted instead, which keeps them just as well.
+static void log_slump_run(Game *game, int lo, int hi, bool reverse)
+{
+    if (lo > hi)
+        return;
+    TerrainLog *log = &game->terrain_log;
+    if (log->op_count == TERRAIN_LOG_CAPACITY)
+        compact_terrain_log(game);
+    else
+        log->ops[log->op_count++] = (TerrainOp){.kind = TERRAIN_OP_SLUMP, .deformation = reverse, .x = lo, .radius = hi};
+}
+
+// Function to settle a new terrain at the angle of repose, so that only
+// ground a crater disturbs ever slumps
+static void settle_terrain(double *terrain)
+{
+    for (int pass = 0; pass < SLUMP_SETTLE_PASSES; pass++)
+    {
+        if (slump_segments(terrain, 0, TERRAIN_SEGMENTS - 1, pass & 1) == 0)
+            break;
+    }
+}
+
+// Function to let the awake stretches of terrain slump by one pass. A chunk
+// whose pass moved dirt stays awake and wakes its neighbours; one that moved
+// none goes to sleep, so a quiet map costs nothing. Each run of neighbouring
+// awake chunks is logged as one op, and tanks under the landslide are
+// buried by it: they take damage for the dirt piled on them, then dig out
+// onto the new ground.
+static void update_slumps(Game *game)
+{
+    if (game->slump_chunks == 0)
+        return;
+
+    // Sweep in alternate directions so the dirt has no favoured side
+    bool reverse = game->step & 1;
+    uint32_t awake = game->slump_chunks, woken = 0;
+    int run_lo = TERRAIN_SEGMENTS, run_hi = -1; // Segments moved in the current run
+    for (int k = 0; k < SLUMP_CHUNKS; k++)
+    {
+        int c = reverse ? SLUMP_CHUNKS - 1 - k : k;
+        if (!(awake & 1u << c))
+        {
+            log_slump_run(game, run_lo, run_hi, reverse);
+            run_lo = TERRAIN_SEGMENTS;
+            run_hi = -1;
+            continue;
+        }
+        int lo = c * SLUMP_CHUNK_SEGMENTS, hi = lo + SLUMP_CHUNK_SEGMENTS - 1;
+        if (slump_segments(game->terrain, lo, hi, reverse) == 0)
+            continue;
+
+        if (lo < run_lo)
+            run_lo = lo;
+        if (hi > run_hi)
+            run_hi = hi;
+        woken |= 1u << c;
+        if (c > 0)
+            woken |= 1u << (c - 1);
+        if (c + 1 < SLUMP_CHUNKS)
+            woken |= 1u << (c + 1);
+        mark_terrain_dirty(game, lo, hi + 1);
+        metrics_add(METRIC_SLUMP_PASSES, 1);
+
+        // Tanks standing on the chunk
+        int candidates[MAX_PLAYERS];
+        double x_lo = (double)lo * WORLD_WIDTH / TERRAIN_SEGMENTS, x_hi = (double)(hi + 2) * WORLD_WIDTH / TERRAIN_SEGMENTS;
+        int candidate_count = query_tanks_in_range(game, x_lo - TANK_WIDTH / 2, x_hi + TANK_WIDTH / 2, candidates);
+        for (int t = 0; t < candidate_count; t++)
+        {
+            Tank *tank = &game->players[candidates[t]];
+            if (tank->health <= 0 || tank->unsettled || (game->world != NULL && !tank_is_resident(tank)))
+                continue;
+            double buried = tank->y - (get_terrain_height(game, (int)tank->x) - TANK_HEIGHT / 2);
+            if (buried < 0)
+            {
+                unsettle_tank(game, candidates[t]); // Its ground slid away
+            }
+            else if (buried > 0)
+            {
+                tank->health -= (int)(buried * LANDSLIDE_DAMAGE);
+                if (tank->health < 0)
+                    tank->health = 0;
+                unsettle_tank(game, candidates[t]);
+            }
+        }
+    }
+    log_slump_run(game, run_lo, run_hi, reverse);
+    game->slump_chunks = woken;
+}
+
+// Function to record that terrain segments lo..hi changed
+static void mark_terrain_dirty(Game *game, int lo, int hi)
+{
+    if (game->terrain_dirty_lo > game->terrain_dirty_hi)
+    {
+        game->terrain_dirty_lo = lo;
+        game->terrain_dirty_hi = hi;
+        return;
+    }
+    if (lo < game->terrain_dirty_lo)
+        game->terrain_dirty_lo = lo;
+    if (hi > game->terrain_dirty_hi)
+        game->terrain_dirty_hi = hi;
+}
+
+// Function to get a wide-world chunk's current heights
+static const uint16_t *world_chunk_heights(const ChunkedWorld *world, int chunk)
+{
+    return world->scars[chunk] != NULL ? world->scars[chunk] : &world->heights[chunk * WORLD_CHUNK_SEGMENTS];
+}
+
+// Function to get the ground height at a wide-world x coordinate
+static double world_height_at(const ChunkedWorld *world, double world_x)
+{
+    int chunk = (int)floor(world_x / WORLD_CHUNK_WIDTH);
+    if (chunk < 0 || chunk >= world->chunk_count)
+        return WORLD_HEIGHT;
+    int segment = terrain_segment_at((int)(world_x - chunk * WORLD_CHUNK_WIDTH));
+    return world_chunk_heights(world, chunk)[segment] / TERRAIN_HEIGHT_STEPS;
+}
+
+// Function to refresh a chunk's minimap peaks
+static void world_update_overview(ChunkedWorld *world, int chunk)
+{
+    const uint16_t *heights = world_chunk_heights(world, chunk);
+    const int span = WORLD_CHUNK_SEGMENTS / WORLD_OVERVIEW_SAMPLES;
+    for (int s = 0; s < WORLD_OVERVIEW_SAMPLES; s++)
+    {
+        uint16_t peak = UINT16_MAX;
+        for (int i = s * span; i < (s + 1) * span; i++)
+        {
+            if (heights[i] < peak)
+                peak = heights[i];
+        }
+        world->overview[chunk * WORLD_OVERVIEW_SAMPLES + s] = peak / TERRAIN_HEIGHT_STEPS;
+    }
+}
+
+// Function to let the kernel drop the map's pages outside the chunks from
+// first to last (they are clean and get read back in when needed)
+static void world_drop_pages(ChunkedWorld *world, int first, int last)
+{
+#ifndef _WIN32
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (uintptr_t)world->file.data;
+    uintptr_t end = begin + world->file.size;
+    uintptr_t keep_lo = (uintptr_t)&world->heights[first * WORLD_CHUNK_SEGMENTS] & ~(page - 1);
+    uintptr_t keep_hi = ((uintptr_t)&world->heights[(last + 1) * WORLD_CHUNK_SEGMENTS] + page - 1) & ~(page - 1);
+    begin &= ~(page - 1);
+    if (keep_lo > begin)
+        madvise((void *)begin, keep_lo - begin, MADV_DONTNEED);
+    if (end > keep_hi)
+        madvise((void *)keep_hi, end - keep_hi, MADV_DONTNEED);
+#else
+    (void)world;
+    (void)first;
+    (void)last;
+#endif
+}
+
+// Function to open a wide-world map file
+static bool load_world(ChunkedWorld *world, const char *path)
+{
+    memset(world, 0, sizeof(*world));
+    if (!map_file(path, &world->file))
+        return false;
+
+    const WorldHeader *header = (const WorldHeader *)world->file.data;
+    if (world->file.size < sizeof(WorldHeader) || memcmp(header->magic, WORLD_MAGIC, 8) != 0 ||
+        header->chunk_segments != WORLD_CHUNK_SEGMENTS || header->chunk_count < 2 ||
+        header->chunk_count > WORLD_MAX_CHUNKS ||
+        world->file.size < sizeof(WorldHeader) + (size_t)header->chunk_count * WORLD_CHUNK_SEGMENTS * sizeof(uint16_t))
+    {
+        unmap_file(&world->file);
+        return false;
+    }
+    world->heights = (const uint16_t *)(world->file.data + sizeof(WorldHeader));
+    world->chunk_count = header->chunk_count;
+    world->scars = calloc(world->chunk_count, sizeof(uint16_t *));
+    world->overview = malloc(world->chunk_count * WORLD_OVERVIEW_SAMPLES * sizeof(float));
+    if (world->scars == NULL || world->overview == NULL)
+    {
+        free(world->scars);
+        free(world->overview);
+        unmap_file(&world->file);
+        return false;
+    }
+
+    // One pass over the map for the minimap, then let its pages go
+    for (int c = 0; c < world->chunk_count; c++)
+        world_update_overview(world, c);
+    world_drop_pages(world, 0, 0);
+    return true;
+}
+
+// Function to close a wide-world map
+static void free_world(ChunkedWorld *world)
+{
+    for (int c = 0; c < world->chunk_count; c++)
+        free(world->scars[c]);
+    free(world->scars);
+    free(world->overview);
+    unmap_file(&world->file);
+    memset(world, 0, sizeof(*world));
+}
+
+// Function to write a wide-world map of the given number of screens, made of
+// generated screens that blend into one another
+static bool write_world(const char *path, int screens, uint32_t seed)
+{
+    if (screens < 1 || screens * 2 > WORLD_MAX_CHUNKS)
+        return false;
+    WorldHeader header = {.magic = WORLD_MAGIC, .chunk_count = screens * 2, .chunk_segments = WORLD_CHUNK_SEGMENTS};
+    char tmp_path[512];
+    FILE *f = begin_atomic_write(path, tmp_path, sizeof(tmp_path));
+    if (f == NULL)
+        return false;
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+
+    uint32_t rng = seed ? seed : 1;
+    double previous = 0, terrain[TERRAIN_SEGMENTS];
+    for (int s = 0; s < screens && ok; s++)
+    {
+        generate_terrain_into(terrain, &rng);
+
+        // Ease the start of the screen from where the last one ended
+        const int blend = TERRAIN_SEGMENTS / 8;
+        double offset = s > 0 ? previous - terrain[0] : 0;
+        for (int i = 0; i < blend; i++)
+            terrain[i] += offset * (blend - i) / blend;
+        settle_terrain(terrain);
+        uint16_t heights[TERRAIN_SEGMENTS];
+        for (int i = 0; i < TERRAIN_SEGMENTS; i++)
+            heights[i] = quantize_terrain_height(terrain[i]);
+        previous = terrain[TERRAIN_SEGMENTS - 1];
+        ok = fwrite(heights, sizeof(heights), 1, f) == 1;
+    }
+    return finish_atomic_write(f, ok, tmp_path, path);
+}
+
+// Function to get a tank's wide-world x at the start of a match: the tanks
+// stand a chunk apart around the middle of the map, close enough to reach
+static double world_tank_x(const ChunkedWorld *world, int num_players, int i)
+{
+    double world_width = (double)world->chunk_count * WORLD_CHUNK_WIDTH;
+    double spacing = fmin(WORLD_CHUNK_WIDTH, world_width / num_players);
+    return floor((world_width - spacing * (num_players - 1)) / 2 + spacing * i);
+}
+
+// Function to pick the window (first of its two chunks) that shows a
+// wide-world x with room on both sides
+static int world_window_for(const ChunkedWorld *world, double world_x)
+{
+    int chunk = (int)floor(world_x / WORLD_CHUNK_WIDTH - 0.5);
+    if (chunk > world->chunk_count - 2)
+        chunk = world->chunk_count - 2;
+    if (chunk < 0)
+        chunk = 0;
+    return chunk;
+}
+
+// Function to fill the game's terrain from its window's chunks; the result
+// becomes the base of the terrain log
+static void world_load_window(Game *game)
+{
+    for (int h = 0; h < 2; h++)
+    {
+        const uint16_t *heights = world_chunk_heights(game->world, game->world_chunk + h);
+        for (int i = 0; i < WORLD_CHUNK_SEGMENTS; i++)
+            game->terrain[h * WORLD_CHUNK_SEGMENTS + i] = heights[i] / TERRAIN_HEIGHT_STEPS;
+    }
+    compact_terrain_log(game);
+    mark_terrain_dirty(game, 0, TERRAIN_SEGMENTS - 1);
+}
+
+// Function to set up a new match on the game's wide world: the map as it
+// was, with the window on the first tank
+static void world_start_match(Game *game)
+{
+    ChunkedWorld *world = game->world;
+    for (int c = 0; c < world->chunk_count; c++)
+    {
+        if (world->scars[c] != NULL)
+        {
+            free(world->scars[c]);
+            world->scars[c] = NULL;
+            world_update_overview(world, c);
+        }
+    }
+    game->world_chunk = world_window_for(world, world_tank_x(world, game->num_players, 0));
+    world_load_window(game);
+    world_drop_pages(world, game->world_chunk, game->world_chunk + 1);
+}
+
+// Function to keep the craters made in the game's window: a chunk whose
+// heights changed gets (or updates) its own copy
+static void world_store_window(Game *game)
+{
+    ChunkedWorld *world = game->world;
+    for (int h = 0; h < 2; h++)
+    {
+        int chunk = game->world_chunk + h;
+        uint16_t heights[WORLD_CHUNK_SEGMENTS];
+        for (int i = 0; i < WORLD_CHUNK_SEGMENTS; i++)
+            heights[i] = quantize_terrain_height(game->terrain[h * WORLD_CHUNK_SEGMENTS + i]);
+        if (memcmp(heights, world_chunk_heights(world, chunk), sizeof(heights)) == 0)
+            continue;
+
+        if (world->scars[chunk] == NULL)
+            world->scars[chunk] = malloc(sizeof(heights));
+        if (world->scars[chunk] == NULL)
+            continue; // The crater is lost, the map stays as it was
+        memcpy(world->scars[chunk], heights, sizeof(heights));
+        world_update_overview(world, chunk);
+    }
+}
+
+// Function to move the game's window to start at another chunk. Everything
+// in the game shifts with it; tanks outside the window stay where they are
+// in the world and are left alone until it comes back to them.
+static void world_slide(Game *game, int chunk)
+{
+    ChunkedWorld *world = game->world;
+    if (chunk > world->chunk_count - 2)
+        chunk = world->chunk_count - 2;
+    if (chunk < 0)
+        chunk = 0;
+    if (chunk == game->world_chunk)
+        return;
+
+    flush_craters(game);
+    world_store_window(game);
+
+    double shift = (double)(chunk - game->world_chunk) * WORLD_CHUNK_WIDTH;
+    for (int i = 0; i < game->num_players; i++)
+        game->players[i].x -= shift;
+    for (int i = 0; i < MAX_PROJECTILES && game->projectile_free_count < MAX_PROJECTILES; i++)
+    {
+        if (game->projectiles[i].active)
+            game->projectiles[i].x -= PHYS_FROM_DOUBLE(shift);
+    }
+    for (int i = 0; i < MAX_EXPLOSIONS; i++)
+        game->explosions[i].x -= shift;
+    for (int i = 0; i < MAX_PARTICLES; i++)
+        game->particles[i].x -= shift;
+
+    // Settling ground moves with the window
+    int slump_shift = (chunk - game->world_chunk) * (WORLD_CHUNK_SEGMENTS / SLUMP_CHUNK_SEGMENTS);
+    if (abs(slump_shift) >= SLUMP_CHUNKS)
+        game->slump_chunks = 0;
+    else if (slump_shift > 0)
+        game->slump_chunks >>= slump_shift;
+    else
+        game->slump_chunks = (game->slump_chunks << -slump_shift) & ((1ull << SLUMP_CHUNKS) - 1);
+
+    game->world_chunk = chunk;
+    world_load_window(game);
+    world_drop_pages(world, chunk, chunk + 1);
+    rebuild_tank_index(game);
+}
+
+// Function to keep the first shell in flight inside the window, a chunk at
+// a time, so the view follows it across the map
+static void world_follow_shell(Game *game)
+{
+    if (game->projectile_free_count == MAX_PROJECTILES)
+        return;
+    for (int i = 0; i < MAX_PROJECTILES; i++)
+    {
+        if (!game->projectiles[i].active)
+            continue;
+        double x = PHYS_TO_DOUBLE(game->projectiles[i].x);
+        if (x > WORLD_WIDTH * 0.8)
+            world_slide(game, game->world_chunk + 1);
+        else if (x < WORLD_WIDTH * 0.2)
+            world_slide(game, game->world_chunk - 1);
+        return;
+    }
+}
+
+// Function to bring a tank into the window
+static void world_show_tank(Game *game, int index)
+{
+    double world_x = game->players[index].x + (double)game->world_chunk * WORLD_CHUNK_WIDTH;
+    world_slide(game, world_window_for(game->world, world_x));
+}
+
+// Function to check whether a tank is inside the simulated window
+static bool tank_is_resident(const Tank *tank)
+{
+    return tank->x >= 0 && tank->x < WORLD_WIDTH;
+}
+
+// Function to read a heightmap sample, scaled to 0..65535
+static uint32_t heightmap_sample(const unsigned char *data, const MapPackEntry *entry, uint32_t k)
+{
+    const unsigned char *p = data + entry->offset;
+    uint32_t v;
+    if (entry->format == HEIGHTMAP_U8)
+        v = p[k];
+    else if (entry->format == HEIGHTMAP_U16_BE)
+        v = (uint32_t)p[2 * k] << 8 | p[2 * k + 1];
+    else
+        v = p[2 * k] | (uint32_t)p[2 * k + 1] << 8;
+    if (v > entry->max)
+        v = entry->max;
+    return v * 65535u / entry->max;
+}
+
+// Function to find the heightmap in a file that is not a map pack: a PGM
+// (P5) image, whose first row is used, or raw little-endian 16-bit samples
+static bool parse_heightmap(const unsigned char *data, size_t size, MapPackEntry *entry)
+{
+    memset(entry, 0, sizeof(*entry));
+    if (size >= 2 && data[0] == 'P' && data[1] == '5')
+    {
+        // Header: width, height and maxval, separated by whitespace or comments
+        long fields[3];
+        size_t pos = 2;
+        for (int f = 0; f < 3; f++)
+        {
+            while (pos < size && (data[pos] == ' ' || data[pos] == '\t' || data[pos] == '\r' || data[pos] == '\n' ||
+                                  data[pos] == '#'))
+            {
+                if (data[pos] == '#')
+                {
+                    while (pos < size && data[pos] != '\n')
+                        pos++;
+                }
+                else
+                {
+                    pos++;
+                }
+            }
+            fields[f] = 0;
+            if (pos >= size || data[pos] < '0' || data[pos] > '9')
+                return false;
+            while (pos < size && data[pos] >= '0' && data[pos] <= '9' && fields[f] < 1000000)
+                fields[f] = fields[f] * 10 + (data[pos++] - '0');
+        }
+        pos++; // Single whitespace before the samples
+
+        long width = fields[0], maxval = fields[2];
+        int bytes = maxval > 255 ? 2 : 1;
+        if (width < 2 || fields[1] < 1 || maxval < 1 || maxval > 65535 || pos + (size_t)width * bytes > size)
+            return false;
+        entry->offset = pos;
+        entry->width = width;
+        entry->format = bytes == 2 ? HEIGHTMAP_U16_BE : HEIGHTMAP_U8;
+        entry->max = maxval;
+        return true;
+    }
+
+    if (size < 4)
+        return false;
+    entry->offset = 0;
+    entry->width = size / 2;
+    entry->format = HEIGHTMAP_U16_LE;
+    entry->max = 65535;
+    return true;
+}
+
+// Function to open a map pack or a single heightmap
+static bool load_maps(MapSet *maps, const char *path)
+{
+    memset(maps, 0, sizeof(*maps));
+    if (!map_file(path, &maps->file))
+        return false;
+
+    const MapPackHeader *header = (const MapPackHeader *)maps->file.data;
+    if (maps->file.size < sizeof(MapPackHeader) || memcmp(header->magic, MAP_PACK_MAGIC, 8) != 0)
+    {
+        // A lone heightmap
+        if (!parse_heightmap(maps->file.data, maps->file.size, &maps->single))
+        {
+            unmap_file(&maps->file);
+            return false;
+        }
+        maps->entries = &maps->single;
+        maps->map_count = 1;
+        return true;
+    }
+
+    // A pack: check every index entry once, so a round start can trust them
+    size_t index_end = sizeof(MapPackHeader) + (size_t)header->map_count * sizeof(MapPackEntry);
+    bool ok = header->map_count > 0 && header->map_count <= MAP_PACK_MAX_MAPS && index_end <= maps->file.size;
+    const MapPackEntry *entries = (const MapPackEntry *)(maps->file.data + sizeof(MapPackHeader));
+    for (uint32_t m = 0; ok && m < header->map_count; m++)
+    {
+        const MapPackEntry *e = &entries[m];
+        size_t bytes = (size_t)e->width * (e->format == HEIGHTMAP_U8 ? 1 : 2);
+        ok = e->width >= 2 && e->max > 0 && e->format <= HEIGHTMAP_U8 && e->offset <= maps->file.size &&
+             bytes <= maps->file.size - e->offset;
+    }
+    if (!ok)
+    {
+        unmap_file(&maps->file);
+        return false;
+    }
+    maps->entries = entries;
+    maps->map_count = header->map_count;
+    return true;
+}
+
+// Function to close a map set
+static void free_maps(MapSet *maps)
+{
+    unmap_file(&maps->file);
+    memset(maps, 0, sizeof(*maps));
+}
+
+// Function to resample a heightmap into the game's terrain, in integers so
+// every build gets the same heights (already on the terrain log's grid)
+static void load_map_terrain(Game *game, const MapSet *maps, int index)
+{
+    const MapPackEntry *entry = &maps->entries[index];
+    const int64_t span = TERRAIN_SEGMENTS - 1;
+    for (int i = 0; i < TERRAIN_SEGMENTS; i++)
+    {
+        int64_t position = (int64_t)i * (entry->width - 1);
+        uint32_t k = position / span;
+        int64_t frac = position % span;
+        int64_t v = heightmap_sample(maps->file.data, entry, k) * (span - frac);
+        if (frac > 0)
+            v += heightmap_sample(maps->file.data, entry, k + 1) * frac;
+
+        // Sample 0 is as low as generated terrain goes, 65535 as high
+        const int64_t steps_per_px = TERRAIN_HEIGHT_STEPS;
+        int64_t steps = HEIGHTMAP_LOWEST * steps_per_px -
+                        v * (HEIGHTMAP_LOWEST - HEIGHTMAP_HIGHEST) * steps_per_px / (65535 * span);
+        game->terrain[i] = steps / TERRAIN_HEIGHT_STEPS;
+    }
+}
+
+// Function to build a map pack from raw and PGM heightmaps; the samples are
+// stored as little-endian 16-bit values scaled to 0..65535
+static bool write_map_pack(const char *path, char **inputs, int count)
+{
+    if (count < 1 || count > MAP_PACK_MAX_MAPS)
+        return false;
+    MapPackEntry *entries = calloc(count, sizeof(MapPackEntry));
+    MappedFile *files = calloc(count, sizeof(MappedFile));
+    if (entries == NULL || files == NULL)
+    {
+        free(entries);
+        free(files);
+        return false;
+    }
+
+    // Read every input first, so the index can be written up front
+    bool ok = true;
+    MapPackEntry *sources = calloc(count, sizeof(MapPackEntry));
+    uint64_t offset = sizeof(MapPackHeader) + (uint64_t)count * sizeof(MapPackEntry);
+    for (int m = 0; ok && m < count; m++)
+    {
+        ok = sources != NULL && map_file(inputs[m], &files[m]) &&
+             (files[m].size < 8 || memcmp(files[m].data, MAP_PACK_MAGIC, 8) != 0) &&
+             parse_heightmap(files[m].data, files[m].size, &sources[m]);
+        if (!ok)
+        {
+            fprintf(stderr, "Cannot read heightmap %s\n", inputs[m]);
+            break;
+        }
+        entries[m] = (MapPackEntry){.offset = offset, .width = sources[m].width, .format = HEIGHTMAP_U16_LE, .max = 65535};
+        offset += (uint64_t)sources[m].width * 2;
+    }
+
+    char tmp_path[512];
+    FILE *f = ok ? begin_atomic_write(path, tmp_path, sizeof(tmp_path)) : NULL;
+    if (f != NULL)
+    {
+        MapPackHeader header = {.magic = MAP_PACK_MAGIC, .map_count = count};
+        ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(entries, sizeof(MapPackEntry), count, f) == (size_t)count;
+        for (int m = 0; ok && m < count; m++)
+        {
+            for (uint32_t k = 0; ok && k < sources[m].width; k++)
+            {
+                uint32_t v = heightmap_sample(files[m].data, &sources[m], k);
+                unsigned char bytes[2] = {v & 0xff, v >> 8};
+                ok = fwrite(bytes, 2, 1, f) == 1;
+            }
+        }
+        ok = finish_atomic_write(f, ok, tmp_path, path);
+    }
+    else
+    {
+        ok = false;
+    }
+
+    for (int m = 0; m < count; m++)
+    {
+        if (files[m].data != NULL)
+            unmap_file(&files[m]);
+    }
+    free(sources);
+    free(files);
+    free(entries);
+    return ok;
+}
+
+// Function to add a clod's dirt to the deposit buffer, spread over the
+// segments around where it landed (weights 1, 2, 3, 2, 1)
+static void deposit_debris(int segment, int steps)
+{
+    DepositBuffer *deposits = &deposit_buffer;
+    int left = steps;
+    for (int d = -DEBRIS_SPREAD; d <= DEBRIS_SPREAD; d++)
+    {
+        int share = d == DEBRIS_SPREAD ? left : steps * (DEBRIS_SPREAD + 1 - abs(d)) / ((DEBRIS_SPREAD + 1) * (DEBRIS_SPREAD + 1));
+        left -= share;
+        int i = segment + d;
+        i = i < 0 ? 0 : i >= TERRAIN_SEGMENTS ? TERRAIN_SEGMENTS - 1 : i;
+        deposits->steps[i] += share;
+        if (i < deposits->lo)
+            deposits->lo = i;
+        if (i > deposits->hi)
+            deposits->hi = i;
+    }
+}
+
+// Function to throw the dirt a crater dug out back up as clods of debris.
+// Velocities are whole 1/64 px per step, so their flights are exact in every
+// build; dirt with no free particle slot falls straight back in.
+static void create_debris(Game *game, double x, double y, int steps, double power)
+{
+    int clods = steps / DEBRIS_CLOD_STEPS + 1;
+    if (clods > DEBRIS_MAX_CLODS)
+        clods = DEBRIS_MAX_CLODS;
+    int spread = (int)(power * 4) + 1, lift = (int)(power * 12) + 1;
+    int part_index = -1;
+    for (int c = 0; c < clods; c++)
+    {
+        int mass = steps / clods + (c < steps % clods);
+
+        // Free slots are searched for from the last one taken; once there
+        // are none, the rest of the dirt lands straight back in the crater
+        do
+            part_index++;
+        while (part_index < MAX_PARTICLES && game->particles[part_index].active);
+        if (part_index == MAX_PARTICLES)
+        {
+            int rest = steps - (steps / clods) * c - (c < steps % clods ? c : steps % clods);
+            metrics_add(METRIC_PARTICLE_DROPS, clods - c);
+            deposit_debris(terrain_segment_at((int)x), rest);
+            return;
+        }
+        metrics_add(METRIC_PARTICLE_SPAWNS, 1);
+
+        Particle *part = &game->particles[part_index];
+        part->active = true;
+        part->x = x;
+        part->y = y;
+        part->dx = (game_rand(game) % (2 * spread + 1) - spread) / 64.0;
+        part->dy = -((game_rand(game) % lift) + power * 4) / 64.0;
+        part->lifetime = part->max_lifetime = 1;
+        part->size = 3 + mass / DEBRIS_CLOD_STEPS;
+        part->debris = mass;
+    }
+}
+
+// Function to put the step's landed debris onto the terrain in one pass.
+// Each raised segment is logged, and only the deposit's range is marked for
+// redrawing; the new ground may slump, and tanks on it climb onto it.
+static void flush_deposits(Game *game)
+{
+    DepositBuffer *deposits = &deposit_buffer;
+    if (deposits->lo > deposits->hi)
+        return;
+
+    TerrainLog *log = &game->terrain_log;
+    for (int i = deposits->lo; i <= deposits->hi; i++)
+    {
+        // An op holds at most INT16_MAX steps
+        while (deposits->steps[i] > 0)
+        {
+            int steps = deposits->steps[i] > INT16_MAX ? INT16_MAX : deposits->steps[i];
+            deposits->steps[i] -= steps;
+            TerrainOp op = {.kind = TERRAIN_OP_DEPOSIT, .x = i, .y = steps};
+            apply_terrain_op(game->terrain, &op);
+            if (log->op_count == TERRAIN_LOG_CAPACITY)
+                compact_terrain_log(game);
+            else
+                log->ops[log->op_count++] = op;
+        }
+    }
+    mark_terrain_dirty(game, deposits->lo, deposits->hi);
+    wake_slump_chunks(game, deposits->lo - 1, deposits->hi + 1);
+
+    int candidates[MAX_PLAYERS];
+    double x_lo = (double)deposits->lo * WORLD_WIDTH / TERRAIN_SEGMENTS;
+    double x_hi = (double)(deposits->hi + 1) * WORLD_WIDTH / TERRAIN_SEGMENTS;
+    int candidate_count = query_tanks_in_range(game, x_lo - TANK_WIDTH / 2, x_hi + TANK_WIDTH / 2, candidates);
+    for (int c = 0; c < candidate_count; c++)
+        unsettle_tank(game, candidates[c]);
+
+    deposits->lo = TERRAIN_SEGMENTS;
+    deposits->hi = -1;
+}
+
+// Function to create particles
+static void create_particles(Game *game, double x, double y, int count, double power)
+{
+    for (int i = 0; i < count; i++)
+    {
+        // Find an inactive particle
+        int part_index = -1;
+        for (int j = 0; j < MAX_PARTICLES; j++)
+        {
+            if (!game->particles[j].active)
+            {
+                part_index = j;
+                break;
+            }
+        }
+
+        if (part_index == -1)
+        {
+            metrics_add(METRIC_PARTICLE_DROPS, count - i); // No available particles
+            break;
+        }
+        metrics_add(METRIC_PARTICLE_SPAWNS, 1);
+
+        // Activate particle
+        Particle *part = &game->particles[part_index];
+        part->active = true;
+        part->x = x;
+        part->y = y;
+
+        // Random velocity in all directions. Particles never touch the
+        // outcome, but the slots they hold decide how many get drawn from
+        // the game's generator, so fixed-point builds use the sine table.
+#ifdef ARTILLERY_FIXED_POINT
+        uint32_t angle = fx_angle_tenths(game_rand(game) % 360 * 10);
+        double speed = (game_rand(game) % (int)(power * 0.5)) + power * 0.2;
+
+        part->dx = PHYS_TO_DOUBLE(fx_cos(angle)) * speed;
+        part->dy = PHYS_TO_DOUBLE(fx_sin(angle)) * speed;
+#else
+        double angle = (game_rand(game) % 360) * PI / 180.0;
+        double speed = (game_rand(game) % (int)(power * 0.5)) + power * 0.2;
+
+        part->dx = cos(angle) * speed;
+        part->dy = sin(angle) * speed;
+#endif
+
+        // Random lifetime and size
+        part->lifetime = (game_rand(game) % 30) + 20;
+        part->max_lifetime = part->lifetime;
+        part->size = (game_rand(game) % 3) + 2;
+        part->debris = 0;
+    }
+}
+
+// Function to reset the game
+static void reset_game(Game *game)
+{
+    // Reset scores but keep other player info
+    int scores[MAX_PLAYERS];
+    for (int i = 0; i < game->num_players; i++)
+    {
+        scores[i] = game->players[i].score;
+    }
+
+    init_game(game);
+
+    // Restore scores
+    for (int i = 0; i < game->num_players; i++)
+    {
+        game->players[i].score = scores[i];
+    }
+}
+
+// Function to get the broadphase grid cell of a point (clamped to the grid)
+static int grid_cell_coord(double v, int cells)
+{
+    int c = (int)(v / GRID_CELL_SIZE);
+    if (c < 0)
+        c = 0;
+    if (c >= cells)
+        c = cells - 1;
+    return c;
+}
+
+// Function to bin the active projectiles into the broadphase grid (counting sort)
+static void build_projectile_grid(Game *game)
+{
+    ProjectileGrid *grid = &projectile_grid;
+    int cell_count = GRID_COLS * GRID_ROWS;
+
+    memset(grid->cell_start, 0, sizeof(grid->cell_start));
+    for (int i = 0; i < MAX_PROJECTILES; i++)
+    {
+        if (!game->projectiles[i].active)
+        {
+            grid->cell_of[i] = -1;
+            continue;
+        }
+
+        Projectile *proj = &game->projectiles[i];
+        int cell = grid_cell_coord(PHYS_TO_DOUBLE(proj->y), GRID_ROWS) * GRID_COLS +
+                   grid_cell_coord(PHYS_TO_DOUBLE(proj->x), GRID_COLS);
+        grid->cell_of[i] = cell;
+        grid->cell_start[cell + 1]++;
+    }
+
+    for (int c = 0; c < cell_count; c++)
+    {
+        grid->cell_start[c + 1] += grid->cell_start[c];
+    }
+    grid->item_count = grid->cell_start[cell_count];
+
+    memcpy(grid->cell_end, grid->cell_start, sizeof(grid->cell_end));
+    for (int i = 0; i < MAX_PROJECTILES; i++)
+    {
+        if (grid->cell_of[i] >= 0)
+        {
+            int k = grid->cell_end[grid->cell_of[i]]++;
+            grid->items[k] = i;
+            grid->item_x[k] = (grid_coord_t)game->projectiles[i].x;
+            grid->item_y[k] = (grid_coord_t)game->projectiles[i].y;
+        }
+    }
+}
+
+// Function to drop entry k from a grid cell by swapping in the cell's last entry
+static void remove_from_cell(ProjectileGrid *grid, int cell, int k)
+{
+    int last = --grid->cell_end[cell];
+    grid->items[k] = grid->items[last];
+    grid->item_x[k] = grid->item_x[last];
+    grid->item_y[k] = grid->item_y[last];
+}
+
+// Function to tell whether an offset from a blast lies inside its radius
+static bool within_radius(phys_t dx, phys_t dy, phys_t radius)
+{
+#ifdef ARTILLERY_FIXED_POINT
+    return (int64_t)dx * dx + (int64_t)dy * dy < (int64_t)radius * radius;
+#else
+    return dx * dx + dy * dy < radius * radius;
+#endif
+}
+
+// Function to handle projectile interactions through the broadphase grid:
+// projectiles hitting a tank explode on contact, and blasts set off armed
+// bomblets within their radius, which may in turn set off their neighbours
+static void update_projectile_interactions(Game *game)
+{
+    ProjectileGrid *grid = &projectile_grid;
+    if (game->projectile_free_count == MAX_PROJECTILES)
+        return;
+
+    build_projectile_grid(game);
+
+    // Projectile vs tank: only the cells covered by each tank are visited
+    for (int t = 0; t < game->num_players; t++)
+    {
+        Tank *tank = &game->players[t];
+        if (tank->health <= 0)
+            continue;
+
+        phys_t left = PHYS_FROM_DOUBLE(tank->x - TANK_WIDTH / 2), right = PHYS_FROM_DOUBLE(tank->x + TANK_WIDTH / 2);
+        phys_t top = PHYS_FROM_DOUBLE(tank->y - TANK_HEIGHT / 2), bottom = PHYS_FROM_DOUBLE(tank->y + TANK_HEIGHT / 2);
+        for (int cy = grid_cell_coord(PHYS_TO_DOUBLE(top), GRID_ROWS); cy <= grid_cell_coord(PHYS_TO_DOUBLE(bottom), GRID_ROWS); cy++)
+        {
+            for (int cx = grid_cell_coord(PHYS_TO_DOUBLE(left), GRID_COLS); cx <= grid_cell_coord(PHYS_TO_DOUBLE(right), GRID_COLS); cx++)
+            {
+                int cell = cy * GRID_COLS + cx;
+                int k = grid->cell_start[cell];
+                while (k < grid->cell_end[cell])
+                {
+                    if (grid->item_x[k] < left || grid->item_x[k] > right || grid->item_y[k] < top || grid->item_y[k] > bottom)
+                    {
+                        k++;
+                        continue;
+                    }
+
+                    // Slots freed or reused since the grid was built are dropped from the cell
+                    int i = grid->items[k];
+                    if (game->projectiles[i].active && grid->cell_of[i] >= 0)
+                        detonate_projectile(game, i);
+                    remove_from_cell(grid, cell, k);
+                }
+            }
+        }
+    }
+
+    // Projectile vs projectile: only armed bomblets can be set off, so the
+    // rest are dropped from the cells before any blast is checked against them
+    if (grid->detonation_count == 0)
+        return;
+    for (int cell = 0; cell < GRID_COLS * GRID_ROWS; cell++)
+    {
+        int kept = grid->cell_start[cell];
+        for (int k = grid->cell_start[cell]; k < grid->cell_end[cell]; k++)
+        {
+            const Projectile *proj = &game->projectiles[grid->items[k]];
+            if (!proj->active || grid->cell_of[grid->items[k]] < 0 ||
+                !game->weapon_properties[proj->weapon_type].sympathetic_detonation || proj->stage != 0 ||
+                proj->travel_distance < FUSE_ARM_DISTANCE)
+                continue;
+            grid->items[kept] = grid->items[k];
+            grid->item_x[kept] = grid->item_x[k];
+            grid->item_y[kept] = grid->item_y[k];
+            kept++;
+        }
+        grid->cell_end[cell] = kept;
+    }
+
+    // Work through this step's blasts, appending the ones they set off,
+    // until the chain reaction dies out
+    for (int d = 0; d < grid->detonation_count; d++)
+    {
+        phys_t x = grid->detonation_x[d];
+        phys_t y = grid->detonation_y[d];
+        phys_t radius = grid->detonation_radius[d];
+        int row_lo = grid_cell_coord(PHYS_TO_DOUBLE(y - radius), GRID_ROWS);
+        int row_hi = grid_cell_coord(PHYS_TO_DOUBLE(y + radius), GRID_ROWS);
+        int col_lo = grid_cell_coord(PHYS_TO_DOUBLE(x - radius), GRID_COLS);
+        int col_hi = grid_cell_coord(PHYS_TO_DOUBLE(x + radius), GRID_COLS);
+
+        for (int cy = row_lo; cy <= row_hi; cy++)
+        {
+            for (int cx = col_lo; cx <= col_hi; cx++)
+            {
+                int cell = cy * GRID_COLS + cx;
+                int k = grid->cell_start[cell];
+                while (k < grid->cell_end[cell])
+                {
+                    if (!within_radius(grid->item_x[k] - x, grid->item_y[k] - y, radius))
+                    {
+                        k++;
+                        continue;
+                    }
+
+                    // Slots freed or reused since the grid was built are dropped from the cell
+                    int i = grid->items[k];
+                    if (game->projectiles[i].active && grid->cell_of[i] >= 0)
+                        detonate_projectile(game, i);
+                    remove_from_cell(grid, cell, k);
+                }
+            }
+        }
+    }
+}
+
+// Function to get the wind's push on a projectile per step (in fixed-point
+// builds from the wind in thousandths, which is what the wind is made of)
+static phys_t wind_push(double wind)
+{
+#ifdef ARTILLERY_FIXED_POINT
+    return (phys_t)(lround(wind * 1000) * FX_ONE / 4000);
+#else
+    return wind * 0.25;
+#endif
+}
+
+// Function to rebuild the wind field from the turn's wind: stronger aloft,
+// weaker in the lee of high ground, with a gust blowing across. Integer
+// math on the (quantized) terrain, so every build gets the same field.
+static void update_wind_field(Game *game)
+{
+    WindField *field = &game->wind_field;
+    int32_t base = lround(game->wind * 1000);
+    int upwind = base > 0 ? -1 : 1;
+
+    // The gust crosses the world downwind; how strong it is depends on the turn
+    const int gust_span = WORLD_WIDTH + 2 * WIND_GUST_WIDTH;
+    int gust_x = (int)(game->step * WIND_GUST_SPEED % gust_span) - WIND_GUST_WIDTH;
+    if (base < 0)
+        gust_x = WORLD_WIDTH - gust_x;
+    int gust_pct = WIND_GUST_MIN_PCT + ((uint32_t)game->turn * 2654435761u >> 24) % (WIND_GUST_MAX_PCT - WIND_GUST_MIN_PCT + 1);
+
+    for (int c = 0; c < WIND_FIELD_COLS; c++)
+    {
+        int x = c * WIND_FIELD_SPACING;
+
+        // Highest ground upwind of this column, within reach of shielding it
+        double ridge = WORLD_HEIGHT;
+        for (int d = 0; d <= WIND_SHIELD_REACH; d += WIND_SHIELD_STRIDE)
+        {
+            int ground_x = x + upwind * d;
+            if (ground_x >= 0 && ground_x < WORLD_WIDTH)
+                ridge = fmin(ridge, game->terrain[terrain_segment_at(ground_x)]);
+        }
+
+        int gust_distance = abs(x - gust_x);
+        for (int r = 0; r < WIND_FIELD_ROWS; r++)
+        {
+            int y = r * WIND_FIELD_SPACING;
+            int pct = WIND_GROUND_PCT + (WIND_ALOFT_PCT - WIND_GROUND_PCT) * (WIND_FIELD_ROWS - 1 - r) / (WIND_FIELD_ROWS - 1);
+            if (gust_distance < WIND_GUST_WIDTH)
+                pct += pct * gust_pct * (WIND_GUST_WIDTH - gust_distance) / (WIND_GUST_WIDTH * 100);
+            if (y > ridge)
+                pct = pct * WIND_SHIELD_PCT / 100;
+            else if (y > ridge - WIND_LEE_HEIGHT)
+                pct = pct * WIND_LEE_PCT / 100;
+
+            int node = r * WIND_FIELD_COLS + c;
+            field->milli[node] = base * pct / 100;
+            field->push[node] = wind_push(field->milli[node] / 1000.0);
+            field->particle_push[node] = field->milli[node] * PARTICLE_WIND_PUSH;
+        }
+    }
+
+    for (int r = 0; r < WIND_FIELD_ROWS - 1; r++)
+    {
+        for (int c = 0; c < WIND_FIELD_COLS - 1; c++)
+        {
+            const phys_t *p = field->push + r * WIND_FIELD_COLS + c;
+            phys_t *cell = field->cell[r * (WIND_FIELD_COLS - 1) + c];
+            cell[0] = p[0];
+            cell[1] = p[1] - p[0];
+            cell[2] = p[WIND_FIELD_COLS] - p[0];
+            cell[3] = p[WIND_FIELD_COLS + 1] - p[WIND_FIELD_COLS] - p[1] + p[0];
+        }
+    }
+}
+
+// Function to get a wind field node's cell and the weight of the next
+// node along one axis, for a coordinate in world units
+static inline int wind_cell(double v, int nodes, double *frac)
+{
+    double g = v * (1.0 / WIND_FIELD_SPACING);
+    g = g < 0 ? 0 : g;
+    g = g > nodes - 1 ? nodes - 1 : g;
+    int cell = (int)g;
+    cell = cell > nodes - 2 ? nodes - 2 : cell;
+    *frac = g - cell;
+    return cell;
+}
+
+// Function to sample the wind's push on a batch of particles
+static void sample_particle_wind(const WindField *field, const double *xs, const double *ys, double *out, int count)
+{
+    const double *push = field->particle_push;
+    for (int n = 0; n < count; n++)
+    {
+        double fx, fy;
+        int cx = wind_cell(xs[n], WIND_FIELD_COLS, &fx);
+        int cy = wind_cell(ys[n], WIND_FIELD_ROWS, &fy);
+        const double *p = push + cy * WIND_FIELD_COLS + cx;
+        double top = p[0] + (p[1] - p[0]) * fx;
+        double bottom = p[WIND_FIELD_COLS] + (p[WIND_FIELD_COLS + 1] - p[WIND_FIELD_COLS]) * fx;
+        out[n] = top + (bottom - top) * fy;
+    }
+}
+
+// Function to sample the wind's push on a batch of projectiles (in
+// fixed-point builds with integer weights, so every build agrees)
+static void sample_wind_push(const WindField *field, const phys_t *xs, const phys_t *ys, phys_t *out, int count)
+{
+#ifdef ARTILLERY_FIXED_POINT
+    for (int n = 0; n < count; n++)
+    {
+        // Grid coordinates in Q16.16
+        int32_t gx = xs[n] / WIND_FIELD_SPACING, gy = ys[n] / WIND_FIELD_SPACING;
+        gx = gx < 0 ? 0 : gx;
+        gx = gx > (WIND_FIELD_COLS - 1) * FX_ONE ? (WIND_FIELD_COLS - 1) * FX_ONE : gx;
+        gy = gy < 0 ? 0 : gy;
+        gy = gy > (WIND_FIELD_ROWS - 1) * FX_ONE ? (WIND_FIELD_ROWS - 1) * FX_ONE : gy;
+        int cx = gx / FX_ONE, cy = gy / FX_ONE;
+        cx = cx > WIND_FIELD_COLS - 2 ? WIND_FIELD_COLS - 2 : cx;
+        cy = cy > WIND_FIELD_ROWS - 2 ? WIND_FIELD_ROWS - 2 : cy;
+        int64_t fx = gx - cx * FX_ONE, fy = gy - cy * FX_ONE;
+
+        const phys_t *cell = field->cell[cy * (WIND_FIELD_COLS - 1) + cx];
+        int64_t v = ((int64_t)cell[0] * FX_ONE + cell[1] * fx + cell[2] * fy) * FX_ONE + cell[3] * fx * fy;
+        out[n] = (phys_t)(v / ((int64_t)FX_ONE * FX_ONE));
+    }
+#else
+    for (int n = 0; n < count; n++)
+    {
+        double fx, fy;
+        int cx = wind_cell(xs[n], WIND_FIELD_COLS, &fx);
+        int cy = wind_cell(ys[n], WIND_FIELD_ROWS, &fy);
+        const double *cell = field->cell[cy * (WIND_FIELD_COLS - 1) + cx];
+        out[n] = cell[0] + cell[1] * fx + (cell[2] + cell[3] * fx) * fy;
+    }
+#endif
+}
+
+#ifndef ARTILLERY_HEADLESS
+// Function to get the wind at a point, as the HUD shows it
+static double wind_at(const Game *game, double x, double y)
+{
+    const int32_t *milli = game->wind_field.milli;
+    double fx, fy;
+    int cx = wind_cell(x, WIND_FIELD_COLS, &fx);
+    int cy = wind_cell(y, WIND_FIELD_ROWS, &fy);
+    const int32_t *p = milli + cy * WIND_FIELD_COLS + cx;
+    double top = p[0] + (p[1] - p[0]) * fx;
+    double bottom = p[WIND_FIELD_COLS] + (p[WIND_FIELD_COLS + 1] - p[WIND_FIELD_COLS]) * fx;
+    return (top + (bottom - top) * fy) / 1000.0;
+}
+#endif
+
+// Function to get the length of a projectile's step
+static phys_t phys_length(phys_t dx, phys_t dy)
+{
+#ifdef ARTILLERY_FIXED_POINT
+    return fx_length(dx, dy);
+#else
+    return sqrt(dx * dx + dy * dy);
+#endif
+}
+
+// Function to slow a velocity component down while drilling
+static phys_t drill_slowdown(phys_t v)
+{
+#ifdef ARTILLERY_FIXED_POINT
+    return v * 4 / 5;
+#else
+    return v * 0.8;
+#endif
+}
+
+// Function to update game state
+static void update_game(Game *game)
+{
+    if (game->game_paused)
+        return;
+
+    game->step++;
+    game->frame_count++;
+    double step_start = now_ms();
+
+    // A wide world's window follows the shell in flight
+    if (game->world != NULL)
+        world_follow_shell(game);
+
+    update_wind_field(game);
+
+    // Gather the projectiles in flight and sample the wind for all of them
+    WindBatch *batch = &wind_batch;
+    int flying = 0;
+    for (int i = 0; i < MAX_PROJECTILES && flying < MAX_PROJECTILES - game->projectile_free_count; i++)
+    {
+        if (game->projectiles[i].active)
+        {
+            batch->index[flying] = i;
+            batch->x[flying] = game->projectiles[i].x;
+            batch->y[flying] = game->projectiles[i].y;
+            flying++;
+        }
+    }
+    sample_wind_push(&game->wind_field, batch->x, batch->y, batch->push, flying);
+
+    // Update projectiles; shells split off this step start moving on the next
+    projectile_grid.detonation_count = 0;
+    for (int n = 0; n < flying; n++)
+    {
+        int i = batch->index[n];
+        if (game->projectiles[i].active)
+        {
+            Projectile *proj = &game->projectiles[i];
+
+            // Apply wind and gravity
+            proj->dx += batch->push[n];
+            proj->dy += PHYS_GRAVITY;
+
+            // Update position
+            proj->x += proj->dx;
+            proj->y += proj->dy;
+
+            // Track distance traveled
+            proj->travel_distance += phys_length(proj->dx, proj->dy);
+
+            // Airburst weapons split on the way down, before reaching the ground
+            WeaponProperty *wp = &game->weapon_properties[proj->weapon_type];
+            if (wp->airburst && proj->sub_projectiles > 0 && proj->dy > 0 &&
+                proj->travel_distance > PHYS_FROM_DOUBLE(AIRBURST_DISTANCE))
+            {
+                Projectile shell = *proj;
+                release_projectile(game, i);
+                spawn_cluster_bombs(game, &shell);
+                continue;
+            }
+
+            // Check for terrain collision
+            if (PHYS_TO_DOUBLE(proj->y) >= get_terrain_height(game, PHYS_TO_INT(proj->x)))
+            {
+                // Handle drill weapons differently
+                double drill_capability = wp->drill_capability;
+
+                if (drill_capability > 0 && proj->travel_distance < PHYS_FROM_DOUBLE(100))
+                {
+                    // Drill through terrain
+                    proj->dx = drill_slowdown(proj->dx);
+                    proj->dy = drill_slowdown(proj->dy);
+                }
+                else
+                {
+                    // Explosion (also handles cluster bombs)
+                    detonate_projectile(game, i);
+                    continue;
+                }
+            }
+
+            // Check if out of bounds
+            if (proj->x < 0 || proj->x > PHYS_FROM_DOUBLE(WORLD_WIDTH) || proj->y > PHYS_FROM_DOUBLE(WORLD_HEIGHT))
+            {
+                release_projectile(game, i);
+            }
+        }
+    }
+
+    // Direct hits on tanks and mid-air chain detonations
+    update_projectile_interactions(game);
+
+    // Apply this step's craters in one pass, let steep ground slump, then
+    // let loosened tanks fall
+    flush_craters(game);
+    update_slumps(game);
+    update_tanks(game);
+
+    // Update explosions
+    bool all_explosions_done = true;
+    int live_explosions = 0, live_particles = 0;
+    for (int i = 0; i < MAX_EXPLOSIONS; i++)
+    {
+        if (game->explosions[i].active)
+        {
+            Explosion *exp = &game->explosions[i];
+            live_explosions++;
+
+            // Grow explosion
+            exp->radius += exp->growth_rate;
+
+            // Check if explosion is done
+            if (exp->radius >= exp->max_radius)
+            {
+                exp->active = false;
+            }
+            else
+            {
+                all_explosions_done = false;
+            }
+        }
+    }
+
+    // Update particles, sampling the wind for all of them first
+    for (int i = 0; i < MAX_PARTICLES; i++)
+    {
+        if (game->particles[i].active)
+        {
+            batch->particle_index[live_particles] = i;
+            batch->particle_x[live_particles] = game->particles[i].x;
+            batch->particle_y[live_particles] = game->particles[i].y;
+            live_particles++;
+        }
+    }
+    sample_particle_wind(&game->wind_field, batch->particle_x, batch->particle_y, batch->particle_push, live_particles);
+    for (int n = 0; n < live_particles; n++)
+    {
+        Particle *part = &game->particles[batch->particle_index[n]];
+
+        // Debris: too heavy for the wind, and its dirt stays where it lands
+        if (part->debris > 0)
+        {
+            part->dy += DEBRIS_GRAVITY;
+            part->x += part->dx;
+            part->y += part->dy;
+            if (part->x < 0 || part->x >= WORLD_WIDTH)
+                part->active = false; // Thrown off the map
+            else if (part->y >= get_terrain_height(game, (int)part->x))
+            {
+                deposit_debris(terrain_segment_at((int)part->x), part->debris);
+                part->active = false;
+            }
+            continue;
+        }
+
+        // Apply wind and gravity
+        part->dx += batch->particle_push[n];
+        part->dy += GRAVITY * 0.1;
+
+        // Update position
+        part->x += part->dx;
+        part->y += part->dy;
+
+        // Check for terrain collision
+        if (part->y >= get_terrain_height(game, (int)part->x))
+        {
+            part->dy *= -0.5; // Bounce
+            part->dx *= 0.8;  // Friction
+            part->y = get_terrain_height(game, (int)part->x) - 1;
+        }
+
+        // Decrease lifetime
+        part->lifetime--;
+
+        // Check if particle is done
+        if (part->lifetime <= 0 || part->x < 0 || part->x > WORLD_WIDTH || part->y > WORLD_HEIGHT)
+        {
+            part->active = false;
+        }
+    }
+    flush_deposits(game);
+
+    // Check if all projectiles and explosions are done
+    bool all_projectiles_done = (game->projectile_free_count == MAX_PROJECTILES);
+
+    metrics_add(METRIC_STEPS, 1);
+    metrics_peak(METRIC_PEAK_PROJECTILES, MAX_PROJECTILES - game->projectile_free_count);
+    metrics_peak(METRIC_PEAK_PARTICLES, live_particles);
+    metrics_peak(METRIC_PEAK_EXPLOSIONS, live_explosions);
+
+    // State transitions
+    if ((game->state == STATE_FIRING || game->state == STATE_EXPLOSION) && all_projectiles_done && all_explosions_done &&
+        game->unsettled_tanks == 0)
+    {
+        // Check if game is over (one team or nobody left standing)
+        int last_team;
+        if (count_alive_teams(game, &last_team) <= 1)
+        {
+            game->state = STATE_GAME_OVER;
+            game->winning_team = last_team;
+
+            // Award score to every tank on the winning team
+            for (int i = 0; i < game->num_players; i++)
+            {
+                if (game->players[i].team == last_team)
+                    game->players[i].score++;
+            }
+
+            telemetry_emit(&(TelemetryEvent){.kind = TELEMETRY_ROUND, .step = game->step, .value = last_team});
+        }
+        else
+        {
+            // Switch to the next tank that is still alive, bringing it into view on a wide world
+            game->current_player = next_alive_player(game);
+            game->state = STATE_AIMING;
+            game->turn++;
+            game->players[game->current_player].last_turn = game->turn;
+            if (game->world != NULL)
+                world_show_tank(game, game->current_player);
+
+            // Fold a long terrain log into a new base
+            if (game->terrain_log.op_count >= TERRAIN_COMPACT_OPS)
+                compact_terrain_log(game);
+
+            // Reset moves for the new player's turn
+            game->players[game->current_player].moves_left = 3;
+
+            // Generate new random wind
+            double wind_magnitude = (0.02 + (game_rand(game) % 31) / 1000.0);
+            int direction = (game_rand(game) % 2) * 2 - 1;
+            game->wind = wind_magnitude * direction;
+
+            // Ensure wind is never exactly zero
+            if (fabs(game->wind) < 0.02)
+            {
+                game->wind = (game->wind >= 0) ? 0.02 : -0.02;
+            }
+
+            // Update wind display
+            update_wind_field(game);
+            update_wind_display(game);
+
+            telemetry_emit(&(TelemetryEvent){.kind = TELEMETRY_TURN,
+                                             .step = game->step,
+                                             .player = game->current_player,
+                                             .value = game->turn,
+                                             .c = game->wind});
+        }
+    }
+
+    metrics_time(&metrics_thread_block()->step_time, now_ms() - step_start);
+}
+
+// Add this new function implementation after update_game
+static void update_wind_display(Game *game)
+{
+    (void)game; // The wind is drawn from the game state; this only asks for a redraw
+
+#ifndef ARTILLERY_HEADLESS
+    // Force immediate redraw
+    if (window != NULL)
+    {
+        gtk_widget_queue_draw(window);
+    }
+#endif
+}
+
+#ifdef __linux__
+static pthread_key_t telemetry_key;
+static pthread_once_t telemetry_key_once = PTHREAD_ONCE_INIT;
+
+// Function run as a thread with a telemetry ring exits: hand the ring back.
+// Events still in it are drained as usual.
+static void telemetry_detach(void *ring)
+{
+    atomic_store_explicit(&((TelemetryRing *)ring)->claimed, false, memory_order_release);
+}
+
+// Function to create the key whose destructor hands rings back
+static void telemetry_make_key(void)
+{
+    pthread_key_create(&telemetry_key, telemetry_detach);
+}
+#endif
+
+// Function to give the calling thread its telemetry ring on its first event:
+// one handed back by an exited thread, else a new one
+static TelemetryRing *telemetry_attach(void)
+{
+    TelemetryRing *ring = NULL;
+    int count = atomic_load(&telemetry.ring_count);
+    for (int r = 0; r < count && r < TELEMETRY_MAX_RINGS && ring == NULL; r++)
+    {
+        TelemetryRing *free_ring = atomic_load_explicit(&telemetry.rings[r], memory_order_acquire);
+        bool claimed = false;
+        if (free_ring != NULL && atomic_compare_exchange_strong(&free_ring->claimed, &claimed, true))
+            ring = free_ring;
+    }
+    if (ring == NULL)
+    {
+        // Take the next unused ring slot, if any are left; the count never
+        // goes past TELEMETRY_MAX_RINGS, however often threads come asking
+        int index = count;
+        while (index < TELEMETRY_MAX_RINGS &&
+               !atomic_compare_exchange_weak(&telemetry.ring_count, &index, index + 1))
+            ;
+        ring = index < TELEMETRY_MAX_RINGS ? calloc(1, sizeof(TelemetryRing)) : NULL;
+        if (ring == NULL)
+            return NULL;
+        atomic_store(&ring->claimed, true);
+        atomic_store_explicit(&telemetry.rings[index], ring, memory_order_release);
+    }
+#ifdef __linux__
+    pthread_once(&telemetry_key_once, telemetry_make_key);
+    pthread_setspecific(telemetry_key, ring);
+#endif
+    return ring;
+}
+
+// Function to log a telemetry event without ever waiting: when the ring is
+// full the event is counted as dropped instead
+static void telemetry_emit(const TelemetryEvent *event)
+{
+    if (!atomic_load_explicit(&telemetry.enabled, memory_order_relaxed))
+        return;
+
+    if (telemetry_ring == NULL)
+    {
+        telemetry_ring = telemetry_attach();
+        if (telemetry_ring == NULL)
+        {
+            atomic_fetch_add_explicit(&telemetry.unringed, 1, memory_order_relaxed);
+            return;
+        }
+    }
+
+    TelemetryRing *ring = telemetry_ring;
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= TELEMETRY_RING_SIZE)
+    {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    ring->events[head & (TELEMETRY_RING_SIZE - 1)] = *event;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// Function to get the events dropped so far
+static unsigned long long telemetry_dropped(void)
+{
+    unsigned long long dropped = atomic_load(&telemetry.unringed);
+    int count = atomic_load(&telemetry.ring_count);
+    for (int r = 0; r < count && r < TELEMETRY_MAX_RINGS; r++)
+    {
+        TelemetryRing *ring = atomic_load_explicit(&telemetry.rings[r], memory_order_acquire);
+        if (ring != NULL)
+            dropped += atomic_load(&ring->dropped);
+    }
+    return dropped;
+}
+
+// Function to write a telemetry event as one NDJSON line
+static void telemetry_write(FILE *f, const TelemetryEvent *event)
+{
+    switch (event->kind)
+    {
+    case TELEMETRY_SHOT:
+        fprintf(f, "{\"step\":%u,\"event\":\"shot\",\"player\":%d,\"weapon\":%d,\"angle\":%g,\"power\":%g,\"wind\":%.3f,\"shells\":%d}\n",
+                event->step, event->player, event->weapon, event->a, event->b, event->c, event->value);
+        break;
+    case TELEMETRY_IMPACT:
+        fprintf(f, "{\"step\":%u,\"event\":\"impact\",\"x\":%.1f,\"y\":%.1f,\"radius\":%g,\"damage\":%d}\n", event->step,
+                event->a, event->b, event->c, event->value);
+        break;
+    case TELEMETRY_DAMAGE:
+        fprintf(f, "{\"step\":%u,\"event\":\"damage\",\"player\":%d,\"damage\":%d,\"health\":%g}\n", event->step,
+                event->player, event->value, event->a);
+        break;
+    case TELEMETRY_TURN:
+        fprintf(f, "{\"step\":%u,\"event\":\"turn\",\"player\":%d,\"turn\":%d,\"wind\":%.3f}\n", event->step,
+                event->player, event->value, event->c);
+        break;
+    case TELEMETRY_ROUND:
+        fprintf(f, "{\"step\":%u,\"event\":\"round\",\"winning_team\":%d}\n", event->step, event->value);
+        break;
+    case TELEMETRY_DROPPED:
+        fprintf(f, "{\"event\":\"dropped\",\"total\":%d}\n", event->value);
+        break;
+    }
+}
+
+// Function to log a telemetry event in the file's format
+static void telemetry_record(const TelemetryEvent *event)
+{
+    if (telemetry.ndjson)
+        telemetry_write(telemetry.file, event);
+    else
+        fwrite(event, sizeof(TelemetryEvent), 1, telemetry.file);
+}
+
+// Function to move every pending event from the rings to the log file
+static void telemetry_drain(void)
+{
+    int count = atomic_load(&telemetry.ring_count);
+    for (int r = 0; r < count && r < TELEMETRY_MAX_RINGS; r++)
+    {
+        TelemetryRing *ring = atomic_load_explicit(&telemetry.rings[r], memory_order_acquire);
+        if (ring == NULL)
+            continue;
+
+        unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        for (; tail != head; tail++)
+        {
+            telemetry_record(&ring->events[tail & (TELEMETRY_RING_SIZE - 1)]);
+            telemetry.written++;
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+}
+
+#ifdef __linux__
+// Function run by the telemetry thread: drain the rings every few
+// milliseconds, noting new drops as they happen
+static void *telemetry_thread(void *arg)
+{
+    (void)arg;
+    unsigned long long reported = 0;
+    const struct timespec pause = {0, TELEMETRY_DRAIN_MS * 1000000L};
+    while (!atomic_load(&telemetry.stopping))
+    {
+        telemetry_drain();
+        unsigned long long dropped = telemetry_dropped();
+        if (dropped != reported)
+        {
+            int total = dropped > INT32_MAX ? INT32_MAX : (int)dropped;
+            telemetry_record(&(TelemetryEvent){.kind = TELEMETRY_DROPPED, .value = total});
+            reported = dropped;
+        }
+        fflush(telemetry.file);
+        nanosleep(&pause, NULL);
+    }
+    return NULL;
+}
+#endif
+
+// Function to start logging telemetry events to path: NDJSON when the name
+// ends in .ndjson or .json, otherwise raw TelemetryEvent records, which
+// cost the telemetry thread far less
+static bool telemetry_start(const char *path)
+{
+#ifdef __linux__
+    const char *extension = strrchr(path, '.');
+    telemetry.ndjson = extension != NULL && (strcmp(extension, ".ndjson") == 0 || strcmp(extension, ".json") == 0);
+    telemetry.file = fopen(path, telemetry.ndjson ? "w" : "wb");
+    if (telemetry.file == NULL)
+        return false;
+    atomic_store(&telemetry.stopping, false);
+    if (pthread_create(&telemetry.thread, NULL, telemetry_thread, NULL) != 0)
+    {
+        fclose(telemetry.file);
+        telemetry.file = NULL;
+        return false;
+    }
+    atomic_store(&telemetry.enabled, true);
+    return true;
+#else
+    (void)path;
+    return false; // The telemetry thread needs pthreads
+#endif
+}
+
+// Function to stop logging: the thread is joined, the rings drained one last
+// time and the drop count written at the end of the log
+static void telemetry_stop(void)
+{
+    if (!atomic_load(&telemetry.enabled))
+        return;
+    atomic_store(&telemetry.enabled, false);
+#ifdef __linux__
+    atomic_store(&telemetry.stopping, true);
+    pthread_join(telemetry.thread, NULL);
+#endif
+    telemetry_drain();
+    if (telemetry.ndjson)
+        fprintf(telemetry.file, "{\"event\":\"end\",\"events\":%llu,\"dropped\":%llu}\n", telemetry.written,
+                telemetry_dropped());
+    else
+        telemetry_record(&(TelemetryEvent){.kind = TELEMETRY_DROPPED, .value = (int)telemetry_dropped()});
+    fclose(telemetry.file);
+    telemetry.file = NULL;
+}
+
+#ifdef __linux__
+static pthread_key_t metrics_key;
+static pthread_once_t metrics_key_once = PTHREAD_ONCE_INIT;
+
+// Function run as a thread with a metrics block exits: hand the block back.
+// Its counts stay in the totals.
+static void metrics_detach(void *block)
+{
+    atomic_store_explicit(&((MetricsBlock *)block)->claimed, false, memory_order_release);
+}
+
+// Function to create the key whose destructor hands blocks back
+static void metrics_make_key(void)
+{
+    pthread_key_create(&metrics_key, metrics_detach);
+}
+#endif
+
+// Function to get the calling thread's metrics block, registering it first:
+// one handed back by an exited thread, else a new one
+static MetricsBlock *metrics_thread_block(void)
+{
+    if (metrics_block != NULL)
+        return metrics_block;
+
+    MetricsBlock *block = NULL;
+    int count = atomic_load(&metrics.block_count);
+    for (int b = 0; b < count && b < METRICS_MAX_THREADS && block == NULL; b++)
+    {
+        MetricsBlock *free_block = atomic_load_explicit(&metrics.blocks[b], memory_order_acquire);
+        bool claimed = false;
+        if (free_block != NULL && atomic_compare_exchange_strong(&free_block->claimed, &claimed, true))
+            block = free_block;
+    }
+    if (block == NULL)
+    {
+        // Take the next unused block slot, if any are left, as
+        // telemetry_attach does for rings
+        int index = count;
+        while (index < METRICS_MAX_THREADS &&
+               !atomic_compare_exchange_weak(&metrics.block_count, &index, index + 1))
+            ;
+        block = index < METRICS_MAX_THREADS ? calloc(1, sizeof(MetricsBlock)) : NULL;
+        if (block == NULL)
+        {
+            metrics_block = &metrics.overflow;
+            return metrics_block;
+        }
+        atomic_store(&block->claimed, true);
+        atomic_store_explicit(&metrics.blocks[index], block, memory_order_release);
+    }
+#ifdef __linux__
+    pthread_once(&metrics_key_once, metrics_make_key);
+    pthread_setspecific(metrics_key, block);
+#endif
+    metrics_block = block;
+    return block;
+}
+
+// Function to add to a counter
+static void metrics_add(MetricId id, unsigned long long amount)
+{
+    atomic_fetch_add_explicit(&metrics_thread_block()->counters[id], amount, memory_order_relaxed);
+}
+
+// Function to raise a high-water mark
+static void metrics_peak(MetricId id, unsigned long long value)
+{
+    atomic_ullong *peak = &metrics_thread_block()->counters[id];
+    unsigned long long seen = atomic_load_explicit(peak, memory_order_relaxed);
+    while (value > seen && !atomic_compare_exchange_weak_explicit(peak, &seen, value, memory_order_relaxed,
+                                                                  memory_order_relaxed))
+    {
+    }
+}
+
+// Function to record a duration in a histogram
+static void metrics_time(MetricHistogram *histogram, double ms)
+{
+    int bucket = 0;
+    while (bucket < METRIC_TIME_BUCKETS && ms > metric_time_bounds_ms[bucket])
+        bucket++;
+    atomic_fetch_add_explicit(&histogram->buckets[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->total_ns, (unsigned long long)(ms * 1e6), memory_order_relaxed);
+}
+
+// Function to add up every thread's metrics
+static void metrics_collect(MetricsBlock *sum)
+{
+    memset(sum, 0, sizeof(*sum));
+    int count = atomic_load(&metrics.block_count);
+    for (int b = -1; b < count && b < METRICS_MAX_THREADS; b++)
+    {
+        MetricsBlock *block = b < 0 ? &metrics.overflow : atomic_load_explicit(&metrics.blocks[b], memory_order_acquire);
+        if (block == NULL)
+            continue;
+        for (int i = 0; i < METRIC_COUNT; i++)
+        {
+            unsigned long long value = atomic_load_explicit(&block->counters[i], memory_order_relaxed);
+            if (i >= METRIC_PEAK_PROJECTILES)
+                value = value > sum->counters[i] ? value : sum->counters[i];
+            else
+                value += sum->counters[i];
+            sum->counters[i] = value;
+        }
+        for (int i = 0; i <= METRIC_TIME_BUCKETS; i++)
+        {
+            sum->step_time.buckets[i] += atomic_load_explicit(&block->step_time.buckets[i], memory_order_relaxed);
+            sum->frame_time.buckets[i] += atomic_load_explicit(&block->frame_time.buckets[i], memory_order_relaxed);
+        }
+        sum->step_time.total_ns += atomic_load_explicit(&block->step_time.total_ns, memory_order_relaxed);
+        sum->frame_time.total_ns += atomic_load_explicit(&block->frame_time.total_ns, memory_order_relaxed);
+    }
+}
+
+// Function to write a histogram in Prometheus text format
+static size_t metrics_format_histogram(char *out, size_t cap, const char *name, const char *help,
+                                       const MetricHistogram *histogram)
+{
+    size_t len = snprintf(out, cap, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    unsigned long long cumulative = 0;
+    for (int i = 0; i <= METRIC_TIME_BUCKETS && len < cap; i++)
+    {
+        cumulative += histogram->buckets[i];
+        if (i < METRIC_TIME_BUCKETS)
+            len += snprintf(out + len, cap - len, "%s_bucket{le=\"%g\"} %llu\n", name, metric_time_bounds_ms[i] / 1000,
+                            cumulative);
+        else
+            len += snprintf(out + len, cap - len, "%s_bucket{le=\"+Inf\"} %llu\n", name, cumulative);
+    }
+    if (len < cap)
+        len += snprintf(out + len, cap - len, "%s_sum %.6f\n%s_count %llu\n", name, histogram->total_ns / 1e9, name,
+                        cumulative);
+    return len;
+}
+
+// Function to write every metric in Prometheus text format; returns the length
+static size_t metrics_format(char *out, size_t cap)
+{
+    MetricsBlock sum;
+    metrics_collect(&sum);
+    unsigned long long c[METRIC_COUNT];
+    for (int i = 0; i < METRIC_COUNT; i++)
+        c[i] = sum.counters[i];
+
+    static const char *pools[3] = {"projectile", "particle", "explosion"};
+    const unsigned long long capacity[3] = {MAX_PROJECTILES, MAX_PARTICLES, MAX_EXPLOSIONS};
+    size_t len = snprintf(out, cap,
+                          "# HELP artillery_steps_total Simulation steps run\n"
+                          "# TYPE artillery_steps_total counter\n"
+                          "artillery_steps_total %llu\n"
+                          "# HELP artillery_shots_lost_total Shots that launched nothing for lack of projectile slots\n"
+                          "# TYPE artillery_shots_lost_total counter\n"
+                          "artillery_shots_lost_total %llu\n"
+                          "# HELP artillery_crater_ops_total Craters added to the terrain log\n"
+                          "# TYPE artillery_crater_ops_total counter\n"
+                          "artillery_crater_ops_total %llu\n"
+                          "# HELP artillery_slump_passes_total Terrain chunk passes in which dirt slumped\n"
+                          "# TYPE artillery_slump_passes_total counter\n"
+                          "artillery_slump_passes_total %llu\n"
+                          "# HELP artillery_telemetry_dropped_total Telemetry events dropped on full rings\n"
+                          "# TYPE artillery_telemetry_dropped_total counter\n"
+                          "artillery_telemetry_dropped_total %llu\n",
+                          c[METRIC_STEPS], c[METRIC_SHOTS_LOST], c[METRIC_CRATER_OPS], c[METRIC_SLUMP_PASSES],
+                          telemetry_dropped());
+
+    int quality_level = atomic_load(&metrics.quality_level);
+    if (quality_level >= 0 && len < cap)
+        len += snprintf(out + len, cap - len,
+                        "# HELP artillery_quality_level Quality level the window draws at (0 Minimal to 3 High)\n"
+                        "# TYPE artillery_quality_level gauge\n"
+                        "artillery_quality_level %d\n",
+                        quality_level);
+
+    static const char *families[4][3] = {
+        {"artillery_spawns_total", "counter", "Entities allocated from a pool"},
+        {"artillery_drops_total", "counter", "Entities not created because their pool was full"},
+        {"artillery_live_high_water", "gauge", "Most live entities seen in one game"},
+        {"artillery_pool_capacity", "gauge", "Entity pool sizes"}};
+    for (int f = 0; f < 4 && len < cap; f++)
+    {
+        len += snprintf(out + len, cap - len, "# HELP %s %s\n# TYPE %s %s\n", families[f][0], families[f][2],
+                        families[f][0], families[f][1]);
+        for (int p = 0; p < 3 && len < cap; p++)
+        {
+            unsigned long long values[4] = {c[METRIC_PROJECTILE_SPAWNS + 2 * p], c[METRIC_PROJECTILE_DROPS + 2 * p],
+                                            c[METRIC_PEAK_PROJECTILES + p], capacity[p]};
+            len += snprintf(out + len, cap - len, "%s{pool=\"%s\"} %llu\n", families[f][0], pools[p], values[f]);
+        }
+    }
+
+    if (len < cap)
+        len += metrics_format_histogram(out + len, cap - len, "artillery_step_seconds", "Time taken by simulation steps",
+                                        &sum.step_time);
+    if (len < cap)
+        len += metrics_format_histogram(out + len, cap - len, "artillery_frame_seconds", "Interval between drawn frames",
+                                        &sum.frame_time);
+    return len < cap ? len : cap - 1;
+}
+
+// Function to get a monotonic timestamp in milliseconds
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// Function to step a xorshift32 generator
+static uint32_t xorshift32(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+// Function to draw a non-negative int from a xorshift32 generator
+static int next_rand(uint32_t *state)
+{
+    return (int)(xorshift32(state) >> 1);
+}
+
+// Function to draw from the game's own random generator, so the whole
+// simulation can be saved, restored and replayed
+static int game_rand(Game *game)
+{
+    return next_rand(&game->rng_state);
+}
+
+// Function to seed the game's random generator (xorshift needs a non-zero state)
+static void seed_game_rand(Game *game, uint32_t seed)
+{
+    game->rng_state = seed ? seed : 0x9E3779B9u;
+    game->round_seed = 0;
+}
+
+// Structure for the fixed header of a snapshot. The sections follow it back
+// to back: the terrain log (quantized base, then ops), the tanks, active
+// projectiles, active explosions and active particles, each stored in its in-memory layout so a
+// mapped file is block-copied rather than parsed. The record sizes guard
+// against loading a file written by a build with different structures.
+typedef struct
+{
+    char magic[4]; // "ARTS"
+    uint32_t version;
+    uint32_t size; // Whole snapshot, header included
+    uint16_t tank_size, projectile_size, explosion_size, particle_size;
+    double wind;
+    uint32_t rng_state;
+    uint32_t step;
+    int32_t turn;
+    int32_t frame_count;
+    int32_t num_players;
+    int32_t current_player;
+    int32_t winning_team;
+    int32_t state;
+    int32_t match_players;
+    uint8_t match_teams;
+    uint8_t game_paused;
+    uint8_t match_debris;
+    uint8_t reserved;
+    uint32_t terrain_base_seq;
+    uint32_t terrain_op_count;
+    uint32_t slump_chunks;
+    uint32_t round_seed;
+    uint32_t projectile_count;
+    uint32_t explosion_count;
+    uint32_t particle_count;
+} SnapshotHeader;
+
+#define SNAPSHOT_MAX_SIZE (sizeof(SnapshotHeader) + TERRAIN_SEGMENTS * sizeof(int32_t) + \
+                           TERRAIN_LOG_CAPACITY * sizeof(TerrainOp) + \
+                           MAX_PLAYERS * sizeof(Tank) + MAX_PROJECTILES * sizeof(Projectile) + \
+                           MAX_EXPLOSIONS * sizeof(Explosion) + MAX_PARTICLES * sizeof(Particle))
+
+// Function to map a whole file read-only (read into memory on Windows)
+static bool map_file(const char *path, MappedFile *file)
+{
+#ifdef _WIN32
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+        return false;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char *data = (size > 0) ? malloc(size) : NULL;
+    if (data == NULL || fread(data, 1, size, f) != (size_t)size)
+    {
+        free(data);
+        fclose(f);
+        return false;
+    }
+    fclose(f);
+    file->data = data;
+    file->size = size;
+    return true;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+    file->data = data;
+    file->size = st.st_size;
+    return true;
+#endif
+}
+
+// Function to release a file mapped with map_file
+static void unmap_file(MappedFile *file)
+{
+#ifdef _WIN32
+    free((void *)file->data);
+#else
+    munmap((void *)file->data, file->size);
+#endif
+    file->data = NULL;
+    file->size = 0;
+}
+
+// Function to serialize the game into out (at least SNAPSHOT_MAX_SIZE bytes);
+// returns the snapshot size
+static size_t write_snapshot(const Game *game, unsigned char *out)
+{
+    SnapshotHeader header = {0};
+    memcpy(header.magic, "ARTS", 4);
+    header.version = SNAPSHOT_VERSION;
+    header.tank_size = sizeof(Tank);
+    header.projectile_size = sizeof(Projectile);
+    header.explosion_size = sizeof(Explosion);
+    header.particle_size = sizeof(Particle);
+    header.wind = game->wind;
+    header.rng_state = game->rng_state;
+    header.step = game->step;
+    header.turn = game->turn;
+    header.frame_count = game->frame_count;
+    header.num_players = game->num_players;
+    header.current_player = game->current_player;
+    header.winning_team = game->winning_team;
+    header.state = game->state;
+    header.match_players = game->match_players;
+    header.match_teams = game->match_teams;
+    header.match_debris = game->match_debris;
+    header.game_paused = game->game_paused;
+
+    // The terrain as its log, which reproduces it exactly
+    const TerrainLog *log = &game->terrain_log;
+    header.terrain_base_seq = log->base_seq;
+    header.terrain_op_count = log->op_count;
+    header.slump_chunks = game->slump_chunks;
+    header.round_seed = game->round_seed;
+    size_t offset = sizeof(SnapshotHeader);
+    memcpy(out + offset, log->base, sizeof(log->base));
+    offset += sizeof(log->base);
+    memcpy(out + offset, log->ops, log->op_count * sizeof(TerrainOp));
+    offset += log->op_count * sizeof(TerrainOp);
+
+    memcpy(out + offset, game->players, game->num_players * sizeof(Tank));
+    offset += game->num_players * sizeof(Tank);
+
+    // Active entries only, in slot order
+    for (int i = 0; i < MAX_PROJECTILES; i++)
+    {
+        if (game->projectiles[i].active)
+        {
+            memcpy(out + offset, &game->projectiles[i], sizeof(Projectile));
+            offset += sizeof(Projectile);
+            header.projectile_count++;
+        }
+    }
+    for (int i = 0; i < MAX_EXPLOSIONS; i++)
+    {
+        if (game->explosions[i].active)
+        {
+            memcpy(out + offset, &game->explosions[i], sizeof(Explosion));
+            offset += sizeof(Explosion);
+            header.explosion_count++;
+        }
+    }
+    for (int i = 0; i < MAX_PARTICLES; i++)
+    {
+        if (game->particles[i].active)
+        {
+            memcpy(out + offset, &game->particles[i], sizeof(Particle));
+            offset += sizeof(Particle);
+            header.particle_count++;
+        }
+    }
+
+    header.size = offset;
+    memcpy(out, &header, sizeof(header));
+    return offset;
+}
+
+// Function to restore the game from a snapshot; the game is left untouched
+// if the snapshot is invalid
+static bool read_snapshot(Game *game, const unsigned char *data, size_t size)
+{
+    SnapshotHeader header;
+    if (size < sizeof(header))
+        return false;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, "ARTS", 4) != 0 || header.version != SNAPSHOT_VERSION || header.size != size ||
+        header.tank_size != sizeof(Tank) || header.projectile_size != sizeof(Projectile) ||
+        header.explosion_size != sizeof(Explosion) || header.particle_size != sizeof(Particle))
+        return false;
+    if (header.num_players < 2 || header.num_players > MAX_PLAYERS || header.current_player < 0 ||
+        header.current_player >= header.num_players || header.projectile_count > MAX_PROJECTILES ||
+        header.explosion_count > MAX_EXPLOSIONS || header.particle_count > MAX_PARTICLES ||
+        header.terrain_op_count > TERRAIN_LOG_CAPACITY)
+        return false;
+    size_t terrain_size = TERRAIN_SEGMENTS * sizeof(int32_t) + header.terrain_op_count * sizeof(TerrainOp);
+    size_t expected = sizeof(header) + terrain_size + header.num_players * sizeof(Tank) +
+                      header.projectile_count * sizeof(Projectile) + header.explosion_count * sizeof(Explosion) +
+                      header.particle_count * sizeof(Particle);
+    if (expected != size)
+        return false;
+
+    // Fields the game uses as indices must be in range, or a corrupt file
+    // would index past the end of arrays
+    if (header.state < STATE_AIMING || header.state > STATE_GAME_OVER || header.winning_team < -1 ||
+        header.winning_team >= header.num_players)
+        return false;
+    const unsigned char *entities = data + sizeof(header) + terrain_size;
+    for (int i = 0; i < header.num_players; i++)
+    {
+        Tank tank;
+        memcpy(&tank, entities + i * sizeof(Tank), sizeof(Tank));
+        if (tank.team < 0 || tank.team >= header.num_players || tank.current_weapon < 0 ||
+            tank.current_weapon >= WEAPON_COUNT)
+            return false;
+    }
+    entities += header.num_players * sizeof(Tank);
+    for (uint32_t i = 0; i < header.projectile_count; i++)
+    {
+        Projectile proj;
+        memcpy(&proj, entities + i * sizeof(Projectile), sizeof(Projectile));
+        if (proj.weapon_type < 0 || proj.weapon_type >= WEAPON_COUNT)
+            return false;
+    }
+
+    game->wind = header.wind;
+    game->rng_state = header.rng_state;
+    game->step = header.step;
+    game->turn = header.turn;
+    game->frame_count = header.frame_count;
+    game->num_players = header.num_players;
+    game->current_player = header.current_player;
+    game->winning_team = header.winning_team;
+    game->state = (GameState)header.state;
+    game->match_players = header.match_players;
+    game->match_teams = header.match_teams;
+    game->match_debris = header.match_debris;
+    game->game_paused = header.game_paused;
+    init_weapons(game);
+
+    size_t offset = sizeof(header);
+    TerrainLog *log = &game->terrain_log;
+    memcpy(log->base, data + offset, sizeof(log->base));
+    memcpy(log->ops, data + offset + sizeof(log->base), header.terrain_op_count * sizeof(TerrainOp));
+    log->base_seq = header.terrain_base_seq;
+    log->op_count = header.terrain_op_count;
+    rebuild_terrain(log, game->terrain);
+    game->slump_chunks = header.slump_chunks;
+    game->round_seed = header.round_seed;
+    offset += terrain_size;
+    game->terrain_dirty_lo = 1;
+    game->terrain_dirty_hi = 0;
+    mark_terrain_dirty(game, 0, TERRAIN_SEGMENTS - 1);
+
+    memcpy(game->players, data + offset, game->num_players * sizeof(Tank));
+    offset += game->num_players * sizeof(Tank);
+    game->unsettled_tanks = 0;
+    for (int i = 0; i < game->num_players; i++)
+    {
+        if (game->players[i].unsettled)
+            game->unsettled_tanks++;
+    }
+    rebuild_tank_index(game);
+
+    // Projectiles are packed into the lowest slots
+    for (int i = 0; i < MAX_PROJECTILES; i++)
+    {
+        game->projectiles[i].active = false;
+        game->projectile_free[i] = MAX_PROJECTILES - 1 - i;
+    }
+    game->projectile_free_count = MAX_PROJECTILES;
+    for (uint32_t i = 0; i < header.projectile_count; i++)
+    {
+        int index = alloc_projectile(game);
+        memcpy(&game->projectiles[index], data + offset, sizeof(Projectile));
+        offset += sizeof(Projectile);
+    }
+
+    for (int i = 0; i < MAX_EXPLOSIONS; i++)
+    {
+        game->explosions[i].active = false;
+    }
+    memcpy(game->explosions, data + offset, header.explosion_count * sizeof(Explosion));
+    offset += header.explosion_count * sizeof(Explosion);
+
+    for (int i = 0; i < MAX_PARTICLES; i++)
+    {
+        game->particles[i].active = false;
+    }
+    memcpy(game->particles, data + offset, header.particle_count * sizeof(Particle));
+    update_wind_field(game);
+
+    return true;
+}
+
+// Function to open a temporary file beside path for begin/finish_atomic_write
+static FILE *begin_atomic_write(const char *path, char *tmp_path, size_t tmp_size)
+{
+    snprintf(tmp_path, tmp_size, "%s.tmp", path);
+    return fopen(tmp_path, "wb");
+}
+
+// Function to close the temporary file and rename it over path, so a crash
+// mid-save keeps the previous file
+static bool finish_atomic_write(FILE *f, bool ok, const char *tmp_path, const char *path)
+{
+    ok &= fclose(f) == 0;
+#ifdef _WIN32
+    remove(path);
+#endif
+    if (!ok || rename(tmp_path, path) != 0)
+    {
+        remove(tmp_path);
+        return false;
+    }
+    return true;
+}
+
+// Function to save a snapshot file
+static bool save_snapshot(Game *game, const char *path)
+{
+    static unsigned char buffer[SNAPSHOT_MAX_SIZE];
+    size_t size = write_snapshot(game, buffer);
+
+    char tmp_path[256];
+    FILE *f = begin_atomic_write(path, tmp_path, sizeof(tmp_path));
+    if (f == NULL)
+        return false;
+    return finish_atomic_write(f, fwrite(buffer, 1, size, f) == size, tmp_path, path);
+}
+
+// Function to load a snapshot file
+static bool load_snapshot(Game *game, const char *path)
+{
+    MappedFile file;
+    if (!map_file(path, &file))
+        return false;
+    bool ok = read_snapshot(game, file.data, file.size);
+    unmap_file(&file);
+
+    if (!ok)
+        fprintf(stderr, "Ignoring invalid snapshot %s\n", path);
+    return ok;
+}
+
+#ifndef ARTILLERY_HEADLESS
+// Function to save a snapshot from the window and report it on the console
+static bool window_save_snapshot(Game *game, const char *path)
+{
+    double start = now_ms();
+    bool ok = save_snapshot(game, path);
+    if (ok)
+        printf("Saved %s in %.3f ms\n", path, now_ms() - start);
+    else
+        fprintf(stderr, "Cannot save %s\n", path);
+    return ok;
+}
+
+// Function to load a snapshot into the window's game and report it on the console
+static bool window_load_snapshot(Game *game, const char *path)
+{
+    double start = now_ms();
+    bool ok = load_snapshot(game, path);
+    if (ok)
+        printf("Loaded %s in %.3f ms\n", path, now_ms() - start);
+    return ok;
+}
+#endif
+
+// Function to apply one player action to the game
+static void apply_action(Game *game, GameAction action)
+{
+    // New round, keeping the scores (works even when the game is over)
+    if (action == ACTION_RESET)
+    {
+        reset_game(game);
+        return;
+    }
+
+    // Cycle the number of tanks or toggle team play; both start a new match
+    if (action == ACTION_CYCLE_PLAYERS)
+    {
+        static const int player_counts[] = {2, 3, 4, 6, 8, 16, 32, 64};
+        int count = sizeof(player_counts) / sizeof(player_counts[0]);
+        int next = 0;
+        for (int i = 0; i < count; i++)
+        {
+            if (player_counts[i] == game->num_players)
+                next = (i + 1) % count;
+        }
+        game->match_players = player_counts[next];
+        init_game(game);
+        return;
+    }
+    if (action == ACTION_TOGGLE_TEAMS)
+    {
+        game->match_teams = !game->match_teams;
+        init_game(game);
+        return;
+    }
+    if (action == ACTION_TOGGLE_DEBRIS)
+    {
+        game->match_debris = !game->match_debris;
+        init_game(game);
+        return;
+    }
+
+    // Skip if game is over or not in aiming state
+    if (game->state == STATE_GAME_OVER || game->state != STATE_AIMING)
+        return;
+
+    Tank *current_tank = &game->players[game->current_player];
+
+    switch (action)
+    {
+    case ACTION_ANGLE_DOWN:
+        // Decrease angle
+        current_tank->angle = (current_tank->angle - 1) % 360;
+        if (current_tank->angle < 0)
+            current_tank->angle += 360;
+        break;
+
+    case ACTION_ANGLE_UP:
+        // Increase angle
+        current_tank->angle = (current_tank->angle + 1) % 360;
+        break;
+
+    case ACTION_POWER_UP:
+        // Increase power
+        if (current_tank->power < MAX_POWER)
+            current_tank->power++;
+        break;
+
+    case ACTION_POWER_DOWN:
+        // Decrease power
+        if (current_tank->power > 1)
+            current_tank->power--;
+        break;
+
+    case ACTION_NEXT_WEAPON:
+        // Select next weapon
+        current_tank->current_weapon = (current_tank->current_weapon + 1) % WEAPON_COUNT;
+        break;
+
+    case ACTION_PREV_WEAPON:
+        // Select previous weapon
+        current_tank->current_weapon = (current_tank->current_weapon - 1 + WEAPON_COUNT) % WEAPON_COUNT;
+        break;
+
+    case ACTION_FIRE:
+        // Fire weapon
+        fire_weapon(game);
+        break;
+
+    case ACTION_PAUSE:
+        // Toggle pause
+        game->game_paused = !game->game_paused;
+        break;
+
+    case ACTION_MOVE_LEFT:
+        if (current_tank->moves_left > 0)
+        {
+            // Move left
+            current_tank->x -= 22.0;
+            if (current_tank->x < TANK_WIDTH / 2)
+            {
+                current_tank->x = TANK_WIDTH / 2;
+            }
+            rebuild_tank_index(game);
+            unsettle_tank(game, game->current_player);
+            current_tank->moves_left--;
+        }
+        break;
+
+    case ACTION_MOVE_RIGHT:
+        if (current_tank->moves_left > 0)
+        {
+            // Move right
+            current_tank->x += 22.0;
+            if (current_tank->x > WORLD_WIDTH - TANK_WIDTH / 2)
+            {
+                current_tank->x = WORLD_WIDTH - TANK_WIDTH / 2;
+            }
+            rebuild_tank_index(game);
+            unsettle_tank(game, game->current_player);
+            current_tank->moves_left--;
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+// Function to make room for count more elements in a growable array
+static bool reserve_array(void **items, size_t *capacity, size_t count, size_t element_size)
+{
+    if (count <= *capacity)
+        return true;
+    size_t new_capacity = *capacity ? *capacity : 64;
+    while (new_capacity < count)
+        new_capacity *= 2;
+    void *grown = realloc(*items, new_capacity * element_size);
+    if (grown == NULL)
+        return false;
+    *items = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+// Function to add a keyframe of the current game to a recording
+static void replay_add_keyframe(Replay *replay, Game *game)
+{
+    if (!reserve_array((void **)&replay->keyframes, &replay->keyframe_capacity, replay->keyframe_count + 1, sizeof(ReplayKeyframe)) ||
+        !reserve_array((void **)&replay->data, &replay->data_capacity, replay->data_size + SNAPSHOT_MAX_SIZE, 1))
+        return;
+
+    ReplayKeyframe *keyframe = &replay->keyframes[replay->keyframe_count++];
+    keyframe->step = game->step;
+    keyframe->action_index = replay->action_count;
+    keyframe->offset = replay->data_size;
+    keyframe->size = write_snapshot(game, replay->data + replay->data_size);
+    replay->data_size += keyframe->size;
+    replay->keyframe_turn = game->turn;
+}
+
+// Function to discard a recording
+static void replay_clear(Replay *replay)
+{
+    free(replay->actions);
+    free(replay->keyframes);
+    free(replay->data);
+    memset(replay, 0, sizeof(*replay));
+}
+
+// Function to start recording from the current game state
+static void replay_start(Replay *replay, Game *game)
+{
+    replay_clear(replay);
+    replay->seed = game->rng_state;
+    replay->end_step = game->step;
+    replay_add_keyframe(replay, game);
+}
+
+// Function to record an action about to be applied at the current step
+static void replay_record_action(Replay *replay, Game *game, GameAction action)
+{
+    if (!reserve_array((void **)&replay->actions, &replay->action_capacity, replay->action_count + 1, sizeof(uint32_t)))
+        return;
+    replay->actions[replay->action_count++] = game->step << 5 | action;
+}
+
+// Function to note a finished step; keyframes are added every few turns
+static void replay_record_step(Replay *replay, Game *game)
+{
+    replay->end_step = game->step;
+    if (game->turn - replay->keyframe_turn >= REPLAY_KEYFRAME_TURNS)
+        replay_add_keyframe(replay, game);
+}
+
+// Function to write the actions, keyframes and data recorded since the last
+// save as one chunk
+static bool write_replay_chunk(Replay *replay, FILE *f)
+{
+    ReplayChunk chunk = {replay->action_count - replay->saved_actions, replay->keyframe_count - replay->saved_keyframes,
+                         replay->data_size - replay->saved_data};
+    bool ok = fwrite(&chunk, sizeof(chunk), 1, f) == 1;
+    ok &= fwrite(replay->actions + replay->saved_actions, sizeof(uint32_t), chunk.action_count, f) == chunk.action_count;
+    ok &= fwrite(replay->keyframes + replay->saved_keyframes, sizeof(ReplayKeyframe), chunk.keyframe_count, f) ==
+          chunk.keyframe_count;
+    ok &= fwrite(replay->data + replay->saved_data, 1, chunk.data_size, f) == chunk.data_size;
+    return ok;
+}
+
+// Function to save a recording. The first save writes the whole file; later
+// saves to the same path append what was recorded since as a new chunk and
+// then update the header, so saving at every turn costs only that turn.
+static bool save_replay(Replay *replay, const char *path)
+{
+    ReplayHeader header = {{'A', 'R', 'T', 'R'}, REPLAY_VERSION, replay->seed, replay->end_step,
+                           replay->action_count, replay->keyframe_count, replay->data_size};
+    bool ok;
+    uint64_t size;
+    if (replay->saved_size > 0 && strcmp(replay->saved_path, path) == 0)
+    {
+        // Chunks go after the last complete one, over anything a failed save left
+        FILE *f = fopen(path, "r+b");
+        if (f == NULL)
+            return false;
+        ok = fseek(f, (long)replay->saved_size, SEEK_SET) == 0 && write_replay_chunk(replay, f);
+        size = ok ? (uint64_t)ftell(f) : 0;
+        ok = ok && fflush(f) == 0 && fseek(f, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, f) == 1;
+        ok &= fclose(f) == 0;
+    }
+    else
+    {
+        replay->saved_actions = replay->saved_keyframes = 0;
+        replay->saved_data = 0;
+        char tmp_path[256];
+        FILE *f = begin_atomic_write(path, tmp_path, sizeof(tmp_path));
+        if (f == NULL)
+            return false;
+        ok = fwrite(&header, sizeof(header), 1, f) == 1 && write_replay_chunk(replay, f);
+        size = ok ? (uint64_t)ftell(f) : 0;
+        ok = finish_atomic_write(f, ok, tmp_path, path);
+    }
+
+    // A failed save writes the whole file again next time
+    replay->saved_size = ok ? size : 0;
+    snprintf(replay->saved_path, sizeof(replay->saved_path), "%s", path);
+    replay->saved_actions = replay->action_count;
+    replay->saved_keyframes = replay->keyframe_count;
+    replay->saved_data = replay->data_size;
+    return ok;
+}
+
+// Function to load a recording saved with save_replay
+static bool load_replay(Replay *replay, const char *path)
+{
+    MappedFile file;
+    if (!map_file(path, &file))
+        return false;
+
+    ReplayHeader header;
+    bool ok = file.size >= sizeof(header);
+    if (ok)
+    {
+        memcpy(&header, file.data, sizeof(header));
+        ok = memcmp(header.magic, "ARTR", 4) == 0 && header.version == REPLAY_VERSION && header.keyframe_count > 0 &&
+             header.action_count <= file.size / sizeof(uint32_t) &&
+             header.keyframe_count <= file.size / sizeof(ReplayKeyframe) && header.data_size <= file.size;
+    }
+    if (ok)
+    {
+        replay_clear(replay);
+        replay->seed = header.seed;
+        replay->end_step = header.end_step;
+        replay->action_count = replay->action_capacity = header.action_count;
+        replay->keyframe_count = replay->keyframe_capacity = header.keyframe_count;
+        replay->data_size = replay->data_capacity = header.data_size;
+        replay->actions = malloc(header.action_count * sizeof(uint32_t) + 1);
+        replay->keyframes = malloc(header.keyframe_count * sizeof(ReplayKeyframe));
+        replay->data = malloc(header.data_size);
+        ok = replay->actions != NULL && replay->keyframes != NULL && replay->data != NULL;
+    }
+    if (ok)
+    {
+        // Gather the chunks up to the header's totals; anything after them
+        // is left from a save that did not finish
+        size_t offset = sizeof(header);
+        uint32_t actions = 0, keyframes = 0;
+        uint64_t data_size = 0;
+        while (ok && (actions < header.action_count || keyframes < header.keyframe_count ||
+                      data_size < header.data_size))
+        {
+            ReplayChunk chunk;
+            ok = file.size - offset >= sizeof(chunk);
+            if (!ok)
+                break;
+            memcpy(&chunk, file.data + offset, sizeof(chunk));
+            offset += sizeof(chunk);
+            ok = chunk.action_count <= header.action_count - actions &&
+                 chunk.keyframe_count <= header.keyframe_count - keyframes &&
+                 chunk.data_size <= header.data_size - data_size &&
+                 file.size - offset >= chunk.action_count * sizeof(uint32_t) +
+                                           chunk.keyframe_count * sizeof(ReplayKeyframe) + chunk.data_size;
+            if (!ok)
+                break;
+            memcpy(replay->actions + actions, file.data + offset, chunk.action_count * sizeof(uint32_t));
+            offset += chunk.action_count * sizeof(uint32_t);
+            memcpy(replay->keyframes + keyframes, file.data + offset, chunk.keyframe_count * sizeof(ReplayKeyframe));
+            offset += chunk.keyframe_count * sizeof(ReplayKeyframe);
+            memcpy(replay->data + data_size, file.data + offset, chunk.data_size);
+            offset += chunk.data_size;
+            actions += chunk.action_count;
+            keyframes += chunk.keyframe_count;
+            data_size += chunk.data_size;
+        }
+        for (uint32_t i = 0; i < header.keyframe_count && ok; i++)
+        {
+            ok = replay->keyframes[i].offset + (uint64_t)replay->keyframes[i].size <= header.data_size &&
+                 replay->keyframes[i].action_index <= header.action_count;
+        }
+    }
+    unmap_file(&file);
+    if (!ok)
+        replay_clear(replay);
+    return ok;
+}
+
+// Function to run one step of a recording: apply the actions recorded for
+// the current step, then simulate. Returns false at the end of the recording.
+static bool replay_advance(Replay *replay, Game *game, int *next_action)
+{
+    while (*next_action < replay->action_count && (replay->actions[*next_action] >> 5) == game->step)
+    {
+        apply_action(game, (GameAction)(replay->actions[*next_action] & 31));
+        (*next_action)++;
+    }
+    if (game->step >= replay->end_step || game->game_paused)
+        return false;
+    update_game(game);
+    return true;
+}
+
+// Function to jump to a step: load the nearest keyframe at or before it and
+// fast-forward from there. Returns false, leaving the game as it was, if
+// that keyframe is corrupt.
+static bool replay_seek(Replay *replay, Game *game, uint32_t target_step, int *next_action)
+{
+    int lo = 0, hi = replay->keyframe_count - 1;
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+        if (replay->keyframes[mid].step <= target_step)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    ReplayKeyframe *keyframe = &replay->keyframes[lo];
+    if (!read_snapshot(game, replay->data + keyframe->offset, keyframe->size))
+        return false;
+    *next_action = keyframe->action_index;
+    while (game->step < target_step && replay_advance(replay, game, next_action))
+        ;
+    return true;
+}
+
+// Function to run a whole recording headlessly and check the game matches
+// every keyframe it passes; returns non-zero on a mismatch
+static int verify_replay(const char *path)
+{
+    static Replay replay;
+    static Game replay_game;
+    static unsigned char snapshot[SNAPSHOT_MAX_SIZE];
+    if (!load_replay(&replay, path))
+    {
+        fprintf(stderr, "Cannot read replay %s\n", path);
+        return 1;
+    }
+
+    double start = now_ms();
+    int next_action = 0;
+    if (!replay_seek(&replay, &replay_game, replay.keyframes[0].step, &next_action))
+    {
+        printf("Replay keyframe 0 is corrupt\n");
+        return 1;
+    }
+    for (int k = 1; k < replay.keyframe_count; k++)
+    {
+        ReplayKeyframe *keyframe = &replay.keyframes[k];
+        while (replay_game.step < keyframe->step && replay_advance(&replay, &replay_game, &next_action))
+            ;
+        size_t size = write_snapshot(&replay_game, snapshot);
+        if (size != keyframe->size || memcmp(snapshot, replay.data + keyframe->offset, size) != 0)
+        {
+            // A keyframe that does not even load is damage, not divergence
+            static Game scratch;
+            if (!read_snapshot(&scratch, replay.data + keyframe->offset, keyframe->size))
+                printf("Replay keyframe %d (step %u) is corrupt\n", k, keyframe->step);
+            else
+                printf("Replay diverged at step %u (keyframe %d)\n", keyframe->step, k);
+            return 1;
+        }
+    }
+    while (replay_advance(&replay, &replay_game, &next_action))
+        ;
+
+    printf("Replay verified: %d actions, %d keyframes, %u steps in %.1f ms\n",
+           replay.action_count, replay.keyframe_count, replay_game.step - replay.keyframes[0].step, now_ms() - start);
+    return 0;
+}
+
+#ifdef __linux__
+// Function to open a socket for an address: "unix:PATH" (or just a path)
+// for a Unix domain socket, "tcp:PORT" for loopback TCP. Returns a
+// non-blocking descriptor, or -1.
+static int net_open(const char *address, bool listening)
+{
+    int fd;
+    if (strncmp(address, "tcp:", 4) == 0)
+    {
+        struct sockaddr_in addr = {0};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(atoi(address + 4));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -1;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (listening ? bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 128) != 0
+                      : connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    else
+    {
+        const char *path = strncmp(address, "unix:", 5) == 0 ? address + 5 : address;
+        struct sockaddr_un addr = {0};
+        addr.sun_family = AF_UNIX;
+        if (strlen(path) >= sizeof(addr.sun_path))
+            return -1;
+        strcpy(addr.sun_path, path);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -1;
+        if (listening)
+            unlink(path);
+        if (listening ? bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 128) != 0
+                      : connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+// Function to set up a connection on an open socket
+static void net_init_connection(NetConnection *conn, int fd)
+{
+    memset(conn, 0, sizeof(*conn));
+    conn->fd = fd;
+}
+
+// Function to close a connection and free its buffers
+static void net_close(NetConnection *conn)
+{
+    if (conn->fd >= 0)
+        close(conn->fd);
+    free(conn->in);
+    free(conn->out);
+    memset(conn, 0, sizeof(*conn));
+    conn->fd = -1;
+}
+
+// Function to write as much queued output as the socket takes; false if
+// the connection failed
+static bool net_flush(NetConnection *conn)
+{
+    size_t sent = 0;
+    while (sent < conn->out_len)
+    {
+        ssize_t n = send(conn->fd, conn->out + sent, conn->out_len - sent, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        sent += n;
+    }
+    memmove(conn->out, conn->out + sent, conn->out_len - sent);
+    conn->out_len -= sent;
+    return conn->out_len <= NET_MAX_BACKLOG;
+}
+
+// Function to queue a message: a 32-bit length, the type byte, then the
+// payload, which may be given in two parts
+static bool net_queue(NetConnection *conn, NetMessageType type, const void *payload, size_t len,
+                      const void *extra, size_t extra_len)
+{
+    uint32_t frame_len = 1 + len + extra_len;
+    if (!reserve_array((void **)&conn->out, &conn->out_cap, conn->out_len + 4 + frame_len, 1))
+        return false;
+    unsigned char *p = conn->out + conn->out_len;
+    memcpy(p, &frame_len, 4);
+    p[4] = type;
+    memcpy(p + 5, payload, len);
+    if (extra_len > 0)
+        memcpy(p + 5 + len, extra, extra_len);
+    conn->out_len += 4 + frame_len;
+    return true;
+}
+
+// Function to read what has arrived, up to NET_MAX_INPUT buffered bytes (the
+// rest waits in the socket); false if the peer closed, failed or sent a
+// malformed frame
+static bool net_receive(NetConnection *conn)
+{
+    if (conn->broken)
+        return false;
+
+    // Drop messages already handled
+    if (conn->in_pos > 0)
+    {
+        memmove(conn->in, conn->in + conn->in_pos, conn->in_len - conn->in_pos);
+        conn->in_len -= conn->in_pos;
+        conn->in_pos = 0;
+    }
+    while (conn->in_len < NET_MAX_INPUT)
+    {
+        size_t want = NET_MAX_INPUT - conn->in_len < 65536 ? NET_MAX_INPUT - conn->in_len : 65536;
+        if (!reserve_array((void **)&conn->in, &conn->in_cap, conn->in_len + want, 1))
+            return false;
+        ssize_t n = recv(conn->fd, conn->in + conn->in_len, want, 0);
+        if (n > 0)
+        {
+            conn->in_len += n;
+            continue;
+        }
+        if (n == 0)
+            return false;
+        if (errno == EINTR)
+            continue;
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    return true;
+}
+
+// Function to take the next complete message from the input; false if none.
+// A frame that is empty or longer than any message is a protocol error: it
+// marks the connection broken rather than waiting for bytes that never fit.
+static bool net_next_message(NetConnection *conn, NetMessageType *type, const unsigned char **payload, size_t *len)
+{
+    size_t available = conn->in_len - conn->in_pos;
+    if (available < 5)
+        return false;
+    uint32_t frame_len;
+    memcpy(&frame_len, conn->in + conn->in_pos, 4);
+    if (frame_len == 0 || frame_len > NET_MAX_MESSAGE)
+    {
+        conn->broken = true;
+        return false;
+    }
+    if (available < 4 + (size_t)frame_len)
+        return false;
+    *type = (NetMessageType)conn->in[conn->in_pos + 4];
+    *payload = conn->in + conn->in_pos + 5;
+    *len = frame_len - 1;
+    conn->in_pos += 4 + frame_len;
+    return true;
+}
+
+// Function to check that a seat may take an action in a match. Seats take
+// the turns of the tanks they own (player index modulo the seat count);
+// match setup and pausing, which stop the match for every seat, belong to
+// seat 0.
+static bool seat_may_act(Game *game, int seat, GameAction action)
+{
+    switch (action)
+    {
+    case ACTION_RESET:
+    case ACTION_CYCLE_PLAYERS:
+    case ACTION_TOGGLE_TEAMS:
+    case ACTION_TOGGLE_DEBRIS:
+    case ACTION_PAUSE:
+        return seat == 0;
+    default:
+        return action < ACTION_COUNT && game->current_player % MATCH_SEATS == seat;
+    }
+}
+
+// Function to queue a snapshot of a match for one client
+static void server_send_state(ServerClient *client, Game *game, NetMessageType type)
+{
+    static unsigned char snapshot[SNAPSHOT_MAX_SIZE];
+    size_t size = write_snapshot(game, snapshot);
+    NetWelcome welcome = {client->match, client->seat, MATCH_SEATS};
+    if (type == MSG_WELCOME)
+        net_queue(&client->conn, MSG_WELCOME, &welcome, sizeof(welcome), snapshot, size);
+    else
+        net_queue(&client->conn, MSG_SNAPSHOT, NULL, 0, snapshot, size);
+}
+
+// Function to handle the messages a client has sent
+static void server_handle_client(Server *server, int index)
+{
+    ServerClient *client = &server->clients[index];
+    NetMessageType type;
+    const unsigned char *payload;
+    size_t len;
+    while (net_next_message(&client->conn, &type, &payload, &len))
+    {
+        if (type == MSG_JOIN && len == sizeof(uint32_t) && client->match < 0)
+        {
+            // Seat the client in the requested match, or the first with a free seat
+            uint32_t wanted;
+            memcpy(&wanted, payload, sizeof(wanted));
+            for (int m = 0; m < server->match_count && client->match < 0; m++)
+            {
+                if (wanted != UINT32_MAX && (uint32_t)m != wanted)
+                    continue;
+                for (int seat = 0; seat < MATCH_SEATS; seat++)
+                {
+                    if (server->matches[m].seats[seat] < 0)
+                    {
+                        server->matches[m].seats[seat] = index;
+                        client->match = m;
+                        client->seat = seat;
+                        break;
+                    }
+                }
+            }
+            if (client->match < 0)
+            {
+                client->closing = true;
+                return;
+            }
+            server_send_state(client, server->matches[client->match].game, MSG_WELCOME);
+        }
+        else if (type == MSG_INPUT && len == sizeof(NetInput) && client->match >= 0)
+        {
+            NetInput input;
+            memcpy(&input, payload, sizeof(input));
+            client->last_seq = input.seq;
+            ServerMatch *match = &server->matches[client->match];
+            if (match->pending_count < MAX_STEP_ACTIONS)
+                match->pending[match->pending_count++] = (NetAction){input.action, client->seat};
+        }
+        else if (type == MSG_RESYNC && client->match >= 0)
+        {
+            server_send_state(client, server->matches[client->match].game, MSG_SNAPSHOT);
+        }
+    }
+}
+
+// Function to tell whether a match has nothing to simulate: waiting for an
+// input with everything settled and no effects playing. Stepping it would
+// only advance its counters.
+static bool game_is_idle(Game *game)
+{
+    if ((game->state != STATE_AIMING && game->state != STATE_GAME_OVER) || game->unsettled_tanks > 0 ||
+        game->projectile_free_count < MAX_PROJECTILES)
+        return false;
+    for (int i = 0; i < MAX_EXPLOSIONS; i++)
+    {
+        if (game->explosions[i].active)
+            return false;
+    }
+    for (int i = 0; i < MAX_PARTICLES; i++)
+    {
+        if (game->particles[i].active)
+            return false;
+    }
+    return true;
+}
+
+// Function to run one step of a match: its pending inputs, then
+// update_game. Runs on a pool worker; the match is parked once idle.
+static void server_step_match(void *context, int task)
+{
+    ServerMatch *match = &((Server *)context)->matches[task];
+    Game *game = match->game;
+    double start = now_ms();
+
+    match->applied_count = 0;
+    for (int k = 0; k < match->pending_count; k++)
+    {
+        NetAction *a = &match->pending[k];
+        if (seat_may_act(game, a->seat, (GameAction)a->action))
+        {
+            apply_action(game, (GameAction)a->action);
+            match->applied[match->applied_count++] = *a;
+        }
+    }
+    match->pending_count = 0;
+    update_game(game);
+    match->parked = game_is_idle(game);
+
+    double elapsed = now_ms() - start;
+    match->step_ms[match->steps % MATCH_STEP_SAMPLES] = elapsed;
+    match->step_ms_total += elapsed;
+    match->steps++;
+}
+
+// Function to send every seated client of a match the step it just ran
+static void server_send_step(Server *server, ServerMatch *match)
+{
+    NetStep step = {match->game->step, match->game->rng_state, 0, match->applied_count};
+    for (int seat = 0; seat < MATCH_SEATS; seat++)
+    {
+        if (match->seats[seat] < 0)
+            continue;
+        ServerClient *client = &server->clients[match->seats[seat]];
+        step.ack_seq = client->last_seq;
+        net_queue(&client->conn, MSG_STEP, &step, sizeof(step), match->applied,
+                  match->applied_count * sizeof(NetAction));
+    }
+}
+
+// Function to take a task: the worker's own newest, else the oldest of
+// another worker's. Returns -1 when every deque is empty.
+static int pool_take(WorkPool *pool, int worker)
+{
+    WorkQueue *own = &pool->queues[worker];
+    pthread_mutex_lock(&own->lock);
+    int task = own->tail > own->head ? own->tasks[--own->tail] : -1;
+    pthread_mutex_unlock(&own->lock);
+
+    for (int k = 1; task < 0 && k < pool->worker_count; k++)
+    {
+        WorkQueue *victim = &pool->queues[(worker + k) % pool->worker_count];
+        pthread_mutex_lock(&victim->lock);
+        if (victim->tail > victim->head)
+            task = victim->tasks[victim->head++];
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return task;
+}
+
+// Function run by each pool worker: wait for a batch, work through it
+// (stealing once out of work), then wait for the next one
+static void *pool_worker(void *arg)
+{
+    WorkerArgs *args = arg;
+    WorkPool *pool = args->pool;
+    int worker = args->index;
+    free(args);
+
+    uint64_t seen = 0;
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->batch == seen && !pool->stopping)
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        if (pool->stopping)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->batch;
+        pthread_mutex_unlock(&pool->lock);
+
+        int task;
+        while ((task = pool_take(pool, worker)) >= 0)
+        {
+            pool->run(pool->context, task);
+            if (atomic_fetch_sub(&pool->remaining, 1) == 1)
+            {
+                pthread_mutex_lock(&pool->lock);
+                pthread_cond_signal(&pool->batch_done);
+                pthread_mutex_unlock(&pool->lock);
+            }
+        }
+    }
+}
+
+// Function to start a pool of worker threads, each with room for
+// max_tasks queued tasks
+static bool pool_start(WorkPool *pool, int workers, int max_tasks, void (*run)(void *, int), void *context)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->worker_count = workers < 1 ? 1 : workers > POOL_MAX_WORKERS ? POOL_MAX_WORKERS : workers;
+    pool->run = run;
+    pool->context = context;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->batch_done, NULL);
+    for (int w = 0; w < pool->worker_count; w++)
+    {
+        pthread_mutex_init(&pool->queues[w].lock, NULL);
+        pool->queues[w].tasks = malloc(max_tasks * sizeof(int));
+        WorkerArgs *args = malloc(sizeof(WorkerArgs));
+        if (pool->queues[w].tasks == NULL || args == NULL)
+            return false;
+        *args = (WorkerArgs){pool, w};
+        pthread_create(&pool->threads[w], NULL, pool_worker, args);
+    }
+    return true;
+}
+
+// Function to run a batch of tasks on the pool and wait for all of them.
+// Task k starts on worker k % workers, so a match tends to stay on the
+// same thread (and cache) from step to step.
+static void pool_run(WorkPool *pool, const int *tasks, int count)
+{
+    if (count == 0)
+        return;
+
+    // A worker still looking for work from the last batch may take these
+    // tasks as soon as they are queued, so the count goes first and the
+    // deques are filled under their locks
+    atomic_store(&pool->remaining, count);
+    for (int w = 0; w < pool->worker_count; w++)
+    {
+        pthread_mutex_lock(&pool->queues[w].lock);
+        pool->queues[w].head = pool->queues[w].tail = 0;
+    }
+    for (int k = 0; k < count; k++)
+    {
+        WorkQueue *queue = &pool->queues[tasks[k] % pool->worker_count];
+        queue->tasks[queue->tail++] = tasks[k];
+    }
+    for (int w = 0; w < pool->worker_count; w++)
+    {
+        pthread_mutex_unlock(&pool->queues[w].lock);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->batch++;
+    pthread_cond_broadcast(&pool->work_ready);
+    while (atomic_load(&pool->remaining) > 0)
+        pthread_cond_wait(&pool->batch_done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Function to stop the pool's workers
+static void pool_stop(WorkPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+    for (int w = 0; w < pool->worker_count; w++)
+    {
+        pthread_join(pool->threads[w], NULL);
+        free(pool->queues[w].tasks);
+    }
+}
+
+// Function to step every match that is due: seated (or always, with
+// no_seats_needed) and not parked, or parked with input waiting
+static int server_step_due_matches(Server *server, bool no_seats_needed)
+{
+    int count = 0;
+    for (int m = 0; m < server->match_count; m++)
+    {
+        ServerMatch *match = &server->matches[m];
+        bool occupied = no_seats_needed;
+        for (int seat = 0; seat < MATCH_SEATS; seat++)
+            occupied |= match->seats[seat] >= 0;
+        if (occupied && (!match->parked || match->pending_count > 0))
+            server->due[count++] = m;
+    }
+    pool_run(&server->pool, server->due, count);
+    return count;
+}
+
+// Function to create a server's matches (match m seeded with seed + m) and
+// worker pool
+static bool server_start(Server *server, int match_count, int threads, uint32_t seed)
+{
+    server->match_count = match_count;
+    server->matches = calloc(match_count, sizeof(ServerMatch));
+    server->due = malloc(match_count * sizeof(int));
+    if (server->matches == NULL || server->due == NULL)
+        return false;
+    for (int m = 0; m < match_count; m++)
+    {
+        ServerMatch *match = &server->matches[m];
+        match->game = calloc(1, sizeof(Game));
+        if (match->game == NULL)
+            return false;
+        seed_game_rand(match->game, seed + m);
+        init_game(match->game);
+        match->parked = game_is_idle(match->game);
+        for (int seat = 0; seat < MATCH_SEATS; seat++)
+            match->seats[seat] = -1;
+    }
+    return pool_start(&server->pool, threads, match_count, server_step_match, server);
+}
+
+// Function to free a server's matches and stop its pool
+static void server_stop(Server *server)
+{
+    pool_stop(&server->pool);
+    for (int m = 0; m < server->match_count; m++)
+        free(server->matches[m].game);
+    free(server->matches);
+    free(server->due);
+}
+
+// Function to print step time percentiles over all matches, and the matches
+// with the slowest recent steps
+static void server_report_steps(Server *server)
+{
+    int sample_count = 0;
+    uint64_t steps = 0;
+    double total = 0;
+    for (int m = 0; m < server->match_count; m++)
+    {
+        ServerMatch *match = &server->matches[m];
+        steps += match->steps;
+        total += match->step_ms_total;
+        sample_count += match->steps < MATCH_STEP_SAMPLES ? match->steps : MATCH_STEP_SAMPLES;
+    }
+    if (steps == 0)
+        return;
+
+    double *samples = malloc(sample_count * sizeof(double));
+    double *match_p99 = malloc(server->match_count * sizeof(double));
+    int *order = malloc(server->match_count * sizeof(int));
+    int n = 0, parked = 0;
+    for (int m = 0; m < server->match_count; m++)
+    {
+        ServerMatch *match = &server->matches[m];
+        int count = match->steps < MATCH_STEP_SAMPLES ? match->steps : MATCH_STEP_SAMPLES;
+        double own[MATCH_STEP_SAMPLES];
+        for (int k = 0; k < count; k++)
+            samples[n++] = own[k] = match->step_ms[k];
+        qsort(own, count, sizeof(double), compare_doubles);
+        match_p99[m] = count > 0 ? own[(count - 1) * 99 / 100] : 0;
+        order[m] = m;
+        parked += match->parked;
+    }
+    qsort(samples, n, sizeof(double), compare_doubles);
+    printf("Steps: %llu over %d matches (%d parked now), avg %.3f ms  p50 %.3f ms  p99 %.3f ms  max %.3f ms\n",
+           (unsigned long long)steps, server->match_count, parked, total / steps, samples[n / 2],
+           samples[(n - 1) * 99 / 100], samples[n - 1]);
+
+    // Slowest matches by their own p99
+    for (int a = 0; a < server->match_count && a < 5; a++)
+    {
+        for (int b = a + 1; b < server->match_count; b++)
+        {
+            if (match_p99[order[b]] > match_p99[order[a]])
+            {
+                int t = order[a];
+                order[a] = order[b];
+                order[b] = t;
+            }
+        }
+        ServerMatch *match = &server->matches[order[a]];
+        printf("  match %4d: %llu steps, p99 %.3f ms\n", order[a], (unsigned long long)match->steps, match_p99[order[a]]);
+    }
+    free(samples);
+    free(match_p99);
+    free(order);
+}
+
+// Function to drop a client and free its seat
+static void server_drop_client(Server *server, int index)
+{
+    ServerClient *client = &server->clients[index];
+    if (client->match >= 0)
+        server->matches[client->match].seats[client->seat] = -1;
+    net_close(&client->conn);
+    client->match = -1;
+    client->used = false;
+}
+
+static volatile sig_atomic_t server_stopping;
+
+// Function to stop the server loop from a signal
+static void stop_server(int signal_number)
+{
+    (void)signal_number;
+    server_stopping = 1;
+}
+
+// Function to run a dedicated server: match_count matches stepped at 60 Hz
+// on one event loop, each stepping only while someone is seated. Runs for
+// the given number of seconds (forever if 0) and reports what one core
+// sustains.
+static int run_server(const char *address, int match_count, int threads, uint32_t seed, double seconds)
+{
+    Server *server = calloc(1, sizeof(Server));
+    int listen_fd = net_open(address, true);
+    if (server == NULL || listen_fd < 0 || !server_start(server, match_count, threads, seed))
+    {
+        fprintf(stderr, "Cannot listen on %s\n", address);
+        return 1;
+    }
+
+    int epoll_fd = epoll_create1(0);
+    struct epoll_event ev = {.events = EPOLLIN, .data.u32 = UINT32_MAX};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+    printf("Serving %d matches on %s with %d threads\n", match_count, address, server->pool.worker_count);
+    struct sigaction sa = {0};
+    sa.sa_handler = stop_server;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    double start = now_ms();
+    double next_step = start;
+    uint64_t match_steps = 0;
+    struct timespec cpu_start;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+    while (!server_stopping && (seconds <= 0 || now_ms() - start < seconds * 1000))
+    {
+        struct epoll_event events[64];
+        int timeout = (int)fmax(0, ceil(next_step - now_ms()));
+        int n = epoll_wait(epoll_fd, events, 64, timeout);
+        for (int e = 0; e < n; e++)
+        {
+            if (events[e].data.u32 == UINT32_MAX)
+            {
+                // New connections
+                int fd;
+                while ((fd = accept(listen_fd, NULL, NULL)) >= 0)
+                {
+                    int index = 0;
+                    while (index < SERVER_MAX_CLIENTS && server->clients[index].used)
+                        index++;
+                    if (index == SERVER_MAX_CLIENTS)
+                    {
+                        close(fd);
+                        continue;
+                    }
+                    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                    int one = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    ServerClient *client = &server->clients[index];
+                    net_init_connection(&client->conn, fd);
+                    client->used = true;
+                    client->closing = false;
+                    client->match = -1;
+                    client->last_seq = 0;
+                    struct epoll_event client_ev = {.events = EPOLLIN, .data.u32 = index};
+                    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &client_ev);
+                }
+                continue;
+            }
+
+            int index = events[e].data.u32;
+            ServerClient *client = &server->clients[index];
+            bool alive = net_receive(&client->conn);
+            server_handle_client(server, index);
+            if (!alive || client->closing || client->conn.broken || !net_flush(&client->conn))
+                server_drop_client(server, index);
+        }
+
+        // Step the occupied, unparked matches on the pool when the next step is due
+        if (now_ms() >= next_step)
+        {
+            int stepped = server_step_due_matches(server, false);
+            for (int k = 0; k < stepped; k++)
+                server_send_step(server, &server->matches[server->due[k]]);
+            match_steps += stepped;
+            for (int i = 0; i < SERVER_MAX_CLIENTS; i++)
+            {
+                if (server->clients[i].used && !net_flush(&server->clients[i].conn))
+                    server_drop_client(server, i);
+            }
+
+            next_step += NET_STEP_MS;
+            if (now_ms() - next_step > 5 * NET_STEP_MS)
+                next_step = now_ms(); // Too far behind: skip rather than burst
+        }
+    }
+
+    // Report: a core can keep this many active matches at 60 steps per second
+    struct timespec cpu_end;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+    double cpu_ms = (cpu_end.tv_sec - cpu_start.tv_sec) * 1000.0 + (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1e6;
+    server_report_steps(server);
+    if (match_steps > 0)
+    {
+        double per_step = cpu_ms / match_steps;
+        printf("Server: %.3f ms CPU per match step (network included) -> %.0f active matches per core at 60 Hz\n",
+               per_step, NET_STEP_MS / per_step);
+    }
+
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++)
+    {
+        if (server->clients[i].used)
+            server_drop_client(server, i);
+    }
+    server_stop(server);
+    free(server);
+    close(epoll_fd);
+    close(listen_fd);
+    if (strncmp(address, "tcp:", 4) != 0)
+        unlink(strncmp(address, "unix:", 5) == 0 ? address + 5 : address);
+    return 0;
+}
+
+// Function to connect to a server and join a match (UINT32_MAX for any).
+// Blocks until the welcome snapshot is loaded into game.
+static bool net_client_connect(NetClient *client, Game *game, const char *address, uint32_t match)
+{
+    memset(client, 0, sizeof(*client));
+    int fd = net_open(address, false);
+    if (fd < 0)
+        return false;
+    net_init_connection(&client->conn, fd);
+    net_queue(&client->conn, MSG_JOIN, &match, sizeof(match), NULL, 0);
+
+    double deadline = now_ms() + 5000;
+    while (now_ms() < deadline)
+    {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (!net_flush(&client->conn))
+            break;
+        poll(&pfd, 1, 100);
+        if (!net_receive(&client->conn))
+            break;
+        NetMessageType type;
+        const unsigned char *payload;
+        size_t len;
+        if (net_next_message(&client->conn, &type, &payload, &len) && type == MSG_WELCOME && len >= sizeof(NetWelcome))
+        {
+            NetWelcome welcome;
+            memcpy(&welcome, payload, sizeof(welcome));
+            if (!read_snapshot(game, payload + sizeof(welcome), len - sizeof(welcome)))
+                break;
+            client->match = welcome.match;
+            client->seat = welcome.seat;
+            client->active = true;
+            return true;
+        }
+    }
+    net_close(&client->conn);
+    return false;
+}
+
+// Function to send an action to the server; it takes effect when the
+// server's step including it comes back
+static void net_client_send_action(NetClient *client, GameAction action)
+{
+    NetInput input = {++client->next_seq, action};
+    client->sent_ms[input.seq % NET_LATENCY_SLOTS] = now_ms();
+    net_queue(&client->conn, MSG_INPUT, &input, sizeof(input), NULL, 0);
+    if (!net_flush(&client->conn))
+        client->active = false;
+}
+
+// Function to apply the steps the server has sent. Each step replays the
+// server's actions and runs update_game, then checks the random generator
+// state against the server's; a mismatch requests a fresh snapshot.
+static int net_client_poll(NetClient *client, Game *game)
+{
+    if (!net_receive(&client->conn) || !net_flush(&client->conn))
+    {
+        client->active = false;
+        return 0;
+    }
+
+    int steps = 0;
+    NetMessageType type;
+    const unsigned char *payload;
+    size_t len;
+    while (net_next_message(&client->conn, &type, &payload, &len))
+    {
+        if (type == MSG_SNAPSHOT)
+        {
+            client->awaiting_resync = !read_snapshot(game, payload, len);
+        }
+        else if (type == MSG_STEP && len >= sizeof(NetStep) && !client->awaiting_resync)
+        {
+            NetStep step;
+            memcpy(&step, payload, sizeof(step));
+            if (len != sizeof(step) + step.action_count * sizeof(NetAction))
+                continue;
+            const NetAction *actions = (const NetAction *)(payload + sizeof(step));
+            for (int k = 0; k < step.action_count; k++)
+                apply_action(game, (GameAction)actions[k].action);
+            update_game(game);
+            steps++;
+
+            if (step.ack_seq > client->acked_seq && step.ack_seq <= client->next_seq)
+            {
+                client->latency_ms = now_ms() - client->sent_ms[step.ack_seq % NET_LATENCY_SLOTS];
+                client->acked_seq = step.ack_seq;
+            }
+            if (game->step != step.step || game->rng_state != step.rng_state)
+            {
+                client->desyncs++;
+                client->awaiting_resync = true;
+                net_queue(&client->conn, MSG_RESYNC, NULL, 0, NULL, 0);
+            }
+        }
+    }
+    if (!net_flush(&client->conn))
+        client->active = false;
+    return steps;
+}
+
+// Function to run bot clients against a server for a while: bot_count
+// connections that join any match and press random keys, plus one full
+// lockstep client that simulates along and checks for desyncs. Reports the
+// input-to-step latency percentiles.
+static int run_net_bots(const char *address, int bot_count, double seconds)
+{
+    enum { MAX_SAMPLES = 200000 };
+    static double latency[MAX_SAMPLES];
+    int samples = 0;
+
+    NetClient *bots = calloc(bot_count, sizeof(NetClient));
+    Game *scratch = malloc(sizeof(Game));
+    Game *lockstep_game = calloc(1, sizeof(Game));
+    NetClient lockstep;
+    if (bots == NULL || scratch == NULL || lockstep_game == NULL)
+        return 1;
+    int connected = 0;
+    for (int b = 0; b < bot_count; b++)
+        connected += net_client_connect(&bots[b], scratch, address, UINT32_MAX);
+    free(scratch);
+    bool have_lockstep = net_client_connect(&lockstep, lockstep_game, address, UINT32_MAX);
+    printf("Bots: %d of %d connected%s\n", connected, bot_count, have_lockstep ? ", plus a lockstep client" : "");
+
+    static const GameAction keys[] = {ACTION_ANGLE_UP, ACTION_ANGLE_DOWN, ACTION_POWER_UP, ACTION_POWER_DOWN,
+                                      ACTION_NEXT_WEAPON, ACTION_FIRE};
+    uint32_t rng = 12345;
+    double start = now_ms();
+    double *next_press = calloc(bot_count, sizeof(double));
+    int lockstep_steps = 0;
+    while (now_ms() - start < seconds * 1000)
+    {
+        double now = now_ms();
+        for (int b = 0; b < bot_count; b++)
+        {
+            NetClient *bot = &bots[b];
+            if (!bot->active)
+                continue;
+            if (now >= next_press[b])
+            {
+                net_client_send_action(bot, keys[xorshift32(&rng) % (sizeof(keys) / sizeof(keys[0]))]);
+                next_press[b] = now + 50 + xorshift32(&rng) % 450;
+            }
+
+            // Bots only read acknowledgements; they do not simulate
+            if (!net_receive(&bot->conn))
+            {
+                bot->active = false;
+                continue;
+            }
+            NetMessageType type;
+            const unsigned char *payload;
+            size_t len;
+            while (net_next_message(&bot->conn, &type, &payload, &len))
+            {
+                NetStep step;
+                if (type != MSG_STEP || len < sizeof(step))
+                    continue;
+                memcpy(&step, payload, sizeof(step));
+                while (bot->acked_seq < step.ack_seq && bot->acked_seq < bot->next_seq)
+                {
+                    bot->acked_seq++;
+                    if (samples < MAX_SAMPLES)
+                        latency[samples++] = now_ms() - bot->sent_ms[bot->acked_seq % NET_LATENCY_SLOTS];
+                }
+            }
+        }
+        if (have_lockstep && lockstep.active)
+            lockstep_steps += net_client_poll(&lockstep, lockstep_game);
+        usleep(1000);
+    }
+
+    if (samples > 0)
+    {
+        qsort(latency, samples, sizeof(double), compare_doubles);
+        printf("Input latency over %d inputs: p50 %.2f ms  p99 %.2f ms  max %.2f ms\n", samples,
+               latency[samples / 2], latency[(samples - 1) * 99 / 100], latency[samples - 1]);
+    }
+    if (have_lockstep)
+        printf("Lockstep client: %d steps, %d desyncs\n", lockstep_steps, lockstep.desyncs);
+
+    for (int b = 0; b < bot_count; b++)
+        net_close(&bots[b].conn);
+    if (have_lockstep)
+        net_close(&lockstep.conn);
+    free(next_press);
+    free(bots);
+    free(lockstep_game);
+    return have_lockstep && lockstep.desyncs == 0 ? 0 : 1;
+}
+
+// Function to measure a local server: a server process hosting the matches
+// and a bot process filling every seat, talking over a Unix socket
+static int run_net_benchmark(int match_count, int threads, double seconds)
+{
+    char address[64];
+    snprintf(address, sizeof(address), "unix:/tmp/artillery-bench-%d.sock", (int)getpid());
+
+    fflush(stdout);
+    pid_t server_pid = fork();
+    if (server_pid == 0)
+        exit(run_server(address, match_count, threads, (uint32_t)time(NULL), seconds + 1));
+
+    // Give the server a moment to listen
+    usleep(200000);
+    int status = run_net_bots(address, match_count * MATCH_SEATS - 1, seconds);
+    int server_status;
+    waitpid(server_pid, &server_status, 0);
+    return status;
+}
+
+// Function to run the multi-match host without networking for a number of
+// ticks, as fast as it goes, with scripted players feeding the matches.
+// Returns the wall time and a checksum of the final match states.
+static double run_host_ticks(Server *server, int ticks, uint32_t *checksum)
+{
+    static const GameAction aims[] = {ACTION_ANGLE_UP, ACTION_ANGLE_DOWN, ACTION_POWER_UP, ACTION_NEXT_WEAPON};
+    uint32_t rng = 777;
+    double start = now_ms();
+    for (int t = 0; t < ticks; t++)
+    {
+        // A few players per tick adjust their aim and fire; most matches idle
+        for (int m = 0; m < server->match_count; m++)
+        {
+            ServerMatch *match = &server->matches[m];
+            if (xorshift32(&rng) % 200 != 0)
+                continue;
+            GameAction action = xorshift32(&rng) % 3 == 0 ? ACTION_FIRE : aims[xorshift32(&rng) % 4];
+            if (match->game->state == STATE_GAME_OVER)
+                action = ACTION_RESET;
+            int seat = match->game->current_player % MATCH_SEATS;
+            match->pending[match->pending_count++] = (NetAction){action, action == ACTION_RESET ? 0 : seat};
+        }
+        server_step_due_matches(server, true);
+    }
+    double elapsed = now_ms() - start;
+
+    *checksum = 0;
+    for (int m = 0; m < server->match_count; m++)
+        *checksum = *checksum * 31 + server->matches[m].game->rng_state + server->matches[m].game->step;
+    return elapsed;
+}
+
+// Function to measure how the multi-match host scales with threads: the
+// same matches and inputs are run with 1, 2, 4, ... threads up to the core
+// count, and every run must end in the same state
+static int run_host_benchmark(int match_count, int ticks)
+{
+    int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    double base_ms = 0;
+    uint32_t base_checksum = 0;
+    bool identical = true;
+
+    // One seed for every thread count, so their results can be compared
+    uint32_t seed = (uint32_t)time(NULL);
+    printf("Host: %d matches, %d ticks, %d cores, seed %u\n", match_count, ticks, cores, seed);
+    for (int threads = 1;; threads = threads * 2 > cores && threads < cores ? cores : threads * 2)
+    {
+        Server *server = calloc(1, sizeof(Server));
+        if (server == NULL || !server_start(server, match_count, threads, seed))
+            return 1;
+        uint32_t checksum;
+        double ms = run_host_ticks(server, ticks, &checksum);
+        if (threads == 1)
+        {
+            base_ms = ms;
+            base_checksum = checksum;
+        }
+        identical &= checksum == base_checksum;
+
+        uint64_t steps = 0;
+        for (int m = 0; m < match_count; m++)
+            steps += server->matches[m].steps;
+        printf("%2d threads: %8.1f ms  %9.0f match steps/s  speedup %.2fx  (%.1f%% of match ticks parked)\n", threads, ms,
+               steps / (ms / 1000), base_ms / ms, 100.0 * (1 - (double)steps / ((double)match_count * ticks)));
+        server_report_steps(server);
+        server_stop(server);
+        free(server);
+        if (threads >= cores)
+            break;
+    }
+    printf("Results identical across thread counts: %s\n", identical ? "yes" : "NO");
+    return identical ? 0 : 1;
+}
+
+// Function run by the metrics thread: answer every connection with the
+// current metrics as a plain-text HTTP response, then close it
+static void *metrics_thread(void *arg)
+{
+    (void)arg;
+    static char body[METRICS_MAX_TEXT];
+    while (!atomic_load(&metrics.stopping))
+    {
+        struct pollfd pfd = {.fd = metrics.listen_fd, .events = POLLIN};
+        if (poll(&pfd, 1, 200) <= 0)
+            continue;
+        int fd = accept(metrics.listen_fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+
+        // The request itself does not matter; read what has arrived of it
+        char request[1024];
+        struct pollfd cfd = {.fd = fd, .events = POLLIN};
+        if (poll(&cfd, 1, 100) > 0)
+        {
+            ssize_t got = recv(fd, request, sizeof(request), 0);
+            (void)got;
+        }
+
+        size_t len = metrics_format(body, sizeof(body));
+        char header[160];
+        int header_len = snprintf(header, sizeof(header),
+                                  "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                  "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                                  len);
+        if (send(fd, header, header_len, MSG_NOSIGNAL) == header_len)
+        {
+            for (size_t sent = 0; sent < len;)
+            {
+                ssize_t n = send(fd, body + sent, len - sent, MSG_NOSIGNAL);
+                if (n <= 0)
+                    break;
+                sent += n;
+            }
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+// Function to serve metrics on address (tcp:PORT on localhost, or
+// unix:PATH) from a background thread
+static bool metrics_serve(const char *address)
+{
+    metrics.listen_fd = net_open(address, true);
+    if (metrics.listen_fd < 0)
+        return false;
+    fcntl(metrics.listen_fd, F_SETFL, fcntl(metrics.listen_fd, F_GETFL) & ~O_NONBLOCK);
+    atomic_store(&metrics.stopping, false);
+    if (pthread_create(&metrics.thread, NULL, metrics_thread, NULL) != 0)
+    {
+        close(metrics.listen_fd);
+        return false;
+    }
+    return true;
+}
+
+// Function to stop serving metrics
+static void metrics_stop(void)
+{
+    atomic_store(&metrics.stopping, true);
+    pthread_join(metrics.thread, NULL);
+    close(metrics.listen_fd);
+}
+#else
+// Function to serve metrics (the endpoint needs Linux)
+static bool metrics_serve(const char *address)
+{
+    (void)address;
+    return false;
+}
+
+// Function to stop serving metrics
+static void metrics_stop(void)
+{
+}
+#endif
+
+#ifndef ARTILLERY_HEADLESS
+
+// Structure for one visual quality level
+typedef struct
+{
+    const char *name;
+    int decoration_step;  // Decorate every Nth column (0 = no grass, rocks or soil)
+    int soil_specks;      // Soil specks per decorated column
+    bool contours;
+    bool shadows;
+    int particle_stride;  // Draw every Nth particle
+    int explosion_stops;  // Gradient stops per explosion (0 = flat fill)
+    double outline_error; // Most the drawn surface may stray from the terrain, in device pixels
+} QualityLevel;
+
+#define QUALITY_LEVEL_COUNT 4
+
+// Quality levels, lowest first
+static const QualityLevel quality_levels[QUALITY_LEVEL_COUNT] = {
+    {"Minimal", 0, 0, false, false, 4, 0, 1.0},
+    {"Low", 4, 1, false, true, 2, 2, 0.5},
+    {"Medium", 2, 2, true, true, 1, 3, 0.35},
+    {"High", 1, 3, true, true, 1, 3, 0.25},
+};
+
+// Structure for the part of an atlas cell a sprite covers, in device pixels
+// from the cell's corner (empty when x1 <= x0)
+typedef struct
+{
+    int16_t x0, y0, x1, y1;
+} SpriteBounds;
+
+// Rendering state kept between frames
+typedef struct
+{
+    cairo_surface_t *terrain_layer; // Terrain and its decorations, transparent sky
+    double terrain_layer_scale;     // Device pixels per world unit in the layer
+    cairo_surface_t *offscreen;     // Reduced-resolution frame when render_scale < 1
+    int offscreen_width, offscreen_height;
+    double render_scale;            // Internal resolution, MIN_RENDER_SCALE..MAX_RENDER_SCALE
+    TerrainOutline outline;         // Surface drawn into the layer, at the quality level's tolerance
+    cairo_surface_t *atlas;         // Prebuilt tanks and shells (see build_sprite_atlas)
+    cairo_pattern_t *atlas_pattern; // The atlas as a source, moved onto each sprite
+    double atlas_scale;             // Device pixels per world unit in the atlas
+    int atlas_cell;                 // Cell size in device pixels
+    SpriteBounds *sprite_bounds;    // Drawn part of each cell, row by row
+    const QualityLevel *quality;    // Detail to draw at
+    bool window;                    // Draw the window's status lines (quality, render scale, replay)
+} RenderCache;
+
+// The window's cache; video export keeps one per worker
+static RenderCache render_cache = {.render_scale = 1.0, .window = true};
+
+// Structure for the governor that trades visual detail for frame time.
+// It only changes what is drawn, never the simulation.
+typedef struct
+{
+    int level;                          // Index into quality_levels
+    gint64 last_frame_time;             // Frame clock time of the previous tick, in us
+    double frame_ms[QUALITY_WINDOW];    // Recent frame intervals
+    int frame_count;                    // Valid entries in frame_ms
+    int frame_next;                     // Ring position of the next entry
+    double average_ms;
+    int on_time_frames;                 // Consecutive frames within budget
+    int up_frames;                      // On-time frames needed to raise the level
+    int cooldown;                       // Frames left before another change
+    int frames_since_raise;
+} QualityGovernor;
+
+static QualityGovernor quality = {.level = QUALITY_LEVEL_COUNT - 1, .up_frames = QUALITY_UP_FRAMES};
+
+// Function to get the active quality level
+static const QualityLevel *current_quality(void)
+{
+    return &quality_levels[quality.level];
+}
+
+// Function to switch quality level; the cached terrain is redrawn at the new detail
+static void set_quality_level(Game *game, int level)
+{
+    quality.level = level;
+    quality.frame_count = 0;
+    quality.frame_next = 0;
+    quality.on_time_frames = 0;
+    quality.cooldown = QUALITY_COOLDOWN;
+    mark_terrain_dirty(game, 0, TERRAIN_SEGMENTS - 1);
+}
+
+// Function to feed the governor one frame clock timestamp. A level is
+// dropped as soon as a full window averages over budget, but only raised
+// after a long run of on-time frames; the wait doubles whenever a raise is
+// quickly undone, so a level that cannot be sustained is not retried often.
+static void update_quality_governor(Game *game, gint64 frame_time)
+{
+    gint64 last = quality.last_frame_time;
+    quality.last_frame_time = frame_time;
+    double interval = (frame_time - last) / 1000.0;
+    if (last == 0 || interval <= 0 || interval > 250)
+    {
+        // First frame, or the window was hidden: nothing to judge
+        quality.frame_count = 0;
+        quality.on_time_frames = 0;
+        return;
+    }
+
+    metrics_time(&metrics_thread_block()->frame_time, interval);
+    quality.frame_ms[quality.frame_next] = interval;
+    quality.frame_next = (quality.frame_next + 1) % QUALITY_WINDOW;
+    if (quality.frame_count < QUALITY_WINDOW)
+        quality.frame_count++;
+    double sum = 0;
+    for (int i = 0; i < quality.frame_count; i++)
+        sum += quality.frame_ms[i];
+    quality.average_ms = sum / quality.frame_count;
+
+    if (interval <= FRAME_BUDGET_MS * QUALITY_UP_FACTOR)
+        quality.on_time_frames++;
+    else
+        quality.on_time_frames = 0;
+    quality.frames_since_raise++;
+
+    if (quality.cooldown > 0)
+    {
+        quality.cooldown--;
+        return;
+    }
+
+    if (quality.frame_count == QUALITY_WINDOW && quality.average_ms > FRAME_BUDGET_MS * QUALITY_DOWN_FACTOR &&
+        quality.level > 0)
+    {
+        if (quality.frames_since_raise < 2 * quality.up_frames && quality.up_frames < QUALITY_MAX_UP_FRAMES)
+            quality.up_frames *= 2;
+        set_quality_level(game, quality.level - 1);
+    }
+    else if (quality.on_time_frames >= quality.up_frames && quality.level < QUALITY_LEVEL_COUNT - 1)
+    {
+        quality.frames_since_raise = 0;
+        set_quality_level(game, quality.level + 1);
+    }
+}
+
+// Structure for the camera mapping world units onto the window
+typedef struct
+{
+    double scale;              // Window pixels per world unit
+    double offset_x, offset_y; // Window position of the world origin
+} Camera;
+
+// Function to set the internal render scale (clamped to 50-100%)
+static void set_render_scale(double scale)
+{
+    if (scale < MIN_RENDER_SCALE)
+        scale = MIN_RENDER_SCALE;
+    if (scale > MAX_RENDER_SCALE)
+        scale = MAX_RENDER_SCALE;
+    render_cache.render_scale = scale;
+}
+
+// Function to step the internal render scale up or down
+static void adjust_render_scale(double delta)
+{
+    set_render_scale(render_cache.render_scale + delta);
+}
+
+// Function to fit the whole world into the window, letterboxed, with the
+// world origin on a device pixel
+static Camera fit_camera(int width, int height, double pixel_scale)
+{
+    Camera cam;
+    cam.scale = fmin((double)width / WORLD_WIDTH, (double)height / WORLD_HEIGHT);
+    cam.offset_x = round((width - WORLD_WIDTH * cam.scale) / 2 * pixel_scale) / pixel_scale;
+    cam.offset_y = round((height - WORLD_HEIGHT * cam.scale) / 2 * pixel_scale) / pixel_scale;
+    return cam;
+}
+
+// Function to get a pseudo-random number for a terrain column. Decorations
+// depend only on their column, so any span can be redrawn on its own.
+static unsigned int decoration_rand(int column, int salt)
+{
+    unsigned int h = (unsigned int)column * 2654435761u ^ (unsigned int)salt * 40503u;
+    h ^= h >> 15;
+    h *= 2246822519u;
+    h ^= h >> 13;
+    h *= 3266489917u;
+    h ^= h >> 16;
+    return h;
+}
+
+// Structure for the decorations of one terrain column, relative to the
+// surface. They depend only on the column, so they are worked out once.
+typedef struct
+{
+    bool grass;
+    float grass_dx, grass_height; // Blade tip offset from its root
+    bool rock;
+    float rock_size;
+    float speck_dx[MAX_SOIL_SPECKS], speck_dy[MAX_SOIL_SPECKS];
+} ColumnDecoration;
+
+// Structure for every column's decorations, with the grass blades and
+// rocks sorted by color so each color is drawn as one path. Colors are kept
+// in order of the first column using them.
+typedef struct
+{
+    bool built;
+    ColumnDecoration columns[TERRAIN_SEGMENTS];
+    double grass_colors[TERRAIN_SEGMENTS][3];
+    double rock_colors[TERRAIN_SEGMENTS][3];
+    int grass_color_count, rock_color_count;
+    uint16_t grass_columns[TERRAIN_SEGMENTS]; // Columns with grass, by color then column
+    uint16_t rock_columns[TERRAIN_SEGMENTS];
+    int grass_start[TERRAIN_SEGMENTS + 1]; // Color c is grass_columns[grass_start[c]..grass_start[c+1])
+    int rock_start[TERRAIN_SEGMENTS + 1];
+} DecorationTable;
+
+static DecorationTable decorations;
+
+// Function to get the index of a color in a list, adding it if new
+static int decoration_color(double colors[][3], int *count, double r, double g, double b)
+{
+    for (int c = 0; c < *count; c++)
+    {
+        if (colors[c][0] == r && colors[c][1] == g && colors[c][2] == b)
+            return c;
+    }
+    colors[*count][0] = r;
+    colors[*count][1] = g;
+    colors[*count][2] = b;
+    return (*count)++;
+}
+
+// Function to sort a list of columns by color (counting sort, so each
+// color keeps its columns in order)
+static void sort_decoration_columns(const uint16_t *color_of, const bool *present, int color_count,
+                                    uint16_t *columns, int *start)
+{
+    memset(start, 0, (color_count + 1) * sizeof(int));
+    for (int i = 0; i < TERRAIN_SEGMENTS; i++)
+    {
+        if (present[i])
+            start[color_of[i] + 1]++;
+    }
+    for (int c = 0; c < color_count; c++)
+        start[c + 1] += start[c];
+    int next[TERRAIN_SEGMENTS];
+    memcpy(next, start, color_count * sizeof(int));
+    for (int i = 0; i < TERRAIN_SEGMENTS; i++)
+    {
+        if (present[i])
+            columns[next[color_of[i]]++] = i;
+    }
+}
+
+// Function to work out every column's decorations, once
+static void build_decorations(void)
+{
+    DecorationTable *t = &decorations;
+    uint16_t grass_color[TERRAIN_SEGMENTS], rock_color[TERRAIN_SEGMENTS];
+    bool has_grass[TERRAIN_SEGMENTS], has_rock[TERRAIN_SEGMENTS];
+
+    t->grass_color_count = t->rock_color_count = 0;
+    for (int i = 0; i < TERRAIN_SEGMENTS; i++)
+    {
+        ColumnDecoration *d = &t->columns[i];
+
+        // Grass: deterministic random based on position (prime numbers for better distribution)
+        d->grass = i < TERRAIN_SEGMENTS - 1 && (i * 7919) % 17 < 6;
+        double grass_angle = ((i * 4463) % 40 - 20) * PI / 180.0;
+        d->grass_height = 2 + ((i * 3779) % 4);
+        d->grass_dx = cos(grass_angle) * d->grass_height;
+        has_grass[i] = d->grass;
+        if (d->grass)
+        {
+            // Brighter, more varied greens
+            grass_color[i] = decoration_color(t->grass_colors, &t->grass_color_count,
+                                              0.2 + ((i * 1597) % 20) / 100.0, // Red component
+                                              0.6 + ((i * 2389) % 30) / 100.0, // Green component
+                                              0.1 + ((i * 3571) % 15) / 100.0); // Blue component
+        }
+
+        // Rocks
+        d->rock = decoration_rand(i, 0) % 20 == 0;
+        d->rock_size = 2 + (decoration_rand(i, 4) % 4);
+        has_rock[i] = d->rock;
+        if (d->rock)
+        {
+            rock_color[i] = decoration_color(t->rock_colors, &t->rock_color_count,
+                                             0.4 + (decoration_rand(i, 1) % 20) / 100.0,
+                                             0.3 + (decoration_rand(i, 2) % 20) / 100.0,
+                                             0.2 + (decoration_rand(i, 3) % 20) / 100.0);
+        }
+
+        // Soil texture
+        for (int j = 0; j < MAX_SOIL_SPECKS; j++)
+        {
+            d->speck_dx[j] = (decoration_rand(i, 5 + 2 * j) % 5) - 2.0;
+            d->speck_dy[j] = decoration_rand(i, 6 + 2 * j) % 10;
+        }
+    }
+
+    sort_decoration_columns(grass_color, has_grass, t->grass_color_count, t->grass_columns, t->grass_start);
+    sort_decoration_columns(rock_color, has_rock, t->rock_color_count, t->rock_columns, t->rock_start);
+    t->built = true;
+}
+
+// Function to draw the terrain and its decorations for segments from..to,
+// at the detail of the cache's quality level
+static void draw_terrain(RenderCache *cache, Game *game, cairo_t *cr, int from, int to)
+{
+    const QualityLevel *q = cache->quality;
+    const TerrainOutline *outline = &cache->outline;
+
+    if (from < 0)
+        from = 0;
+    if (to > TERRAIN_SEGMENTS - 1)
+        to = TERRAIN_SEGMENTS - 1;
+
+    // The surface runs through the outline's kept segments, from the kept
+    // ones either side of the span, so a strip matches a full redraw
+    int first = from, last = to;
+    while (!outline->keep[first])
+        first--;
+    while (!outline->keep[last])
+        last++;
+
+    // Create terrain path
+    double from_x = (double)first / TERRAIN_SEGMENTS * WORLD_WIDTH;
+    double to_x = (last == TERRAIN_SEGMENTS - 1) ? WORLD_WIDTH : (double)last / TERRAIN_SEGMENTS * WORLD_WIDTH;
+    cairo_move_to(cr, from_x, WORLD_HEIGHT);
+    for (int i = first; i <= last; i++)
+    {
+        if (!outline->keep[i])
+            continue;
+        double x = (double)i / TERRAIN_SEGMENTS * WORLD_WIDTH;
+        cairo_line_to(cr, x, game->terrain[i]);
+    }
+    cairo_line_to(cr, to_x, WORLD_HEIGHT);
+    cairo_close_path(cr);
+
+    // Draw terrain with gradient
+    cairo_pattern_t *terrain_gradient = cairo_pattern_create_linear(0, 0, 0, WORLD_HEIGHT);
+    cairo_pattern_add_color_stop_rgb(terrain_gradient, 0.0, 0.2, 0.5, 0.1); // Dark green top
+    cairo_pattern_add_color_stop_rgb(terrain_gradient, 0.3, 0.3, 0.6, 0.2); // Medium green middle
+    cairo_pattern_add_color_stop_rgb(terrain_gradient, 1.0, 0.1, 0.4, 0.1); // Deep green bottom
+    cairo_set_source(cr, terrain_gradient);
+    cairo_fill(cr);
+    cairo_pattern_destroy(terrain_gradient);
+
+    // Outline the surface in grass green
+    cairo_set_source_rgba(cr, 0.2, 0.6, 0.1, 0.9);
+    cairo_set_line_width(cr, 1.0);
+    for (int i = first; i <= last; i++)
+    {
+        if (!outline->keep[i])
+            continue;
+        double x = (double)i / TERRAIN_SEGMENTS * WORLD_WIDTH;
+        cairo_line_to(cr, x, game->terrain[i]);
+    }
+    cairo_stroke(cr);
+
+    // Decorations are drawn as one path per color: the grass blades of each
+    // color, the rocks of each color, then the soil, contours and shadows.
+    // Shapes sharing a path never overlap, so they blend exactly as they
+    // would drawn one by one; only which of two crossing blades (or a rock
+    // and a speck) ends up on top can differ from drawing column by column.
+    if (!decorations.built)
+        build_decorations();
+    const DecorationTable *t = &decorations;
+
+    // Add grass layer on top
+    int grass_step = q->decoration_step;
+    cairo_set_line_width(cr, 1.0);
+    for (int c = 0; grass_step > 0 && c < t->grass_color_count; c++)
+    {
+        bool any = false;
+        for (int k = t->grass_start[c]; k < t->grass_start[c + 1]; k++)
+        {
+            int i = t->grass_columns[k];
+            if (i < from || i > to || i % grass_step != 0)
+                continue;
+            const ColumnDecoration *d = &t->columns[i];
+            double x = (double)i / TERRAIN_SEGMENTS * WORLD_WIDTH;
+            double y = game->terrain[i];
+            cairo_move_to(cr, x, y);
+            cairo_line_to(cr, x + d->grass_dx, y - d->grass_height);
+            any = true;
+        }
+        if (!any)
+            continue;
+        cairo_set_source_rgba(cr, t->grass_colors[c][0], t->grass_colors[c][1], t->grass_colors[c][2], 0.9);
+        cairo_stroke(cr);
+    }
+
+    // Add terrain texture and details: rocks, then soil specks
+    int detail_step = 2 * q->decoration_step;
+    for (int c = 0; detail_step > 0 && c < t->rock_color_count; c++)
+    {
+        bool any = false;
+        for (int k = t->rock_start[c]; k < t->rock_start[c + 1]; k++)
+        {
+            int i = t->rock_columns[k];
+            if (i < from || i > to || i % detail_step != 0)
+                continue;
+            double x = (double)i / TERRAIN_SEGMENTS * WORLD_WIDTH;
+            double rock_size = t->columns[i].rock_size;
+            cairo_new_sub_path(cr);
+            cairo_arc(cr, x, game->terrain[i] - rock_size / 2, rock_size, 0, 2 * PI);
+            any = true;
+        }
+        if (!any)
+            continue;
+        cairo_set_source_rgba(cr, t->rock_colors[c][0], t->rock_colors[c][1], t->rock_colors[c][2], 0.7);
+        cairo_fill(cr);
+    }
+
+    // Specks can land on their column's other specks and on the next
+    // column's, so each path takes one speck from every other column and
+    // stacked specks still darken
+    int specks = q->soil_specks < MAX_SOIL_SPECKS ? q->soil_specks : MAX_SOIL_SPECKS;
+    cairo_set_source_rgba(cr, 0.2, 0.5, 0.1, 0.1); // Green soil texture
+    for (int pass = 0; detail_step > 0 && pass < 2 * specks; pass++)
+    {
+        int j = pass / 2, column_step = 2 * detail_step;
+        int first_column = (from + detail_step - 1) / detail_step * detail_step;
+        if ((first_column / detail_step) % 2 != pass % 2)
+            first_column += detail_step;
+        for (int i = first_column; i <= to; i += column_step)
+        {
+            const ColumnDecoration *d = &t->columns[i];
+            double x = (double)i / TERRAIN_SEGMENTS * WORLD_WIDTH;
+            double y = game->terrain[i];
+            if (y + d->speck_dy[j] < WORLD_HEIGHT)
+                cairo_rectangle(cr, x + d->speck_dx[j], y + d->speck_dy[j], 1, 1);
+        }
+        cairo_fill(cr);
+    }
+
+    // Add terrain contours, every other one per path as neighbours meet
+    cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.1);
+    cairo_set_line_width(cr, 0.5);
+    for (int pass = 0; q->contours && pass < 2; pass++)
+    {
+        for (int i = (from / 10 + pass) * 10; i < TERRAIN_SEGMENTS - 10 && i <= to; i += 20)
+        {
+            double x1 = (double)i / TERRAIN_SEGMENTS * WORLD_WIDTH;
+            double x2 = (double)(i + 10) / TERRAIN_SEGMENTS * WORLD_WIDTH;
+            double y1 = game->terrain[i];
+            double y2 = game->terrain[i + 10];
+
+            cairo_move_to(cr, x1, y1);
+            cairo_curve_to(cr,
+                           x1 + 3, y1,
+                           x2 - 3, y2,
+                           x2, y2);
+        }
+        cairo_stroke(cr);
+    }
+
+    // Add terrain shadows on rising slopes
+    cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.2);
+    for (int i = (from > 1 ? from : 1); q->shadows && i <= to; i++)
+    {
+        double x = (double)i / TERRAIN_SEGMENTS * WORLD_WIDTH;
+        double y = game->terrain[i];
+        double prev_y = game->terrain[i - 1];
+
+        if (y > prev_y)
+        {
+            cairo_move_to(cr, x, y);
+            cairo_line_to(cr, x, prev_y);
+        }
+    }
+    if (q->shadows)
+        cairo_stroke(cr);
+}
+
+// Function to bring the cached terrain layer up to date with the terrain's
+// dirty range: only that strip is cleared and redrawn. The layer is kept at
+// the output resolution, so a new window size or render scale rebuilds it.
+static void update_terrain_layer(RenderCache *cache, Game *game, double layer_scale)
+{
+    if (cache->terrain_layer == NULL || cache->terrain_layer_scale != layer_scale)
+    {
+        if (cache->terrain_layer != NULL)
+            cairo_surface_destroy(cache->terrain_layer);
+        cache->terrain_layer = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, (int)ceil(WORLD_WIDTH * layer_scale),
+                                                          (int)ceil(WORLD_HEIGHT * layer_scale));
+        cache->terrain_layer_scale = layer_scale;
+        mark_terrain_dirty(game, 0, TERRAIN_SEGMENTS - 1);
+    }
+    if (game->terrain_dirty_lo > game->terrain_dirty_hi)
+        return;
+
+    // Simplify the changed stretch of the surface to within the quality
+    // level's error at this resolution
+    update_terrain_outline(&cache->outline, game->terrain, game->terrain_dirty_lo, game->terrain_dirty_hi,
+                           cache->quality->outline_error / layer_scale);
+
+    // Widen the strip to whole contour curves (which join every 10th segment)
+    // and to the widest decoration (grass, rocks and soil reach ~6 px sideways)
+    int lo = (game->terrain_dirty_lo / 10) * 10 - 10;
+    int hi = (game->terrain_dirty_hi / 10) * 10 + 10;
+    double clip_left = (double)lo / TERRAIN_SEGMENTS * WORLD_WIDTH - 6;
+    double clip_right = (double)hi / TERRAIN_SEGMENTS * WORLD_WIDTH + 6;
+    game->terrain_dirty_lo = 1;
+    game->terrain_dirty_hi = 0;
+
+    cairo_t *cr = cairo_create(cache->terrain_layer);
+    cairo_scale(cr, layer_scale, layer_scale);
+    cairo_rectangle(cr, clip_left, 0, clip_right - clip_left, WORLD_HEIGHT);
+    cairo_clip(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+    cairo_paint(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+
+    // Decorations up to 6 px (3 segments) outside the strip can reach into it
+    draw_terrain(cache, game, cr, lo - 3, hi + 3);
+    cairo_destroy(cr);
+}
+
+// Tank colors, indexed by team (red and blue first, as in two-player games)
+#define TEAM_COLOR_COUNT 8
+static const double team_colors[TEAM_COLOR_COUNT][3] = {
+    {0.8, 0.2, 0.2}, // Red
+    {0.2, 0.2, 0.8}, // Blue
+    {0.9, 0.6, 0.1}, // Orange
+    {0.5, 0.2, 0.7}, // Purple
+    {0.1, 0.6, 0.6}, // Teal
+    {0.9, 0.4, 0.7}, // Pink
+    {0.4, 0.3, 0.1}, // Brown
+    {0.9, 0.9, 0.9}, // White
+};
+
+// Sprite atlas rows: a tank per team color with its barrel at each angle,
+// the drill at each angle, then the shells that need no rotation
+#define SPRITE_ROW_DRILL TEAM_COLOR_COUNT
+#define SPRITE_ROW_SHELLS (TEAM_COLOR_COUNT + 1)
+#define SPRITE_ROWS (TEAM_COLOR_COUNT + 2)
+
+// Shells in the last atlas row
+typedef enum
+{
+    SPRITE_SMALL_MISSILE,
+    SPRITE_BIG_MISSILE,
+    SPRITE_CLUSTER,
+    SPRITE_NUKE_RED, // The nuke blinks between the two
+    SPRITE_NUKE_YELLOW
+} ShellSprite;
+
+// Function to draw a shell with a glow around it, centered on the origin
+static void draw_glowing_shell(cairo_t *cr, double r, double g, double b, double radius)
+{
+    cairo_set_source_rgb(cr, r, g, b);
+    cairo_arc(cr, 0, 0, radius, 0, 2 * PI);
+    cairo_fill(cr);
+    cairo_set_source_rgba(cr, r, g, b, 0.3);
+    cairo_arc(cr, 0, 0, radius + 2, 0, 2 * PI);
+    cairo_fill(cr);
+}
+
+// Function to draw a blinking nuke with its radiation symbol, centered on the origin
+static void draw_nuke_shell(cairo_t *cr, double r, double g, double b)
+{
+    cairo_set_source_rgb(cr, r, g, b);
+    cairo_arc(cr, 0, 0, 6, 0, 2 * PI);
+    cairo_fill(cr);
+
+    cairo_set_source_rgb(cr, 0.0, 0.0, 0.0); // Black
+    double radius = 4;
+    for (int j = 0; j < 3; j++)
+    {
+        cairo_save(cr);
+        cairo_rotate(cr, j * (2 * PI / 3));
+        cairo_move_to(cr, 0, 0);
+        cairo_arc(cr, 0, -radius, radius / 2, 0, PI);
+        cairo_close_path(cr);
+        cairo_fill(cr);
+        cairo_restore(cr);
+    }
+}
+
+// Function to prebuild every tank and shell sprite at the output resolution.
+// Rotations are quantized to SPRITE_ANGLES, so each frame only copies cells
+// out of the atlas instead of building and filling paths.
+static void build_sprite_atlas(RenderCache *cache, double scale)
+{
+    if (cache->atlas != NULL && cache->atlas_scale == scale)
+        return;
+    if (cache->atlas != NULL)
+    {
+        cairo_pattern_destroy(cache->atlas_pattern);
+        cairo_surface_destroy(cache->atlas);
+    }
+
+    // Cells are whole device pixels, so every sprite sits on the same grid
+    int cell = (int)ceil(SPRITE_CELL * scale);
+    cache->atlas = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, SPRITE_ANGLES * cell, SPRITE_ROWS * cell);
+    cache->atlas_scale = scale;
+    cache->atlas_cell = cell;
+
+    cairo_t *cr = cairo_create(cache->atlas);
+    for (int row = 0; row < SPRITE_ROWS; row++)
+    {
+        for (int k = 0; k < SPRITE_ANGLES; k++)
+        {
+            double angle = k * 2 * PI / SPRITE_ANGLES;
+            cairo_save(cr);
+            cairo_translate(cr, (k + 0.5) * cell, (row + 0.5) * cell);
+            cairo_scale(cr, scale, scale);
+            if (row < TEAM_COLOR_COUNT)
+            {
+                // Tank body, and its barrel from just above the middle
+                const double *color = team_colors[row];
+                cairo_set_source_rgb(cr, color[0], color[1], color[2]);
+                cairo_rectangle(cr, -TANK_WIDTH / 2, -TANK_HEIGHT / 2, TANK_WIDTH, TANK_HEIGHT);
+                cairo_fill(cr);
+                cairo_set_line_width(cr, 3.0);
+                cairo_move_to(cr, 0, -TANK_HEIGHT / 4);
+                cairo_line_to(cr, cos(angle) * 20.0, -TANK_HEIGHT / 4 - sin(angle) * 20.0);
+                cairo_stroke(cr);
+            }
+            else if (row == SPRITE_ROW_DRILL)
+            {
+                cairo_set_source_rgb(cr, 0.7, 0.7, 0.9); // Bright metallic
+                cairo_rotate(cr, angle);
+                cairo_move_to(cr, 0, 0);
+                cairo_line_to(cr, 8, -3);
+                cairo_line_to(cr, 8, 3);
+                cairo_close_path(cr);
+                cairo_fill(cr);
+            }
+            else if (k == SPRITE_SMALL_MISSILE)
+                draw_glowing_shell(cr, 1.0, 0.9, 0.2, 3); // Bright yellow
+            else if (k == SPRITE_BIG_MISSILE)
+                draw_glowing_shell(cr, 1.0, 0.5, 0.0, 5); // Bright orange
+            else if (k == SPRITE_CLUSTER)
+                draw_glowing_shell(cr, 1.0, 0.3, 1.0, 4); // Bright purple
+            else if (k == SPRITE_NUKE_RED)
+                draw_nuke_shell(cr, 0.8, 0.0, 0.0);
+            else if (k == SPRITE_NUKE_YELLOW)
+                draw_nuke_shell(cr, 1.0, 1.0, 0.0);
+            cairo_restore(cr);
+        }
+    }
+    cairo_destroy(cr);
+
+    // Note the pixels each sprite touched, so a blit fills only those
+    cairo_surface_flush(cache->atlas);
+    const unsigned char *data = cairo_image_surface_get_data(cache->atlas);
+    int stride = cairo_image_surface_get_stride(cache->atlas);
+    free(cache->sprite_bounds);
+    cache->sprite_bounds = malloc(SPRITE_ROWS * SPRITE_ANGLES * sizeof(SpriteBounds));
+    for (int row = 0; cache->sprite_bounds != NULL && row < SPRITE_ROWS; row++)
+    {
+        for (int k = 0; k < SPRITE_ANGLES; k++)
+        {
+            SpriteBounds b = {(int16_t)cell, (int16_t)cell, 0, 0};
+            for (int y = 0; y < cell; y++)
+            {
+                const uint32_t *line = (const uint32_t *)(data + (size_t)(row * cell + y) * stride) + k * cell;
+                for (int x = 0; x < cell; x++)
+                {
+                    if (line[x] >> 24 == 0)
+                        continue;
+                    if (x < b.x0)
+                        b.x0 = x;
+                    if (x >= b.x1)
+                        b.x1 = x + 1;
+                    if (y < b.y0)
+                        b.y0 = y;
+                    b.y1 = y + 1;
+                }
+            }
+            // One pixel more each side, which bilinear filtering may reach
+            if (b.x1 > b.x0)
+            {
+                b.x0 = b.x0 > 0 ? b.x0 - 1 : 0;
+                b.y0 = b.y0 > 0 ? b.y0 - 1 : 0;
+                b.x1 = b.x1 < cell ? b.x1 + 1 : cell;
+                b.y1 = b.y1 < cell ? b.y1 + 1 : cell;
+            }
+            cache->sprite_bounds[row * SPRITE_ANGLES + k] = b;
+        }
+    }
+
+    cache->atlas_pattern = cairo_pattern_create_for_surface(cache->atlas);
+    cairo_pattern_set_filter(cache->atlas_pattern, CAIRO_FILTER_BILINEAR);
+}
+
+// Function to get the atlas column for a rotation, in radians. Barrels turn
+// counterclockwise on screen, like tank angles; drills clockwise, like
+// cairo_rotate and a heading from the shell's velocity.
+static int sprite_angle_index(double angle)
+{
+    long k = lround(angle * SPRITE_ANGLES / (2 * PI)) % SPRITE_ANGLES;
+    return k < 0 ? k + SPRITE_ANGLES : k;
+}
+
+// Function to composite one atlas sprite centered on a world position,
+// filling only the part of its cell it covers
+static void blit_sprite(RenderCache *cache, cairo_t *cr, int row, int column, double x, double y)
+{
+    double scale = cache->atlas_scale;
+    int cell = cache->atlas_cell;
+    SpriteBounds b = {0, 0, (int16_t)cell, (int16_t)cell};
+    if (cache->sprite_bounds != NULL)
+        b = cache->sprite_bounds[row * SPRITE_ANGLES + column];
+    if (b.x1 <= b.x0)
+        return;
+
+    cairo_matrix_t matrix;
+    cairo_matrix_init(&matrix, scale, 0, 0, scale, (column + 0.5) * cell - x * scale, (row + 0.5) * cell - y * scale);
+    cairo_pattern_set_matrix(cache->atlas_pattern, &matrix);
+    cairo_set_source(cr, cache->atlas_pattern);
+    double left = x + (b.x0 - cell / 2.0) / scale, top = y + (b.y0 - cell / 2.0) / scale;
+    cairo_rectangle(cr, left, top, (b.x1 - b.x0) / scale, (b.y1 - b.y0) / scale);
+    cairo_fill(cr);
+}
+
+// Function to draw the detailed info panel of one player
+static void draw_player_info(Game *game, cairo_t *cr, int i, double text_x)
+{
+    // Highlight current player
+    if (i == game->current_player && game->state == STATE_AIMING)
+    {
+        cairo_set_source_rgb(cr, 0.7, 0.0, 0.0); // Dark red for current player
+    }
+    else
+    {
+        cairo_set_source_rgb(cr, 0.0, 0.0, 0.0); // Black for others
+    }
+
+    // Player name and score
+    char player_text[100];
+    sprintf(player_text, "%s: %d pts (Health: %d)", game->players[i].name, game->players[i].score, game->players[i].health);
+    cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+    cairo_set_font_size(cr, 20); // Increased from 14 to 20
+
+    cairo_move_to(cr, text_x, 50); // Adjusted y position
+    cairo_show_text(cr, player_text);
+
+    // Current weapon
+    char weapon_text[100];
+    sprintf(weapon_text, "Weapon: %s", game->weapon_properties[game->players[i].current_weapon].name);
+    cairo_move_to(cr, text_x, 80); // Adjusted spacing
+    cairo_show_text(cr, weapon_text);
+
+    // Angle and power
+    char angle_text[50];
+    sprintf(angle_text, "Angle: %d°", game->players[i].angle);
+    cairo_move_to(cr, text_x, 110); // Adjusted spacing
+    cairo_show_text(cr, angle_text);
+
+    char power_text[50];
+    sprintf(power_text, "Power: %d/%d", game->players[i].power, MAX_POWER);
+    cairo_move_to(cr, text_x, 140); // Adjusted spacing
+    cairo_show_text(cr, power_text);
+
+    // Moves left
+    char moves_text[50];
+    sprintf(moves_text, "Moves left: %d", game->players[i].moves_left);
+    cairo_move_to(cr, text_x, 170); // Adjusted spacing
+    cairo_show_text(cr, moves_text);
+}
+
+// Function to draw a wide world's minimap: the whole map's skyline, the
+// window being played, the tanks and the shell in flight
+static void draw_minimap(Game *game, cairo_t *cr)
+{
+    const ChunkedWorld *world = game->world;
+    const int map_width = 800;
+    const double map_height = 48, map_x = (WORLD_WIDTH - map_width) / 2, map_y = WORLD_HEIGHT - 80;
+    int samples = world->chunk_count * WORLD_OVERVIEW_SAMPLES;
+    double scale = map_width / ((double)world->chunk_count * WORLD_CHUNK_WIDTH);
+
+    cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.5);
+    cairo_rectangle(cr, map_x, map_y, map_width, map_height);
+    cairo_fill(cr);
+
+    // Skyline: the highest peak under each minimap column
+    cairo_set_source_rgba(cr, 0.35, 0.6, 0.3, 0.9);
+    cairo_move_to(cr, map_x, map_y + map_height);
+    for (int column = 0; column < map_width; column++)
+    {
+        int first = column * samples / map_width;
+        int last = (column + 1) * samples / map_width;
+        float peak = WORLD_HEIGHT;
+        for (int s = first; s < last || s == first; s++)
+            peak = fminf(peak, world->overview[s]);
+        cairo_line_to(cr, map_x + column, map_y + map_height * peak / WORLD_HEIGHT);
+    }
+    cairo_line_to(cr, map_x + map_width, map_y + map_height);
+    cairo_close_path(cr);
+    cairo_fill(cr);
+
+    // The window being played
+    double window_x = (double)game->world_chunk * WORLD_CHUNK_WIDTH;
+    cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+    cairo_set_line_width(cr, 1.5);
+    cairo_rectangle(cr, map_x + window_x * scale, map_y, WORLD_WIDTH * scale, map_height);
+    cairo_stroke(cr);
+
+    // Tanks in their team colors
+    for (int i = 0; i < game->num_players; i++)
+    {
+        Tank *tank = &game->players[i];
+        if (tank->health <= 0)
+            continue;
+        const double *color = team_colors[tank->team % TEAM_COLOR_COUNT];
+        cairo_set_source_rgb(cr, color[0], color[1], color[2]);
+        cairo_rectangle(cr, map_x + (window_x + tank->x) * scale - 2, map_y + map_height * tank->y / WORLD_HEIGHT - 4, 4, 4);
+        cairo_fill(cr);
+    }
+
+    // The shell the window follows
+    for (int i = 0; i < MAX_PROJECTILES && game->projectile_free_count < MAX_PROJECTILES; i++)
+    {
+        if (game->projectiles[i].active)
+        {
+            double x = window_x + PHYS_TO_DOUBLE(game->projectiles[i].x);
+            double y = fmax(0, PHYS_TO_DOUBLE(game->projectiles[i].y));
+            cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+            cairo_arc(cr, map_x + x * scale, map_y + map_height * y / WORLD_HEIGHT, 2, 0, 2 * PI);
+            cairo_fill(cr);
+            break;
+        }
+    }
+}
+
+// Function to draw the world, in world units, onto a context whose device
+// has pixel_scale pixels per world unit
+static void draw_world(RenderCache *cache, Game *game, cairo_t *cr, double pixel_scale)
+{
+    // Clear background
+    cairo_set_source_rgb(cr, 0.2, 0.6, 0.9); // Sky blue
+    cairo_paint(cr);
+
+    // Terrain comes from the cached layer, redrawn only where it changed
+    update_terrain_layer(cache, game, pixel_scale);
+    cairo_save(cr);
+    cairo_scale(cr, 1.0 / pixel_scale, 1.0 / pixel_scale);
+    cairo_set_source_surface(cr, cache->terrain_layer, 0, 0);
+    cairo_paint(cr);
+    cairo_restore(cr);
+
+    // Draw tanks, body and barrel in one sprite of the team's color
+    build_sprite_atlas(cache, pixel_scale);
+    for (int i = 0; i < game->num_players; i++)
+    {
+        blit_sprite(cache, cr, game->players[i].team % TEAM_COLOR_COUNT,
+                    sprite_angle_index(game->players[i].angle * PI / 180.0), game->players[i].x, game->players[i].y);
+
+        // Draw health bar
+        cairo_set_source_rgb(cr, 0.8, 0.2, 0.2); // Red background
+        cairo_rectangle(cr, game->players[i].x - TANK_WIDTH / 2, game->players[i].y - TANK_HEIGHT - 10, TANK_WIDTH, 5);
+        cairo_fill(cr);
+
+        cairo_set_source_rgb(cr, 0.2, 0.8, 0.2); // Green health
+        cairo_rectangle(cr, game->players[i].x - TANK_WIDTH / 2, game->players[i].y - TANK_HEIGHT - 10, TANK_WIDTH * game->players[i].health / 100.0, 5);
+        cairo_fill(cr);
+    }
+
+    // Draw projectiles from the atlas. Salvo rockets and barrage bomblets
+    // come in the thousands and are plain squares, so they are collected into
+    // one path per weapon and filled once instead.
+    bool has_rockets = false, has_bomblets = false;
+    for (int i = 0; i < MAX_PROJECTILES; i++)
+    {
+        if (game->projectiles[i].active)
+        {
+            Projectile *proj = &game->projectiles[i];
+
+            double x = PHYS_TO_DOUBLE(proj->x), y = PHYS_TO_DOUBLE(proj->y);
+            switch (proj->weapon_type)
+            {
+            case WEAPON_SMALL_MISSILE:
+                blit_sprite(cache, cr, SPRITE_ROW_SHELLS, SPRITE_SMALL_MISSILE, x, y);
+                break;
+
+            case WEAPON_BIG_MISSILE:
+                blit_sprite(cache, cr, SPRITE_ROW_SHELLS, SPRITE_BIG_MISSILE, x, y);
+                break;
+
+            case WEAPON_DRILL:
+                blit_sprite(cache, cr, SPRITE_ROW_DRILL, sprite_angle_index(atan2(proj->dy, proj->dx)), x, y);
+                break;
+
+            case WEAPON_CLUSTER:
+                blit_sprite(cache, cr, SPRITE_ROW_SHELLS, SPRITE_CLUSTER, x, y);
+                break;
+
+            case WEAPON_NUKE:
+                blit_sprite(cache, cr, SPRITE_ROW_SHELLS, game->frame_count % 10 < 5 ? SPRITE_NUKE_RED : SPRITE_NUKE_YELLOW, x, y);
+                break;
+
+            case WEAPON_SALVO:
+                has_rockets = true;
+                break;
+
+            case WEAPON_BARRAGE:
+                has_bomblets = true;
+                break;
+
+            case WEAPON_COUNT:
+                break;
+            }
+        }
+    }
+
+    if (has_rockets)
+    {
+        cairo_set_source_rgb(cr, 1.0, 0.2, 0.1); // Bright red
+        for (int i = 0; i < MAX_PROJECTILES; i++)
+        {
+            Projectile *proj = &game->projectiles[i];
+            if (proj->active && proj->weapon_type == WEAPON_SALVO)
+                cairo_rectangle(cr, PHYS_TO_DOUBLE(proj->x) - 2, PHYS_TO_DOUBLE(proj->y) - 2, 4, 4);
+        }
+        cairo_fill(cr);
+    }
+
+    if (has_bomblets)
+    {
+        cairo_set_source_rgb(cr, 0.3, 0.3, 0.3); // Dark grey
+        for (int i = 0; i < MAX_PROJECTILES; i++)
+        {
+            Projectile *proj = &game->projectiles[i];
+            if (proj->active && proj->weapon_type == WEAPON_BARRAGE)
+                cairo_rectangle(cr, PHYS_TO_DOUBLE(proj->x) - 1, PHYS_TO_DOUBLE(proj->y) - 1, 2, 2);
+        }
+        cairo_fill(cr);
+    }
+
+    // Draw explosions
+    const QualityLevel *q = cache->quality;
+    for (int i = 0; i < MAX_EXPLOSIONS; i++)
+    {
+        if (game->explosions[i].active)
+        {
+            Explosion *exp = &game->explosions[i];
+
+            if (q->explosion_stops == 0)
+            {
+                // Flat fireball
+                cairo_set_source_rgba(cr, 0.9, 0.4, 0.0, 0.5);
+                cairo_arc(cr, exp->x, exp->y, exp->radius, 0, 2 * PI);
+                cairo_fill(cr);
+                continue;
+            }
+
+            // Draw explosion with gradient
+            cairo_pattern_t *pattern = cairo_pattern_create_radial(
+                exp->x, exp->y, 0,
+                exp->x, exp->y, exp->radius);
+
+            cairo_pattern_add_color_stop_rgba(pattern, 0.0, 1.0, 0.7, 0.0, 0.8);     // Orange center
+            if (q->explosion_stops > 2)
+                cairo_pattern_add_color_stop_rgba(pattern, 0.7, 0.8, 0.2, 0.0, 0.5); // Red middle
+            cairo_pattern_add_color_stop_rgba(pattern, 1.0, 0.5, 0.0, 0.0, 0.0);     // Transparent edge
+
+            cairo_set_source(cr, pattern);
+            cairo_arc(cr, exp->x, exp->y, exp->radius, 0, 2 * PI);
+            cairo_fill(cr);
+
+            cairo_pattern_destroy(pattern);
+        }
+    }
+
+    // Draw particles (only every Nth dust particle at reduced quality; debris
+    // is always drawn, since it is dirt on its way back to the ground)
+    for (int i = 0; i < MAX_PARTICLES; i++)
+    {
+        if (game->particles[i].active && (game->particles[i].debris > 0 || i % q->particle_stride == 0))
+        {
+            Particle *part = &game->particles[i];
+
+            // Fade out based on lifetime
+            double alpha = part->lifetime / part->max_lifetime;
+            cairo_set_source_rgba(cr, 0.5, 0.3, 0.1, alpha); // Brown with fade
+
+            cairo_arc(cr, part->x, part->y, part->size, 0, 2 * PI);
+            cairo_fill(cr);
+        }
+    }
+
+    // Draw UI
+    // Wind indicator text with direction, for the wind where the current tank is
+    const Tank *aiming = &game->players[game->current_player];
+    double wind = wind_at(game, aiming->x, aiming->y - TANK_HEIGHT);
+    char wind_text[100];
+    char direction[10];
+    if (wind > 0)
+    {
+        strcpy(direction, "RIGHT");
+    }
+    else
+    {
+        strcpy(direction, "LEFT");
+    }
+    sprintf(wind_text, "Wind: %.3f (%s)", fabs(wind), direction);
+
+    // Make wind display more prominent
+    cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+    cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+    cairo_set_font_size(cr, 24);                   // Increased size
+    cairo_move_to(cr, WORLD_WIDTH / 2 - 120, 40); // Adjusted position
+    cairo_show_text(cr, wind_text);
+
+    // Draw wind arrow (make it more visible)
+    double arrow_center_x = WORLD_WIDTH / 2 + 150;
+    double arrow_y = 35;
+    double arrow_length = wind * 1200.0; // Increased scale for better visibility
+    double arrow_width = 4.0;                  // Thicker arrow
+
+    // Calculate arrow start and end positions based on direction
+    double arrow_start_x, arrow_end_x;
+    if (wind > 0)
+    {
+        arrow_start_x = arrow_center_x - fabs(arrow_length) / 2;
+        arrow_end_x = arrow_center_x + fabs(arrow_length) / 2;
+    }
+    else
+    {
+        arrow_start_x = arrow_center_x + fabs(arrow_length) / 2;
+        arrow_end_x = arrow_center_x - fabs(arrow_length) / 2;
+    }
+
+    // Draw arrow line
+    cairo_set_source_rgb(cr, 0.0, 0.0, 0.8);
+    cairo_set_line_width(cr, arrow_width);
+    cairo_move_to(cr, arrow_start_x, arrow_y);
+    cairo_line_to(cr, arrow_end_x, arrow_y);
+    cairo_stroke(cr);
+
+    // Draw larger arrow head
+    double arrow_head_size = 8.0;
+    if (wind > 0)
+    {
+        cairo_move_to(cr, arrow_end_x, arrow_y);
+        cairo_line_to(cr, arrow_end_x - arrow_head_size, arrow_y - arrow_head_size);
+        cairo_line_to(cr, arrow_end_x - arrow_head_size, arrow_y + arrow_head_size);
+    }
+    else
+    {
+        cairo_move_to(cr, arrow_end_x, arrow_y);
+        cairo_line_to(cr, arrow_end_x + arrow_head_size, arrow_y - arrow_head_size);
+        cairo_line_to(cr, arrow_end_x + arrow_head_size, arrow_y + arrow_head_size);
+    }
+    cairo_close_path(cr);
+    cairo_fill(cr);
+
+    // Player info
+    if (game->num_players == 2)
+    {
+        draw_player_info(game, cr, 0, 20);
+        draw_player_info(game, cr, 1, WORLD_WIDTH - 320); // Adjusted x position for larger text
+    }
+    else
+    {
+        // Detailed panel for the tank whose turn it is, compact scoreboard for everyone
+        draw_player_info(game, cr, game->current_player, 20);
+
+        cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+        cairo_set_font_size(cr, 12);
+        for (int i = 0; i < game->num_players; i++)
+        {
+            const double *color = team_colors[game->players[i].team % TEAM_COLOR_COUNT];
+            cairo_set_source_rgb(cr, color[0], color[1], color[2]);
+            cairo_rectangle(cr, WORLD_WIDTH - 240, 41 + i * 15, 10, 10);
+            cairo_fill(cr);
+
+            if (i == game->current_player)
+                cairo_set_source_rgb(cr, 0.7, 0.0, 0.0);
+            else if (game->players[i].health <= 0)
+                cairo_set_source_rgb(cr, 0.4, 0.4, 0.4);
+            else
+                cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+
+            char score_text[100];
+            sprintf(score_text, "%s: %d pts (Health: %d)", game->players[i].name, game->players[i].score, game->players[i].health);
+            cairo_move_to(cr, WORLD_WIDTH - 225, 50 + i * 15);
+            cairo_show_text(cr, score_text);
+        }
+    }
+
+    // Game state messages
+    if (game->state == STATE_GAME_OVER)
+    {
+        // Determine winner
+        char winner_text[100];
+        if (game->winning_team < 0)
+        {
+            sprintf(winner_text, "Nobody survived! Press R to play again.");
+        }
+        else if (game->match_teams)
+        {
+            sprintf(winner_text, "Team %d wins! Press R to play again.", game->winning_team + 1);
+        }
+        else
+        {
+            // Free-for-all teams are the tank indices
+            sprintf(winner_text, "%s wins! Press R to play again.", game->players[game->winning_team].name);
+        }
+
+        cairo_set_source_rgb(cr, 0.8, 0.0, 0.0);
+        cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+        cairo_set_font_size(cr, 24);
+
+        // Center text
+        cairo_text_extents_t extents;
+        cairo_text_extents(cr, winner_text, &extents);
+        cairo_move_to(cr, (WORLD_WIDTH - extents.width) / 2, WORLD_HEIGHT / 2);
+        cairo_show_text(cr, winner_text);
+    }
+    else if (game->game_paused)
+    {
+        // Paused message
+        char paused_text[] = "GAME PAUSED - Press P to continue";
+
+        cairo_set_source_rgb(cr, 0.0, 0.0, 0.8);
+        cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+        cairo_set_font_size(cr, 24);
+
+        // Center text
+        cairo_text_extents_t extents;
+        cairo_text_extents(cr, paused_text, &extents);
+        cairo_move_to(cr, (WORLD_WIDTH - extents.width) / 2, WORLD_HEIGHT / 2);
+        cairo_show_text(cr, paused_text);
+    }
+
+    // Replay viewer status
+    if (cache->window && viewer.active)
+    {
+        char replay_text[160];
+        uint32_t first_step = recording.keyframes[0].step;
+        sprintf(replay_text, "REPLAY %s %dx  step %u / %u  -  Space (play/pause), 1/2/3 (1x/8x/64x), Left/Right (seek 5 s), Home/End",
+                viewer.paused ? "paused" : "playing", viewer.speed, game->step - first_step, recording.end_step - first_step);
+
+        cairo_set_source_rgb(cr, 0.8, 0.0, 0.0);
+        cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+        cairo_set_font_size(cr, 16);
+        cairo_text_extents_t extents;
+        cairo_text_extents(cr, replay_text, &extents);
+        cairo_move_to(cr, (WORLD_WIDTH - extents.width) / 2, 30);
+        cairo_show_text(cr, replay_text);
+    }
+
+    // Draw controls help
+    cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+    cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+    cairo_set_font_size(cr, 12);
+
+    char controls_text[] = "Controls: Arrows (aim/power), W/S (weapon), A/D (move), Space (fire), R (reset), P (pause), N (players), T (teams), B (debris), [/] (render scale), F5/F9 (save/load)";
+    cairo_move_to(cr, 10, WORLD_HEIGHT - 10);
+    cairo_show_text(cr, controls_text);
+
+    if (cache->window)
+    {
+        char scale_text[100];
+        sprintf(scale_text, "Quality: %s (%.1f ms)   Render scale: %d%%", q->name, quality.average_ms,
+                (int)round(cache->render_scale * 100));
+        cairo_move_to(cr, WORLD_WIDTH - 320, WORLD_HEIGHT - 10);
+        cairo_show_text(cr, scale_text);
+    }
+
+    if (game->world != NULL)
+        draw_minimap(game, cr);
+}
+
+// Function to draw a whole frame for a window of the given size, whose
+// device has pixel_scale pixels per window pixel
+static void draw_frame(RenderCache *cache, Game *game, cairo_t *cr, int width, int height, double pixel_scale)
+{
+    Camera cam = fit_camera(width, height, pixel_scale);
+
+    // Letterbox bars
+    cairo_set_source_rgb(cr, 0.05, 0.05, 0.05);
+    cairo_paint(cr);
+
+    cairo_save(cr);
+    cairo_translate(cr, cam.offset_x, cam.offset_y);
+    cairo_scale(cr, cam.scale, cam.scale);
+    cairo_rectangle(cr, 0, 0, WORLD_WIDTH, WORLD_HEIGHT);
+    cairo_clip(cr);
+    draw_world(cache, game, cr, cam.scale * pixel_scale);
+    cairo_restore(cr);
+}
+
+// Function to render the game. Below 100% render scale the frame is drawn
+// into a smaller offscreen surface and upscaled into the window.
+static void render_game(GtkDrawingArea *drawing_area, cairo_t *cr, int width, int height, gpointer user_data)
+{
+    Game *game = (Game *)user_data;
+    double device_scale = (drawing_area != NULL) ? gtk_widget_get_scale_factor(GTK_WIDGET(drawing_area)) : 1;
+    render_cache.quality = current_quality();
+    atomic_store_explicit(&metrics.quality_level, quality.level, memory_order_relaxed);
+
+    if (render_cache.render_scale >= MAX_RENDER_SCALE)
+    {
+        draw_frame(&render_cache, game, cr, width, height, device_scale);
+        return;
+    }
+
+    double pixel_scale = device_scale * render_cache.render_scale;
+    int offscreen_width = (int)ceil(width * pixel_scale);
+    int offscreen_height = (int)ceil(height * pixel_scale);
+    if (render_cache.offscreen == NULL || render_cache.offscreen_width != offscreen_width ||
+        render_cache.offscreen_height != offscreen_height)
+    {
+        if (render_cache.offscreen != NULL)
+            cairo_surface_destroy(render_cache.offscreen);
+        render_cache.offscreen = cairo_image_surface_create(CAIRO_FORMAT_RGB24, offscreen_width, offscreen_height);
+        render_cache.offscreen_width = offscreen_width;
+        render_cache.offscreen_height = offscreen_height;
+    }
+
+    cairo_t *offscreen_cr = cairo_create(render_cache.offscreen);
+    cairo_scale(offscreen_cr, pixel_scale, pixel_scale);
+    draw_frame(&render_cache, game, offscreen_cr, width, height, pixel_scale);
+    cairo_destroy(offscreen_cr);
+
+    // Upscale into the window
+    cairo_save(cr);
+    cairo_scale(cr, 1.0 / pixel_scale, 1.0 / pixel_scale);
+    cairo_set_source_surface(cr, render_cache.offscreen, 0, 0);
+    cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_BILINEAR);
+    cairo_paint(cr);
+    cairo_restore(cr);
+}
+
+// Structure for one frame slot of the video export ring
+typedef struct
+{
+    Game game;          // The match at this frame, copied out by the simulation
+    unsigned char *yuv; // The frame once rendered, EXPORT_FRAME_BYTES of I420
+    int64_t frame;      // The frame the slot holds, once queued
+    int state;          // EXPORT_SLOT_*
+} ExportSlot;
+
+enum
+{
+    EXPORT_SLOT_FREE,     // Ready for the simulation's next frame
+    EXPORT_SLOT_QUEUED,   // Waiting for its render worker
+    EXPORT_SLOT_RENDERED, // Waiting for the encoder
+};
+
+// Structure for a video export: the simulation queues frames into a ring
+// of slots, render workers draw them in parallel and the encoder thread
+// writes them out in order. Frame f uses slot f % slot_count and worker
+// f % threads; a slot is handed on from worker to worker, so each waits for
+// its own frame number as well as the slot's state.
+typedef struct
+{
+    ExportSlot *slots;
+    int slot_count;         // EXPORT_RING_FRAMES
+    int threads;
+    int64_t frame_count;    // Frames queued so far
+    bool finished;          // No more frames will be queued
+    GMutex lock;            // Guards the slot states, frame_count and finished
+    GCond changed;          // Broadcast on every change to them
+    FILE *out;
+    bool y4m;               // Y4M stream, else raw I420 frames
+    atomic_bool write_failed;
+} VideoExport;
+
+// Structure for a render worker of a video export
+typedef struct
+{
+    VideoExport *video;
+    int index;
+    GThread *thread;
+    RenderCache cache;      // Layers and atlas, kept across this worker's frames
+    int dirty_lo, dirty_hi; // Terrain changed since this worker's last frame (lo > hi when clean)
+} ExportWorker;
+
+// Function to free a render cache's surfaces
+static void release_render_cache(RenderCache *cache)
+{
+    if (cache->terrain_layer != NULL)
+        cairo_surface_destroy(cache->terrain_layer);
+    if (cache->offscreen != NULL)
+        cairo_surface_destroy(cache->offscreen);
+    if (cache->atlas != NULL)
+    {
+        cairo_pattern_destroy(cache->atlas_pattern);
+        cairo_surface_destroy(cache->atlas);
+    }
+    free(cache->sprite_bounds);
+}
+
+// Function to wait until a slot reaches a state with the given frame (any
+// frame for EXPORT_SLOT_FREE); returns false instead if the export finishes
+// without queueing the frame
+static bool export_wait(VideoExport *video, ExportSlot *slot, int state, int64_t frame)
+{
+    g_mutex_lock(&video->lock);
+    bool reached;
+    while (!(reached = slot->state == state && (state == EXPORT_SLOT_FREE || slot->frame == frame)) &&
+           !(video->finished && frame >= video->frame_count))
+        g_cond_wait(&video->changed, &video->lock);
+    g_mutex_unlock(&video->lock);
+    return reached;
+}
+
+// Function to move a slot on to its next state
+static void export_set_state(VideoExport *video, ExportSlot *slot, int state)
+{
+    g_mutex_lock(&video->lock);
+    slot->state = state;
+    g_cond_broadcast(&video->changed);
+    g_mutex_unlock(&video->lock);
+}
+
+// Function to queue the match as it stands as the next frame, waiting while
+// the ring is full
+static void export_queue_frame(VideoExport *video, ExportWorker *workers, Game *game)
+{
+    int64_t frame = video->frame_count;
+    ExportSlot *slot = &video->slots[frame % video->slot_count];
+    ExportWorker *worker = &workers[frame % video->threads];
+
+    // Each worker's cached terrain layer has missed every change since its
+    // own last frame, not just this step's
+    if (game->terrain_dirty_lo <= game->terrain_dirty_hi)
+    {
+        for (int w = 0; w < video->threads; w++)
+        {
+            if (workers[w].dirty_lo > workers[w].dirty_hi || game->terrain_dirty_lo < workers[w].dirty_lo)
+                workers[w].dirty_lo = game->terrain_dirty_lo;
+            if (workers[w].dirty_lo > workers[w].dirty_hi || game->terrain_dirty_hi > workers[w].dirty_hi)
+                workers[w].dirty_hi = game->terrain_dirty_hi;
+        }
+        game->terrain_dirty_lo = 1;
+        game->terrain_dirty_hi = 0;
+    }
+
+    export_wait(video, slot, EXPORT_SLOT_FREE, frame);
+    slot->game = *game;
+    slot->game.terrain_dirty_lo = worker->dirty_lo;
+    slot->game.terrain_dirty_hi = worker->dirty_hi;
+    slot->game.world = NULL;
+    slot->game.pregenerated = NULL;
+    worker->dirty_lo = 1;
+    worker->dirty_hi = 0;
+
+    g_mutex_lock(&video->lock);
+    slot->frame = frame;
+    slot->state = EXPORT_SLOT_QUEUED;
+    video->frame_count++;
+    g_cond_broadcast(&video->changed);
+    g_mutex_unlock(&video->lock);
+}
+
+// Function to convert a rendered frame to I420, BT.601 full range (Y4M's
+// C420jpeg). Chroma is averaged over each 2x2 block of pixels.
+static void convert_frame_to_i420(cairo_surface_t *surface, unsigned char *yuv)
+{
+    const unsigned char *data = cairo_image_surface_get_data(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+    unsigned char *u = yuv + EXPORT_WIDTH * EXPORT_HEIGHT;
+    unsigned char *v = u + EXPORT_WIDTH * EXPORT_HEIGHT / 4;
+
+    for (int y = 0; y < EXPORT_HEIGHT / 2; y++)
+    {
+        for (int x = 0; x < EXPORT_WIDTH / 2; x++)
+        {
+            int r = 0, g = 0, b = 0;
+            for (int k = 0; k < 4; k++)
+            {
+                int px = 2 * x + (k & 1), py = 2 * y + (k >> 1);
+                uint32_t pixel = *(const uint32_t *)(data + py * stride + px * 4);
+                int pr = pixel >> 16 & 255, pg = pixel >> 8 & 255, pb = pixel & 255;
+                yuv[py * EXPORT_WIDTH + px] = (77 * pr + 150 * pg + 29 * pb + 128) >> 8;
+                r += pr;
+                g += pg;
+                b += pb;
+            }
+
+            // Sums of four pixels, so a further shift by 2; the offsets keep
+            // the sums positive and round
+            u[y * EXPORT_WIDTH / 2 + x] = (-43 * r - 85 * g + 128 * b + 4 * (128 * 256 + 127)) >> 10;
+            v[y * EXPORT_WIDTH / 2 + x] = (128 * r - 107 * g - 21 * b + 4 * (128 * 256 + 127)) >> 10;
+        }
+    }
+}
+
+// Function run by each render worker of a video export: draw every
+// threads-th frame on its own surface and convert it for the encoder
+static gpointer export_worker_main(gpointer data)
+{
+    ExportWorker *worker = data;
+    VideoExport *video = worker->video;
+    cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, EXPORT_WIDTH, EXPORT_HEIGHT);
+
+    for (int64_t frame = worker->index;; frame += video->threads)
+    {
+        ExportSlot *slot = &video->slots[frame % video->slot_count];
+        if (!export_wait(video, slot, EXPORT_SLOT_QUEUED, frame))
+            break;
+        cairo_t *cr = cairo_create(surface);
+        draw_frame(&worker->cache, &slot->game, cr, EXPORT_WIDTH, EXPORT_HEIGHT, 1);
+        cairo_destroy(cr);
+        cairo_surface_flush(surface);
+        convert_frame_to_i420(surface, slot->yuv);
+        export_set_state(video, slot, EXPORT_SLOT_RENDERED);
+    }
+
+    cairo_surface_destroy(surface);
+    release_render_cache(&worker->cache);
+    return NULL;
+}
+
+// Function run by the encoder thread of a video export: write the frames
+// out in order, freeing each slot for the simulation. After a failed write
+// frames are still taken, but dropped.
+static gpointer export_encoder_main(gpointer data)
+{
+    VideoExport *video = data;
+    for (int64_t frame = 0;; frame++)
+    {
+        ExportSlot *slot = &video->slots[frame % video->slot_count];
+        if (!export_wait(video, slot, EXPORT_SLOT_RENDERED, frame))
+            break;
+        if (!atomic_load(&video->write_failed))
+        {
+            bool ok = !video->y4m || fputs("FRAME\n", video->out) >= 0;
+            ok = ok && fwrite(slot->yuv, 1, EXPORT_FRAME_BYTES, video->out) == EXPORT_FRAME_BYTES;
+            if (!ok)
+                atomic_store(&video->write_failed, true);
+        }
+        export_set_state(video, slot, EXPORT_SLOT_FREE);
+    }
+    return NULL;
+}
+
+// Function to free a video export's ring and close its output
+static void release_video_export(VideoExport *video)
+{
+    if (video->out != NULL)
+        fclose(video->out);
+    if (video->slots != NULL)
+    {
+        for (int i = 0; i < video->slot_count; i++)
+            free(video->slots[i].yuv);
+        free(video->slots);
+    }
+    memset(video, 0, sizeof(*video));
+}
+
+// Function to export a match as video without a window: a recording (when
+// replay is given) or the first steps of the scripted match, one frame per
+// simulation step at the highest quality level, rendered on threads workers
+// (0 for one per core). A path ending in .y4m gets a Y4M stream, anything
+// else raw I420 frames. Returns false on failure, having said why; frames
+// and seconds are set either way.
+static bool export_video(Game *game, const char *out_path, Replay *replay, int steps, int threads, int64_t *frames,
+                         double *seconds)
+{
+    static VideoExport video;
+    int next_action = 0;
+    uint32_t script = 0;
+    *frames = 0;
+    *seconds = 0;
+
+    if (replay == NULL)
+    {
+        script = start_scripted_match(game);
+    }
+    else if (!replay_seek(replay, game, replay->keyframes[0].step, &next_action))
+    {
+        fprintf(stderr, "Replay keyframe 0 is corrupt\n");
+        return false;
+    }
+
+    // Workers beyond the ring would only wait for a slot
+    if (threads <= 0)
+        threads = (int)g_get_num_processors();
+    if (threads > EXPORT_RING_FRAMES)
+        threads = EXPORT_RING_FRAMES;
+
+    video.out = fopen(out_path, "wb");
+    if (video.out == NULL)
+    {
+        fprintf(stderr, "Cannot write video %s\n", out_path);
+        return false;
+    }
+    size_t length = strlen(out_path);
+    video.y4m = length >= 4 && strcmp(out_path + length - 4, ".y4m") == 0;
+    if (video.y4m)
+        fprintf(video.out, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", EXPORT_WIDTH, EXPORT_HEIGHT, EXPORT_FPS);
+
+    video.threads = threads;
+    video.slot_count = EXPORT_RING_FRAMES;
+    video.slots = calloc(video.slot_count, sizeof(ExportSlot));
+    ExportWorker *workers = calloc(threads, sizeof(ExportWorker));
+    bool ok = video.slots != NULL && workers != NULL;
+    for (int i = 0; ok && i < video.slot_count; i++)
+    {
+        video.slots[i].yuv = malloc(EXPORT_FRAME_BYTES);
+        ok = video.slots[i].yuv != NULL;
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "Out of memory for a %d frame export ring\n", EXPORT_RING_FRAMES);
+        free(workers);
+        release_video_export(&video);
+        remove(out_path);
+        return false;
+    }
+    g_mutex_init(&video.lock);
+    g_cond_init(&video.changed);
+
+    // The decoration table is built lazily; build it before the workers share it
+    if (!decorations.built)
+        build_decorations();
+
+    double start = now_ms();
+    for (int w = 0; w < threads; w++)
+    {
+        workers[w].video = &video;
+        workers[w].index = w;
+        workers[w].cache.render_scale = 1.0;
+        workers[w].cache.quality = &quality_levels[QUALITY_LEVEL_COUNT - 1];
+        workers[w].dirty_lo = 0;
+        workers[w].dirty_hi = TERRAIN_SEGMENTS - 1;
+        workers[w].thread = g_thread_new("export-render", export_worker_main, &workers[w]);
+    }
+    GThread *encoder = g_thread_new("export-encode", export_encoder_main, &video);
+
+    export_queue_frame(&video, workers, game);
+    for (int s = 1; !atomic_load(&video.write_failed); s++)
+    {
+        if (replay != NULL)
+        {
+            if (!replay_advance(replay, game, &next_action))
+                break;
+        }
+        else if (s <= steps)
+        {
+            play_scripted_step(game, &script, s);
+        }
+        else
+        {
+            break;
+        }
+        export_queue_frame(&video, workers, game);
+    }
+
+    g_mutex_lock(&video.lock);
+    video.finished = true;
+    g_cond_broadcast(&video.changed);
+    g_mutex_unlock(&video.lock);
+    for (int w = 0; w < threads; w++)
+        g_thread_join(workers[w].thread);
+    g_thread_join(encoder);
+
+    ok = !atomic_load(&video.write_failed);
+    ok &= fclose(video.out) == 0;
+    video.out = NULL;
+    *frames = video.frame_count;
+    *seconds = (now_ms() - start) / 1000.0;
+    if (!ok)
+        fprintf(stderr, "Cannot write video %s\n", out_path);
+
+    g_mutex_clear(&video.lock);
+    g_cond_clear(&video.changed);
+    free(workers);
+    release_video_export(&video);
+    return ok;
+}
+
+// Function to export a recording (replay_path) or the scripted match as
+// video from the command line, with the map pack the recording was played
+// on if it used one (maps_path). Returns non-zero on failure.
+static int run_video_export(Game *game, const char *out_path, const char *replay_path, const char *maps_path,
+                            int steps, int threads)
+{
+    static Replay replay;
+    if (maps_path != NULL)
+    {
+        if (!load_maps(&map_rotation, maps_path))
+        {
+            fprintf(stderr, "Cannot read maps %s\n", maps_path);
+            return 1;
+        }
+        game->maps = &map_rotation;
+    }
+    if (replay_path != NULL && !load_replay(&replay, replay_path))
+    {
+        fprintf(stderr, "Cannot read replay %s\n", replay_path);
+        if (maps_path != NULL)
+            free_maps(&map_rotation);
+        return 1;
+    }
+
+    int64_t frames;
+    double seconds;
+    bool ok = export_video(game, out_path, replay_path != NULL ? &replay : NULL, steps, threads, &frames, &seconds);
+    if (ok)
+    {
+        printf("Exported %lld frames (%.1f s of match) to %s in %.1f s: %.1fx real time\n", (long long)frames,
+               (double)frames / EXPORT_FPS, out_path, seconds, frames / (EXPORT_FPS * seconds));
+    }
+
+    if (maps_path != NULL)
+    {
+        game->maps = NULL;
+        free_maps(&map_rotation);
+    }
+    replay_clear(&replay);
+    return ok ? 0 : 1;
+}
+
+// Function run by the round worker thread
+static gpointer round_worker_main(gpointer data)
+{
+    pregenerate_round(data);
+    return NULL;
+}
+
+// Function to keep the next round's terrain building in the background:
+// once a round has drawn the seed for the next one, a worker thread builds
+// it, and reset_game swaps it in instead of generating it on this thread
+static void pregenerate_next_round(Game *game)
+{
+    if (round_worker != NULL)
+    {
+        if (!atomic_load_explicit(&next_round.ready, memory_order_acquire))
+            return; // Still building
+        g_thread_join(round_worker);
+        round_worker = NULL;
+    }
+    if (game->world != NULL || game->maps != NULL || game->round_seed == 0 || next_round.seed == game->round_seed)
+        return;
+
+    next_round.seed = game->round_seed;
+    atomic_store_explicit(&next_round.ready, false, memory_order_relaxed);
+    round_worker = g_thread_new("next-round", round_worker_main, &next_round);
+}
+
+// GTK tick callback
+static gboolean tick(GtkWidget *widget, GdkFrameClock *frame_clock, gpointer user_data)
+{
+    static int autosaved_turn = -1;
+
+    update_quality_governor(&game, gdk_frame_clock_get_frame_time(frame_clock));
+
+    if (viewer.active)
+    {
+        // Play the recording back at the chosen speed
+        for (int i = 0; i < viewer.speed && !viewer.paused; i++)
+        {
+            if (!replay_advance(&recording, &game, &viewer.next_action))
+                viewer.paused = true;
+        }
+        gtk_widget_queue_draw(widget);
+        return G_SOURCE_CONTINUE;
+    }
+
+#ifdef __linux__
+    if (net_client.active)
+    {
+        // The server drives the simulation
+        net_client_poll(&net_client, &game);
+        gtk_widget_queue_draw(widget);
+        return G_SOURCE_CONTINUE;
+    }
+#endif
+
+    update_game(&game);
+    pregenerate_next_round(&game);
+    if (game.world != NULL)
+    {
+        gtk_widget_queue_draw(widget);
+        return G_SOURCE_CONTINUE;
+    }
+    replay_record_step(&recording, &game);
+
+    // Autosave the game and the recording at the start of every turn
+    if (game.turn != autosaved_turn)
+    {
+        window_save_snapshot(&game, AUTOSAVE_PATH);
+        save_replay(&recording, REPLAY_PATH);
+        autosaved_turn = game.turn;
+    }
+    gtk_widget_queue_draw(widget);
+    return G_SOURCE_CONTINUE;
+}
+#endif
+
+// Function to sort frame times for percentiles
+static int compare_doubles(const void *a, const void *b)
+{
+    double da = *(const double *)a, db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+// Function to fire a weapon from a given tank, bypassing turn order
+static void bench_fire(Game *game, int player, WeaponType weapon, int angle, int power)
+{
+    game->current_player = player;
+    game->state = STATE_AIMING;
+    game->players[player].current_weapon = weapon;
+    game->players[player].angle = angle;
+    game->players[player].power = power;
+    fire_weapon(game);
+}
+
+// Function to run one benchmark scenario until everything has landed and
+// report the frame times. With a display build the frame includes rendering
+// into an offscreen surface of the default window size.
+static bool run_benchmark_scenario(Game *game, const char *name, int shells, WeaponType weapon)
+{
+    enum { MAX_BENCH_FRAMES = 2000 };
+    static double frame_ms[MAX_BENCH_FRAMES];
+
+    game->match_players = 16;
+    game->match_teams = false;
+    init_game(game);
+    for (int s = 0; s < shells; s++)
+    {
+        int player = s % game->num_players;
+        bench_fire(game, player, weapon, (game->players[player].x < WORLD_WIDTH / 2) ? 60 : 120, 70);
+    }
+
+#ifndef ARTILLERY_HEADLESS
+    cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, WINDOW_WIDTH, WINDOW_HEIGHT);
+    cairo_t *cr = cairo_create(surface);
+#endif
+
+    int frames = 0;
+    int peak_projectiles = 0;
+    while (frames < MAX_BENCH_FRAMES)
+    {
+        double start = now_ms();
+        update_game(game);
+#ifndef ARTILLERY_HEADLESS
+        render_game(NULL, cr, WINDOW_WIDTH, WINDOW_HEIGHT, game);
+#endif
+        frame_ms[frames++] = now_ms() - start;
+
+        int in_flight = MAX_PROJECTILES - game->projectile_free_count;
+        if (in_flight > peak_projectiles)
+            peak_projectiles = in_flight;
+        if (game->state == STATE_AIMING || game->state == STATE_GAME_OVER)
+            break;
+    }
+
+#ifndef ARTILLERY_HEADLESS
+    cairo_destroy(cr);
+    cairo_surface_destroy(surface);
+#endif
+
+    double total = 0;
+    for (int i = 0; i < frames; i++)
+    {
+        total += frame_ms[i];
+    }
+    qsort(frame_ms, frames, sizeof(double), compare_doubles);
+    double p99 = frame_ms[(frames - 1) * 99 / 100];
+    double worst = frame_ms[frames - 1];
+    bool pass = worst < FRAME_BUDGET_MS;
+
+    printf("%-12s frames %5d  peak projectiles %6d  avg %7.3f ms  p99 %7.3f ms  max %7.3f ms  %s\n",
+           name, frames, peak_projectiles, total / frames, p99, worst, pass ? "PASS" : "FAIL");
+    return pass;
+}
+
+// Function to time saving and loading a snapshot of the game as it is, and
+// check that the loaded game saves back to the same bytes
+static bool run_snapshot_benchmark(Game *game, const char *name)
+{
+    enum { REPEATS = 20 };
+    static unsigned char before[SNAPSHOT_MAX_SIZE], after[SNAPSHOT_MAX_SIZE];
+    const char *path = "artillery_bench.bin";
+    static double terrain[TERRAIN_SEGMENTS];
+    double worst_save = 0, worst_load = 0;
+    bool ok = true;
+
+    memcpy(terrain, game->terrain, sizeof(terrain));
+
+    for (int r = 0; r < REPEATS && ok; r++)
+    {
+        double start = now_ms();
+        ok &= save_snapshot(game, path);
+        double mid = now_ms();
+        ok &= load_snapshot(game, path);
+        double end = now_ms();
+        worst_save = fmax(worst_save, mid - start);
+        worst_load = fmax(worst_load, end - mid);
+    }
+    remove(path);
+
+    // Loading must reproduce the game exactly
+    ok &= memcmp(terrain, game->terrain, sizeof(terrain)) == 0;
+    size_t size = write_snapshot(game, before);
+    ok &= read_snapshot(game, before, size);
+    ok &= write_snapshot(game, after) == size && memcmp(before, after, size) == 0;
+
+    bool pass = ok && worst_save < 1.0 && worst_load < 1.0;
+    printf("%-12s %7zu bytes  max save %7.3f ms  max load %7.3f ms  %s\n",
+           name, size, worst_save, worst_load, pass ? "PASS" : "FAIL");
+    return pass;
+}
+
+// Function to record a scripted match through player actions, as the game
+// does, then check that replaying it reproduces every keyframe
+static bool run_replay_benchmark(Game *game)
+{
+    static Replay replay;
+    const char *path = "artillery_bench_replay.bin";
+    double worst_save = 0;
+    bool saved = true;
+
+    game->match_players = 4;
+    game->match_teams = false;
+    init_game(game);
+    replay_start(&replay, game);
+    for (int turn = 0; turn < 12; turn++)
+    {
+        GameAction script[] = {ACTION_NEXT_WEAPON, ACTION_ANGLE_UP, ACTION_ANGLE_UP, ACTION_POWER_UP,
+                               ACTION_MOVE_LEFT, ACTION_PAUSE, ACTION_PAUSE, ACTION_FIRE};
+        for (int a = 0; a < (int)(sizeof(script) / sizeof(script[0])); a++)
+        {
+            if (game->state == STATE_GAME_OVER)
+                break;
+            replay_record_action(&replay, game, script[a]);
+            apply_action(game, script[a]);
+        }
+        if (game->state == STATE_GAME_OVER)
+        {
+            replay_record_action(&replay, game, ACTION_RESET);
+            apply_action(game, ACTION_RESET);
+        }
+        for (int frame = 0; frame < 2000 && game->state != STATE_AIMING; frame++)
+        {
+            update_game(game);
+            replay_record_step(&replay, game);
+        }
+        // Idle a little at the start of the next turn
+        for (int frame = 0; frame < 30; frame++)
+        {
+            update_game(game);
+            replay_record_step(&replay, game);
+        }
+
+        // Saved at every turn like the window's autosave, each save appending
+        double start = now_ms();
+        saved &= save_replay(&replay, path);
+        worst_save = fmax(worst_save, now_ms() - start);
+    }
+
+    bool pass = saved;
+    printf("%-12s %d actions, %d keyframes, %u steps  max save %.3f ms\n", "replay", replay.action_count,
+           replay.keyframe_count, replay.end_step - replay.keyframes[0].step, worst_save);
+    pass &= verify_replay(path) == 0;
+    remove(path);
+    return pass;
+}
+
+// Function to time the wind field: rebuilding it and sampling it for every
+// projectile and particle slot, and its share of a four-barrage scenario's
+// step time
+static bool run_wind_benchmark(Game *game)
+{
+    enum
+    {
+        REPEATS = 200
+    };
+    WindBatch *batch = &wind_batch;
+    game->match_players = 16;
+    game->match_teams = false;
+    init_game(game);
+    uint32_t rng = 12345;
+    for (int n = 0; n < MAX_PROJECTILES; n++)
+    {
+        batch->x[n] = PHYS_FROM_DOUBLE((double)(next_rand(&rng) % WORLD_WIDTH));
+        batch->y[n] = PHYS_FROM_DOUBLE((double)(next_rand(&rng) % WORLD_HEIGHT));
+    }
+    for (int n = 0; n < MAX_PARTICLES; n++)
+    {
+        batch->particle_x[n] = next_rand(&rng) % WORLD_WIDTH;
+        batch->particle_y[n] = next_rand(&rng) % WORLD_HEIGHT;
+    }
 
-        part->dx = cos(angle) * speed;
-        part->dy = sin(angle) * speed;
+    double start = now_ms();
+    for (int r = 0; r < REPEATS; r++)
+    {
+        game->step++;
+        update_wind_field(game);
+    }
+    double field_ms = (now_ms() - start) / REPEATS;
+    start = now_ms();
+    for (int r = 0; r < REPEATS; r++)
+    {
+        sample_wind_push(&game->wind_field, batch->x, batch->y, batch->push, MAX_PROJECTILES);
+        sample_particle_wind(&game->wind_field, batch->particle_x, batch->particle_y, batch->particle_push,
+                             MAX_PARTICLES);
+    }
+    double sample_ms = (now_ms() - start) / REPEATS;
 
-        // Random lifetime and size
-        part->lifetime = (rand() % 30) + 20;
-        part->max_lifetime = part->lifetime;
-        part->size = (rand() % 3) + 2;
+    // A full step with the same number of shells in flight
+    init_game(game);
+    for (int s = 0; s < 4; s++)
+        bench_fire(game, s, WEAPON_BARRAGE, (game->players[s].x < WORLD_WIDTH / 2) ? 60 : 120, 70);
+    int frames = 0;
+    double step_ms = 0, shell_steps = 0;
+    for (; frames < 2000 && game->state != STATE_AIMING && game->state != STATE_GAME_OVER; frames++)
+    {
+        shell_steps += MAX_PROJECTILES - game->projectile_free_count;
+        start = now_ms();
+        update_game(game);
+        step_ms += now_ms() - start;
     }
+
+    // Share of the barrage's step time the wind took
+    double wind_ms = frames * field_ms + shell_steps * sample_ms / MAX_PROJECTILES;
+    double share = step_ms > 0 ? 100 * wind_ms / step_ms : 0;
+    bool pass = field_ms + sample_ms <= FRAME_BUDGET_MS / 20;
+    printf("%-12s field %.4f ms  %d shells + %d particles sampled in %.4f ms  %.1f%% of barrage x4 step time  %s\n",
+           "wind field", field_ms, MAX_PROJECTILES, MAX_PARTICLES, sample_ms, share, pass ? "PASS" : "FAIL");
+    return pass;
 }
 
-// Function to reset the game
-static void reset_game(Game *game)
+// Function to follow a few turns of shots with a terrain observer, checking
+// it rebuilds the terrain exactly and counting the log bytes it needed
+static bool run_terrain_log_benchmark(Game *game)
 {
-    // Reset scores but keep other player info
-    int p1_score = game->players[0].score;
-    int p2_score = game->players[1].score;
+    static TerrainObserver observer;
+    const WeaponType weapons[] = {WEAPON_SMALL_MISSILE, WEAPON_BIG_MISSILE, WEAPON_DRILL, WEAPON_CLUSTER,
+                                  WEAPON_NUKE, WEAPON_SALVO, WEAPON_BARRAGE, WEAPON_SMALL_MISSILE};
+    int shots = sizeof(weapons) / sizeof(weapons[0]);
 
+    game->match_players = 8;
+    game->match_teams = false;
     init_game(game);
+    observer.synced = false;
+    size_t initial = sync_terrain_observer(&observer, &game->terrain_log);
 
-    // Restore scores
-    game->players[0].score = p1_score;
-    game->players[1].score = p2_score;
+    bool exact = true;
+    size_t bytes = 0;
+    for (int s = 0; s < shots; s++)
+    {
+        int player = s % game->num_players;
+        bench_fire(game, player, weapons[s], (game->players[player].x < WORLD_WIDTH / 2) ? 60 : 120, 60);
+        for (int frame = 0; frame < 2000; frame++)
+        {
+            update_game(game);
+            bytes += sync_terrain_observer(&observer, &game->terrain_log);
+            exact &= memcmp(observer.terrain, game->terrain, sizeof(game->terrain)) == 0;
+            if (game->state == STATE_AIMING || game->state == STATE_GAME_OVER)
+                break;
+        }
+    }
 
-    // Ensure game state is reset to aiming
-    game->state = STATE_AIMING;
-    game->current_player = 0;
-    game->players[0].moves_left = 3;
-    game->players[1].moves_left = 3;
+    printf("%-12s initial %zu bytes, then %zu bytes for %d shots (%zu per full heightfield)  %s\n", "terrain log",
+           initial, bytes, shots, sizeof(game->terrain), exact ? "PASS" : "FAIL");
+    return exact;
 }
 
-// Function to update game state
-static void update_game(Game *game)
+// Function to check that a batch of overlapping craters leaves the terrain
+// bit for bit as applying the same craters one at a time would, and time
+// both doing the same work: logging each crater and digging it, marking the
+// terrain dirty, waking the slopes and re-placing the tanks, once for the
+// batch or once per crater as before batching. Best of a few runs each; the
+// batch has to win.
+static bool run_crater_batch_benchmark(Game *game)
 {
-    if (game->game_paused)
-        return;
+    enum { CRATERS = 2000, RUNS = 5 };
+    static Game start_state, sequential;
+    static TerrainOp ops[CRATERS];
 
-    game->frame_count++;
+    game->match_players = 16;
+    game->match_teams = false;
+    init_game(game);
+    for (int k = 0; k < CRATERS; k++)
+    {
+        // Clustered around a few points, so many craters overlap
+        double x = (game_rand(game) % 4) * WORLD_WIDTH / 4.0 + 200 + game_rand(game) % 200;
+        double radius = 10 + game_rand(game) % 60;
+        ops[k] = make_crater_op(x, game->terrain[terrain_segment_at((int)x)], radius, 5 + game_rand(game) % 40);
+    }
+    start_state = *game;
 
-    // Update projectiles
-    for (int i = 0; i < MAX_PROJECTILES; i++)
+    double batched_ms = INFINITY, single_ms = INFINITY;
+    for (int run = 0; run < RUNS; run++)
     {
-        if (game->projectiles[i].active)
+        *game = start_state;
+        double start = now_ms();
+        for (int k = 0; k < CRATERS; k++)
         {
-            Projectile *proj = &game->projectiles[i];
-
-            // Apply wind and gravity
-            proj->dx += game->wind * 0.25;
-            proj->dy += GRAVITY;
-
-            // Update position
-            proj->x += proj->dx;
-            proj->y += proj->dy;
+            apply_explosion_to_terrain(game, ops[k].x / TERRAIN_OP_SUBPIXELS, ops[k].y / TERRAIN_OP_SUBPIXELS,
+                                       ops[k].radius / TERRAIN_OP_SUBPIXELS, ops[k].deformation);
+        }
+        flush_craters(game);
+        batched_ms = fmin(batched_ms, now_ms() - start);
 
-            // Track distance traveled
-            proj->travel_distance += sqrt(proj->dx * proj->dx + proj->dy * proj->dy);
+        sequential = start_state;
+        start = now_ms();
+        for (int k = 0; k < CRATERS; k++)
+        {
+            TerrainOp logged = make_crater_op(ops[k].x / TERRAIN_OP_SUBPIXELS, ops[k].y / TERRAIN_OP_SUBPIXELS,
+                                              ops[k].radius / TERRAIN_OP_SUBPIXELS, ops[k].deformation);
+            int start_index, end_index;
+            if (!terrain_op_range(&logged, &start_index, &end_index))
+                continue;
+            sequential.terrain_log.ops[sequential.terrain_log.op_count++] = logged;
+            apply_terrain_op(sequential.terrain, &logged);
+            mark_terrain_dirty(&sequential, start_index, end_index);
+            wake_slump_chunks(&sequential, start_index - 1, end_index + 1);
+            check_tank_positions(&sequential);
+        }
+        single_ms = fmin(single_ms, now_ms() - start);
+    }
 
-            // Check for terrain collision
-            if (proj->y >= get_terrain_height(game, (int)proj->x))
-            {
-                // Handle drill weapons differently
-                double drill_capability = game->weapon_properties[proj->weapon_type].drill_capability;
+    bool exact = memcmp(sequential.terrain, game->terrain, sizeof(game->terrain)) == 0;
+    bool pass = exact && batched_ms < single_ms;
+    printf("%-12s %d craters, %d tanks  batched %.3f ms  one by one %.3f ms  %s  %s\n", "crater batch", CRATERS,
+           game->num_players, batched_ms, single_ms, exact ? "exact" : "differ", pass ? "PASS" : "FAIL");
+    return pass;
+}
 
-                if (drill_capability > 0 && proj->travel_distance < 100)
-                {
-                    // Drill through terrain
-                    proj->dx *= 0.8; // Slow down when drilling
-                    proj->dy *= 0.8;
-                }
-                else
-                {
-                    // Explosion
-                    proj->active = false;
+// Function to check that slumping goes to sleep: after one shot, step until
+// every chunk is asleep, then check that further steps leave the terrain,
+// its log and the slump counter alone
+static bool run_slump_benchmark(Game *game)
+{
+    enum { QUIET_STEPS = 600 };
+    static double settled[TERRAIN_SEGMENTS];
+    MetricsBlock totals;
 
-                    // Get weapon properties
-                    WeaponProperty *wp = &game->weapon_properties[proj->weapon_type];
+    game->match_players = 8;
+    game->match_teams = false;
+    init_game(game);
+    metrics_collect(&totals);
+    unsigned long long passes = totals.counters[METRIC_SLUMP_PASSES];
+    bench_fire(game, 0, WEAPON_NUKE, (game->players[0].x < WORLD_WIDTH / 2) ? 60 : 120, 60);
+    int steps = 0;
+    while (steps < 5000 && (game->slump_chunks != 0 || game->state == STATE_EXPLOSION || game->state == STATE_FIRING))
+    {
+        update_game(game);
+        steps++;
+    }
+    metrics_collect(&totals);
+    unsigned long long slumped = totals.counters[METRIC_SLUMP_PASSES] - passes;
+    passes = totals.counters[METRIC_SLUMP_PASSES];
+
+    memcpy(settled, game->terrain, sizeof(settled));
+    int ops = game->terrain_log.op_count;
+    game->terrain_dirty_lo = 1;
+    game->terrain_dirty_hi = 0;
+    double start = now_ms();
+    for (int s = 0; s < QUIET_STEPS; s++)
+    {
+        update_game(game);
+    }
+    double quiet_ms = now_ms() - start;
+    metrics_collect(&totals);
+
+    bool pass = slumped > 0 && game->slump_chunks == 0 && totals.counters[METRIC_SLUMP_PASSES] == passes &&
+                game->terrain_log.op_count == ops && game->terrain_dirty_lo > game->terrain_dirty_hi &&
+                memcmp(settled, game->terrain, sizeof(settled)) == 0;
+    printf("%-12s %llu chunk passes, asleep %d steps after the shot; %d steps after that  avg %.4f ms  %s\n",
+           "slump sleep", slumped, steps, QUIET_STEPS, quiet_ms / QUIET_STEPS, pass ? "PASS" : "FAIL");
+    return pass;
+}
 
-                    // Create explosion
-                    create_explosion(game, proj->x, proj->y, wp->explosion_radius, wp->damage, wp->terrain_deformation);
+// Function to fold a 64-bit value into an FNV-1a hash, byte by byte
+static uint64_t hash_mix(uint64_t hash, uint64_t value)
+{
+    for (int b = 0; b < 8; b++)
+    {
+        hash ^= (value >> (8 * b)) & 0xFF;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
 
-                    // Handle cluster bombs
-                    if (proj->sub_projectiles > 0)
-                    {
-                        spawn_cluster_bombs(game, proj->x, proj->y);
-                    }
-                }
-            }
+// Function to fold a coordinate into a hash as a Q16.16 integer
+static uint64_t hash_mix_q16(uint64_t hash, double value)
+{
+    return hash_mix(hash, (uint64_t)llround(value * 65536.0));
+}
 
-            // Check if out of bounds
-            if (proj->x < 0 || proj->x > WINDOW_WIDTH || proj->y > WINDOW_HEIGHT)
-            {
-                proj->active = false;
-            }
-        }
+// Function to hash the simulation state that decides how a match plays
+// out: counters, generator, tanks, terrain and everything in flight.
+// Fixed-point builds have to agree on it bit for bit whatever the compiler.
+static uint64_t state_hash(const Game *game)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    hash = hash_mix(hash, game->step);
+    hash = hash_mix(hash, game->turn);
+    hash = hash_mix(hash, game->state);
+    hash = hash_mix(hash, game->current_player);
+    hash = hash_mix(hash, game->winning_team);
+    hash = hash_mix(hash, game->rng_state);
+    hash = hash_mix(hash, llround(game->wind * 1000));
+
+    for (int i = 0; i < game->num_players; i++)
+    {
+        const Tank *tank = &game->players[i];
+        hash = hash_mix(hash, tank->health);
+        hash = hash_mix(hash, tank->score);
+        hash = hash_mix(hash, tank->angle);
+        hash = hash_mix(hash, tank->power);
+        hash = hash_mix(hash, tank->current_weapon);
+        hash = hash_mix(hash, tank->moves_left);
+        hash = hash_mix_q16(hash, tank->x);
+        hash = hash_mix_q16(hash, tank->y);
+        hash = hash_mix_q16(hash, tank->vy);
+    }
+    for (int i = 0; i < TERRAIN_SEGMENTS; i++)
+    {
+        hash = hash_mix(hash, llround(game->terrain[i] * TERRAIN_HEIGHT_STEPS));
+    }
+    for (int i = 0; i < MAX_PROJECTILES; i++)
+    {
+        const Projectile *proj = &game->projectiles[i];
+        if (!proj->active)
+            continue;
+        hash = hash_mix(hash, i);
+        hash = hash_mix(hash, proj->weapon_type);
+        hash = hash_mix(hash, proj->stage);
+        hash = hash_mix_q16(hash, PHYS_TO_DOUBLE(proj->x));
+        hash = hash_mix_q16(hash, PHYS_TO_DOUBLE(proj->y));
+        hash = hash_mix_q16(hash, PHYS_TO_DOUBLE(proj->dx));
+        hash = hash_mix_q16(hash, PHYS_TO_DOUBLE(proj->dy));
+        hash = hash_mix_q16(hash, PHYS_TO_DOUBLE(proj->travel_distance));
     }
-
-    // Update explosions
-    bool all_explosions_done = true;
     for (int i = 0; i < MAX_EXPLOSIONS; i++)
     {
         if (game->explosions[i].active)
         {
-            Explosion *exp = &game->explosions[i];
-
-            // Grow explosion
-            exp->radius += exp->growth_rate;
-
-            // Check if explosion is done
-            if (exp->radius >= exp->max_radius)
-            {
-                exp->active = false;
-            }
-            else
-            {
-                all_explosions_done = false;
-            }
+            hash = hash_mix(hash, i);
+            hash = hash_mix_q16(hash, game->explosions[i].x);
+            hash = hash_mix_q16(hash, game->explosions[i].y);
         }
     }
-
-    // Update particles
     for (int i = 0; i < MAX_PARTICLES; i++)
     {
         if (game->particles[i].active)
         {
-            Particle *part = &game->particles[i];
-
-            // Apply gravity
-            part->dy += GRAVITY * 0.1;
-
-            // Update position
-            part->x += part->dx;
-            part->y += part->dy;
+            hash = hash_mix(hash, i);
+            hash = hash_mix(hash, (uint64_t)game->particles[i].lifetime);
+        }
+    }
+    return hash;
+}
 
-            // Check for terrain collision
-            if (part->y >= get_terrain_height(game, (int)part->x))
-            {
-                part->dy *= -0.5; // Bounce
-                part->dx *= 0.8;  // Friction
-                part->y = get_terrain_height(game, (int)part->x) - 1;
-            }
+// Function to start the scripted four-player match; returns the players'
+// own generator (an LCG), apart from the game's
+static uint32_t start_scripted_match(Game *game)
+{
+    seed_game_rand(game, 2024);
+    game->match_players = 4;
+    game->match_teams = false;
+    init_game(game);
+    return 12345;
+}
 
-            // Decrease lifetime
-            part->lifetime--;
+// Function to run step s (from 1) of the scripted match: players take a
+// moment to aim, then adjust a few times and fire
+static void play_scripted_step(Game *game, uint32_t *script, int s)
+{
+    static const GameAction aims[] = {ACTION_ANGLE_UP,    ACTION_ANGLE_DOWN, ACTION_POWER_UP,  ACTION_POWER_DOWN,
+                                      ACTION_NEXT_WEAPON, ACTION_MOVE_LEFT,  ACTION_MOVE_RIGHT};
 
-            // Check if particle is done
-            if (part->lifetime <= 0 || part->x < 0 || part->x > WINDOW_WIDTH || part->y > WINDOW_HEIGHT)
-            {
-                part->active = false;
-            }
-        }
+    if (game->state == STATE_GAME_OVER)
+    {
+        apply_action(game, ACTION_RESET);
     }
-
-    // Check if all projectiles and explosions are done
-    bool all_projectiles_done = true;
-    for (int i = 0; i < MAX_PROJECTILES; i++)
+    else if (game->state == STATE_AIMING && s % 20 == 0)
     {
-        if (game->projectiles[i].active)
+        for (int a = 0; a < 8; a++)
         {
-            all_projectiles_done = false;
-            break;
+            *script = *script * 1664525u + 1013904223u;
+            apply_action(game, aims[(*script >> 16) % (sizeof(aims) / sizeof(aims[0]))]);
         }
+        apply_action(game, ACTION_FIRE);
     }
+    update_game(game);
+}
 
-    // State transitions
-    if ((game->state == STATE_FIRING || game->state == STATE_EXPLOSION) && all_projectiles_done && all_explosions_done)
+// Function to play the scripted match for a number of steps, printing the
+// state hash every HASH_CHECKPOINT_STEPS. Two builds (other compilers,
+// other flags) are compared by their output, or by passing one build's
+// final hash to the other as expected; returns non-zero on a mismatch.
+static int run_hash_check(Game *game, int steps, const char *expected)
+{
+    uint32_t script = start_scripted_match(game);
+#ifdef ARTILLERY_FIXED_POINT
+    printf("Fixed-point physics, %d steps\n", steps);
+#else
+    printf("Floating-point physics, %d steps\n", steps);
+#endif
+
+    for (int s = 1; s <= steps; s++)
     {
-        // Check if game is over
-        if (game->players[0].health <= 0 || game->players[1].health <= 0)
-        {
-            game->state = STATE_GAME_OVER;
-
-            // Award score to winner
-            if (game->players[0].health <= 0)
-            {
-                game->players[1].score++;
-            }
-            else
-            {
-                game->players[0].score++;
-            }
-        }
-        else
-        {
-            // Switch player
-            game->current_player = 1 - game->current_player;
-            game->state = STATE_AIMING;
-
-            // Reset moves for the new player's turn
-            game->players[game->current_player].moves_left = 3;
+        play_scripted_step(game, &script, s);
 
-            // Generate new random wind
-            srand(time(NULL) + game->frame_count); // Ensure better randomization
-            double wind_magnitude = (0.02 + (rand() % 31) / 1000.0);
-            int direction = (rand() % 2) * 2 - 1;
-            game->wind = wind_magnitude * direction;
+        if (s % HASH_CHECKPOINT_STEPS == 0 || s == steps)
+            printf("step %6d  turn %4d  hash %016llx\n", s, game->turn, (unsigned long long)state_hash(game));
+    }
 
-            // Ensure wind is never exactly zero
-            if (fabs(game->wind) < 0.02)
-            {
-                game->wind = (game->wind >= 0) ? 0.02 : -0.02;
-            }
+    if (expected == NULL)
+        return 0;
+    bool match = state_hash(game) == strtoull(expected, NULL, 16);
+    printf("Expected %s: %s\n", expected, match ? "match" : "MISMATCH");
+    return match ? 0 : 1;
+}
 
-            // Update wind display
-            update_wind_display(game);
+// Weapons the batched environment plays: the ones firing a single shell
+static const WeaponType env_weapons[] = {WEAPON_SMALL_MISSILE, WEAPON_BIG_MISSILE, WEAPON_DRILL, WEAPON_NUKE};
+#define ENV_WEAPON_COUNT ((int)(sizeof(env_weapons) / sizeof(env_weapons[0])))
 
-            // Debug print to verify wind changes
-            printf("New Wind: %.3f\n", game->wind);
+// Structure for a batch of training matches (declared in artillery_env.h),
+// held as structure of arrays: the flight update of a step runs straight
+// down contiguous arrays of shell state
+struct ArtilleryEnv
+{
+    int count;
+    int chunk_size, chunk_count; // Matches are stepped in chunks, one pool task each
+    int *chunk_ids;
+    WeaponProperty weapons[WEAPON_COUNT];
+
+    // Per match
+    uint32_t *rng;
+    float *terrain; // TERRAIN_SEGMENTS heights per match
+    float *profile; // ARTILLERY_ENV_PROFILE heights per match, kept in step with the terrain
+    double *wind;
+    phys_t *push; // wind_push of the wind
+    int *current; // Tank to act
+    int *steps;
+    uint8_t *flying; // 1 while a shell is in the air
+    phys_t *shell_x, *shell_y, *shell_dx, *shell_dy, *shell_travel;
+    int *shell_weapon;
+
+    // Per tank, two per match
+    float *tank_x, *tank_y;
+    int *health, *angle, *power, *weapon, *moves;
+
+    // Arguments of the step being run
+    const int32_t *actions;
+    float *observations, *rewards;
+    uint8_t *dones, *truncations;
+#ifdef __linux__
+    WorkPool pool;
+#endif
+};
+
+// Function to get a match's terrain height at a pixel column
+static double env_terrain_height(const ArtilleryEnv *env, int e, int x)
+{
+    if (x < 0 || x >= WORLD_WIDTH)
+        return WORLD_HEIGHT;
+    return env->terrain[e * TERRAIN_SEGMENTS + terrain_segment_at(x)];
+}
 
-            // Force redraw of the window to update wind display
-            // if (window != NULL)
-            // {
-            //     gtk_widget_queue_draw(window);
-            // }
-        }
+// Function to resample a match's terrain into its observation profile
+static void env_update_profile(ArtilleryEnv *env, int e)
+{
+    for (int k = 0; k < ARTILLERY_ENV_PROFILE; k++)
+    {
+        int segment = (2 * k + 1) * TERRAIN_SEGMENTS / (2 * ARTILLERY_ENV_PROFILE);
+        env->profile[e * ARTILLERY_ENV_PROFILE + k] = env->terrain[e * TERRAIN_SEGMENTS + segment] / WORLD_HEIGHT;
     }
-
-    // Always check tank positions to adjust for terrain changes
-    check_tank_positions(game);
 }
 
-// Add this new function implementation after update_game
-static void update_wind_display(Game *game)
+// Function to drop a tank onto the ground below it the way update_tanks
+// does, but in one go (no sliding); returns the fall damage
+static int env_settle_tank(ArtilleryEnv *env, int e, int t)
 {
-    // Debug print
-    printf("New Wind: %.3f\n", game->wind);
-
-    // Force immediate redraw
-    if (window != NULL)
+    double ground = env_terrain_height(env, e, (int)env->tank_x[t]) - TANK_HEIGHT / 2;
+    double y = env->tank_y[t], vy = 0;
+    while (y < ground)
     {
-        gtk_widget_queue_draw(window);
-
-        // Process any pending events using GTK4's event system
-        while (g_main_context_iteration(NULL, FALSE))
-            ;
+        vy += PHYS_TO_DOUBLE(PHYS_GRAVITY);
+        y += vy;
     }
+    env->tank_y[t] = ground;
+
+    int damage = 0;
+    if (vy > FALL_DAMAGE_SPEED && env->health[t] > 0)
+        damage = (int)((vy - FALL_DAMAGE_SPEED) * FALL_DAMAGE_FACTOR);
+    if (damage > env->health[t])
+        damage = env->health[t];
+    env->health[t] -= damage;
+    return damage;
 }
 
-// Function to render the game
-static void render_game(GtkDrawingArea *drawing_area, cairo_t *cr, int width, int height, gpointer user_data)
+// Function to pick a match's wind for a new turn, as update_game does
+static void env_new_wind(ArtilleryEnv *env, int e)
 {
-    Game *game = (Game *)user_data;
-
-    // Clear background
-    cairo_set_source_rgb(cr, 0.2, 0.6, 0.9); // Sky blue
-    cairo_paint(cr);
+    double wind_magnitude = (0.02 + (next_rand(&env->rng[e]) % 31) / 1000.0);
+    int direction = (next_rand(&env->rng[e]) % 2) * 2 - 1;
+    env->wind[e] = wind_magnitude * direction;
+    env->push[e] = wind_push(env->wind[e]);
+}
 
-    // Create terrain path
-    cairo_move_to(cr, 0, WINDOW_HEIGHT);
+// Function to start a match afresh: new terrain, tanks at a quarter and
+// three quarters of the way across, as in a two-player game
+static void env_reset_match(ArtilleryEnv *env, int e)
+{
+    double terrain[TERRAIN_SEGMENTS];
+    generate_terrain_into(terrain, &env->rng[e]);
     for (int i = 0; i < TERRAIN_SEGMENTS; i++)
     {
-        double x = (double)i / TERRAIN_SEGMENTS * WINDOW_WIDTH;
-        cairo_line_to(cr, x, game->terrain[i]);
+        env->terrain[e * TERRAIN_SEGMENTS + i] = quantize_terrain_height(terrain[i]) / TERRAIN_HEIGHT_STEPS;
     }
-    cairo_line_to(cr, WINDOW_WIDTH, WINDOW_HEIGHT);
-    cairo_close_path(cr);
-
-    // Draw terrain with gradient
-    cairo_pattern_t *terrain_gradient = cairo_pattern_create_linear(0, 0, 0, WINDOW_HEIGHT);
-    cairo_pattern_add_color_stop_rgb(terrain_gradient, 0.0, 0.2, 0.5, 0.1); // Dark green top
-    cairo_pattern_add_color_stop_rgb(terrain_gradient, 0.3, 0.3, 0.6, 0.2); // Medium green middle
-    cairo_pattern_add_color_stop_rgb(terrain_gradient, 1.0, 0.1, 0.4, 0.1); // Deep green bottom
-    cairo_set_source(cr, terrain_gradient);
-    cairo_fill_preserve(cr);
-    cairo_pattern_destroy(terrain_gradient);
-
-    // Modify the grass rendering section in render_game:
+    env_update_profile(env, e);
 
-    // Add this at the start of render_game function to seed random number generator
-    static unsigned int grass_seed = 0;
-    srand(grass_seed); // Use consistent seed for grass
-
-    // Replace the grass layer section with this:
-    // Add grass layer on top
-    for (int i = 0; i < TERRAIN_SEGMENTS - 1; i++)
+    for (int p = 0; p < 2; p++)
     {
-        double x = (double)i / TERRAIN_SEGMENTS * WINDOW_WIDTH;
-        double y = game->terrain[i];
-
-        // Use deterministic random based on position
-        if ((i * 7919) % 17 < 6)
-        { // Prime numbers for better distribution
-            double grass_height = 2 + ((i * 3779) % 4);
-            // Brighter, more varied greens
-            cairo_set_source_rgba(cr,
-                                  0.2 + ((i * 1597) % 20) / 100.0, // Red component
-                                  0.6 + ((i * 2389) % 30) / 100.0, // Green component
-                                  0.1 + ((i * 3571) % 15) / 100.0, // Blue component
-                                  0.9);                            // More opaque
-
-            cairo_set_line_width(cr, 1.0);
-            cairo_move_to(cr, x, y);
-            // Use position-based randomization for angle
-            double grass_angle = ((i * 4463) % 40 - 20) * PI / 180.0;
-            cairo_line_to(cr,
-                          x + cos(grass_angle) * grass_height,
-                          y - grass_height);
-            cairo_stroke(cr);
-        }
+        int t = 2 * e + p;
+        env->tank_x[t] = WORLD_WIDTH * (2 * p + 1) / 4;
+        env->health[t] = 100;
+        env->angle[t] = p == 0 ? 45 : 135;
+        env->power[t] = 50;
+        env->weapon[t] = 0;
+        env->moves[t] = 3;
+        env->tank_y[t] = env_terrain_height(env, e, (int)env->tank_x[t]) - TANK_HEIGHT / 2;
     }
 
-    // Add terrain texture and details
-    for (int i = 0; i < TERRAIN_SEGMENTS; i += 2)
+    do
     {
-        double x = (double)i / TERRAIN_SEGMENTS * WINDOW_WIDTH;
-        double y = game->terrain[i];
+        env->wind[e] = (next_rand(&env->rng[e]) % 21 - 10) * 0.01;
+    } while (fabs(env->wind[e]) < 0.02);
+    env->push[e] = wind_push(env->wind[e]);
+    env->current[e] = 0;
+    env->steps[e] = 0;
+    env->flying[e] = 0;
+}
 
-        // Rock details
-        if (rand() % 20 == 0)
-        {
-            cairo_set_source_rgba(cr, 0.4 + (rand() % 20) / 100.0,
-                                  0.3 + (rand() % 20) / 100.0,
-                                  0.2 + (rand() % 20) / 100.0,
-                                  0.7);
-            double rock_size = 2 + (rand() % 4);
-            cairo_arc(cr, x, y - rock_size / 2, rock_size, 0, 2 * PI);
-            cairo_fill(cr);
-        }
+// Function to apply a player action to a match, as apply_action does;
+// returns the fall damage a move did to the tank
+static int env_apply_action(ArtilleryEnv *env, int e, int action)
+{
+    if (env->flying[e])
+        return 0;
 
-        // Soil texture
-        for (int j = 0; j < 3; j++)
+    int t = 2 * e + env->current[e];
+    int damage = 0;
+    switch (action)
+    {
+    case ARTILLERY_ENV_ANGLE_UP:
+        env->angle[t] = (env->angle[t] + 1) % 360;
+        break;
+    case ARTILLERY_ENV_ANGLE_DOWN:
+        env->angle[t] = (env->angle[t] + 359) % 360;
+        break;
+    case ARTILLERY_ENV_POWER_UP:
+        if (env->power[t] < MAX_POWER)
+            env->power[t]++;
+        break;
+    case ARTILLERY_ENV_POWER_DOWN:
+        if (env->power[t] > 1)
+            env->power[t]--;
+        break;
+    case ARTILLERY_ENV_NEXT_WEAPON:
+        env->weapon[t] = (env->weapon[t] + 1) % ENV_WEAPON_COUNT;
+        break;
+    case ARTILLERY_ENV_MOVE_LEFT:
+    case ARTILLERY_ENV_MOVE_RIGHT:
+        if (env->moves[t] > 0)
         {
-            double dx = (rand() % 5) - 2;
-            double dy = (rand() % 10);
-            if (y + dy < WINDOW_HEIGHT)
-            {
-                cairo_set_source_rgba(cr, 0.2, 0.5, 0.1, 0.1); // Green soil texture
-                cairo_rectangle(cr, x + dx, y + dy, 1, 1);
-                cairo_fill(cr);
-            }
+            float x = env->tank_x[t] + (action == ARTILLERY_ENV_MOVE_LEFT ? -22 : 22);
+            env->tank_x[t] = x < TANK_WIDTH / 2 ? TANK_WIDTH / 2 : x > WORLD_WIDTH - TANK_WIDTH / 2 ? WORLD_WIDTH - TANK_WIDTH / 2 : x;
+            env->tank_y[t] = fmin(env->tank_y[t], env_terrain_height(env, e, (int)env->tank_x[t]) - TANK_HEIGHT / 2);
+            damage = env_settle_tank(env, e, t);
+            env->moves[t]--;
         }
+        break;
+    case ARTILLERY_ENV_FIRE:
+    {
+        Projectile shell;
+        launch_projectile(&shell, env->tank_x[t], env->tank_y[t], env->angle[t] * 10, env->power[t] * 100);
+        env->shell_x[e] = shell.x;
+        env->shell_y[e] = shell.y;
+        env->shell_dx[e] = shell.dx;
+        env->shell_dy[e] = shell.dy;
+        env->shell_travel[e] = 0;
+        env->shell_weapon[e] = env_weapons[env->weapon[t]];
+        env->flying[e] = 1;
+        break;
     }
-
-    // Add terrain contours
-    cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.1);
-    cairo_set_line_width(cr, 0.5);
-    for (int i = 0; i < TERRAIN_SEGMENTS - 10; i += 10)
-    {
-        double x1 = (double)i / TERRAIN_SEGMENTS * WINDOW_WIDTH;
-        double x2 = (double)(i + 10) / TERRAIN_SEGMENTS * WINDOW_WIDTH;
-        double y1 = game->terrain[i];
-        double y2 = game->terrain[i + 10];
-
-        cairo_move_to(cr, x1, y1);
-        cairo_curve_to(cr,
-                       x1 + 3, y1,
-                       x2 - 3, y2,
-                       x2, y2);
-        cairo_stroke(cr);
+    default:
+        break;
     }
+    return damage;
+}
 
-    // Add terrain shadows
-    cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.2);
-    for (int i = 1; i < TERRAIN_SEGMENTS; i++)
+// Function to blow up a match's shell where it is: blast damage as in
+// create_explosion, the crater as flush_craters digs it, then the tanks settle
+static void env_explode(ArtilleryEnv *env, int e)
+{
+    const WeaponProperty *wp = &env->weapons[env->shell_weapon[e]];
+    double x = PHYS_TO_DOUBLE(env->shell_x[e]), y = PHYS_TO_DOUBLE(env->shell_y[e]);
+    double radius = wp->explosion_radius;
+
+    for (int t = 2 * e; t < 2 * e + 2; t++)
     {
-        double x = (double)i / TERRAIN_SEGMENTS * WINDOW_WIDTH;
-        double y = game->terrain[i];
-        double prev_y = game->terrain[i - 1];
+        env->health[t] -= blast_damage(env->tank_x[t] - x, env->tank_y[t] - y, radius * 1.5, wp->damage);
+        if (env->health[t] < 0)
+            env->health[t] = 0;
+    }
 
-        if (y > prev_y)
-        { // Create shadow on rising slopes
-            cairo_move_to(cr, x, y);
-            cairo_line_to(cr, x, prev_y);
-            cairo_stroke(cr);
+    int start_index, end_index;
+    TerrainOp op = make_crater_op(x, y, radius, wp->terrain_deformation);
+    if (y + radius >= env_terrain_height(env, e, (int)x) && terrain_op_range(&op, &start_index, &end_index))
+    {
+        float *terrain = &env->terrain[e * TERRAIN_SEGMENTS];
+        for (int i = start_index; i <= end_index; i++)
+        {
+            terrain[i] += crater_depth_at(i, op.x / TERRAIN_OP_SUBPIXELS, op.radius / TERRAIN_OP_SUBPIXELS, op.deformation);
         }
+        env_update_profile(env, e);
+        for (int t = 2 * e; t < 2 * e + 2; t++)
+            env_settle_tank(env, e, t);
     }
+}
+
+// Function to follow a match's shell after it moved: distance, terrain
+// (drills bore through for a while), leaving the world, direct hits.
+// Returns true when the shot is over.
+static bool env_shell_done(ArtilleryEnv *env, int e)
+{
+    const WeaponProperty *wp = &env->weapons[env->shell_weapon[e]];
+    env->shell_travel[e] += phys_length(env->shell_dx[e], env->shell_dy[e]);
 
-    // Draw tanks
-    for (int i = 0; i < 2; i++)
+    if (PHYS_TO_DOUBLE(env->shell_y[e]) >= env_terrain_height(env, e, PHYS_TO_INT(env->shell_x[e])))
     {
-        // Choose color based on player
-        if (i == 0)
+        if (wp->drill_capability > 0 && env->shell_travel[e] < PHYS_FROM_DOUBLE(100))
         {
-            cairo_set_source_rgb(cr, 0.8, 0.2, 0.2); // Red
+            env->shell_dx[e] = drill_slowdown(env->shell_dx[e]);
+            env->shell_dy[e] = drill_slowdown(env->shell_dy[e]);
         }
         else
         {
-            cairo_set_source_rgb(cr, 0.2, 0.2, 0.8); // Blue
+            env_explode(env, e);
+            return true;
         }
+    }
 
-        // Draw tank body
-        cairo_rectangle(cr, game->players[i].x - TANK_WIDTH / 2, game->players[i].y - TANK_HEIGHT / 2, TANK_WIDTH, TANK_HEIGHT);
-        cairo_fill(cr);
-
-        // Draw tank barrel
-        double angle_rad = game->players[i].angle * PI / 180.0;
-        double barrel_length = 20.0;
-        double barrel_width = 3.0;
+    if (env->shell_x[e] < 0 || env->shell_x[e] > PHYS_FROM_DOUBLE(WORLD_WIDTH) ||
+        env->shell_y[e] > PHYS_FROM_DOUBLE(WORLD_HEIGHT))
+        return true;
 
-        // Barrel start position
-        double barrel_start_x = game->players[i].x;
-        double barrel_start_y = game->players[i].y - TANK_HEIGHT / 4;
+    double x = PHYS_TO_DOUBLE(env->shell_x[e]), y = PHYS_TO_DOUBLE(env->shell_y[e]);
+    for (int t = 2 * e; t < 2 * e + 2; t++)
+    {
+        if (env->health[t] > 0 && fabs(x - env->tank_x[t]) <= TANK_WIDTH / 2 && fabs(y - env->tank_y[t]) <= TANK_HEIGHT / 2)
+        {
+            env_explode(env, e);
+            return true;
+        }
+    }
+    return false;
+}
 
-        // Barrel end position
-        double barrel_end_x = barrel_start_x + cos(angle_rad) * barrel_length;
-        double barrel_end_y = barrel_start_y - sin(angle_rad) * barrel_length;
+// Function to write a match's observation (see artillery_env.h)
+static void env_observe(const ArtilleryEnv *env, int e, float *obs)
+{
+    int self = 2 * e + env->current[e], other = 2 * e + 1 - env->current[e];
+    memcpy(&obs[ARTILLERY_OBS_TERRAIN], &env->profile[e * ARTILLERY_ENV_PROFILE], ARTILLERY_ENV_PROFILE * sizeof(float));
+    obs[ARTILLERY_OBS_SELF_X] = env->tank_x[self] / WORLD_WIDTH;
+    obs[ARTILLERY_OBS_SELF_Y] = env->tank_y[self] / WORLD_HEIGHT;
+    obs[ARTILLERY_OBS_SELF_HEALTH] = env->health[self] / 100.0f;
+    obs[ARTILLERY_OBS_OPPONENT_X] = env->tank_x[other] / WORLD_WIDTH;
+    obs[ARTILLERY_OBS_OPPONENT_Y] = env->tank_y[other] / WORLD_HEIGHT;
+    obs[ARTILLERY_OBS_OPPONENT_HEALTH] = env->health[other] / 100.0f;
+    obs[ARTILLERY_OBS_ANGLE] = env->angle[self] / 360.0f;
+    obs[ARTILLERY_OBS_POWER] = (float)env->power[self] / MAX_POWER;
+    obs[ARTILLERY_OBS_WEAPON] = (float)env->weapon[self] / ENV_WEAPON_COUNT;
+    obs[ARTILLERY_OBS_MOVES] = env->moves[self] / 3.0f;
+    obs[ARTILLERY_OBS_WIND] = (float)(env->wind[e] * 10);
+    obs[ARTILLERY_OBS_AIMING] = !env->flying[e];
+    obs[ARTILLERY_OBS_SHELL_X] = env->flying[e] ? (float)(PHYS_TO_DOUBLE(env->shell_x[e]) / WORLD_WIDTH) : -1;
+    obs[ARTILLERY_OBS_SHELL_Y] = env->flying[e] ? (float)(PHYS_TO_DOUBLE(env->shell_y[e]) / WORLD_HEIGHT) : -1;
+    obs[ARTILLERY_OBS_PLAYER] = env->current[e];
+    obs[ARTILLERY_OBS_STEPS] = (float)env->steps[e] / ARTILLERY_ENV_MAX_STEPS;
+}
 
-        // Draw barrel
-        cairo_set_line_width(cr, barrel_width);
-        cairo_move_to(cr, barrel_start_x, barrel_start_y);
-        cairo_line_to(cr, barrel_end_x, barrel_end_y);
-        cairo_stroke(cr);
+// Function to run one step for a chunk of matches (a pool task)
+static void env_step_chunk(void *context, int chunk)
+{
+    ArtilleryEnv *env = context;
+    int lo = chunk * env->chunk_size;
+    int hi = lo + env->chunk_size < env->count ? lo + env->chunk_size : env->count;
 
-        // Draw health bar
-        cairo_set_source_rgb(cr, 0.8, 0.2, 0.2); // Red background
-        cairo_rectangle(cr, game->players[i].x - TANK_WIDTH / 2, game->players[i].y - TANK_HEIGHT - 10, TANK_WIDTH, 5);
-        cairo_fill(cr);
+    // The reward starts as the fall damage of a move
+    for (int e = lo; e < hi; e++)
+    {
+        env->rewards[e] = -env_apply_action(env, e, env->actions[e]) / 100.0f;
+    }
 
-        cairo_set_source_rgb(cr, 0.2, 0.8, 0.2); // Green health
-        cairo_rectangle(cr, game->players[i].x - TANK_WIDTH / 2, game->players[i].y - TANK_HEIGHT - 10, TANK_WIDTH * game->players[i].health / 100.0, 5);
-        cairo_fill(cr);
+    // Wind, gravity and motion for every shell of the chunk in one
+    // branch-free pass (grounded shells get a zero step), which the
+    // compiler turns into vector code
+    phys_t *restrict x = env->shell_x, *restrict y = env->shell_y;
+    phys_t *restrict dx = env->shell_dx, *restrict dy = env->shell_dy;
+    const phys_t *restrict push = env->push;
+    const uint8_t *restrict flying = env->flying;
+    for (int e = lo; e < hi; e++)
+    {
+        phys_t live = flying[e];
+        dx[e] += live * push[e];
+        dy[e] += live * PHYS_GRAVITY;
+        x[e] += live * dx[e];
+        y[e] += live * dy[e];
     }
 
-    // Draw projectiles
-    for (int i = 0; i < MAX_PROJECTILES; i++)
+    for (int e = lo; e < hi; e++)
     {
-        if (game->projectiles[i].active)
+        int self = 2 * e + env->current[e], other = 2 * e + 1 - env->current[e];
+        int self_health = env->health[self], other_health = env->health[other];
+        env->dones[e] = 0;
+        env->truncations[e] = 0;
+        env->steps[e]++;
+
+        // A finished shot hands the turn over, unless it ended the match
+        if (env->flying[e] && env_shell_done(env, e))
         {
-            Projectile *proj = &game->projectiles[i];
-
-            // Replace the projectile coloring section with brighter colors:
-            switch (proj->weapon_type)
+            env->flying[e] = 0;
+            env->rewards[e] += ((other_health - env->health[other]) - (self_health - env->health[self])) / 100.0f;
+            if (env->health[self] > 0 && env->health[other] > 0)
             {
-            case WEAPON_SMALL_MISSILE:
-                cairo_set_source_rgb(cr, 1.0, 0.9, 0.2); // Bright yellow
-                cairo_arc(cr, proj->x, proj->y, 3, 0, 2 * PI);
-                cairo_fill(cr);
-                // Add glow effect
-                cairo_set_source_rgba(cr, 1.0, 0.9, 0.2, 0.3);
-                cairo_arc(cr, proj->x, proj->y, 5, 0, 2 * PI);
-                cairo_fill(cr);
-                break;
+                env->current[e] ^= 1;
+                env->moves[2 * e + env->current[e]] = 3;
+                env_new_wind(env, e);
+            }
+        }
 
-            case WEAPON_BIG_MISSILE:
-                cairo_set_source_rgb(cr, 1.0, 0.5, 0.0); // Bright orange
-                cairo_arc(cr, proj->x, proj->y, 5, 0, 2 * PI);
-                cairo_fill(cr);
-                // Add glow effect
-                cairo_set_source_rgba(cr, 1.0, 0.5, 0.0, 0.3);
-                cairo_arc(cr, proj->x, proj->y, 7, 0, 2 * PI);
-                cairo_fill(cr);
-                break;
+        // A shot, or a fall after a move, can end the match
+        if (env->health[self] == 0 || env->health[other] == 0)
+        {
+            env->rewards[e] += (env->health[other] == 0) - (env->health[self] == 0);
+            env->dones[e] = 1;
+        }
 
-            case WEAPON_DRILL:
-                cairo_set_source_rgb(cr, 0.7, 0.7, 0.9); // Bright metallic
-                cairo_save(cr);
-                cairo_translate(cr, proj->x, proj->y);
-                double angle = atan2(proj->dy, proj->dx);
-                cairo_rotate(cr, angle);
-                cairo_move_to(cr, 0, 0);
-                cairo_line_to(cr, 8, -3);
-                cairo_line_to(cr, 8, 3);
-                cairo_close_path(cr);
-                cairo_fill(cr);
-                cairo_restore(cr);
-                break;
+        // A match still going at the step limit is cut short, not ended
+        if (!env->dones[e] && env->steps[e] >= ARTILLERY_ENV_MAX_STEPS)
+            env->truncations[e] = 1;
+        if (env->dones[e] || env->truncations[e])
+            env_reset_match(env, e);
+        env_observe(env, e, &env->observations[e * ARTILLERY_ENV_OBS_SIZE]);
+    }
+}
 
-            case WEAPON_CLUSTER:
-                cairo_set_source_rgb(cr, 1.0, 0.3, 1.0); // Bright purple
-                cairo_arc(cr, proj->x, proj->y, 4, 0, 2 * PI);
-                cairo_fill(cr);
-                // Add glow effect
-                cairo_set_source_rgba(cr, 1.0, 0.3, 1.0, 0.3);
-                cairo_arc(cr, proj->x, proj->y, 6, 0, 2 * PI);
-                cairo_fill(cr);
-                break;
+// Function to create a batch of matches (see artillery_env.h)
+ArtilleryEnv *artillery_env_create(int count, int threads, uint32_t seed)
+{
+    ArtilleryEnv *env = calloc(1, sizeof(ArtilleryEnv));
+    if (env == NULL || count <= 0)
+    {
+        free(env);
+        return NULL;
+    }
+    env->count = count;
+    env->chunk_size = 256;
+    env->chunk_count = (count + env->chunk_size - 1) / env->chunk_size;
 
-            case WEAPON_NUKE:
-                // Draw blinking nuke symbol
-                if (game->frame_count % 10 < 5)
-                {
-                    cairo_set_source_rgb(cr, 0.8, 0.0, 0.0); // Red
-                }
-                else
-                {
-                    cairo_set_source_rgb(cr, 1.0, 1.0, 0.0); // Yellow
-                }
-                cairo_arc(cr, proj->x, proj->y, 6, 0, 2 * PI);
-                cairo_fill(cr);
+    // The weapons come from the game's table
+    Game *scratch = calloc(1, sizeof(Game));
+    if (scratch == NULL)
+    {
+        free(env);
+        return NULL;
+    }
+    init_weapons(scratch);
+    memcpy(env->weapons, scratch->weapon_properties, sizeof(env->weapons));
+    free(scratch);
+
+    env->chunk_ids = malloc(env->chunk_count * sizeof(int));
+    env->rng = malloc(count * sizeof(uint32_t));
+    env->terrain = malloc((size_t)count * TERRAIN_SEGMENTS * sizeof(float));
+    env->profile = malloc((size_t)count * ARTILLERY_ENV_PROFILE * sizeof(float));
+    env->wind = malloc(count * sizeof(double));
+    env->push = malloc(count * sizeof(phys_t));
+    env->current = malloc(count * sizeof(int));
+    env->steps = malloc(count * sizeof(int));
+    env->flying = malloc(count);
+    env->shell_x = calloc(count, sizeof(phys_t));
+    env->shell_y = calloc(count, sizeof(phys_t));
+    env->shell_dx = calloc(count, sizeof(phys_t));
+    env->shell_dy = calloc(count, sizeof(phys_t));
+    env->shell_travel = calloc(count, sizeof(phys_t));
+    env->shell_weapon = calloc(count, sizeof(int));
+    env->tank_x = malloc(2 * count * sizeof(float));
+    env->tank_y = malloc(2 * count * sizeof(float));
+    env->health = malloc(2 * count * sizeof(int));
+    env->angle = malloc(2 * count * sizeof(int));
+    env->power = malloc(2 * count * sizeof(int));
+    env->weapon = malloc(2 * count * sizeof(int));
+    env->moves = malloc(2 * count * sizeof(int));
+    if (!env->chunk_ids || !env->rng || !env->terrain || !env->profile || !env->wind || !env->push || !env->current ||
+        !env->steps || !env->flying || !env->shell_x || !env->shell_y || !env->shell_dx || !env->shell_dy ||
+        !env->shell_travel || !env->shell_weapon || !env->tank_x || !env->tank_y || !env->health || !env->angle ||
+        !env->power || !env->weapon || !env->moves)
+    {
+        artillery_env_destroy(env);
+        return NULL;
+    }
 
-                // Draw radiation symbol
-                cairo_set_source_rgb(cr, 0.0, 0.0, 0.0); // Black
-                double radius = 4;
-                for (int j = 0; j < 3; j++)
-                {
-                    double angle = j * (2 * PI / 3);
-                    cairo_save(cr);
-                    cairo_translate(cr, proj->x, proj->y);
-                    cairo_rotate(cr, angle);
-                    cairo_move_to(cr, 0, 0);
-                    cairo_arc(cr, 0, -radius, radius / 2, 0, PI);
-                    cairo_close_path(cr);
-                    cairo_fill(cr);
-                    cairo_restore(cr);
-                }
-                break;
-            }
-        }
+    for (int c = 0; c < env->chunk_count; c++)
+        env->chunk_ids[c] = c;
+    for (int e = 0; e < count; e++)
+    {
+        env->rng[e] = seed + e * 0x9E3779B9u;
+        if (env->rng[e] == 0)
+            env->rng[e] = 1; // xorshift never leaves zero
+        env_reset_match(env, e);
     }
 
-    // Draw explosions
-    for (int i = 0; i < MAX_EXPLOSIONS; i++)
+#ifdef __linux__
+    if (threads <= 0)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (!pool_start(&env->pool, threads, env->chunk_count, env_step_chunk, env))
     {
-        if (game->explosions[i].active)
-        {
-            Explosion *exp = &game->explosions[i];
+        artillery_env_destroy(env);
+        return NULL;
+    }
+#else
+    (void)threads;
+#endif
+    return env;
+}
 
-            // Draw explosion with gradient
-            cairo_pattern_t *pattern = cairo_pattern_create_radial(
-                exp->x, exp->y, 0,
-                exp->x, exp->y, exp->radius);
+// Function to free a batch of matches
+void artillery_env_destroy(ArtilleryEnv *env)
+{
+    if (env == NULL)
+        return;
+#ifdef __linux__
+    if (env->pool.worker_count > 0)
+        pool_stop(&env->pool);
+#endif
+    free(env->chunk_ids);
+    free(env->rng);
+    free(env->terrain);
+    free(env->profile);
+    free(env->wind);
+    free(env->push);
+    free(env->current);
+    free(env->steps);
+    free(env->flying);
+    free(env->shell_x);
+    free(env->shell_y);
+    free(env->shell_dx);
+    free(env->shell_dy);
+    free(env->shell_travel);
+    free(env->shell_weapon);
+    free(env->tank_x);
+    free(env->tank_y);
+    free(env->health);
+    free(env->angle);
+    free(env->power);
+    free(env->weapon);
+    free(env->moves);
+    free(env);
+}
+
+// Function to start every match afresh
+void artillery_env_reset(ArtilleryEnv *env, float *observations)
+{
+    for (int e = 0; e < env->count; e++)
+    {
+        env_reset_match(env, e);
+        env_observe(env, e, &observations[e * ARTILLERY_ENV_OBS_SIZE]);
+    }
+}
 
-            cairo_pattern_add_color_stop_rgba(pattern, 0.0, 1.0, 0.7, 0.0, 0.8); // Orange center
-            cairo_pattern_add_color_stop_rgba(pattern, 0.7, 0.8, 0.2, 0.0, 0.5); // Red middle
-            cairo_pattern_add_color_stop_rgba(pattern, 1.0, 0.5, 0.0, 0.0, 0.0); // Transparent edge
+// Function to step every match once, chunks running on the pool
+void artillery_env_step(ArtilleryEnv *env, const int32_t *actions, float *observations, float *rewards, uint8_t *dones,
+                        uint8_t *truncations)
+{
+    env->actions = actions;
+    env->observations = observations;
+    env->rewards = rewards;
+    env->dones = dones;
+    env->truncations = truncations;
+#ifdef __linux__
+    pool_run(&env->pool, env->chunk_ids, env->chunk_count);
+#else
+    for (int c = 0; c < env->chunk_count; c++)
+        env_step_chunk(env, c);
+#endif
+}
 
-            cairo_set_source(cr, pattern);
-            cairo_arc(cr, exp->x, exp->y, exp->radius, 0, 2 * PI);
-            cairo_fill(cr);
+// Function to measure the batched environment: matches driven by random
+// actions (firing often) for a number of steps on every core
+static int run_env_benchmark(int count, int steps)
+{
+    ArtilleryEnv *env = artillery_env_create(count, 0, 1234);
+    int32_t *actions = malloc(count * sizeof(int32_t));
+    float *observations = malloc((size_t)count * ARTILLERY_ENV_OBS_SIZE * sizeof(float));
+    float *rewards = malloc(count * sizeof(float));
+    uint8_t *dones = malloc(count), *truncations = malloc(count);
+    if (env == NULL || actions == NULL || observations == NULL || rewards == NULL || dones == NULL ||
+        truncations == NULL)
+        return 1;
+
+    artillery_env_reset(env, observations);
+    uint32_t rng = 99;
+    long matches = 0, cut_short = 0;
+    double reward_total = 0, action_ms = 0;
+    double start = now_ms();
+    for (int s = 0; s < steps; s++)
+    {
+        double mark = now_ms();
+        for (int e = 0; e < count; e++)
+            actions[e] = xorshift32(&rng) % ARTILLERY_ENV_ACTIONS;
+        action_ms += now_ms() - mark;
 
-            cairo_pattern_destroy(pattern);
+        artillery_env_step(env, actions, observations, rewards, dones, truncations);
+        for (int e = 0; e < count; e++)
+        {
+            matches += dones[e];
+            cut_short += truncations[e];
+            reward_total += rewards[e];
         }
     }
+    double elapsed = now_ms() - start - action_ms;
+
+    printf("Env: %d matches x %d steps in %.1f ms: %.2f M steps/s (%d threads), %ld matches finished, %ld cut short, reward sum %.1f\n",
+           count, steps, elapsed, (double)count * steps / elapsed / 1000,
+#ifdef __linux__
+           env->pool.worker_count,
+#else
+           1,
+#endif
+           matches, cut_short, reward_total);
+
+    artillery_env_destroy(env);
+    free(actions);
+    free(observations);
+    free(rewards);
+    free(dones);
+    free(truncations);
+    return 0;
+}
 
-    // Draw particles
-    for (int i = 0; i < MAX_PARTICLES; i++)
+// Function to play shots on a 100-screen wide world: the window has to
+// follow the shells and jump between tanks without a step going over budget
+static bool run_world_benchmark(Game *game)
+{
+    static ChunkedWorld world;
+    const char *path = "artillery_bench_world.bin";
+    if (!write_world(path, 100, 7) || !load_world(&world, path))
     {
-        if (game->particles[i].active)
-        {
-            Particle *part = &game->particles[i];
+        printf("%-12s cannot write %s  FAIL\n", "wide world", path);
+        return false;
+    }
 
-            // Fade out based on lifetime
-            double alpha = part->lifetime / part->max_lifetime;
-            cairo_set_source_rgba(cr, 0.5, 0.3, 0.1, alpha); // Brown with fade
+    game->world = &world;
+    game->match_players = 4;
+    game->match_teams = false;
+    init_game(game);
 
-            cairo_arc(cr, part->x, part->y, part->size, 0, 2 * PI);
-            cairo_fill(cr);
+    int slides = 0, shots = 0, last_chunk = game->world_chunk;
+    double max_ms = 0;
+    for (; shots < 24 && game->state == STATE_AIMING; shots++)
+    {
+        Tank *tank = &game->players[game->current_player];
+        tank->current_weapon = WEAPON_BIG_MISSILE;
+        tank->angle = (shots % 2) ? 135 : 45;
+        tank->power = 80 + shots % 20;
+        fire_weapon(game);
+        for (int frame = 0; frame < 3000 && game->state != STATE_AIMING && game->state != STATE_GAME_OVER; frame++)
+        {
+            double start = now_ms();
+            update_game(game);
+            max_ms = fmax(max_ms, now_ms() - start);
+            slides += game->world_chunk != last_chunk;
+            last_chunk = game->world_chunk;
         }
     }
 
-    // Draw UI
-    // Wind indicator text with direction
-    char wind_text[100];
-    char direction[10];
-    if (game->wind > 0)
+    int scarred = 0;
+    for (int c = 0; c < world.chunk_count; c++)
+        scarred += world.scars[c] != NULL;
+    bool pass = max_ms <= FRAME_BUDGET_MS && slides > 0;
+    printf("%-12s %d chunks, %d shots, %d window moves, %d chunks cratered (%zu bytes)  max step %.3f ms  %s\n",
+           "wide world", world.chunk_count, shots, slides, scarred, scarred * WORLD_CHUNK_SEGMENTS * sizeof(uint16_t),
+           max_ms, pass ? "PASS" : "FAIL");
+
+    game->world = NULL;
+    free_world(&world);
+    remove(path);
+    return pass;
+}
+
+// Function to time round starts from a 2000-map pack built out of raw and
+// PGM heightmaps against round starts on generated terrain
+static bool run_maps_benchmark(Game *game)
+{
+    enum
     {
-        strcpy(direction, "RIGHT");
+        SOURCES = 8,
+        MAPS = 2000,
+        ROUNDS = 500
+    };
+    static MapSet maps;
+    const char *pack_path = "artillery_bench_maps.pack";
+    char source_paths[SOURCES][64];
+    char *inputs[MAPS];
+    bool ok = true;
+
+    // Heightmaps of different widths; even ones raw, odd ones 16-bit PGM
+    for (int s = 0; s < SOURCES && ok; s++)
+    {
+        int width = 257 << (s % 4);
+        snprintf(source_paths[s], sizeof(source_paths[s]), "artillery_bench_map%d.%s", s, s % 2 ? "pgm" : "raw");
+        FILE *f = fopen(source_paths[s], "wb");
+        ok = f != NULL;
+        if (ok && s % 2)
+            fprintf(f, "P5\n# bench map\n%d 1\n65535\n", width);
+        for (int k = 0; ok && k < width; k++)
+        {
+            uint32_t v = (uint32_t)(32767.5 + 32767.5 * sin(k * (s + 1) * 0.01) * cos(k * 0.003));
+            unsigned char bytes[2] = {s % 2 ? v >> 8 : v & 0xff, s % 2 ? v & 0xff : v >> 8};
+            ok = fwrite(bytes, 2, 1, f) == 1;
+        }
+        if (f != NULL)
+            ok &= fclose(f) == 0;
     }
-    else
+    for (int m = 0; m < MAPS; m++)
+        inputs[m] = source_paths[m % SOURCES];
+
+    double start = now_ms();
+    ok = ok && write_map_pack(pack_path, inputs, MAPS) && load_maps(&maps, pack_path);
+    double pack_ms = now_ms() - start;
+    for (int s = 0; s < SOURCES; s++)
+        remove(source_paths[s]);
+    if (!ok)
     {
-        strcpy(direction, "LEFT");
+        printf("%-12s cannot write %s  FAIL\n", "map pack", pack_path);
+        remove(pack_path);
+        return false;
     }
-    sprintf(wind_text, "Wind: %.3f (%s)", fabs(game->wind), direction);
 
-    // Make wind display more prominent
-    cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
-    cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
-    cairo_set_font_size(cr, 24);                   // Increased size
-    cairo_move_to(cr, WINDOW_WIDTH / 2 - 120, 40); // Adjusted position
-    cairo_show_text(cr, wind_text);
+    // Round starts on generated terrain, then from the pack
+    double generated_ms = 0, packed_ms = 0, max_ms = 0;
+    game->match_players = DEFAULT_PLAYERS;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        game->maps = pass ? &maps : NULL;
+        for (int r = 0; r < ROUNDS; r++)
+        {
+            start = now_ms();
+            reset_game(game);
+            double ms = now_ms() - start;
+            *(pass ? &packed_ms : &generated_ms) += ms;
+            if (pass)
+                max_ms = fmax(max_ms, ms);
+        }
+    }
+    game->maps = NULL;
 
-    // Draw wind arrow (make it more visible)
-    double arrow_center_x = WINDOW_WIDTH / 2 + 150;
-    double arrow_y = 35;
-    double arrow_length = game->wind * 1200.0; // Increased scale for better visibility
-    double arrow_width = 4.0;                  // Thicker arrow
+    bool pass = max_ms <= FRAME_BUDGET_MS;
+    printf("%-12s %d maps (%zu bytes, packed in %.1f ms)  round start %.3f ms (generated %.3f ms)  max %.3f ms  %s\n",
+           "map pack", maps.map_count, maps.file.size, pack_ms, packed_ms / ROUNDS, generated_ms / ROUNDS, max_ms,
+           pass ? "PASS" : "FAIL");
 
-    // Calculate arrow start and end positions based on direction
-    double arrow_start_x, arrow_end_x;
-    if (game->wind > 0)
+    free_maps(&maps);
+    remove(pack_path);
+    return pass;
+}
+
+// Function to time round starts with the terrain built ahead of time (as
+// the window's worker thread does) against generating it in place, checking
+// both give the same round
+static bool run_pregen_benchmark(Game *game)
+{
+    enum
     {
-        arrow_start_x = arrow_center_x - fabs(arrow_length) / 2;
-        arrow_end_x = arrow_center_x + fabs(arrow_length) / 2;
-    }
-    else
+        ROUNDS = 500
+    };
+    static PregeneratedRound next;
+    static Game in_place;
+
+    game->match_players = DEFAULT_PLAYERS;
+    game->match_teams = false;
+    init_game(game);
+
+    double swapped_ms = 0, generated_ms = 0, max_ms = 0, build_ms = 0;
+    bool same = true;
+    for (int r = 0; r < ROUNDS; r++)
     {
-        arrow_start_x = arrow_center_x + fabs(arrow_length) / 2;
-        arrow_end_x = arrow_center_x - fabs(arrow_length) / 2;
+        in_place = *game;
+
+        double start = now_ms();
+        next.seed = game->round_seed;
+        atomic_store(&next.ready, false);
+        pregenerate_round(&next);
+        build_ms += now_ms() - start;
+
+        game->pregenerated = &next;
+        start = now_ms();
+        reset_game(game);
+        double ms = now_ms() - start;
+        swapped_ms += ms;
+        max_ms = fmax(max_ms, ms);
+        game->pregenerated = NULL;
+
+        start = now_ms();
+        reset_game(&in_place);
+        generated_ms += now_ms() - start;
+        same &= memcmp(game->terrain, in_place.terrain, sizeof(game->terrain)) == 0 &&
+                game->rng_state == in_place.rng_state && game->round_seed == in_place.round_seed;
     }
 
-    // Draw arrow line
-    cairo_set_source_rgb(cr, 0.0, 0.0, 0.8);
-    cairo_set_line_width(cr, arrow_width);
-    cairo_move_to(cr, arrow_start_x, arrow_y);
-    cairo_line_to(cr, arrow_end_x, arrow_y);
-    cairo_stroke(cr);
+    bool pass = same && max_ms <= FRAME_BUDGET_MS;
+    printf("%-12s round start %.3f ms with the terrain built ahead (%.3f ms off the game thread), %.3f ms "
+           "generated in place  max %.3f ms  %s\n",
+           "next round", swapped_ms / ROUNDS, build_ms / ROUNDS, generated_ms / ROUNDS, max_ms,
+           pass ? "PASS" : "FAIL");
+    return pass;
+}
 
-    // Draw larger arrow head
-    double arrow_head_size = 8.0;
-    if (game->wind > 0)
+// Function to get how far an outline strays from its heightfield
+static double outline_error(const TerrainOutline *outline, const double *terrain)
+{
+    double worst = 0;
+    for (int a = 0, b = 1; b < TERRAIN_SEGMENTS; b++)
     {
-        cairo_move_to(cr, arrow_end_x, arrow_y);
-        cairo_line_to(cr, arrow_end_x - arrow_head_size, arrow_y - arrow_head_size);
-        cairo_line_to(cr, arrow_end_x - arrow_head_size, arrow_y + arrow_head_size);
+        if (!outline->keep[b])
+            continue;
+        for (int i = a + 1; i < b; i++)
+            worst = fmax(worst, fabs(terrain[i] - (terrain[a] + (terrain[b] - terrain[a]) * (i - a) / (b - a))));
+        a = b;
     }
-    else
+    return worst;
+}
+
+// Function to simplify the terrain outline at a few tolerances, then keep
+// it up to date through shots, checking it stays within the tolerance and
+// timing the local updates against rebuilding it
+static bool run_outline_benchmark(Game *game)
+{
+    static const double tolerances[] = {0.25, 0.5, 1.0};
+    static TerrainOutline outlines[3];
+    enum
     {
-        cairo_move_to(cr, arrow_end_x, arrow_y);
-        cairo_line_to(cr, arrow_end_x + arrow_head_size, arrow_y - arrow_head_size);
-        cairo_line_to(cr, arrow_end_x + arrow_head_size, arrow_y + arrow_head_size);
-    }
-    cairo_close_path(cr);
-    cairo_fill(cr);
+        SHOTS = 8
+    };
+    const WeaponType weapons[SHOTS] = {WEAPON_SMALL_MISSILE, WEAPON_BIG_MISSILE, WEAPON_DRILL, WEAPON_CLUSTER,
+                                       WEAPON_NUKE,          WEAPON_SALVO,       WEAPON_BARRAGE, WEAPON_SMALL_MISSILE};
 
-    // In the render_game function, modify the player info section:
+    game->match_players = 8;
+    game->match_teams = false;
+    init_game(game);
 
-    // Player info
-    for (int i = 0; i < 2; i++)
+    double full_ms = 0, update_ms = 0, worst = 0;
+    int updates = 0;
+    for (int t = 0; t < 3; t++)
     {
-        // Position text based on player
-        double text_x = (i == 0) ? 20 : WINDOW_WIDTH - 320; // Adjusted x position for larger text
+        outlines[t].tolerance = 0;
+        double start = now_ms();
+        update_terrain_outline(&outlines[t], game->terrain, 0, TERRAIN_SEGMENTS - 1, tolerances[t]);
+        full_ms += now_ms() - start;
+    }
+    int initial = outlines[0].vertex_count;
 
-        // Highlight current player
-        if (i == game->current_player && game->state == STATE_AIMING)
-        {
-            cairo_set_source_rgb(cr, 0.7, 0.0, 0.0); // Dark red for current player
-        }
-        else
+    for (int s = 0; s < SHOTS; s++)
+    {
+        int player = s % game->num_players;
+        bench_fire(game, player, weapons[s], (game->players[player].x < WORLD_WIDTH / 2) ? 60 : 120, 60);
+        for (int frame = 0; frame < 2000; frame++)
         {
-            cairo_set_source_rgb(cr, 0.0, 0.0, 0.0); // Black for others
+            update_game(game);
+            if (game->terrain_dirty_lo <= game->terrain_dirty_hi)
+            {
+                double start = now_ms();
+                for (int t = 0; t < 3; t++)
+                    update_terrain_outline(&outlines[t], game->terrain, game->terrain_dirty_lo,
+                                           game->terrain_dirty_hi, tolerances[t]);
+                update_ms += now_ms() - start;
+                updates++;
+                game->terrain_dirty_lo = 1;
+                game->terrain_dirty_hi = 0;
+            }
+            if (game->state == STATE_AIMING || game->state == STATE_GAME_OVER)
+                break;
         }
+    }
 
-        // Player name and score
-        char player_text[100];
-        sprintf(player_text, "%s: %d pts (Health: %d)", game->players[i].name, game->players[i].score, game->players[i].health);
-        cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
-        cairo_set_font_size(cr, 20); // Increased from 14 to 20
+    bool pass = true;
+    for (int t = 0; t < 3; t++)
+    {
+        double error = outline_error(&outlines[t], game->terrain);
+        worst = fmax(worst, error / tolerances[t]);
+        pass &= error <= tolerances[t];
+    }
+    printf("%-12s %d segments -> %d / %d / %d vertices at %.2g / %.2g / %.2g px (%d at start), worst %.0f%% of "
+           "tolerance  rebuild %.4f ms  update %.4f ms  %s\n",
+           "outline", TERRAIN_SEGMENTS, outlines[0].vertex_count, outlines[1].vertex_count, outlines[2].vertex_count,
+           tolerances[0], tolerances[1], tolerances[2], initial, worst * 100, full_ms / 3,
+           updates ? update_ms / updates / 3 : 0, pass ? "PASS" : "FAIL");
+    return pass;
+}
+
+// Function to total the dirt in a match, in terrain height steps: the
+// ground, plus the debris still in the air
+static double dirt_steps(const Game *game)
+{
+    double steps = 0;
+    for (int i = 0; i < TERRAIN_SEGMENTS; i++)
+        steps += (WORLD_HEIGHT - game->terrain[i]) * TERRAIN_HEIGHT_STEPS;
+    for (int i = 0; i < MAX_PARTICLES; i++)
+    {
+        if (game->particles[i].active)
+            steps += game->particles[i].debris;
+    }
+    return steps;
+}
 
-        cairo_move_to(cr, text_x, 50); // Adjusted y position
-        cairo_show_text(cr, player_text);
+// Function to play shots in debris mode, checking the dirt each crater
+// digs out comes back down: all of it, less what flew off the map (exactly
+// in fixed-point builds, to rounding otherwise), within the frame budget
+static bool run_debris_benchmark(Game *game)
+{
+    const WeaponType weapons[] = {WEAPON_SMALL_MISSILE, WEAPON_BIG_MISSILE, WEAPON_NUKE, WEAPON_CLUSTER,
+                                  WEAPON_BARRAGE,       WEAPON_DRILL,       WEAPON_SALVO};
+    int shots = sizeof(weapons) / sizeof(weapons[0]);
 
-        // Current weapon
-        char weapon_text[100];
-        sprintf(weapon_text, "Weapon: %s", game->weapon_properties[game->players[i].current_weapon].name);
-        cairo_move_to(cr, text_x, 80); // Adjusted spacing
-        cairo_show_text(cr, weapon_text);
+    game->match_players = 8;
+    game->match_teams = false;
+    game->match_debris = true;
+    init_game(game);
 
-        // Angle and power
-        char angle_text[50];
-        sprintf(angle_text, "Angle: %d°", game->players[i].angle);
-        cairo_move_to(cr, text_x, 110); // Adjusted spacing
-        cairo_show_text(cr, angle_text);
+    double dirt = dirt_steps(game), lost = 0, drift = 0, max_ms = 0, total_ms = 0;
+    int frames = 0;
+    long long clods = 0;
+    for (int s = 0; s < shots; s++)
+    {
+        int player = s % game->num_players;
+        bench_fire(game, player, weapons[s], (game->players[player].x < WORLD_WIDTH / 2) ? 60 : 120, 60);
+        for (int frame = 0; frame < 2000; frame++)
+        {
+            bool flying[MAX_PARTICLES];
+            for (int i = 0; i < MAX_PARTICLES; i++)
+                flying[i] = game->particles[i].active && game->particles[i].debris > 0;
 
-        char power_text[50];
-        sprintf(power_text, "Power: %d/%d", game->players[i].power, MAX_POWER);
-        cairo_move_to(cr, text_x, 140); // Adjusted spacing
-        cairo_show_text(cr, power_text);
+            double start = now_ms();
+            update_game(game);
+            double ms = now_ms() - start;
+            total_ms += ms;
+            max_ms = fmax(max_ms, ms);
+            frames++;
 
-        // Moves left
-        char moves_text[50];
-        sprintf(moves_text, "Moves left: %d", game->players[i].moves_left);
-        cairo_move_to(cr, text_x, 170); // Adjusted spacing
-        cairo_show_text(cr, moves_text);
+            // Clods are left in their slots when they land or leave, until reused
+            for (int i = 0; i < MAX_PARTICLES; i++)
+            {
+                const Particle *part = &game->particles[i];
+                if (flying[i] && !part->active && (part->x < 0 || part->x >= WORLD_WIDTH))
+                    lost += part->debris;
+                if (!flying[i] && part->active && part->debris > 0)
+                    clods++;
+            }
+            if (game->state == STATE_AIMING || game->state == STATE_GAME_OVER)
+                break;
+        }
+        double now = dirt_steps(game);
+        drift = fmax(drift, fabs(now + lost - dirt));
     }
+    game->match_debris = false;
+
+#ifdef ARTILLERY_FIXED_POINT
+    bool conserved = drift == 0;
+#else
+    bool conserved = drift <= 0.5 * TERRAIN_SEGMENTS;
+#endif
+    bool pass = conserved && max_ms <= FRAME_BUDGET_MS;
+    printf("%-12s %d shots, %lld clods, %.0f steps lost off the map, drift %.1f steps  avg %.3f ms  max %.3f ms  %s\n",
+           "debris", shots, clods, lost, drift, total_ms / frames, max_ms, pass ? "PASS" : "FAIL");
+    return pass;
+}
 
-    // Game state messages
-    if (game->state == STATE_GAME_OVER)
-    {
-        // Determine winner
-        int winner = (game->players[0].health <= 0) ? 1 : 0;
+// Function to fill the terrain log up to count ops with deposits of no
+// dirt, which take up log space without moving the terrain
+static void pad_terrain_log(TerrainLog *log, int count)
+{
+    for (int k = log->op_count; k < count; k++)
+        log->ops[k] = (TerrainOp){.kind = TERRAIN_OP_DEPOSIT, .x = k % TERRAIN_SEGMENTS};
+    if (log->op_count < count)
+        log->op_count = count;
+}
 
-        char winner_text[100];
-        sprintf(winner_text, "%s wins! Press R to play again.", game->players[winner].name);
+// Function to log craters into a terrain log that slumps and deposits have
+// filled: first one crater into a full log (and a second after one queued
+// into the last slot), then barrages in debris mode with the log topped up
+// to nearly full before each. Checks the log never overruns and that an
+// observer still rebuilds the terrain exactly.
+static bool run_full_log_benchmark(Game *game)
+{
+    enum { SHOTS = 4, HEADROOM = 16 };
+    static TerrainObserver observer;
+    TerrainLog *log = &game->terrain_log;
 
-        cairo_set_source_rgb(cr, 0.8, 0.0, 0.0);
-        cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
-        cairo_set_font_size(cr, 24);
+    game->match_players = 8;
+    game->match_teams = false;
+    game->match_debris = true;
+    init_game(game);
+    observer.synced = false;
+    sync_terrain_observer(&observer, log);
 
-        // Center text
-        cairo_text_extents_t extents;
-        cairo_text_extents(cr, winner_text, &extents);
-        cairo_move_to(cr, (WINDOW_WIDTH - extents.width) / 2, WINDOW_HEIGHT / 2);
-        cairo_show_text(cr, winner_text);
-    }
-    else if (game->game_paused)
+    bool exact = true, bounded = true;
+    for (int queued = 0; queued < 2; queued++)
     {
-        // Paused message
-        char paused_text[] = "GAME PAUSED - Press P to continue";
+        pad_terrain_log(log, TERRAIN_LOG_CAPACITY - queued);
+        for (int c = 0; c <= queued; c++)
+        {
+            double x = WORLD_WIDTH / 3.0 + 40 * c;
+            apply_explosion_to_terrain(game, x, game->terrain[terrain_segment_at((int)x)], 30, 20);
+            bounded &= log->op_count <= TERRAIN_LOG_CAPACITY;
+        }
+        flush_craters(game);
+        sync_terrain_observer(&observer, log);
+        exact &= memcmp(observer.terrain, game->terrain, sizeof(game->terrain)) == 0;
+    }
 
-        cairo_set_source_rgb(cr, 0.0, 0.0, 0.8);
-        cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
-        cairo_set_font_size(cr, 24);
+    int compactions = 0;
+    double max_ms = 0;
+    for (int s = 0; s < SHOTS; s++)
+    {
+        pad_terrain_log(log, TERRAIN_LOG_CAPACITY - HEADROOM);
 
-        // Center text
-        cairo_text_extents_t extents;
-        cairo_text_extents(cr, paused_text, &extents);
-        cairo_move_to(cr, (WINDOW_WIDTH - extents.width) / 2, WINDOW_HEIGHT / 2);
-        cairo_show_text(cr, paused_text);
+        int player = s % game->num_players;
+        bench_fire(game, player, WEAPON_BARRAGE, (game->players[player].x < WORLD_WIDTH / 2) ? 60 : 120, 60);
+        for (int frame = 0; frame < 2000; frame++)
+        {
+            uint32_t base_seq = log->base_seq;
+            double start = now_ms();
+            update_game(game);
+            max_ms = fmax(max_ms, now_ms() - start);
+            compactions += log->base_seq != base_seq;
+            bounded &= log->op_count <= TERRAIN_LOG_CAPACITY;
+            sync_terrain_observer(&observer, log);
+            exact &= memcmp(observer.terrain, game->terrain, sizeof(game->terrain)) == 0;
+            if (game->state == STATE_AIMING || game->state == STATE_GAME_OVER)
+                break;
+        }
     }
+    game->match_debris = false;
 
-    // Draw controls help
-    cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
-    cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-    cairo_set_font_size(cr, 12);
+    bool pass = exact && bounded && compactions > 0 && max_ms <= FRAME_BUDGET_MS;
+    printf("%-12s %d debris barrages into a nearly full log, %d compactions  max %.3f ms  %s\n", "full log", SHOTS,
+           compactions, max_ms, pass ? "PASS" : "FAIL");
+    return pass;
+}
 
-    char controls_text[] = "Controls: Arrows (aim/power), W/S (weapon), A/D (move), Space (fire), R (reset), P (pause)";
-    cairo_move_to(cr, 10, WINDOW_HEIGHT - 10);
-    cairo_show_text(cr, controls_text);
+#ifndef ARTILLERY_HEADLESS
+// Function to export the first steps of the scripted match as a Y4M video,
+// checking it holds one frame per step (plus the starting frame) and
+// timing it against real time
+static bool run_export_benchmark(Game *game)
+{
+    const char *path = "artillery_bench_export.y4m";
+    int64_t frames;
+    double seconds;
+    bool pass = export_video(game, path, NULL, EXPORT_BENCH_STEPS, 0, &frames, &seconds);
+
+    // The stream header, then a FRAME line and the planes for every frame
+    char header[64];
+    long expected = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", EXPORT_WIDTH,
+                             EXPORT_HEIGHT, EXPORT_FPS) +
+                    (long)(EXPORT_BENCH_STEPS + 1) * (6 + EXPORT_FRAME_BYTES);
+    long size = -1;
+    FILE *f = fopen(path, "rb");
+    if (f != NULL)
+    {
+        if (fseek(f, 0, SEEK_END) == 0)
+            size = ftell(f);
+        fclose(f);
+    }
+    remove(path);
+
+    pass &= frames == EXPORT_BENCH_STEPS + 1 && size == expected;
+    printf("%-12s %lld frames (%.1f MB) in %.2f s  %.1fx real time  %s\n", "export", (long long)frames,
+           size / 1e6, seconds, seconds > 0 ? frames / (EXPORT_FPS * seconds) : 0.0, pass ? "PASS" : "FAIL");
+    return pass;
 }
+#endif
 
-// GTK tick callback
-static gboolean tick(GtkWidget *widget, GdkFrameClock *frame_clock, gpointer user_data)
+// Function to run the benchmark suite; returns non-zero if any scenario
+// misses the frame budget
+static int run_benchmarks(Game *game)
 {
-    update_game(&game);
-    gtk_widget_queue_draw(widget);
-    return G_SOURCE_CONTINUE;
-}
\ No newline at end of file
+    bool pass = true;
+
+    printf("Frame budget: %.1f ms\n", FRAME_BUDGET_MS);
+    pass &= run_benchmark_scenario(game, "missile", 1, WEAPON_SMALL_MISSILE);
+    pass &= run_benchmark_scenario(game, "cluster", 1, WEAPON_CLUSTER);
+    pass &= run_benchmark_scenario(game, "salvo x16", 16, WEAPON_SALVO);
+    pass &= run_benchmark_scenario(game, "barrage", 1, WEAPON_BARRAGE);
+    pass &= run_benchmark_scenario(game, "barrage x4", 4, WEAPON_BARRAGE);
+
+    // Snapshots at a turn start (what autosave writes) and mid-barrage
+    init_game(game);
+    pass &= run_snapshot_benchmark(game, "save turn");
+    bench_fire(game, 0, WEAPON_BARRAGE, 60, 70);
+    for (int i = 0; i < 200; i++)
+    {
+        update_game(game);
+    }
+    pass &= run_snapshot_benchmark(game, "save barrage");
+    pass &= run_replay_benchmark(game);
+    pass &= run_terrain_log_benchmark(game);
+    pass &= run_crater_batch_benchmark(game);
+    pass &= run_slump_benchmark(game);
+    pass &= run_wind_benchmark(game);
+    pass &= run_world_benchmark(game);
+    pass &= run_maps_benchmark(game);
+    pass &= run_debris_benchmark(game);
+    pass &= run_full_log_benchmark(game);
+    pass &= run_outline_benchmark(game);
+    pass &= run_pregen_benchmark(game);
+#ifndef ARTILLERY_HEADLESS
+    pass &= run_export_benchmark(game);
+#endif
+
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,81 @@
+#ifndef ARTILLERY_ENV_H
+#define ARTILLERY_ENV_H
+
+// Batched training environment: many independent two-tank matches held
+// together and stepped with one call, for training agents. It runs the
+// game's own physics without any GTK; build it as a library with
+//
+//   gcc -O3 -shared -fPIC -DARTILLERY_HEADLESS Artillery.c -o libartillery.so -lm -pthread
+//
+// One step is one 60 Hz simulation frame. Matches play the single-shell
+// weapons (small missile, big missile, drill, nuke). A match that is won or
+// lost sets its done flag for that step; one still going after
+// ARTILLERY_ENV_MAX_STEPS sets its truncation flag instead. Either way it is
+// reset straight away.
+
+#include <stdint.h>
+
+#define ARTILLERY_ENV_PROFILE 32    // Terrain heights in an observation
+#define ARTILLERY_ENV_OBS_SIZE 48   // Floats per observation
+#define ARTILLERY_ENV_MAX_STEPS 7200 // Steps before a match is cut short (two minutes)
+
+// Actions, one per match per step
+enum
+{
+    ARTILLERY_ENV_NOOP,
+    ARTILLERY_ENV_ANGLE_UP,
+    ARTILLERY_ENV_ANGLE_DOWN,
+    ARTILLERY_ENV_POWER_UP,
+    ARTILLERY_ENV_POWER_DOWN,
+    ARTILLERY_ENV_NEXT_WEAPON,
+    ARTILLERY_ENV_MOVE_LEFT,
+    ARTILLERY_ENV_MOVE_RIGHT,
+    ARTILLERY_ENV_FIRE,
+    ARTILLERY_ENV_ACTIONS
+};
+
+// Observation layout, from the point of view of the tank whose turn it is.
+// Positions and heights are scaled by the world size, so they lie in 0..1.
+enum
+{
+    ARTILLERY_OBS_TERRAIN = 0,                             // ARTILLERY_ENV_PROFILE heights, left to right
+    ARTILLERY_OBS_SELF_X = ARTILLERY_ENV_PROFILE,          // Tank to act: x, y, health (0..1)
+    ARTILLERY_OBS_SELF_Y,
+    ARTILLERY_OBS_SELF_HEALTH,
+    ARTILLERY_OBS_OPPONENT_X,                              // The other tank: x, y, health
+    ARTILLERY_OBS_OPPONENT_Y,
+    ARTILLERY_OBS_OPPONENT_HEALTH,
+    ARTILLERY_OBS_ANGLE,                                   // Aim of the tank to act: angle / 360
+    ARTILLERY_OBS_POWER,                                   // power / 100
+    ARTILLERY_OBS_WEAPON,                                  // Weapon index / 4
+    ARTILLERY_OBS_MOVES,                                   // Moves left / 3
+    ARTILLERY_OBS_WIND,                                    // Wind * 10 (about -0.5..0.5)
+    ARTILLERY_OBS_AIMING,                                  // 1 while waiting for a shot, 0 while one flies
+    ARTILLERY_OBS_SHELL_X,                                 // Shell in flight, or -1, -1
+    ARTILLERY_OBS_SHELL_Y,
+    ARTILLERY_OBS_PLAYER,                                  // Which tank is acting (0 or 1)
+    ARTILLERY_OBS_STEPS                                    // Steps into the match / ARTILLERY_ENV_MAX_STEPS
+};
+
+typedef struct ArtilleryEnv ArtilleryEnv;
+
+// Create count matches seeded from seed, stepped on up to threads threads
+// (0 for one per core). Returns NULL if out of memory.
+ArtilleryEnv *artillery_env_create(int count, int threads, uint32_t seed);
+
+// Free the matches and stop their threads
+void artillery_env_destroy(ArtilleryEnv *env);
+
+// Start every match afresh and write their observations
+// (count * ARTILLERY_ENV_OBS_SIZE floats)
+void artillery_env_reset(ArtilleryEnv *env, float *observations);
+
+// Apply one action per match, run one step and write the observations,
+// rewards, done flags and truncation flags. A reward goes to the tank that
+// acted in that step: the damage its shell dealt the opponent minus what it
+// did to itself and what it took falling after a move (1 per 100 health),
+// plus 1 for winning or -1 for losing. A tank killed by its own fall loses.
+void artillery_env_step(ArtilleryEnv *env, const int32_t *actions, float *observations, float *rewards,
+                        uint8_t *dones, uint8_t *truncations);
+
+#endif